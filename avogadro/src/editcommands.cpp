@@ -53,22 +53,9 @@ namespace Avogadro {
       m_molecule->clear();
     }
     else {
-      // Make sure any selection is an atom
-      // FIXME: Do we need to do bonds or other primitives?
-      foreach(unsigned long atomid, m_selectedList.subList(Primitive::AtomType)) {
-        Atom *atom = m_molecule->atomById(atomid);
-        if(atom)
-        {
-          m_molecule->removeAtom(atom);
-        }
-      }
-      foreach(unsigned long bondid, m_selectedList.subList(Primitive::BondType)) {
-        Bond *bond = m_molecule->bondById(bondid);
-        if(bond)
-        {
-          m_molecule->removeBond(bond);
-        }
-      }
+      // Removed together, so the rest are renumbered once
+      m_molecule->removeAtoms(m_selectedList.subList(Primitive::AtomType));
+      m_molecule->removeBonds(m_selectedList.subList(Primitive::BondType));
       foreach(unsigned long residueid, m_selectedList.subList(Primitive::ResidueType)) {
         Residue *residue = m_molecule->residueById(residueid);
         if(residue)
@@ -140,22 +127,9 @@ namespace Avogadro {
       m_molecule->clear();
     }
     else {
-      // Make sure any selection is an atom
-      // FIXME: Do we need to do bonds or other primitives?
-      foreach(unsigned long atomid, m_selectedList.subList(Primitive::AtomType)) {
-        Atom *atom = m_molecule->atomById(atomid);
-        if(atom)
-        {
-          m_molecule->removeAtom(atom);
-        }
-      }
-      foreach(unsigned long bondid, m_selectedList.subList(Primitive::BondType)) {
-        Bond *bond = m_molecule->bondById(bondid);
-        if(bond)
-        {
-          m_molecule->removeBond(bond);
-        }
-      }
+      // Removed together, so the rest are renumbered once
+      m_molecule->removeAtoms(m_selectedList.subList(Primitive::AtomType));
+      m_molecule->removeBonds(m_selectedList.subList(Primitive::BondType));
       foreach(unsigned long residueid, m_selectedList.subList(Primitive::ResidueType)) {
         Residue *residue = m_molecule->residueById(residueid);
         if(residue)
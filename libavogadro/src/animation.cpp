@@ -25,12 +25,14 @@
 #include <avogadro/molecule.h>
 #include <avogadro/atom.h>
 #include <avogadro/bond.h>
-#include <openbabel/mol.h>
+#include <avogadro/bondperception.h>
 #include <Eigen/Core>
 
 #include <QTimeLine>
+#include <QVector>
+
+#include <cmath>
 
-using namespace OpenBabel;
 using Eigen::Vector3d;
 
 namespace Avogadro {
@@ -38,11 +40,23 @@ namespace Avogadro {
   class AnimationPrivate
   {
     public:
-      AnimationPrivate() : fps(25), framesSet(false), dynamicBonds(false) {}
+      AnimationPrivate() : fps(25), framesSet(false), dynamicBonds(false),
+        displaced(false), amplitude(1.0), framesPerPeriod(0), currentFrame(0) {}
 
       int fps;
       bool framesSet;
       bool dynamicBonds;
+
+      // Harmonic motion computed per frame, packed by atom index
+      bool displaced;
+      QVector<double> equilibrium;
+      QVector<double> displacements;
+      QVector<double> coordinates;
+      double amplitude;
+      int framesPerPeriod;
+      int currentFrame;
+
+      BondPerception bondPerception;
   };
 
   Animation::Animation(QObject *parent) : QObject(parent), d(new AnimationPrivate),
@@ -65,6 +79,9 @@ namespace Avogadro {
   void Animation::setMolecule(Molecule *molecule)
   {
     m_molecule = molecule;
+    // The displacements belong to the atoms of the previous molecule
+    d->displaced = false;
+    d->bondPerception.setMolecule(molecule);
     if (molecule == NULL)
       return; // we can't save the current conformers
 
@@ -80,6 +97,8 @@ namespace Avogadro {
 
   int Animation::numFrames() const
   {
+    if (d->displaced)
+      return d->framesPerPeriod;
     if (d->framesSet)
       return m_frames.size();
     if (m_molecule)
@@ -110,32 +129,27 @@ namespace Avogadro {
   void Animation::setFrame(int i)
   {
     m_molecule->lock()->lockForWrite();
-    m_molecule->setConformer(i);
-    if (d->dynamicBonds) {
-      // construct minimal OBMol
-      OpenBabel::OBMol obmol;
-      obmol.BeginModify();
-      foreach(Atom *atom, m_molecule->atoms()) {
-        OpenBabel::OBAtom *a = obmol.NewAtom();
-        OpenBabel::OBAtom obatom = atom->OBAtom();
-        *a = obatom;
-      }
-      obmol.EndModify();
-
-      // connect the dots
-      obmol.ConnectTheDots();
-
-      QList<Bond*> bonds(m_molecule->bonds());
-      foreach(Bond *bond, bonds)
-        m_molecule->removeBond(bond->id());
-
-      FOR_BONDS_OF_MOL (obbond, obmol) {
-        Bond *bond = m_molecule->addBond();
-        bond->setBegin(m_molecule->atom(obbond->GetBeginAtomIdx()-1));
-        bond->setEnd(m_molecule->atom(obbond->GetEndAtomIdx()-1));
-        bond->setOrder(obbond->GetBondOrder());
+    d->currentFrame = i;
+    if (d->displaced) {
+      if (d->equilibrium.size() == 3 * static_cast<int>(m_molecule->numAtoms())) {
+        const double *equilibrium = d->equilibrium.constData();
+        const double *displacements = d->displacements.constData();
+        double *coordinates = d->coordinates.data();
+        const double scale = d->amplitude * sin(2.0 * M_PI * i / d->framesPerPeriod);
+        for (int k = 0; k < d->coordinates.size(); ++k)
+          coordinates[k] = equilibrium[k] + scale * displacements[k];
+        m_molecule->setAtomPositions(coordinates);
       }
     }
+    else
+      m_molecule->setConformer(i);
+    // Only the bonds that changed since the last frame are touched
+    if (d->dynamicBonds) {
+      const bool packed = d->displaced &&
+        d->coordinates.size() == 3 * static_cast<int>(m_molecule->numAtoms());
+      d->bondPerception.updateBonds(packed ? d->coordinates.constData() : 0);
+    }
+    m_molecule->publishSnapshot();
     m_molecule->lock()->unlock();
     m_molecule->update();
     emit frameChanged(i);
@@ -169,6 +183,54 @@ namespace Avogadro {
     m_timeLine->setFrameRange(0, frames.size() - 1);
   }
 
+  void Animation::setDisplacements(const std::vector<Vector3d> &displacements,
+                                   double amplitude, int framesPerPeriod)
+  {
+    d->displaced = false;
+    d->equilibrium.clear();
+    d->displacements.clear();
+    d->coordinates.clear();
+    if (!m_molecule || displacements.empty() || framesPerPeriod < 1)
+      return;
+
+    // The current positions are the equilibrium, so set this at rest
+    const int n = m_molecule->numAtoms();
+    d->equilibrium.resize(3 * n);
+    d->displacements.fill(0.0, 3 * n);
+    d->coordinates.resize(3 * n);
+    foreach (Atom *atom, m_molecule->atoms()) {
+      const int i = atom->index();
+      const Vector3d *pos = atom->pos();
+      d->equilibrium[3*i] = pos->x();
+      d->equilibrium[3*i+1] = pos->y();
+      d->equilibrium[3*i+2] = pos->z();
+      if (static_cast<unsigned int>(i) < displacements.size()) {
+        d->displacements[3*i] = displacements[i].x();
+        d->displacements[3*i+1] = displacements[i].y();
+        d->displacements[3*i+2] = displacements[i].z();
+      }
+    }
+
+    d->displaced = true;
+    d->framesSet = false;
+    d->amplitude = amplitude;
+    d->framesPerPeriod = framesPerPeriod;
+    m_timeLine->setFrameRange(0, framesPerPeriod - 1);
+  }
+
+  double Animation::amplitude() const
+  {
+    return d->amplitude;
+  }
+
+  void Animation::setAmplitude(double amplitude)
+  {
+    d->amplitude = amplitude;
+    // A paused animation shows the new amplitude right away
+    if (d->displaced && m_timeLine->state() != QTimeLine::Running && d->currentFrame)
+      setFrame(d->currentFrame);
+  }
+
   void Animation::stop()
   {
     m_timeLine->stop();
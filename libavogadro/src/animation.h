@@ -52,8 +52,11 @@ namespace Avogadro {
    *
    * An Animation object works by changing conformers inside a Molecule. Consequently,
    * you can either read in the conformers from a file, or call Animation::setFrames()
-   * to set the coordinates for the animation. The latter works well for generated coordinates,
-   * for example, vibrations.
+   * to set the coordinates for the animation. The latter works well for generated coordinates.
+   *
+   * Periodic motions such as vibrations need no stored frames at all: after
+   * setDisplacements() each frame writes equilibrium + amplitude * sin(phase)
+   * * displacement straight into the current atom positions.
    */
   class AnimationPrivate;
   class A_EXPORT Animation : public QObject
@@ -86,6 +89,19 @@ namespace Avogadro {
        */
       void setFrames(std::vector< std::vector< Eigen::Vector3d> *> frames);
 
+      /**
+       * Animate a harmonic motion along @p displacements, one vector per
+       * atom in index order, about the current positions of the atoms,
+       * which are kept as the equilibrium. A period takes
+       * @p framesPerPeriod frames. An empty list switches back to frames.
+       */
+      void setDisplacements(const std::vector<Eigen::Vector3d> &displacements,
+                            double amplitude, int framesPerPeriod);
+      /**
+       * @return The amplitude the displacements are scaled by.
+       */
+      double amplitude() const;
+
       /**
        * @return The number of frames per second.
        */
@@ -123,6 +139,11 @@ namespace Avogadro {
        */
       void setFrame(int i);
 
+      /**
+       * Scale the displacements by @p amplitude from the next frame on.
+       */
+      void setAmplitude(double amplitude);
+
       /**
        * Enable/disable dynamic bond detection. For QM reactions for example.
        */
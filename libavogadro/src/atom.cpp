@@ -74,6 +74,8 @@ using Eigen::Vector3d;
 
    void Atom::setAtomicNumber(int num)
    {
+     if (num != m_atomicNumber && m_molecule)
+       m_molecule->invalidateTopology();
      m_atomicNumber = num;
      update(); // signal that the element has changed, to update residues
    }
@@ -140,6 +142,8 @@ using Eigen::Vector3d;
    {
      Q_D(Atom);
      d->assignedFormalCharge = true;
+     if (charge != m_formalCharge && m_molecule)
+       m_molecule->invalidateTopology();
      m_formalCharge = charge;
    }
 
@@ -231,6 +235,13 @@ using Eigen::Vector3d;
 	 m_groupIndex = index;
    }
 
+   unsigned int Atom::groupIndex() const
+   {
+     if (m_molecule)
+       m_molecule->calculateGroupIndices();
+     return m_groupIndex;
+   }
+
    unsigned long Atom::residueId() const
    {
      return m_residue;
@@ -154,9 +154,10 @@ namespace Avogadro {
     double valence() const { return static_cast<double>(m_bonds.size()); }
 
     /**
-     * The index of the atom in group of atoms of the same element in Molecule
+     * The index of the atom in group of atoms of the same element in Molecule,
+     * calculated when the topology has changed.
      */
-    unsigned int groupIndex() const { return m_groupIndex; }
+    unsigned int groupIndex() const;
     
     /**
      * @return True if the atom is a hydrogen.
@@ -53,12 +53,16 @@
 
   void Bond::setBegin(Atom* atom)
   {
-    if (m_beginAtomId != FALSE_ID) {
-      Atom *a = m_molecule->atomById(m_beginAtomId);
+    unsigned long previous = m_beginAtomId;
+    if (previous != FALSE_ID) {
+      Atom *a = m_molecule->atomById(previous);
       if (a) a->removeBond(this);
     }
     m_beginAtomId = atom->id();
     atom->addBond(this);
+    m_molecule->invalidateTopology();
+    m_molecule->disconnectAtoms(previous, m_endAtomId);
+    m_molecule->connectAtoms(m_beginAtomId, m_endAtomId);
   }
 
   Atom * Bond::beginAtom() const
@@ -68,12 +72,16 @@
 
   void Bond::setEnd(Atom* atom)
   {
-    if (m_endAtomId != FALSE_ID) {
-      Atom *a = m_molecule->atomById(m_endAtomId);
+    unsigned long previous = m_endAtomId;
+    if (previous != FALSE_ID) {
+      Atom *a = m_molecule->atomById(previous);
       if (a) a->removeBond(this);
     }
     m_endAtomId = atom->id();
     atom->addBond(this);
+    m_molecule->invalidateTopology();
+    m_molecule->disconnectAtoms(previous, m_beginAtomId);
+    m_molecule->connectAtoms(m_endAtomId, m_beginAtomId);
   }
 
   Atom * Bond::endAtom() const
@@ -101,6 +109,17 @@
       qDebug() << "Non-existent atom:" << atom2;
     }
     m_order = order;
+    m_molecule->invalidateTopology();
+    m_molecule->connectAtoms(m_beginAtomId, m_endAtomId);
+  }
+
+  void Bond::setOrder(short order)
+  {
+    if (order == m_order)
+      return;
+    m_order = order;
+    if (m_molecule)
+      m_molecule->invalidateTopology();
   }
 
   const Eigen::Vector3d * Bond::beginPos() const
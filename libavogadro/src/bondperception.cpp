@@ -0,0 +1,285 @@
+/**********************************************************************
+  BondPerception - Find bonds from covalent radii with a cell list
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "bondperception.h"
+#include "periodiccelllist_p.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+#include <avogadro/molecule.h>
+
+#include <openbabel/data.h>
+#include <openbabel/generic.h>
+
+#include <QThread>
+#include <QtCore/QtConcurrentMap>
+
+#include <algorithm>
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  // Pairs closer than this are overlapping atoms rather than bonds
+  static const double minimumDistance2 = 0.40;
+
+  /**
+   * A range of cells of a frame and the bonds found in them, as pairs of
+   * atom indices with the lower one first.
+   */
+  struct BondBlock
+  {
+    const PeriodicCellList *cells;
+    const double *radii;   // covalent radius plus half the tolerance, by atom
+    int firstCell;
+    int endCell;
+    QVector<QPair<int, int> > bonds;
+    QVector<PeriodicCellList::Neighbor> neighbors;
+  };
+
+  static inline void testPair(BondBlock &block, int i, int j,
+                              const Vector3d &shift)
+  {
+    const double *positions = block.cells->positions();
+    const int *slots = block.cells->slots();
+    const int a = slots[i], b = slots[j];
+    if (a == b)   // an atom and its own image
+      return;
+    const double *p = positions + 3 * i, *q = positions + 3 * j;
+    const double dx = q[0] + shift.x() - p[0];
+    const double dy = q[1] + shift.y() - p[1];
+    const double dz = q[2] + shift.z() - p[2];
+    const double d2 = dx * dx + dy * dy + dz * dz;
+    const double cutoff = block.radii[a] + block.radii[b];
+    if (d2 < cutoff * cutoff && d2 >= minimumDistance2)
+      block.bonds.append(a < b ? qMakePair(a, b) : qMakePair(b, a));
+  }
+
+  static void findBonds(BondBlock &block)
+  {
+    const PeriodicCellList *cells = block.cells;
+    block.bonds.clear();
+
+    for (int c = block.firstCell; c < block.endCell; ++c) {
+      cells->halfStencil(c, block.neighbors);
+      const int begin = cells->begin(c), end = cells->end(c);
+      if (begin == end)
+        continue;
+
+      for (int k = 0; k < block.neighbors.size(); ++k) {
+        const PeriodicCellList::Neighbor &neighbor = block.neighbors[k];
+        const int nEnd = cells->end(neighbor.cell);
+        for (int i = begin; i < end; ++i)
+          // Within the cell itself each pair once
+          for (int j = k ? cells->begin(neighbor.cell) : i + 1; j < nEnd; ++j)
+            testPair(block, i, j, neighbor.shift);
+      }
+    }
+  }
+
+  class BondPerceptionPrivate
+  {
+    public:
+      BondPerceptionPrivate() : molecule(0), tolerance(0.45), periodic(true),
+        hasCell(false), topologyVersion(0), cells(1.0, 1) {}
+
+      Molecule *molecule;
+      double tolerance;
+      bool periodic;
+      bool hasCell;
+      Matrix3d cellMatrix;     // lattice vectors as columns
+      unsigned long topologyVersion;   // of the molecule the radii are from
+
+      QVector<double> covalentRadii;   // by atom index
+      QVector<int> atoms;              // all atom indices, for the cell list
+      QVector<double> radii;           // by atom index, with the tolerance
+      QVector<double> coordinates;
+      PeriodicCellList cells;
+      QVector<BondBlock> blocks;
+
+      void setup();
+  };
+
+  void BondPerceptionPrivate::setup()
+  {
+    covalentRadii.clear();
+    atoms.clear();
+    hasCell = false;
+    blocks.resize(4 * qMax(1, QThread::idealThreadCount()));
+    if (!molecule)
+      return;
+
+    topologyVersion = molecule->topologyVersion();
+    foreach (Atom *atom, molecule->atoms()) {
+      atoms.append(covalentRadii.size());
+      covalentRadii.append(OpenBabel::etab.GetCovalentRad(atom->atomicNumber()));
+    }
+
+    if (OpenBabel::OBUnitCell *cell = molecule->OBUnitCell()) {
+      OpenBabel::matrix3x3 ortho = cell->GetOrthoMatrix();
+      for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+          cellMatrix(i, j) = ortho.Get(i, j);
+      hasCell = true;
+    }
+  }
+
+  BondPerception::BondPerception() : d(new BondPerceptionPrivate)
+  {
+    d->setup();
+  }
+
+  BondPerception::~BondPerception()
+  {
+    delete d;
+  }
+
+  void BondPerception::setMolecule(Molecule *molecule)
+  {
+    d->molecule = molecule;
+    d->setup();
+  }
+
+  void BondPerception::setTolerance(double tolerance)
+  {
+    d->tolerance = tolerance >= 0.0 ? tolerance : 0.45;
+  }
+
+  double BondPerception::tolerance() const
+  {
+    return d->tolerance;
+  }
+
+  void BondPerception::setPeriodic(bool periodic)
+  {
+    d->periodic = periodic;
+  }
+
+  bool BondPerception::isPeriodic() const
+  {
+    return d->periodic;
+  }
+
+  QVector<QPair<int, int> > BondPerception::perceive(const double *coordinates)
+  {
+    QVector<QPair<int, int> > bonds;
+    if (!d->molecule)
+      return bonds;
+    // Elements may change without changing the number of atoms
+    if (d->molecule->topologyVersion() != d->topologyVersion)
+      d->setup();
+    const int n = d->atoms.size();
+    if (n < 2)
+      return bonds;
+
+    if (!coordinates) {
+      d->coordinates.resize(3 * n);
+      double *c = d->coordinates.data();
+      foreach (const Atom *atom, d->molecule->atoms()) {
+        const Vector3d *pos = atom->pos();
+        *c++ = pos->x();
+        *c++ = pos->y();
+        *c++ = pos->z();
+      }
+      coordinates = d->coordinates.constData();
+    }
+
+    // Half the tolerance on each atom adds up to the whole for a pair
+    double maxRadius = 0.0;
+    d->radii.resize(n);
+    for (int i = 0; i < n; ++i) {
+      d->radii[i] = d->covalentRadii.at(i) + 0.5 * d->tolerance;
+      maxRadius = qMax(maxRadius, d->radii.at(i));
+    }
+
+    d->cells = PeriodicCellList(qMax(2.0 * maxRadius, 0.1), 1);
+    if (d->periodic && d->hasCell)
+      d->cells.setCell(d->cellMatrix);
+    d->cells.update(coordinates, d->atoms);
+
+    // The cell list keeps the order of the atoms given, so its slots are
+    // atom indices
+    const int numCells = d->cells.numCells();
+    const int numBlocks = d->blocks.size();
+    const int perBlock = (numCells + numBlocks - 1) / numBlocks;
+    for (int b = 0; b < numBlocks; ++b) {
+      BondBlock &block = d->blocks[b];
+      block.cells = &d->cells;
+      block.radii = d->radii.constData();
+      block.firstCell = qMin(numCells, b * perBlock);
+      block.endCell = qMin(numCells, block.firstCell + perBlock);
+    }
+    QtConcurrent::blockingMap(d->blocks, findBonds);
+
+    foreach (const BondBlock &block, d->blocks)
+      bonds += block.bonds;
+    // A pair can be found through more than one image in small cells
+    std::sort(bonds.begin(), bonds.end());
+    bonds.erase(std::unique(bonds.begin(), bonds.end()), bonds.end());
+    return bonds;
+  }
+
+  int BondPerception::updateBonds(const double *coordinates)
+  {
+    const QVector<QPair<int, int> > bonds = perceive(coordinates);
+    Molecule *molecule = d->molecule;
+    if (!molecule || d->atoms.size() < 2)
+      return 0;
+
+    // Atom indices by id, to compare the bonds of the molecule
+    QVector<int> indexOfId(molecule->conformerSize(), -1);
+    foreach (const Atom *atom, molecule->atoms())
+      if (atom->id() < static_cast<unsigned long>(indexOfId.size()))
+        indexOfId[atom->id()] = atom->index();
+
+    QVector<QPair<int, int> > existing;
+    QList<Bond *> stale;
+    foreach (Bond *bond, molecule->bonds()) {
+      const int a = indexOfId.value(bond->beginAtomId(), -1);
+      const int b = indexOfId.value(bond->endAtomId(), -1);
+      const QPair<int, int> pair = a < b ? qMakePair(a, b) : qMakePair(b, a);
+      if (std::binary_search(bonds.begin(), bonds.end(), pair))
+        existing.append(pair);
+      else
+        stale.append(bond);
+    }
+    std::sort(existing.begin(), existing.end());
+
+    foreach (Bond *bond, stale)
+      molecule->removeBond(bond);
+
+    int added = 0;
+    QList<Atom *> atoms = molecule->atoms();
+    for (int i = 0; i < bonds.size(); ++i) {
+      const QPair<int, int> &pair = bonds.at(i);
+      if (std::binary_search(existing.begin(), existing.end(), pair))
+        continue;
+      Bond *bond = molecule->addBond();
+      bond->setAtoms(atoms.at(pair.first)->id(), atoms.at(pair.second)->id(), 1);
+      ++added;
+    }
+    return stale.size() + added;
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,103 @@
+/**********************************************************************
+  BondPerception - Find bonds from covalent radii with a cell list
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef BONDPERCEPTION_H
+#define BONDPERCEPTION_H
+
+#include <avogadro/global.h>
+
+#include <QPair>
+#include <QVector>
+
+namespace Avogadro {
+
+  class Molecule;
+
+  /**
+   * @class BondPerception bondperception.h <avogadro/bondperception.h>
+   * @brief Single bonds between atoms closer than their covalent radii.
+   *
+   * Two atoms are bonded if they are closer than the sum of their covalent
+   * radii plus the tolerance, but not closer than 0.63 Angstrom, the same
+   * test as OpenBabel's ConnectTheDots without building an OBMol. The
+   * pairs are found with the cell list of RadialDistribution, with the
+   * cells shared out over all cores, so the cost grows with the number of
+   * atoms rather than its square. If the molecule has a unit cell, atoms
+   * are also bonded to the periodic images of the others.
+   *
+   * Unlike ConnectTheDots atoms with too many bonds are not pruned, and no
+   * bond orders are perceived.
+   */
+  class BondPerceptionPrivate;
+  class A_EXPORT BondPerception
+  {
+    public:
+      BondPerception();
+      ~BondPerception();
+
+      /**
+       * Take the elements of the atoms and the unit cell, if any, from
+       * @p molecule. They are taken again by perceive() whenever the
+       * topology of the molecule changed, see Molecule::topologyVersion().
+       */
+      void setMolecule(Molecule *molecule);
+
+      /**
+       * Distance allowed beyond the sum of the covalent radii, 0.45
+       * Angstrom by default.
+       */
+      void setTolerance(double tolerance);
+      double tolerance() const;
+
+      /**
+       * Bond to periodic images when the molecule has a unit cell, the
+       * default. Turn it off when the images are already explicit atoms,
+       * as in a super cell.
+       */
+      void setPeriodic(bool periodic);
+      bool isPeriodic() const;
+
+      /**
+       * Find the bonds for packed x, y, z @p coordinates in the order of
+       * the atom indices, or the current positions of the atoms if 0.
+       * @return The pairs of atom indices, first < second, sorted.
+       */
+      QVector<QPair<int, int> > perceive(const double *coordinates = 0);
+
+      /**
+       * Perceive the bonds and change those of the molecule to match,
+       * removing the bonds that were not found and adding single bonds for
+       * the new ones. Bonds that were kept keep their order.
+       * @return The number of bonds added or removed.
+       */
+      int updateBonds(const double *coordinates = 0);
+
+    private:
+      BondPerceptionPrivate * const d;
+      Q_DISABLE_COPY(BondPerception)
+  };
+
+} // End namespace Avogadro
+
+#endif
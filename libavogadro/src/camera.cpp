@@ -141,6 +141,11 @@ namespace Avogadro
     return d->modelview;
   }
 
+  const Eigen::Transform3d & Camera::projection() const
+  {
+    return d->projection;
+  }
+
   void Camera::initializeViewPoint()
   {
     d->modelview.setIdentity();
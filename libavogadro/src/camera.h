@@ -108,6 +108,10 @@ namespace Avogadro {
         *         the camera orientation and position
         * @sa setModelview(), const Eigen::Transform3d & modelview() const */
       Eigen::Transform3d & modelview();
+      /** @return a constant reference to the 4x4 projection matrix last set up
+        *         by applyPerspective()
+        * @sa applyPerspective(), project() */
+      const Eigen::Transform3d & projection() const;
       /** Calls gluPerspective() with parameters automatically chosen
         * for rendering the GLWidget's molecule with this camera. Should be called
         * only in GL_PROJECTION matrix mode. Example code is given
@@ -26,6 +26,8 @@
 #include "color.h"
 #include <cmath> // for fabs()
 
+#include <openbabel/mol.h>
+
 namespace Avogadro {
 
   using std::fabs;
@@ -67,6 +69,22 @@ namespace Avogadro {
     m_channels[3] = alpha;
   }
 
+  void Color::setFromElement(int atomicNumber)
+  {
+    if (atomicNumber) {
+      std::vector<double> rgb = OpenBabel::etab.GetRGB(atomicNumber);
+      m_channels[0] = rgb[0];
+      m_channels[1] = rgb[1];
+      m_channels[2] = rgb[2];
+    } else {
+      m_channels[0] = 0.2;
+      m_channels[1] = 0.2;
+      m_channels[2] = 0.2;
+    }
+
+    m_channels[3] = 1.0;
+  }
+
   void Color::setToSelectionColor()
   {
     m_channels[0] = 0.3;
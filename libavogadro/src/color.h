@@ -148,6 +148,14 @@ namespace Avogadro {
     virtual void setFromRgba(float red, float green,float blue,
                              float alpha = 1.0);
 
+    /**
+     * Set the color of the element with @p atomicNumber (e.g., carbon grey,
+     * oxygen red), for atoms that have no primitive to pass.
+     *
+     * @param atomicNumber The element, 0 for a dummy atom
+     */
+    void setFromElement(int atomicNumber);
+
     /**
      * Set the color explicitly based on a QColor, copying RGB and Alpha levels.
      *
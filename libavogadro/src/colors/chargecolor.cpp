@@ -48,7 +48,14 @@ namespace Avogadro {
       return;
 
     const Atom *atom = static_cast<const Atom*>(p);
-    float charge = atom->partialCharge();
+    // Color the atoms neutral until the charges calculated in the
+    // background are ready, rather than stalling the frame
+    float charge = 0.0f;
+    const Molecule *molecule = static_cast<const Molecule*>(atom->parent());
+    if (molecule && !molecule->hasPartialCharges())
+      molecule->requestPartialCharges();
+    else
+      charge = atom->partialCharge();
     float scaledCharge = sqrt(fabs(charge));
     if (scaledCharge > 1.0)
       scaledCharge = 1.0;
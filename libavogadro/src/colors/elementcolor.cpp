@@ -28,8 +28,6 @@
 #include <avogadro/atom.h>
 #include <QtPlugin>
 
-#include <openbabel/mol.h>
-
 namespace Avogadro {
 
   /// Constructor
@@ -45,20 +43,7 @@ namespace Avogadro {
     if (!p || p->type() != Primitive::AtomType)
       return;
 
-    const Atom *atom = static_cast<const Atom*>(p);
-
-    if (atom->atomicNumber()) {
-      std::vector<double> rgb = OpenBabel::etab.GetRGB(atom->atomicNumber());
-      m_channels[0] = rgb[0];
-      m_channels[1] = rgb[1];
-      m_channels[2] = rgb[2];
-    } else {
-      m_channels[0] = 0.2;
-      m_channels[1] = 0.2;
-      m_channels[2] = 0.2;
-    }
-
-    m_channels[3] = 1.0;
+    setFromElement(static_cast<const Atom*>(p)->atomicNumber());
   }
 
 }
@@ -0,0 +1,463 @@
+/**********************************************************************
+  ConformerClustering - RMSD matrices and clustering of conformer sets
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "conformerclustering.h"
+#include "superposition.h"
+
+#include <avogadro/molecule.h>
+#include <avogadro/atom.h>
+
+#include <QHash>
+#include <QPair>
+#include <QtAlgorithms>
+#include <QtCore/QtConcurrentMap>
+
+#include <limits>
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  // Rows and columns of the RMSD matrix handled by one task
+  static const int TILE_SIZE = 64;
+  // Conformers compared against the existing leaders in one parallel pass
+  static const int LEADER_BATCH = 256;
+  // Reassign and superpose again at most this often per comparison
+  static const int MAX_SYMMETRY_ITERATIONS = 4;
+
+  class ConformerClusteringPrivate
+  {
+    public:
+      ConformerClusteringPrivate() : heavyOnly(true), symmetric(false),
+        numAtoms(0), numConformers(0) {}
+
+      bool heavyOnly;
+      bool symmetric;
+      int numAtoms;
+      int numConformers;
+      QVector<double> coordinates;      // centered, numAtoms * 3 per conformer
+      QVector<double> inner;            // inner product of each conformer
+      QVector<QVector<int> > classes;   // exchangeable atoms, local indices
+
+      const double * conformer(int i) const
+      {
+        return coordinates.constData() + 3 * numAtoms * i;
+      }
+
+      double rmsd(int i, int j) const;
+      double symmetricRmsd(int i, int j) const;
+  };
+
+  double ConformerClusteringPrivate::rmsd(int i, int j) const
+  {
+    if (symmetric && !classes.isEmpty())
+      return symmetricRmsd(i, j);
+    return Superposition::centeredRmsd(conformer(i), conformer(j), numAtoms,
+                                       inner[i], inner[j]);
+  }
+
+  double ConformerClusteringPrivate::symmetricRmsd(int i, int j) const
+  {
+    const double *a = conformer(i);
+    double best = Superposition::centeredRmsd(a, conformer(j), numAtoms,
+                                              inner[i], inner[j]);
+    if (best == 0.0)
+      return best;
+
+    // Permutations keep the inner product, so only the correlation changes
+    QVector<double> mapped(3 * numAtoms);
+    qCopy(conformer(j), conformer(j) + 3 * numAtoms, mapped.begin());
+    QVector<double> candidate;
+    Matrix3d rotation;
+    Vector3d translation;
+
+    for (int iteration = 0; iteration < MAX_SYMMETRY_ITERATIONS; ++iteration) {
+      Superposition::fit(a, mapped.constData(), numAtoms, rotation, translation);
+      candidate = mapped;
+
+      foreach (const QVector<int> &members, classes) {
+        // Greedy assignment of the rotated atoms to the closest partners
+        const int size = members.size();
+        QVector<QPair<double, int> > pairs;
+        pairs.reserve(size * size);
+        for (int k = 0; k < size; ++k) {
+          Vector3d p = rotation * Vector3d(a + 3 * members[k]) + translation;
+          for (int l = 0; l < size; ++l) {
+            Vector3d q(mapped.constData() + 3 * members[l]);
+            pairs.append(qMakePair((p - q).squaredNorm(), k * size + l));
+          }
+        }
+        qSort(pairs);
+
+        QVector<bool> usedA(size, false), usedB(size, false);
+        int assigned = 0;
+        for (int p = 0; p < pairs.size() && assigned < size; ++p) {
+          const int k = pairs[p].second / size, l = pairs[p].second % size;
+          if (usedA[k] || usedB[l])
+            continue;
+          usedA[k] = usedB[l] = true;
+          for (int c = 0; c < 3; ++c)
+            candidate[3 * members[k] + c] = mapped[3 * members[l] + c];
+          ++assigned;
+        }
+      }
+
+      double r = Superposition::centeredRmsd(a, candidate.constData(), numAtoms,
+                                             inner[i], inner[j]);
+      if (r >= best - 1.0e-6) {
+        best = qMin(best, r);
+        break;
+      }
+      best = r;
+      mapped = candidate;
+    }
+    return best;
+  }
+
+  struct RmsdTile
+  {
+    const ConformerClusteringPrivate *d;
+    float *matrix;
+    int rowBegin, rowEnd;
+    int columnBegin, columnEnd;
+  };
+
+  static void computeTile(RmsdTile &tile)
+  {
+    const int n = tile.d->numConformers;
+    for (int i = tile.rowBegin; i < tile.rowEnd; ++i)
+      for (int j = qMax(tile.columnBegin, i + 1); j < tile.columnEnd; ++j)
+        tile.matrix[ConformerClustering::matrixIndex(i, j, n)] =
+          static_cast<float>(tile.d->rmsd(i, j));
+  }
+
+  struct LeaderQuery
+  {
+    const ConformerClusteringPrivate *d;
+    const QVector<int> *leaders;
+    double threshold;
+    int conformer;
+    int cluster;   // index into leaders, -1 if none is close enough
+  };
+
+  static void findLeader(LeaderQuery &query)
+  {
+    const QVector<int> &leaders = *query.leaders;
+    for (int l = 0; l < leaders.size(); ++l)
+      if (query.d->rmsd(leaders[l], query.conformer) < query.threshold) {
+        query.cluster = l;
+        return;
+      }
+  }
+
+  ConformerClustering::ConformerClustering() : d(new ConformerClusteringPrivate)
+  {
+  }
+
+  ConformerClustering::~ConformerClustering()
+  {
+    delete d;
+  }
+
+  void ConformerClustering::setHeavyAtomsOnly(bool heavyOnly)
+  {
+    d->heavyOnly = heavyOnly;
+  }
+
+  bool ConformerClustering::heavyAtomsOnly() const
+  {
+    return d->heavyOnly;
+  }
+
+  void ConformerClustering::setSymmetryAware(bool symmetric)
+  {
+    d->symmetric = symmetric;
+  }
+
+  bool ConformerClustering::symmetryAware() const
+  {
+    return d->symmetric;
+  }
+
+  void ConformerClustering::setConformers(const Molecule *molecule,
+      const std::vector<std::vector<Vector3d> *> &conformers)
+  {
+    d->coordinates.clear();
+    d->inner.clear();
+    d->classes.clear();
+    d->numAtoms = 0;
+    d->numConformers = 0;
+    if (!molecule)
+      return;
+
+    // Fall back to all atoms for molecules without heavy atoms (H2)
+    QList<Atom *> atoms;
+    foreach (Atom *atom, molecule->atoms())
+      if (!d->heavyOnly || !atom->isHydrogen())
+        atoms.append(atom);
+    if (atoms.isEmpty())
+      atoms = molecule->atoms();
+
+    QHash<unsigned long, int> localIndex;
+    for (int k = 0; k < atoms.size(); ++k)
+      localIndex.insert(atoms[k]->id(), k);
+
+    // Terminal atoms of the same element on the same atom can be exchanged
+    QHash<QPair<unsigned long, int>, QVector<int> > groups;
+    for (int k = 0; k < atoms.size(); ++k) {
+      QList<unsigned long> neighbors = atoms[k]->neighbors();
+      if (neighbors.size() == 1)
+        groups[qMakePair(neighbors.first(), atoms[k]->atomicNumber())].append(k);
+    }
+    foreach (const QVector<int> &members, groups)
+      if (members.size() > 1)
+        d->classes.append(members);
+
+    d->numAtoms = atoms.size();
+    d->numConformers = static_cast<int>(conformers.size());
+    d->coordinates.resize(3 * d->numAtoms * d->numConformers);
+    d->inner.resize(d->numConformers);
+    for (int i = 0; i < d->numConformers; ++i) {
+      double *x = d->coordinates.data() + 3 * d->numAtoms * i;
+      const std::vector<Vector3d> &positions = *conformers[i];
+      for (int k = 0; k < atoms.size(); ++k) {
+        const Vector3d &pos = positions[atoms[k]->id()];
+        x[3*k] = pos.x();
+        x[3*k+1] = pos.y();
+        x[3*k+2] = pos.z();
+      }
+      Superposition::center(x, d->numAtoms);
+      d->inner[i] = Superposition::innerProduct(x, d->numAtoms);
+    }
+  }
+
+  int ConformerClustering::numConformers() const
+  {
+    return d->numConformers;
+  }
+
+  int ConformerClustering::numAtoms() const
+  {
+    return d->numAtoms;
+  }
+
+  double ConformerClustering::rmsd(int i, int j) const
+  {
+    if (i < 0 || j < 0 || i >= d->numConformers || j >= d->numConformers)
+      return 0.0;
+    return d->rmsd(i, j);
+  }
+
+  qint64 ConformerClustering::matrixIndex(int i, int j, int n)
+  {
+    return static_cast<qint64>(i) * n - static_cast<qint64>(i) * (i + 1) / 2
+      + (j - i - 1);
+  }
+
+  QVector<float> ConformerClustering::rmsdMatrix() const
+  {
+    const int n = d->numConformers;
+    QVector<float> matrix(static_cast<int>(static_cast<qint64>(n) * (n - 1) / 2));
+    if (n < 2)
+      return matrix;
+
+    QVector<RmsdTile> tiles;
+    for (int row = 0; row < n; row += TILE_SIZE)
+      for (int column = row; column < n; column += TILE_SIZE) {
+        RmsdTile tile;
+        tile.d = d;
+        tile.matrix = matrix.data();
+        tile.rowBegin = row;
+        tile.rowEnd = qMin(row + TILE_SIZE, n);
+        tile.columnBegin = column;
+        tile.columnEnd = qMin(column + TILE_SIZE, n);
+        tiles.append(tile);
+      }
+    QtConcurrent::blockingMap(tiles, computeTile);
+    return matrix;
+  }
+
+  QList<QList<int> > ConformerClustering::leaderClusters(double threshold,
+      const QList<int> &order) const
+  {
+    QList<int> sequence = order;
+    if (sequence.isEmpty())
+      for (int i = 0; i < d->numConformers; ++i)
+        sequence.append(i);
+
+    QList<QList<int> > clusters;
+    QVector<int> leaders;
+
+    // Each batch is compared with the leaders found before it in parallel,
+    // then with the leaders found inside the batch in order, which gives
+    // the same clusters as the sequential algorithm
+    for (int start = 0; start < sequence.size(); start += LEADER_BATCH) {
+      const int end = qMin(start + LEADER_BATCH, sequence.size());
+      const int numPrevious = leaders.size();
+      QVector<LeaderQuery> queries;
+      for (int k = start; k < end; ++k) {
+        LeaderQuery query;
+        query.d = d;
+        query.leaders = &leaders;
+        query.threshold = threshold;
+        query.conformer = sequence[k];
+        query.cluster = -1;
+        queries.append(query);
+      }
+      if (numPrevious)
+        QtConcurrent::blockingMap(queries, findLeader);
+
+      foreach (const LeaderQuery &query, queries) {
+        int cluster = query.cluster;
+        for (int l = numPrevious; cluster < 0 && l < leaders.size(); ++l)
+          if (d->rmsd(leaders[l], query.conformer) < threshold)
+            cluster = l;
+
+        if (cluster < 0) {
+          leaders.append(query.conformer);
+          clusters.append(QList<int>() << query.conformer);
+        } else
+          clusters[cluster].append(query.conformer);
+      }
+    }
+    return clusters;
+  }
+
+  QList<QList<int> > ConformerClustering::hierarchicalClusters(double threshold) const
+  {
+    const int n = d->numConformers;
+    QList<QList<int> > clusters;
+    if (n == 0)
+      return clusters;
+
+    const QVector<float> matrix = rmsdMatrix();
+    QVector<float> linkage = matrix;
+    float *D = linkage.data();
+
+    // Nearest neighbor chain: follow nearest neighbors until two clusters
+    // are each other's nearest, then merge them. Complete linkage is
+    // reducible, so this finds the same tree as the naive algorithm in
+    // O(n^2) time. The merged cluster keeps the index of the first one.
+    QVector<bool> active(n, true);
+    QVector<int> parent(n);
+    for (int i = 0; i < n; ++i)
+      parent[i] = i;
+    QVector<int> chain;
+    int remaining = n;
+    int firstActive = 0;
+
+    while (remaining > 1) {
+      if (chain.isEmpty()) {
+        while (!active[firstActive])
+          ++firstActive;
+        chain.append(firstActive);
+      }
+      const int a = chain.last();
+      const int previous = chain.size() > 1 ? chain[chain.size() - 2] : -1;
+
+      int b = previous;
+      float best = previous >= 0 ? D[matrixIndex(qMin(a, previous), qMax(a, previous), n)]
+                                 : std::numeric_limits<float>::max();
+      for (int k = 0; k < n; ++k) {
+        if (k == a || !active[k])
+          continue;
+        float distance = D[matrixIndex(qMin(a, k), qMax(a, k), n)];
+        if (distance < best) {
+          best = distance;
+          b = k;
+        }
+      }
+
+      if (b != previous) {
+        chain.append(b);
+        continue;
+      }
+
+      chain.resize(chain.size() - 2);
+      for (int k = 0; k < n; ++k) {
+        if (k == a || k == b || !active[k])
+          continue;
+        float &distance = D[matrixIndex(qMin(a, k), qMax(a, k), n)];
+        distance = qMax(distance, D[matrixIndex(qMin(b, k), qMax(b, k), n)]);
+      }
+      active[b] = false;
+      --remaining;
+
+      // Complete linkage heights only grow towards the root, so cutting the
+      // tree keeps exactly the merges below the threshold
+      if (best < threshold) {
+        int rootA = a, rootB = b;
+        while (parent[rootA] != rootA)
+          rootA = parent[rootA];
+        while (parent[rootB] != rootB)
+          rootB = parent[rootB];
+        parent[qMax(rootA, rootB)] = qMin(rootA, rootB);
+      }
+    }
+
+    // Roots are the lowest index of their cluster, so clusters come out
+    // ordered by it
+    QVector<int> clusterOf(n, -1);
+    for (int i = 0; i < n; ++i) {
+      int root = i;
+      while (parent[root] != root)
+        root = parent[root];
+      if (clusterOf[root] < 0) {
+        clusterOf[root] = clusters.size();
+        clusters.append(QList<int>());
+      }
+      clusters[clusterOf[root]].append(i);
+    }
+
+    // Put the medoid first
+    for (int c = 0; c < clusters.size(); ++c) {
+      QList<int> &members = clusters[c];
+      int medoid = 0;
+      double lowest = std::numeric_limits<double>::max();
+      for (int k = 0; k < members.size(); ++k) {
+        double sum = 0.0;
+        for (int l = 0; l < members.size(); ++l)
+          if (l != k)
+            sum += matrix[matrixIndex(qMin(members[k], members[l]),
+                                      qMax(members[k], members[l]), n)];
+        if (sum < lowest) {
+          lowest = sum;
+          medoid = k;
+        }
+      }
+      members.move(medoid, 0);
+    }
+    return clusters;
+  }
+
+  QList<int> ConformerClustering::representatives(const QList<QList<int> > &clusters)
+  {
+    QList<int> result;
+    foreach (const QList<int> &members, clusters)
+      if (!members.isEmpty())
+        result.append(members.first());
+    return result;
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,154 @@
+/**********************************************************************
+  ConformerClustering - RMSD matrices and clustering of conformer sets
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef CONFORMERCLUSTERING_H
+#define CONFORMERCLUSTERING_H
+
+#include <avogadro/global.h>
+
+#include <Eigen/Core>
+
+#include <QList>
+#include <QVector>
+
+#include <vector>
+
+namespace Avogadro {
+
+  class Molecule;
+  class ConformerClusteringPrivate;
+
+  /**
+   * @class ConformerClustering conformerclustering.h <avogadro/conformerclustering.h>
+   * @brief Pairwise RMSD and clustering of conformers or trajectory frames.
+   *
+   * The conformers are copied once, restricted to the heavy atoms by
+   * default and centered, so that every comparison is a single
+   * Superposition::centeredRmsd() pass. With symmetry enabled, equivalent
+   * terminal atoms on the same atom (the hydrogens of a methyl group, the
+   * oxygens of a carboxylate or nitro group, the fluorines of CF3) may be
+   * exchanged: after each superposition they are reassigned to their
+   * nearest partners and the structures superposed again, keeping the
+   * lowest RMSD.
+   *
+   * Two clusterings are offered. leaderClusters() streams through the
+   * conformers, keeping a conformer as a new leader unless it is within the
+   * threshold of an earlier leader; it needs no matrix, so it is the one to
+   * use for thousands of conformers. hierarchicalClusters() does complete
+   * linkage on rmsdMatrix(), so no two members of a cluster are further
+   * apart than the threshold. Both use all cores.
+   *
+   * @code
+   * ConformerClustering clustering;
+   * clustering.setConformers(molecule, molecule->conformers());
+   * QList<int> kept = ConformerClustering::representatives(
+   *   clustering.leaderClusters(1.0));
+   * @endcode
+   */
+  class A_EXPORT ConformerClustering
+  {
+  public:
+    ConformerClustering();
+    ~ConformerClustering();
+
+    /**
+     * Only compare the heavy atoms, the default. This has to be set before
+     * setConformers().
+     */
+    void setHeavyAtomsOnly(bool heavyOnly);
+    bool heavyAtomsOnly() const;
+
+    /**
+     * Allow equivalent terminal atoms to be exchanged, off by default.
+     * This has to be set before setConformers().
+     */
+    void setSymmetryAware(bool symmetric);
+    bool symmetryAware() const;
+
+    /**
+     * Copy @p conformers, which are indexed by atom id like
+     * Molecule::conformers(). The topology of @p molecule selects the atoms
+     * and their equivalence classes.
+     */
+    void setConformers(const Molecule *molecule,
+                       const std::vector<std::vector<Eigen::Vector3d> *> &conformers);
+
+    /**
+     * @return The number of conformers set.
+     */
+    int numConformers() const;
+
+    /**
+     * @return The number of atoms compared per conformer.
+     */
+    int numAtoms() const;
+
+    /**
+     * @return The RMSD between conformers @p i and @p j in Angstrom.
+     */
+    double rmsd(int i, int j) const;
+
+    /**
+     * @return The packed upper triangle of the RMSD matrix, computed in
+     * parallel tiles. Element (i, j) with i < j is at matrixIndex(i, j).
+     * It takes n(n-1)/2 floats, so prefer leaderClusters() for large sets.
+     */
+    QVector<float> rmsdMatrix() const;
+
+    /**
+     * @return The position of element (@p i, @p j) of an @p n x @p n
+     * matrix in the packed upper triangle, @p i < @p j.
+     */
+    static qint64 matrixIndex(int i, int j, int n);
+
+    /**
+     * Leader clustering in the given @p order, all conformers in index order
+     * if it is empty. Pass the conformers sorted by energy to keep the lowest
+     * energy member of each cluster as its leader.
+     * @return The clusters in the order the leaders were found, the leader
+     * first.
+     */
+    QList<QList<int> > leaderClusters(double threshold,
+                                      const QList<int> &order = QList<int>()) const;
+
+    /**
+     * Complete linkage clustering, cut at @p threshold.
+     * @return The clusters ordered by their lowest index, the medoid of
+     * each cluster first.
+     */
+    QList<QList<int> > hierarchicalClusters(double threshold) const;
+
+    /**
+     * @return The first member of each cluster.
+     */
+    static QList<int> representatives(const QList<QList<int> > &clusters);
+
+  private:
+    ConformerClusteringPrivate * const d;
+    Q_DISABLE_COPY(ConformerClustering)
+  };
+
+} // End namespace Avogadro
+
+#endif
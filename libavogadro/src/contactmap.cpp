@@ -0,0 +1,301 @@
+/**********************************************************************
+  ContactMap - Residue contact frequencies over a trajectory
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "contactmap.h"
+#include "periodiccelllist_p.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/molecule.h>
+#include <avogadro/residue.h>
+#include <avogadro/trajectoryanalysis.h>
+
+#include <openbabel/generic.h>
+
+#include <QHash>
+#include <QThread>
+#include <QtCore/QtConcurrentMap>
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  /**
+   * A range of cells of a frame and the residue pairs in contact found in
+   * them, as first * numResidues + second with first < second.
+   */
+  struct ContactBlock
+  {
+    const PeriodicCellList *cells;
+    const int *residues;   // residue of each slot
+    int numResidues;
+    int firstCell;
+    int endCell;
+    double cutoff2;
+    QVector<quint64> contacts;
+    QVector<PeriodicCellList::Neighbor> neighbors;
+  };
+
+  static inline void addContact(ContactBlock &block, int a, int b)
+  {
+    if (a == b)
+      return;
+    const quint64 key = a < b ? quint64(a) * block.numResidues + b
+                              : quint64(b) * block.numResidues + a;
+    // Atoms of the same residues come in runs, skip the repeats
+    if (block.contacts.isEmpty() || block.contacts.last() != key)
+      block.contacts.append(key);
+  }
+
+  static inline bool inContact(const ContactBlock &block, const double *a,
+                               const double *b, const Vector3d &shift)
+  {
+    const double dx = b[0] + shift.x() - a[0];
+    const double dy = b[1] + shift.y() - a[1];
+    const double dz = b[2] + shift.z() - a[2];
+    return dx * dx + dy * dy + dz * dz < block.cutoff2;
+  }
+
+  static void findContacts(ContactBlock &block)
+  {
+    const PeriodicCellList *cells = block.cells;
+    const double *positions = cells->positions();
+    const int *slots = cells->slots();
+    const int *residues = block.residues;
+    block.contacts.clear();
+
+    for (int c = block.firstCell; c < block.endCell; ++c) {
+      cells->halfStencil(c, block.neighbors);
+      const int begin = cells->begin(c), end = cells->end(c);
+      if (begin == end)
+        continue;
+
+      for (int k = 0; k < block.neighbors.size(); ++k) {
+        const PeriodicCellList::Neighbor &neighbor = block.neighbors[k];
+        const int nEnd = cells->end(neighbor.cell);
+        for (int i = begin; i < end; ++i) {
+          const int ri = residues[slots[i]];
+          // Within the cell itself each pair once
+          for (int j = k ? cells->begin(neighbor.cell) : i + 1; j < nEnd; ++j) {
+            const int rj = residues[slots[j]];
+            if (ri != rj && inContact(block, positions + 3 * i, positions + 3 * j,
+                                      neighbor.shift))
+              addContact(block, ri, rj);
+          }
+        }
+      }
+    }
+  }
+
+  struct ContactCount
+  {
+    ContactCount() : count(0), lastFrame(-1) {}
+    int count;
+    int lastFrame;
+  };
+
+  class ContactMapPrivate
+  {
+    public:
+      ContactMapPrivate() : molecule(0), cutoff(4.5), heavyOnly(true),
+        numResidues(0), cells(4.5), numFrames(0) {}
+
+      const Molecule *molecule;
+      double cutoff;
+      bool heavyOnly;
+
+      int numResidues;
+      QVector<int> atoms;      // atoms with a residue
+      QVector<int> residues;   // and their residues
+      PeriodicCellList cells;
+      QVector<ContactBlock> blocks;
+
+      int numFrames;
+      QHash<quint64, ContactCount> counts;
+
+      void setup();
+  };
+
+  void ContactMapPrivate::setup()
+  {
+    atoms.clear();
+    residues.clear();
+    numResidues = 0;
+    cells = PeriodicCellList(cutoff, 1);
+    counts.clear();
+    numFrames = 0;
+    blocks.resize(4 * qMax(1, QThread::idealThreadCount()));
+    if (!molecule)
+      return;
+
+    QHash<const Residue *, int> residueIndex;
+    foreach (Residue *residue, molecule->residues())
+      residueIndex.insert(residue, residueIndex.size());
+    numResidues = residueIndex.size();
+    foreach (Atom *atom, molecule->atoms()) {
+      if (heavyOnly && atom->isHydrogen())
+        continue;
+      QHash<const Residue *, int>::const_iterator it = residueIndex.constFind(atom->residue());
+      if (it == residueIndex.constEnd())
+        continue;
+      atoms.append(atom->index());
+      residues.append(it.value());
+    }
+
+    if (OpenBabel::OBUnitCell *cell = molecule->OBUnitCell()) {
+      OpenBabel::matrix3x3 ortho = cell->GetOrthoMatrix();
+      Matrix3d lattice;
+      for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+          lattice(i, j) = ortho.Get(i, j);
+      cells.setCell(lattice);
+    }
+  }
+
+  ContactMap::ContactMap() : d(new ContactMapPrivate)
+  {
+    d->setup();
+  }
+
+  ContactMap::~ContactMap()
+  {
+    delete d;
+  }
+
+  void ContactMap::setMolecule(const Molecule *molecule)
+  {
+    d->molecule = molecule;
+    d->setup();
+  }
+
+  void ContactMap::setCutoff(double cutoff)
+  {
+    d->cutoff = cutoff > 0.0 ? cutoff : 4.5;
+    d->setup();
+  }
+
+  double ContactMap::cutoff() const
+  {
+    return d->cutoff;
+  }
+
+  void ContactMap::setHeavyAtomsOnly(bool heavyOnly)
+  {
+    d->heavyOnly = heavyOnly;
+    d->setup();
+  }
+
+  bool ContactMap::heavyAtomsOnly() const
+  {
+    return d->heavyOnly;
+  }
+
+  void ContactMap::clear()
+  {
+    d->counts.clear();
+    d->numFrames = 0;
+  }
+
+  void ContactMap::addFrame(const double *coordinates)
+  {
+    const int frame = d->numFrames++;
+    if (d->atoms.isEmpty())
+      return;
+    d->cells.update(coordinates, d->atoms);
+
+    const int numCells = d->cells.numCells();
+    const int numBlocks = d->blocks.size();
+    const int perBlock = (numCells + numBlocks - 1) / numBlocks;
+    for (int b = 0; b < numBlocks; ++b) {
+      ContactBlock &block = d->blocks[b];
+      block.cells = &d->cells;
+      block.residues = d->residues.constData();
+      block.numResidues = d->numResidues;
+      block.firstCell = qMin(numCells, b * perBlock);
+      block.endCell = qMin(numCells, block.firstCell + perBlock);
+      block.cutoff2 = d->cutoff * d->cutoff;
+    }
+    QtConcurrent::blockingMap(d->blocks, findContacts);
+
+    // A pair of residues counts once per frame, however many atoms touch
+    foreach (const ContactBlock &block, d->blocks)
+      foreach (quint64 key, block.contacts) {
+        ContactCount &count = d->counts[key];
+        if (count.lastFrame != frame) {
+          count.lastFrame = frame;
+          ++count.count;
+        }
+      }
+  }
+
+  bool ContactMap::run(TrajectoryFrameSource *source)
+  {
+    clear();
+    const int n = d->molecule ? d->molecule->numAtoms() : 0;
+    if (!source || !n || source->numAtoms() != n || !source->rewind())
+      return false;
+
+    const int chunk = 16;
+    QVector<double> buffer(3 * n * chunk);
+    int read;
+    while ((read = source->readFrames(buffer.data(), chunk)) > 0)
+      for (int f = 0; f < read; ++f)
+        addFrame(buffer.constData() + 3 * n * f);
+    return read == 0;
+  }
+
+  int ContactMap::numFrames() const
+  {
+    return d->numFrames;
+  }
+
+  int ContactMap::numResidues() const
+  {
+    return d->numResidues;
+  }
+
+  QVector<double> ContactMap::frequencies() const
+  {
+    const int r = d->numResidues;
+    QVector<double> matrix(r * r, 0.0);
+    if (!d->numFrames)
+      return matrix;
+    QHash<quint64, ContactCount>::const_iterator it = d->counts.constBegin();
+    for (; it != d->counts.constEnd(); ++it) {
+      const int i = it.key() / r, j = it.key() % r;
+      const double frequency = double(it.value().count) / d->numFrames;
+      matrix[i * r + j] = matrix[j * r + i] = frequency;
+    }
+    return matrix;
+  }
+
+  double ContactMap::frequency(int i, int j) const
+  {
+    const int r = d->numResidues;
+    if (!d->numFrames || i < 0 || j < 0 || i >= r || j >= r || i == j)
+      return 0.0;
+    const quint64 key = i < j ? quint64(i) * r + j : quint64(j) * r + i;
+    return double(d->counts.value(key).count) / d->numFrames;
+  }
+
+} // End namespace Avogadro
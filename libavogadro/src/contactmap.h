@@ -0,0 +1,117 @@
+/**********************************************************************
+  ContactMap - Residue contact frequencies over a trajectory
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef CONTACTMAP_H
+#define CONTACTMAP_H
+
+#include <avogadro/global.h>
+
+#include <QVector>
+
+namespace Avogadro {
+
+  class Molecule;
+  class TrajectoryFrameSource;
+
+  /**
+   * @class ContactMap contactmap.h <avogadro/contactmap.h>
+   * @brief The fraction of frames in which two residues are in contact.
+   *
+   * Two residues are in contact in a frame if any of their atoms are closer
+   * than the cutoff. Atom pairs are found with the same cell list as
+   * RadialDistribution, periodic images included if the molecule has a
+   * unit cell, and the cells are shared out over all cores.
+   */
+  class ContactMapPrivate;
+  class A_EXPORT ContactMap
+  {
+    public:
+      ContactMap();
+      ~ContactMap();
+
+      /**
+       * Take the residues of the atoms and the unit cell, if any, from
+       * @p molecule. Atoms without a residue are left out. This clears the
+       * counts.
+       */
+      void setMolecule(const Molecule *molecule);
+
+      /**
+       * Residues closer than @p cutoff Angstrom are in contact, 4.5 by
+       * default. This clears the counts.
+       */
+      void setCutoff(double cutoff);
+      double cutoff() const;
+
+      /**
+       * Leave out hydrogens, the default. This clears the counts.
+       */
+      void setHeavyAtomsOnly(bool heavyOnly);
+      bool heavyAtomsOnly() const;
+
+      /**
+       * Forget all frames added so far.
+       */
+      void clear();
+
+      /**
+       * Add the frame with packed x, y, z @p coordinates in the order of
+       * the atom indices.
+       */
+      void addFrame(const double *coordinates);
+
+      /**
+       * Clear and add all frames of @p source.
+       * @return false if the source does not match the molecule.
+       */
+      bool run(TrajectoryFrameSource *source);
+
+      int numFrames() const;
+
+      /**
+       * @return The number of residues, in the order of
+       * Molecule::residues().
+       */
+      int numResidues() const;
+
+      /**
+       * @return The contact frequency of each pair of residues, a symmetric
+       * numResidues() square matrix stored by rows.
+       */
+      QVector<double> frequencies() const;
+
+      /**
+       * @return The fraction of frames in which residues @p i and @p j are
+       * in contact.
+       */
+      double frequency(int i, int j) const;
+
+    private:
+      ContactMapPrivate * const d;
+      Q_DISABLE_COPY(ContactMap)
+  };
+
+} // End namespace Avogadro
+
+#endif
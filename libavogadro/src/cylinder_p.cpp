@@ -96,6 +96,12 @@ namespace Avogadro {
     initialize();
   }
 
+  int Cylinder::vertexCount() const
+  {
+    if( d->faces < 3 ) return 2; // drawn as a line
+    return 2 * d->faces + 2;
+  }
+
   void Cylinder::initialize()
   {
     d->isValid = false;
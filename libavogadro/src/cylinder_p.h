@@ -91,6 +91,9 @@ namespace Avogadro {
           double radius, int order, double shift,
           const Eigen::Vector3d &planeNormalVector ) const;
 
+      /** @return the number of vertices sent to OpenGL by draw() */
+      int vertexCount() const;
+
     private:
       CylinderPrivate * const d;
   };
@@ -0,0 +1,241 @@
+/**********************************************************************
+  DepthSorter - Back to front ordering of atoms and bonds
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "depthsorter.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+#include <avogadro/camera.h>
+#include <avogadro/molecule.h>
+
+#include <QVector>
+#include <QPair>
+#include <QFuture>
+#include <QtCore/QtConcurrentRun>
+
+#include <algorithm>
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  class DepthSorterPrivate
+  {
+  public:
+    DepthSorterPrivate() : enabled(true), dirty(true), molecule(0),
+      numAtoms(0), numBonds(0), firstPos(0)
+    {
+      for (int i = 0; i < 4; ++i)
+        depthRow[i] = 0.0;
+    }
+
+    bool enabled;
+    bool dirty;
+
+    // What the order was computed from, to catch changes nobody told us about
+    const Molecule *molecule;
+    unsigned int numAtoms;
+    unsigned int numBonds;
+    const Vector3d *firstPos;
+    double depthRow[4];  // third row of the modelview matrix
+
+    // Input copied on the GUI thread, so the worker never touches the molecule
+    QVector<Vector3d> atomPos;
+    QVector<unsigned long> atomIds;
+    QVector<Vector3d> bondCenters;
+    QVector<unsigned long> bondIds;
+
+    // Output of the worker, ids from the furthest to the closest
+    QVector<unsigned long> atomOrder;
+    QVector<unsigned long> bondOrder;
+
+    QFuture<void> future;
+
+    static void sortAll(DepthSorterPrivate *d);
+    static void sort(const QVector<Vector3d> &pos,
+                     const QVector<unsigned long> &ids,
+                     const double *row, QVector<unsigned long> &order);
+
+    template <class T>
+    QList<T *> reorder(const QList<T *> &list,
+                       const QVector<unsigned long> &order) const;
+  };
+
+  void DepthSorterPrivate::sort(const QVector<Vector3d> &pos,
+                                const QVector<unsigned long> &ids,
+                                const double *row,
+                                QVector<unsigned long> &order)
+  {
+    // Eye space z is negative in front of the camera, the most negative is
+    // the furthest away and must come first
+    QVector<QPair<double, unsigned long> > keys(pos.size());
+    for (int i = 0; i < pos.size(); ++i) {
+      const Vector3d &p = pos[i];
+      keys[i].first = row[0] * p.x() + row[1] * p.y() + row[2] * p.z() + row[3];
+      keys[i].second = ids[i];
+    }
+    std::sort(keys.begin(), keys.end());
+
+    order.resize(keys.size());
+    for (int i = 0; i < keys.size(); ++i)
+      order[i] = keys[i].second;
+  }
+
+  void DepthSorterPrivate::sortAll(DepthSorterPrivate *d)
+  {
+    sort(d->atomPos, d->atomIds, d->depthRow, d->atomOrder);
+    sort(d->bondCenters, d->bondIds, d->depthRow, d->bondOrder);
+  }
+
+  template <class T>
+  QList<T *> DepthSorterPrivate::reorder(const QList<T *> &list,
+                                         const QVector<unsigned long> &order) const
+  {
+    // Scatter the list by id then gather it in depth order, linear in the
+    // size of the molecule
+    unsigned long maxId = 0;
+    foreach (unsigned long id, order)
+      if (id > maxId)
+        maxId = id;
+    QVector<T *> byId(order.isEmpty() ? 0 : maxId + 1, 0);
+
+    foreach (T *item, list)
+      if (item->id() < static_cast<unsigned long>(byId.size()))
+        byId[item->id()] = item;
+
+    QList<T *> sorted;
+    foreach (unsigned long id, order) {
+      if (byId[id]) {
+        sorted.append(byId[id]);
+        byId[id] = 0;
+      }
+    }
+
+    // Anything added since the sort has no depth yet, draw it last
+    foreach (T *item, list)
+      if (item->id() >= static_cast<unsigned long>(byId.size())
+          || byId[item->id()])
+        sorted.append(item);
+    return sorted;
+  }
+
+  DepthSorter::DepthSorter() : d(new DepthSorterPrivate)
+  {
+  }
+
+  DepthSorter::~DepthSorter()
+  {
+    d->future.waitForFinished();
+    delete d;
+  }
+
+  void DepthSorter::setEnabled(bool enabled)
+  {
+    if (d->enabled == enabled)
+      return;
+    d->enabled = enabled;
+    d->dirty = true;
+  }
+
+  bool DepthSorter::isEnabled() const
+  {
+    return d->enabled;
+  }
+
+  void DepthSorter::invalidate()
+  {
+    d->dirty = true;
+  }
+
+  void DepthSorter::update(const Molecule *molecule, const Camera *camera)
+  {
+    if (!d->enabled || !molecule || !camera)
+      return;
+
+    if (molecule != d->molecule || molecule->numAtoms() != d->numAtoms
+        || molecule->numBonds() != d->numBonds
+        || (d->numAtoms && molecule->atoms().first()->pos() != d->firstPos))
+      d->dirty = true;
+
+    const Matrix4d &modelview = camera->modelview().matrix();
+    for (int i = 0; i < 4; ++i)
+      if (modelview(2, i) != d->depthRow[i])
+        d->dirty = true;
+
+    if (!d->dirty)
+      return;
+
+    // The worker may still be reading the previous input
+    d->future.waitForFinished();
+
+    for (int i = 0; i < 4; ++i)
+      d->depthRow[i] = modelview(2, i);
+
+    QList<Atom *> atoms = molecule->atoms();
+    d->atomPos.resize(atoms.size());
+    d->atomIds.resize(atoms.size());
+    for (int i = 0; i < atoms.size(); ++i) {
+      d->atomPos[i] = *atoms[i]->pos();
+      d->atomIds[i] = atoms[i]->id();
+    }
+
+    QList<Bond *> bonds = molecule->bonds();
+    d->bondCenters.resize(bonds.size());
+    d->bondIds.resize(bonds.size());
+    for (int i = 0; i < bonds.size(); ++i) {
+      d->bondCenters[i] = *bonds[i]->midPos();
+      d->bondIds[i] = bonds[i]->id();
+    }
+
+    d->molecule = molecule;
+    d->numAtoms = atoms.size();
+    d->numBonds = bonds.size();
+    d->firstPos = d->numAtoms ? atoms.first()->pos() : 0;
+    d->dirty = false;
+
+    d->future = QtConcurrent::run(DepthSorterPrivate::sortAll, d);
+  }
+
+  void DepthSorter::wait() const
+  {
+    d->future.waitForFinished();
+  }
+
+  QList<Atom *> DepthSorter::sortedAtoms(const QList<Atom *> &atoms) const
+  {
+    if (!d->enabled)
+      return atoms;
+    d->future.waitForFinished();
+    return d->reorder(atoms, d->atomOrder);
+  }
+
+  QList<Bond *> DepthSorter::sortedBonds(const QList<Bond *> &bonds) const
+  {
+    if (!d->enabled)
+      return bonds;
+    d->future.waitForFinished();
+    return d->reorder(bonds, d->bondOrder);
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,107 @@
+/**********************************************************************
+  DepthSorter - Back to front ordering of atoms and bonds
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef DEPTHSORTER_H
+#define DEPTHSORTER_H
+
+#include <avogadro/global.h>
+
+#include <QList>
+
+namespace Avogadro {
+
+  class Atom;
+  class Bond;
+  class Camera;
+  class Molecule;
+  class DepthSorterPrivate;
+
+  /**
+   * @class DepthSorter depthsorter.h <avogadro/depthsorter.h>
+   * @brief Orders atoms and bonds from the back to the front of the view.
+   *
+   * Blended transparency is only exact if the translucent primitives are
+   * drawn furthest first. The GLWidget calls update() at the start of each
+   * frame, which copies the positions and sorts them by view depth on a
+   * worker thread while the opaque layer is being rendered. Engines then
+   * reorder the primitives of their transparent pass with sortedAtoms() and
+   * sortedBonds(), which only wait for the worker if it has not finished.
+   *
+   * Engines normally access the sorter through
+   * PainterDevice::depthSortedAtoms() and PainterDevice::depthSortedBonds().
+   */
+  class A_EXPORT DepthSorter
+  {
+  public:
+    DepthSorter();
+    ~DepthSorter();
+
+    /**
+     * Enable or disable the sorter. A disabled sorter returns primitives in
+     * the order they were supplied.
+     */
+    void setEnabled(bool enabled);
+
+    /**
+     * @return true if the sorter is enabled.
+     */
+    bool isEnabled() const;
+
+    /**
+     * Mark the sorted order as out of date. This must be called whenever
+     * atoms or bonds are added, removed or moved.
+     */
+    void invalidate();
+
+    /**
+     * Start sorting the molecule for the supplied view in the background if
+     * the molecule was invalidated or the camera moved since the last sort.
+     * The molecule must not be modified until the sort is finished, which
+     * is guaranteed once sortedAtoms(), sortedBonds() or wait() returned.
+     */
+    void update(const Molecule *molecule, const Camera *camera);
+
+    /**
+     * Block until the background sort is finished.
+     */
+    void wait() const;
+
+    /**
+     * @return @p atoms ordered from the furthest to the closest atom.
+     */
+    QList<Atom *> sortedAtoms(const QList<Atom *> &atoms) const;
+
+    /**
+     * @return @p bonds ordered from the furthest to the closest bond center.
+     */
+    QList<Bond *> sortedBonds(const QList<Bond *> &bonds) const;
+
+  private:
+    DepthSorterPrivate * const d;
+    Q_DISABLE_COPY(DepthSorter)
+  };
+
+} // End namespace Avogadro
+
+#endif
@@ -300,6 +300,17 @@ namespace Avogadro {
         return true;
       }
 
+      /**
+       * Render the molecule from the snapshot of @p pd, in place of all the
+       * other render functions while another thread is writing to the
+       * molecule. Its atoms and bonds must not be read then, the snapshot
+       * only has their elements, positions, bond orders and unique ids.
+       * @return false if the engine cannot render from a snapshot and is left
+       * out of the frame, the default.
+       * @sa PainterDevice::snapshot()
+       */
+      virtual bool renderSnapshot(PainterDevice *) { return false; }
+
       /**
        * @return transparency level, rendered low to high.
        */
@@ -32,6 +32,7 @@
 #include <avogadro/atom.h>
 #include <avogadro/bond.h>
 #include <avogadro/molecule.h>
+#include <avogadro/moleculesnapshot.h>
 
 #include <QGLWidget> // for OpenGL bits
 #include <QDebug>
@@ -121,8 +122,9 @@ namespace Avogadro
     Color *map = colorMap(); // possible custom color map
     if (!map) map = pd->colorMap(); // fall back to global color map
 
-    // Render the bonds
-    foreach(const Bond *b, bonds()) {
+    // Render the bonds in view, distant ones as simple lines
+    QList<Bond *> coarseBonds;
+    foreach(const Bond *b, pd->visibleBonds(bonds(), &coarseBonds)) {
       Atom* atom1 = pd->molecule()->atomById(b->beginAtomId());
       Atom* atom2 = pd->molecule()->atomById(b->endAtomId());
       if (!atom1 || !atom2) {
@@ -143,22 +145,52 @@ namespace Avogadro
 
       map->setFromPrimitive(atom1);
       pd->painter()->setColor( map );
+      pd->painter()->setName(b);
       pd->painter()->drawMultiCylinder( v1, v3, m_bondRadius, order, shift );
 
       map->setFromPrimitive(atom2);
       pd->painter()->setColor( map );
+      pd->painter()->setName(b);
       pd->painter()->drawMultiCylinder( v3, v2, m_bondRadius, order, shift );
     }
+    foreach(const Bond *b, coarseBonds) {
+      Atom* atom1 = pd->molecule()->atomById(b->beginAtomId());
+      Atom* atom2 = pd->molecule()->atomById(b->endAtomId());
+      if (!atom1 || !atom2)
+        continue;
+
+      Vector3d v1(*atom1->pos());
+      Vector3d v2(*atom2->pos());
+      Vector3d v3((v1 + v2) / 2);
+
+      map->setFromPrimitive(atom1);
+      pd->painter()->setColor(map);
+      pd->painter()->setName(b);
+      pd->painter()->drawLine(v1, v3, 1.0);
+
+      map->setFromPrimitive(atom2);
+      pd->painter()->setColor(map);
+      pd->painter()->setName(b);
+      pd->painter()->drawLine(v3, v2, 1.0);
+    }
 
     glDisable( GL_NORMALIZE );
     glEnable( GL_RESCALE_NORMAL );
 
-    // Render the atoms
-    foreach(const Atom *a, atoms()) {
+    // Render the atoms in view, distant ones as points
+    QList<Atom *> coarseAtoms;
+    foreach(const Atom *a, pd->visibleAtoms(atoms(), &coarseAtoms)) {
       map->setFromPrimitive(a);
       pd->painter()->setColor(map);
+      pd->painter()->setName(a);
       pd->painter()->drawSphere(a->pos(), radius(a));
     }
+    foreach(const Atom *a, coarseAtoms) {
+      map->setFromPrimitive(a);
+      pd->painter()->setColor(map);
+      pd->painter()->setName(a);
+      pd->painter()->drawPoint(*a->pos(), radius(a));
+    }
 
     // normalize normal vectors of bonds
     glDisable( GL_RESCALE_NORMAL );
@@ -177,7 +209,7 @@ namespace Avogadro
 
     glDisable( GL_NORMALIZE );
     glEnable( GL_RESCALE_NORMAL );
-    foreach(const Atom *a, atoms()) {
+    foreach(const Atom *a, pd->depthSortedAtoms(pd->visibleAtoms(atoms()))) {
       // First render the atom if it is transparent.
       if (m_alpha < 0.999 && m_alpha > 0.001) {
         map->setFromPrimitive(a);
@@ -195,7 +227,7 @@ namespace Avogadro
 
     glDisable( GL_RESCALE_NORMAL );
     glEnable( GL_NORMALIZE );
-    foreach(const Bond *b, bonds()) {
+    foreach(const Bond *b, pd->depthSortedBonds(pd->visibleBonds(bonds()))) {
       // If the bond is not selected and balls and sticks are opaque do not render it
       if (!pd->isSelected(b) && m_alpha > 0.999) continue;
 
@@ -248,8 +280,9 @@ namespace Avogadro
     Color cSel;
     cSel.setToSelectionColor();
 
-    // Render the bonds
-    foreach(Bond *b, bonds()) {
+    // Render the bonds in view, distant ones as simple lines
+    QList<Bond *> coarseBonds;
+    foreach(Bond *b, pd->visibleBonds(bonds(), &coarseBonds)) {
       Atom* atom1 = pd->molecule()->atomById(b->beginAtomId());
       Atom* atom2 = pd->molecule()->atomById(b->endAtomId());
       Vector3d v1(*atom1->pos());
@@ -278,11 +311,28 @@ namespace Avogadro
       }
     }
 
+    foreach(Bond *b, coarseBonds) {
+      Atom* atom1 = pd->molecule()->atomById(b->beginAtomId());
+      Atom* atom2 = pd->molecule()->atomById(b->endAtomId());
+      Vector3d v1(*atom1->pos());
+      Vector3d v2(*atom2->pos());
+      Vector3d v3((v1 + v2) / 2);
+
+      map->setFromPrimitive(atom1);
+      pd->painter()->setColor(pd->isSelected(b) ? &cSel : map);
+      pd->painter()->drawLine(v1, v3, 1.0);
+
+      map->setFromPrimitive(atom2);
+      pd->painter()->setColor(pd->isSelected(b) ? &cSel : map);
+      pd->painter()->drawLine(v3, v2, 1.0);
+    }
+
     glDisable(GL_NORMALIZE);
     glEnable(GL_RESCALE_NORMAL);
 
-    // Render the atoms
-    foreach(Atom *a, atoms()) {
+    // Render the atoms in view, distant ones as points
+    QList<Atom *> coarseAtoms;
+    foreach(Atom *a, pd->visibleAtoms(atoms(), &coarseAtoms)) {
       if (pd->isSelected(a)) {
         pd->painter()->setColor(&cSel);
         pd->painter()->drawSphere(a->pos(), SEL_ATOM_EXTRA_RADIUS + radius(a));
@@ -293,6 +343,15 @@ namespace Avogadro
         pd->painter()->drawSphere(a->pos(), radius(a));
       }
     }
+    foreach(Atom *a, coarseAtoms) {
+      if (pd->isSelected(a))
+        pd->painter()->setColor(&cSel);
+      else {
+        map->setFromPrimitive(a);
+        pd->painter()->setColor(map);
+      }
+      pd->painter()->drawPoint(*a->pos(), radius(a));
+    }
 
     // normalize normal vectors of bonds
     glDisable(GL_RESCALE_NORMAL);
@@ -324,10 +383,84 @@ namespace Avogadro
     return true;
   }
 
+  bool BSDYEngine::renderSnapshot(PainterDevice *pd)
+  {
+    // The snapshot has all of the atoms and bonds
+    if (m_customPrims)
+      return false;
+
+    const MoleculeSnapshot *snapshot = pd->snapshot();
+    const QVector<int> &atomicNumbers = snapshot->atomicNumbers();
+    const QVector<Vector3d> &positions = snapshot->atomPositions();
+    const QVector<int> &bondAtoms = snapshot->bondAtoms();
+    Color color;
+    Color cSel;
+    cSel.setToSelectionColor();
+
+    // Render the bonds as renderQuick() does
+    for (int i = 0; i < snapshot->numBonds(); ++i) {
+      int atom1 = bondAtoms.at(2 * i);
+      int atom2 = bondAtoms.at(2 * i + 1);
+      if (atom1 < 0 || atom2 < 0)
+        continue;
+
+      const Vector3d &v1 = positions.at(atom1);
+      const Vector3d &v2 = positions.at(atom2);
+      Vector3d d = v2 - v1;
+      d.normalize();
+      Vector3d v3((v1 + v2 + d*(elementRadius(atomicNumbers.at(atom1))
+                                - elementRadius(atomicNumbers.at(atom2)))) / 2);
+
+      double shift = 0.15;
+      int order = 1;
+      if (m_showMulti) order = snapshot->bondOrders().at(i);
+
+      if (pd->isSelected(Primitive::BondType, snapshot->bondIds().at(i))) {
+        pd->painter()->setColor(&cSel);
+        pd->painter()->drawMultiCylinder(v1, v2, SEL_BOND_EXTRA_RADIUS +
+                                         m_bondRadius, order, shift);
+      }
+      else {
+        color.setFromElement(atomicNumbers.at(atom1));
+        pd->painter()->setColor(&color);
+        pd->painter()->drawMultiCylinder(v1, v3, m_bondRadius, order, shift);
+
+        color.setFromElement(atomicNumbers.at(atom2));
+        pd->painter()->setColor(&color);
+        pd->painter()->drawMultiCylinder(v3, v2, m_bondRadius, order, shift);
+      }
+    }
+
+    glDisable(GL_NORMALIZE);
+    glEnable(GL_RESCALE_NORMAL);
+
+    for (int i = 0; i < snapshot->numAtoms(); ++i) {
+      double r = elementRadius(atomicNumbers.at(i));
+      if (pd->isSelected(Primitive::AtomType, snapshot->atomIds().at(i))) {
+        pd->painter()->setColor(&cSel);
+        r += SEL_ATOM_EXTRA_RADIUS;
+      }
+      else {
+        color.setFromElement(atomicNumbers.at(i));
+        pd->painter()->setColor(&color);
+      }
+      pd->painter()->drawSphere(positions.at(i), r);
+    }
+
+    glDisable(GL_RESCALE_NORMAL);
+    glEnable(GL_NORMALIZE);
+    return true;
+  }
+
   inline double BSDYEngine::radius(const Atom *atom) const
   {
-    if (atom->atomicNumber())
-      return OpenBabel::etab.GetVdwRad(atom->atomicNumber()) * m_atomRadiusPercentage;
+    return elementRadius(atom->atomicNumber());
+  }
+
+  inline double BSDYEngine::elementRadius(int atomicNumber) const
+  {
+    if (atomicNumber)
+      return OpenBabel::etab.GetVdwRad(atomicNumber) * m_atomRadiusPercentage;
     return m_atomRadiusPercentage;
   }
 
@@ -54,6 +54,7 @@ namespace Avogadro {
       bool renderTransparent(PainterDevice *pd);
       bool renderQuick(PainterDevice *pd);
       bool renderPick(PainterDevice *pd);
+      bool renderSnapshot(PainterDevice *pd);
 
       double transparencyDepth() const;
 
@@ -81,6 +82,7 @@ namespace Avogadro {
 
     private:
       double radius(const Atom *atom) const;
+      double elementRadius(int atomicNumber) const;
 
       BSDYSettingsWidget *m_settingsWidget;
 
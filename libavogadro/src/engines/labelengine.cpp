@@ -75,8 +75,11 @@ Bond *dummyBond;*/
                     m_atomType(1), m_bondType(0),
                     m_atomColor(255,255,255), m_bondColor(255,255,255),
 					m_settingsWidget(0),
-                    m_displacement(0,0,0),  m_bondDisplacement(0,0,0)
+                    m_displacement(0,0,0),  m_bondDisplacement(0,0,0),
+                    m_labelsDirty(true), m_labelsVersion(0)
   {
+    // Any change to the settings or primitives invalidates the cached labels
+    connect(this, SIGNAL(changed()), this, SLOT(invalidateLabels()));
     /*dummyAtom.setGroupIndex(1);
 	dummyAtom.setAtomicNumber(12);
 	dummyAtom.setPartialCharge(0.1);
@@ -97,21 +100,141 @@ Bond *dummyBond;*/
 
   bool LabelEngine::renderOpaque(PainterDevice *pd)
   {
+    // Custom properties are set on the atoms without any signal, so labels
+    // showing them are created again for each frame
+    if (m_labelsDirty || !m_molecule || m_atomType > 10
+        || m_molecule->topologyVersion() != m_labelsVersion)
+      updateLabels();
+
+    // Gather all labels close enough to the camera and draw them as one batch
+    Vector3d zAxis = pd->camera()->backTransformedZAxis();
     if (m_atomType > 0) {
-      // Render atom labels
-      foreach(Atom *a, atoms())
-        renderOpaque(pd, a);
+      QList<Atom *> atomList = atoms();
+      m_drawPositions.resize(0);
+      m_drawStrings.resize(0);
+      for (int i = 0; i < atomList.size() && i < m_atomLabels.size(); ++i) {
+        const Atom *a = atomList.at(i);
+        // Labels of distant or off-screen atoms are not drawn
+        if (pd->detail(a) != FrustumCuller::Full)
+          continue;
+        const Vector3d pos = *a->pos();
+        if (pd->camera()->distance(pos) >= 50.0)
+          continue;
+        double renderRadius = pd->radius(a) + 0.05;
+        m_drawPositions.push_back(pos + zAxis * renderRadius + m_displacement);
+        m_drawStrings.push_back(m_atomLabels.at(i));
+      }
+      glColor3f(m_atomColor.redF(), m_atomColor.greenF(), m_atomColor.blueF());
+      pd->painter()->drawTextBatch(m_drawPositions, m_drawStrings);
     }
 
     if (m_bondType > 0) {
-      // Now render the bond labels
-      foreach(Bond *b, bonds())
-        renderOpaque(pd, b);
+      QList<Bond *> bondList = bonds();
+      m_drawPositions.resize(0);
+      m_drawStrings.resize(0);
+      for (int i = 0; i < bondList.size() && i < m_bondLabels.size(); ++i) {
+        const Bond *b = bondList.at(i);
+        if (pd->detail(b) != FrustumCuller::Full)
+          continue;
+        Atom* atom1 = pd->molecule()->atomById(b->beginAtomId());
+        Atom* atom2 = pd->molecule()->atomById(b->endAtomId());
+        // If the render radius is zero then this view does not draw bonds
+        double renderRadius = pd->radius(b);
+        if (!atom1 || !atom2 || renderRadius < 1.0e-3)
+          continue;
+        Vector3d v1 (*atom1->pos());
+        Vector3d v2 (*atom2->pos());
+        Vector3d d = v2 - v1;
+        d.normalize();
+        Vector3d pos ( (v1 + v2 + d*(pd->radius(atom1)-pd->radius(atom2))) / 2.0 );
+        if (pd->camera()->distance(pos) >= 50.0)
+          continue;
+        m_drawPositions.push_back(pos + zAxis * (renderRadius + 0.05)
+                                  + m_bondDisplacement);
+        m_drawStrings.push_back(m_bondLabels.at(i));
+      }
+      glColor3f(m_bondColor.redF(), m_bondColor.greenF(), m_bondColor.blueF());
+      pd->painter()->drawTextBatch(m_drawPositions, m_drawStrings);
     }
-	  
+
     return true;
   }
 
+  void LabelEngine::updateLabels()
+  {
+    m_atomLabels.resize(0);
+    if (m_atomType > 0) {
+      QList<Atom *> atomList = atoms();
+      m_atomLabels.reserve(atomList.size());
+      foreach(Atom *a, atomList)
+        m_atomLabels.push_back(createAtomLabel(a));
+    }
+
+    m_bondLabels.resize(0);
+    if (m_bondType > 0) {
+      QList<Bond *> bondList = bonds();
+      m_bondLabels.reserve(bondList.size());
+      foreach(Bond *b, bondList)
+        m_bondLabels.push_back(createBondLabel(b));
+    }
+    m_labelsDirty = false;
+    m_labelsVersion = m_molecule ? m_molecule->topologyVersion() : 0;
+  }
+
+  void LabelEngine::invalidateLabels()
+  {
+    m_labelsDirty = true;
+  }
+
+  void LabelEngine::invalidateBondLengths()
+  {
+    // Only bond length labels depend on the positions
+    if (m_bondType == 1)
+      m_labelsDirty = true;
+  }
+
+  void LabelEngine::invalidateResidueLabels(Primitive *primitive)
+  {
+    if (primitive && primitive->type() == Primitive::ResidueType)
+      m_labelsDirty = true;
+  }
+
+  void LabelEngine::setMolecule(const Molecule *molecule)
+  {
+    if (m_molecule)
+      disconnect(m_molecule, 0, this, 0);
+    Engine::setMolecule(molecule);
+    connectMolecule();
+  }
+
+  void LabelEngine::setMolecule(Molecule *molecule)
+  {
+    if (m_molecule)
+      disconnect(m_molecule, 0, this, 0);
+    Engine::setMolecule(molecule);
+    connectMolecule();
+  }
+
+  void LabelEngine::connectMolecule()
+  {
+    m_labelsDirty = true;
+    if (!m_molecule)
+      return;
+    // Element, charge and bond changes are caught by the topology version
+    // before drawing. Positions only move, so updated() is ignored unless
+    // bond lengths are shown, and ids change on moleculeChanged().
+    connect(m_molecule, SIGNAL(updated()), this, SLOT(invalidateBondLengths()));
+    connect(m_molecule, SIGNAL(moleculeChanged()), this, SLOT(invalidateLabels()));
+    connect(m_molecule, SIGNAL(partialChargesChanged()),
+            this, SLOT(invalidateLabels()));
+    connect(m_molecule, SIGNAL(primitiveUpdated(Primitive*)),
+            this, SLOT(invalidateResidueLabels(Primitive*)));
+    connect(m_molecule, SIGNAL(atomAdded(Atom*)), this, SLOT(invalidateLabels()));
+    connect(m_molecule, SIGNAL(atomRemoved(Atom*)), this, SLOT(invalidateLabels()));
+    connect(m_molecule, SIGNAL(bondAdded(Bond*)), this, SLOT(invalidateLabels()));
+    connect(m_molecule, SIGNAL(bondRemoved(Bond*)), this, SLOT(invalidateLabels()));
+  }
+
   bool LabelEngine::renderQuick(PainterDevice *)
   {
     // Don't render text when moving...
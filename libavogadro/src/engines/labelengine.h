@@ -71,6 +71,13 @@ namespace Avogadro {
 
       bool hasSettings() { return true; }
 
+      /**
+       * Set the Molecule and listen to its changes to know when the cached
+       * labels need to be regenerated.
+       */
+      void setMolecule(const Molecule *molecule);
+      void setMolecule(Molecule *molecule);
+
 	  QString createAtomLabel(const Atom *a);
 	  QString createBondLabel(const Bond *b);
 
@@ -96,6 +103,18 @@ namespace Avogadro {
 	  Eigen::Vector3d m_bondDisplacement;
       LabelSettingsWidget* m_settingsWidget;
 
+      // Labels are only regenerated when the topology or settings change
+      bool m_labelsDirty;
+      unsigned long m_labelsVersion;
+      QVector<QString> m_atomLabels;
+      QVector<QString> m_bondLabels;
+      // Per frame scratch buffers handed to Painter::drawTextBatch()
+      QVector<Eigen::Vector3d> m_drawPositions;
+      QVector<QString> m_drawStrings;
+
+      void updateLabels();
+      void connectMolecule();
+
     private Q_SLOTS:
       void setAtomType(int value);
       void setBondType(int value);
@@ -106,6 +125,9 @@ namespace Avogadro {
 	  void updateDisplacement(double = 0.0);
 	  void updateBondDisplacement(double = 0.0);
       void settingsWidgetDestroyed();
+      void invalidateLabels();
+      void invalidateBondLengths();
+      void invalidateResidueLabels(Primitive *primitive);
 
   };
 
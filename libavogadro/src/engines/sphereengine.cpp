@@ -72,42 +72,58 @@ namespace Avogadro {
       // Render the atoms as VdW spheres
       glDisable(GL_NORMALIZE);
       glEnable(GL_RESCALE_NORMAL);
-      foreach(Atom *a, atoms())
+      QList<Atom *> coarseAtoms;
+      foreach(Atom *a, pd->visibleAtoms(atoms(), &coarseAtoms))
         render(pd, a);
       glDisable(GL_RESCALE_NORMAL);
       glEnable(GL_NORMALIZE);
+
+      // Distant atoms are drawn as points
+      Color *map = colorMap(); // possible custom color map
+      if (!map) map = pd->colorMap(); // fall back to global color map
+      foreach(Atom *a, coarseAtoms) {
+        map->setFromPrimitive(a);
+        pd->painter()->setColor(map);
+        pd->painter()->setName(a);
+        pd->painter()->drawPoint(*a->pos(), radius(a));
+      }
     }
     return true;
   }
 
   bool SphereEngine::renderTransparent(PainterDevice *pd)
   {
+    QList<Atom *> visibleAtoms = pd->depthSortedAtoms(pd->visibleAtoms(atoms()));
+
     // If m_alpha is between 0 and 1 then render our transparent spheres
     if (m_alpha > 0.001 && m_alpha < 0.999)
     {
-      // First pass using a colour mask - nothing is actually drawn
-      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-      glDisable(GL_LIGHTING);
-      glDisable(GL_BLEND);
-      // This is a little hackish but I am not sure there is a better way,
-      // OpenGL requires this to cull the internal surfaces but it breaks POV-Ray
-      // renders. So I set the color to black and totally transparent, render
-      // with a slightly smaller radius than the actual VdW spheres. Works but
-      // not pretty...
-      pd->painter()->setColor(0.0, 0.0, 0.0, 1.0);
-      foreach(Atom *a, atoms()) {
-        pd->painter()->drawSphere(a->pos(), radius(a)*0.9999);
-      }
+      // The depth pre-pass is not needed when the order does not matter
+      if (!pd->orderIndependentTransparency()) {
+        // First pass using a colour mask - nothing is actually drawn
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDisable(GL_LIGHTING);
+        glDisable(GL_BLEND);
+        // This is a little hackish but I am not sure there is a better way,
+        // OpenGL requires this to cull the internal surfaces but it breaks POV-Ray
+        // renders. So I set the color to black and totally transparent, render
+        // with a slightly smaller radius than the actual VdW spheres. Works but
+        // not pretty...
+        pd->painter()->setColor(0.0, 0.0, 0.0, 1.0);
+        foreach(Atom *a, visibleAtoms) {
+          pd->painter()->drawSphere(a->pos(), radius(a)*0.9999);
+        }
 
-      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-      glEnable(GL_BLEND);
-      glEnable(GL_LIGHTING);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glEnable(GL_BLEND);
+        glEnable(GL_LIGHTING);
+      }
 
       // Render the atoms as VdW spheres
       glDisable(GL_NORMALIZE);
       glEnable(GL_RESCALE_NORMAL);
 
-      foreach(Atom *a, atoms())
+      foreach(Atom *a, visibleAtoms)
         render(pd, a);
 
       glDisable(GL_RESCALE_NORMAL);
@@ -117,7 +133,7 @@ namespace Avogadro {
     // Render the selection sphere if required
     Color *map = colorMap(); // possible custom color map
     if (!map) map = pd->colorMap(); // fall back to global color map
-    foreach(Atom *a, atoms()) {
+    foreach(Atom *a, visibleAtoms) {
       if (pd->isSelected(a)) {
         map->setToSelectionColor();
         pd->painter()->setColor(map);
@@ -137,12 +153,19 @@ namespace Avogadro {
     Color *map = colorMap();
     if (!map) map = pd->colorMap();
 
-    foreach(Atom *a, atoms()) {
+    QList<Atom *> coarseAtoms;
+    foreach(Atom *a, pd->visibleAtoms(atoms(), &coarseAtoms)) {
       map->setFromPrimitive(a);
       pd->painter()->setColor(map);
       pd->painter()->setName(a);
       pd->painter()->drawSphere(a->pos(), radius(a));
     }
+    foreach(Atom *a, coarseAtoms) {
+      map->setFromPrimitive(a);
+      pd->painter()->setColor(map);
+      pd->painter()->setName(a);
+      pd->painter()->drawPoint(*a->pos(), radius(a));
+    }
 
     glDisable(GL_RESCALE_NORMAL);
     glEnable(GL_NORMALIZE);
@@ -29,6 +29,7 @@
 #include <avogadro/atom.h>
 #include <avogadro/bond.h>
 #include <avogadro/molecule.h>
+#include <avogadro/moleculesnapshot.h>
 #include <avogadro/color.h>
 #include <avogadro/glwidget.h>
 #include <avogadro/painterdevice.h>
@@ -75,15 +76,45 @@ namespace Avogadro {
     glDisable( GL_NORMALIZE );
     glEnable( GL_RESCALE_NORMAL );
 
-    // Render the atoms
-    foreach(Atom *a, atoms())
+    Color *map = colorMap(); // possible custom color map
+    if (!map) map = pd->colorMap(); // fall back to global color map
+
+    // Render the atoms in view, distant ones as points
+    QList<Atom *> coarseAtoms;
+    foreach(Atom *a, pd->visibleAtoms(atoms(), &coarseAtoms))
       renderOpaque(pd, a);
+    foreach(Atom *a, coarseAtoms) {
+      map->setFromPrimitive(a);
+      pd->painter()->setColor(map);
+      pd->painter()->setName(a);
+      pd->painter()->drawPoint(*a->pos(), radius(a));
+    }
 
-    // render bonds (sticks)
+    // render bonds (sticks) in view, distant ones as lines
     glDisable( GL_RESCALE_NORMAL );
     glEnable( GL_NORMALIZE );
-    foreach(Bond *b, bonds())
+    QList<Bond *> coarseBonds;
+    foreach(Bond *b, pd->visibleBonds(bonds(), &coarseBonds))
       renderOpaque(pd, b);
+    foreach(Bond *b, coarseBonds) {
+      Atom* atom1 = pd->molecule()->atomById(b->beginAtomId());
+      Atom* atom2 = pd->molecule()->atomById(b->endAtomId());
+      if (!atom1 || !atom2)
+        continue;
+      Vector3d v1 (*atom1->pos());
+      Vector3d v2 (*atom2->pos());
+      Vector3d v3 (( v1 + v2 ) / 2);
+
+      map->setFromPrimitive(atom1);
+      pd->painter()->setColor(map);
+      pd->painter()->setName(b);
+      pd->painter()->drawLine(v1, v3, 2.0);
+
+      map->setFromPrimitive(atom2);
+      pd->painter()->setColor(map);
+      pd->painter()->setName(b);
+      pd->painter()->drawLine(v3, v2, 2.0);
+    }
 
 //    glPopAttrib();
 
@@ -101,7 +132,7 @@ namespace Avogadro {
     pd->painter()->setColor(map);
 
     // Render the atoms
-    foreach(Atom *a, atoms()) {
+    foreach(Atom *a, pd->visibleAtoms(atoms())) {
       if (pd->isSelected(a)) {
         pd->painter()->setName(a);
         pd->painter()->drawSphere(a->pos(), SEL_ATOM_EXTRA_RADIUS + radius(a));
@@ -111,7 +142,7 @@ namespace Avogadro {
     // render bonds (sticks)
     glDisable( GL_RESCALE_NORMAL );
     glEnable( GL_NORMALIZE );
-    foreach(Bond *b, bonds()) {
+    foreach(Bond *b, pd->visibleBonds(bonds())) {
       if (pd->isSelected(b)) {
         Atom* atom1 = pd->molecule()->atomById(b->beginAtomId());
         Atom* atom2 = pd->molecule()->atomById(b->endAtomId());
@@ -144,6 +175,65 @@ namespace Avogadro {
     return true;
   }
 
+  bool StickEngine::renderSnapshot(PainterDevice *pd)
+  {
+    // The snapshot has all of the atoms and bonds
+    if (m_customPrims)
+      return false;
+
+    const MoleculeSnapshot *snapshot = pd->snapshot();
+    const QVector<int> &atomicNumbers = snapshot->atomicNumbers();
+    const QVector<Vector3d> &positions = snapshot->atomPositions();
+    const QVector<int> &bondAtoms = snapshot->bondAtoms();
+    Color color;
+    Color cSel;
+    cSel.setToSelectionColor();
+
+    glDisable( GL_NORMALIZE );
+    glEnable( GL_RESCALE_NORMAL );
+
+    for (int i = 0; i < snapshot->numAtoms(); ++i) {
+      if (pd->isSelected(Primitive::AtomType, snapshot->atomIds().at(i))) {
+        pd->painter()->setColor(&cSel);
+        pd->painter()->drawSphere(positions.at(i), SEL_ATOM_EXTRA_RADIUS + m_radius);
+      }
+      else {
+        color.setFromElement(atomicNumbers.at(i));
+        pd->painter()->setColor(&color);
+        pd->painter()->drawSphere(positions.at(i), m_radius);
+      }
+    }
+
+    glDisable( GL_RESCALE_NORMAL );
+    glEnable( GL_NORMALIZE );
+
+    for (int i = 0; i < snapshot->numBonds(); ++i) {
+      int atom1 = bondAtoms.at(2 * i);
+      int atom2 = bondAtoms.at(2 * i + 1);
+      if (atom1 < 0 || atom2 < 0)
+        continue;
+      const Vector3d &v1 = positions.at(atom1);
+      const Vector3d &v2 = positions.at(atom2);
+
+      if (pd->isSelected(Primitive::BondType, snapshot->bondIds().at(i))) {
+        pd->painter()->setColor(&cSel);
+        pd->painter()->drawCylinder(v1, v2, SEL_BOND_EXTRA_RADIUS + m_radius);
+      }
+      else {
+        Vector3d v3 (( v1 + v2 ) / 2);
+        color.setFromElement(atomicNumbers.at(atom1));
+        pd->painter()->setColor(&color);
+        pd->painter()->drawCylinder(v1, v3, m_radius);
+
+        color.setFromElement(atomicNumbers.at(atom2));
+        pd->painter()->setColor(&color);
+        pd->painter()->drawCylinder(v3, v2, m_radius);
+      }
+    }
+
+    return true;
+  }
+
   inline bool StickEngine::renderOpaque(PainterDevice *pd, const Atom* a)
   {
     Color *map = colorMap(); // possible custom color map
@@ -177,6 +267,8 @@ namespace Avogadro {
 
     Atom* atom1 = pd->molecule()->atomById(b->beginAtomId());
     Atom* atom2 = pd->molecule()->atomById(b->endAtomId());
+    if (!atom1 || !atom2)
+      return true;
     Vector3d v1 (*atom1->pos());
     Vector3d v2 (*atom2->pos());
     Vector3d v3 (( v1 + v2 ) / 2);
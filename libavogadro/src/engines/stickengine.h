@@ -57,6 +57,7 @@ namespace Avogadro {
       bool renderOpaque(PainterDevice *pd);
       bool renderTransparent(PainterDevice *pd);
       bool renderPick(PainterDevice *pd); // make the atoms larger
+      bool renderSnapshot(PainterDevice *pd);
       //@}
 
       double radius(const PainterDevice *pd, const Primitive *p = 0) const;
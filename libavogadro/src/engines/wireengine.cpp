@@ -28,6 +28,7 @@
 #include <avogadro/atom.h>
 #include <avogadro/bond.h>
 #include <avogadro/molecule.h>
+#include <avogadro/moleculesnapshot.h>
 #include <avogadro/color.h>
 #include <avogadro/glwidget.h>
 #include <avogadro/camera.h>
@@ -66,11 +67,11 @@ namespace Avogadro {
 
     // Skip this entire step if the user turns it off
     if (m_showDots) {
-      foreach(Atom *a, atoms())
+      foreach(Atom *a, pd->visibleAtoms(atoms()))
         renderOpaque(pd, a);
     }
 
-    foreach(Bond *b, bonds())
+    foreach(Bond *b, pd->visibleBonds(bonds()))
       renderOpaque(pd, b);
 
     glEnable(GL_LIGHTING);
@@ -83,11 +84,6 @@ namespace Avogadro {
     const Vector3d & v = *a->pos();
     const Camera *camera = pd->camera();
 
-    // perform a rough form of frustum culling
-    Eigen::Vector3d transformedPos = pd->camera()->modelview() * v;
-    double dot = transformedPos.z() / transformedPos.norm();
-    if(dot > -0.8) return true;
-
     Color *map = colorMap(); // possible custom color map
     if (!map) map = pd->colorMap(); // fall back to global color map
 
@@ -144,11 +140,6 @@ namespace Avogadro {
     Color *map = colorMap(); // possible custom color map
     if (!map) map = pd->colorMap(); // fall back to global color map
 
-    // perform a rough form of frustum culling
-    Eigen::Vector3d transformedEnd1 = pd->camera()->modelview() * v1;
-    double dot = transformedEnd1.z() / transformedEnd1.norm();
-    if(dot > -0.8) return true; // i.e., don't bother rendering
-
     const Atom* atom2 = pd->molecule()->atomById(b->endAtomId());
     const Vector3d & v2 = *atom2->pos();
     Vector3d d = v2 - v1;
@@ -204,6 +195,64 @@ namespace Avogadro {
     return true;
   }
 
+  bool WireEngine::renderSnapshot(PainterDevice *pd)
+  {
+    // The snapshot has all of the atoms and bonds
+    if (m_customPrims)
+      return false;
+
+    const MoleculeSnapshot *snapshot = pd->snapshot();
+    const QVector<int> &atomicNumbers = snapshot->atomicNumbers();
+    const QVector<Vector3d> &positions = snapshot->atomPositions();
+    const QVector<int> &bondAtoms = snapshot->bondAtoms();
+    Color color;
+
+    glDisable(GL_LIGHTING);
+
+    // Dots at the default size, without the bond orders
+    if (m_showDots) {
+      for (int i = 0; i < snapshot->numAtoms(); ++i) {
+        double size = 3.0;
+        if (pd->isSelected(Primitive::AtomType, snapshot->atomIds().at(i))) {
+          color.setToSelectionColor();
+          size += 1.0;
+        }
+        else
+          color.setFromElement(atomicNumbers.at(i));
+        color.apply();
+        glPointSize(OpenBabel::etab.GetVdwRad(atomicNumbers.at(i)) * size);
+        glBegin(GL_POINTS);
+        glVertex3d(positions.at(i).x(), positions.at(i).y(), positions.at(i).z());
+        glEnd();
+      }
+    }
+
+    for (int i = 0; i < snapshot->numBonds(); ++i) {
+      int atom1 = bondAtoms.at(2 * i);
+      int atom2 = bondAtoms.at(2 * i + 1);
+      if (atom1 < 0 || atom2 < 0)
+        continue;
+      const Vector3d &v1 = positions.at(atom1);
+      const Vector3d &v2 = positions.at(atom2);
+      Vector3d d = v2 - v1;
+      d.normalize();
+      Vector3d v3 = (v1 + v2 + d*(OpenBabel::etab.GetVdwRad(atomicNumbers.at(atom1))
+                                  - OpenBabel::etab.GetVdwRad(atomicNumbers.at(atom2)))) / 2.0;
+
+      color.setFromElement(atomicNumbers.at(atom1));
+      pd->painter()->setColor(&color);
+      pd->painter()->drawLine(v1, v3, 1.0);
+
+      color.setFromElement(atomicNumbers.at(atom2));
+      pd->painter()->setColor(&color);
+      pd->painter()->drawLine(v3, v2, 1.0);
+    }
+
+    glEnable(GL_LIGHTING);
+
+    return true;
+  }
+
   void WireEngine::setShowMultipleBonds(int setting)
   {
     m_showMulti = setting;
@@ -61,6 +61,7 @@ namespace Avogadro {
       bool renderOpaque(PainterDevice *pd, const Bond *b);
 
       bool renderOpaque(PainterDevice *pd);
+      bool renderSnapshot(PainterDevice *pd);
       //@}
 
       //! Configuration options
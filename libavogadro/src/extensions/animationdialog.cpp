@@ -51,6 +51,7 @@ namespace Avogadro {
     connect(ui.pauseButton, SIGNAL(clicked()), this, SIGNAL(pause()));
     connect(ui.stopButton, SIGNAL(clicked()), this, SIGNAL(stop()));
     connect(ui.saveVideoButton, SIGNAL(clicked()), this, SLOT(saveVideo()));
+    connect(ui.clusterButton, SIGNAL(clicked()), this, SLOT(clusterClicked()));
       }
 
   AnimationDialog::~AnimationDialog()
@@ -88,6 +89,11 @@ namespace Avogadro {
     return ui.fpsSpin->value();
   }
 
+  void AnimationDialog::clusterClicked()
+  {
+    emit clusterFrames(ui.clusterSpin->value());
+  }
+
 
   void AnimationDialog::saveVideo()
   {
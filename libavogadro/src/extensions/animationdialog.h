@@ -51,10 +51,12 @@ namespace Avogadro
       void setFrame(int i);
       void loadFile();
       void saveVideo();
+      void clusterClicked();
 
     Q_SIGNALS:
       void fileName(QString filename);
       void videoFileInfo(QString filename); 
+      void clusterFrames(double threshold);
       void sliderChanged(int i);
       void fpsChanged(int i);
       void dynamicBondsChanged(int state);
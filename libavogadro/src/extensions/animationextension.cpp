@@ -25,6 +25,7 @@
 #include <avogadro/color.h>
 #include <avogadro/animation.h>
 #include <avogadro/glwidget.h>
+#include <avogadro/conformerclustering.h>
 
 #include <openbabel/mol.h>
 #include <openbabel/obconversion.h>
@@ -103,6 +104,7 @@ namespace Avogadro {
       connect(m_animationDialog, SIGNAL(pause()), m_animation, SLOT(pause()));
       connect(m_animationDialog, SIGNAL(stop()), m_animation, SLOT(stop()));
       connect(m_animationDialog, SIGNAL(videoFileInfo(QString)), this, SLOT(saveVideo(QString)));
+      connect(m_animationDialog, SIGNAL(clusterFrames(double)), this, SLOT(clusterFrames(double)));
 
       connect(m_animation, SIGNAL(frameChanged(int)), m_animationDialog, SLOT(setFrame(int)));
     }
@@ -225,6 +227,44 @@ namespace Avogadro {
 
   }
 
+  void AnimationExtension::clusterFrames(double threshold)
+  {
+    if (!m_molecule || m_molecule->numConformers() < 2)
+      return;
+
+    m_animation->stop();
+
+    // Leader clustering in trajectory order: a frame is kept unless it is
+    // within the threshold of an earlier kept frame
+    m_molecule->lock()->lockForRead();
+    ConformerClustering clustering;
+    clustering.setConformers(m_molecule, m_molecule->conformers());
+    QList<int> kept = ConformerClustering::representatives(
+      clustering.leaderClusters(threshold));
+
+    std::vector<std::vector<Vector3d> *> frames;
+    std::vector<double> energies;
+    bool hasEnergies = m_molecule->energies().size() == m_molecule->numConformers();
+    foreach (int i, kept) {
+      frames.push_back(new std::vector<Vector3d>(*m_molecule->conformers()[i]));
+      if (hasEnergies)
+        energies.push_back(m_molecule->energies()[i]);
+    }
+    m_molecule->lock()->unlock();
+
+    m_molecule->lock()->lockForWrite();
+    m_molecule->setAllConformers(frames);
+    if (hasEnergies)
+      m_molecule->setEnergies(energies);
+    m_molecule->lock()->unlock();
+
+    // Reset the frame range to the new conformers
+    m_animation->setMolecule(m_molecule);
+    m_animationDialog->setFrameCount(m_animation->numFrames());
+    m_animationDialog->setFrame(1);
+    m_molecule->update();
+  }
+
   void AnimationExtension::readTrajFromXyz(QString xyzfile)
   {
     OBConversion conv;
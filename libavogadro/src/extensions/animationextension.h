@@ -67,6 +67,7 @@ namespace Avogadro {
       void setLoop(int state);
       void setDynamicBonds(int state);
       void saveVideo(QString videoFileName);
+      void clusterFrames(double threshold);
 
   private:
       //!support to read a trajectory from xyz as described here:
@@ -0,0 +1,412 @@
+/**********************************************************************
+  ConformerSearch - Parallel rotor search for the force field extension
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Some code is based on Open Babel
+  For more information, see <http://openbabel.sourceforge.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#include "conformersearch.h"
+
+#include <avogadro/forcefield.h>
+#include <avogadro/superposition.h>
+
+#include <openbabel/mol.h>
+#include <openbabel/forcefield.h>
+#include <openbabel/rotor.h>
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QString>
+#include <QThread>
+#include <QTime>
+#include <QWaitCondition>
+#include <QtCore/QtConcurrentRun>
+
+#include <cmath>
+#include <cstring>
+
+using namespace OpenBabel;
+
+namespace Avogadro
+{
+  // Conformers further apart in energy are never considered duplicates
+  static const double DUPLICATE_ENERGY_WINDOW = 5.0;
+  // Weighted search: candidates this close to the lowest energy reinforce
+  // the torsion values they used
+  static const double WEIGHTED_ENERGY_WINDOW = 10.0;
+
+  struct ConformerEntry
+  {
+    QVector<double> coordinates;
+    QVector<double> heavy;  // centered heavy atom coordinates, for the RMSD
+    double inner;           // their inner product
+    double energy;
+  };
+
+  class ConformerSearchPrivate
+  {
+    public:
+      ConformerSearchPrivate() : prototype(0), native(false), method(0),
+        numCandidates(0), steps(0), rmsdThreshold(0.5), numTaken(0),
+        lowestEnergy(0.0), next(0), processed(0), running(0), stop(false),
+        elapsed(-1) {}
+
+      OBMol mol;
+      OBForceField *prototype;
+      OBFFConstraints constraints;
+      bool native;
+      int method;
+      int numCandidates;
+      int steps;
+      double rmsdThreshold;
+
+      QVector<int> heavyAtoms;                // 0 based indices
+      QVector<QVector<int> > rotorAtoms;      // 1 based dihedral atoms
+      QVector<QVector<double> > rotorValues;  // radians
+      QVector<QVector<double> > weights;      // weighted search only
+
+      // Shared result store, guarded by mutex
+      QMutex mutex;
+      QWaitCondition acceptedCondition;
+      QVector<ConformerEntry *> entries;
+      int numTaken;
+      double lowestEnergy;
+
+      QAtomicInt next;
+      QAtomicInt processed;
+      int running;
+      volatile bool stop;
+      QList<QFuture<void> > futures;
+      QTime timer;
+      int elapsed;
+
+      static void work(ConformerSearchPrivate *d);
+      void choose(int index, QVector<int> &choice);
+      void submit(ConformerEntry *entry, const QVector<int> &choice);
+      bool isUnique(const ConformerEntry &entry,
+                    const QVector<ConformerEntry *> &list, int begin) const;
+  };
+
+  void ConformerSearchPrivate::choose(int index, QVector<int> &choice)
+  {
+    const int numRotors = rotorValues.size();
+    if (method == ConformerSearch::Systematic) {
+      // Mixed radix digits of the candidate index
+      for (int r = 0; r < numRotors; ++r) {
+        choice[r] = index % rotorValues[r].size();
+        index /= rotorValues[r].size();
+      }
+      return;
+    }
+
+    // xorshift seeded by the candidate index, so the result does not depend
+    // on which worker picks the candidate up
+    unsigned int seed = static_cast<unsigned int>(index) * 2654435761u + 1u;
+    if (method == ConformerSearch::Random) {
+      for (int r = 0; r < numRotors; ++r) {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        choice[r] = seed % rotorValues[r].size();
+      }
+      return;
+    }
+
+    // Weighted: roulette over the weights learned so far
+    QMutexLocker locker(&mutex);
+    for (int r = 0; r < numRotors; ++r) {
+      seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+      double total = 0.0;
+      foreach (double w, weights[r])
+        total += w;
+      double pick = total * (seed / 4294967296.0);
+      int v = 0;
+      while (v < weights[r].size() - 1 && pick >= weights[r][v])
+        pick -= weights[r][v++];
+      choice[r] = v;
+    }
+  }
+
+  bool ConformerSearchPrivate::isUnique(const ConformerEntry &entry,
+                                        const QVector<ConformerEntry *> &list,
+                                        int begin) const
+  {
+    for (int i = begin; i < list.size(); ++i) {
+      if (fabs(list[i]->energy - entry.energy) > DUPLICATE_ENERGY_WINDOW)
+        continue;
+      if (Superposition::centeredRmsd(list[i]->heavy.constData(),
+                                      entry.heavy.constData(),
+                                      entry.heavy.size() / 3,
+                                      list[i]->inner, entry.inner) < rmsdThreshold)
+        return false;
+    }
+    return true;
+  }
+
+  void ConformerSearchPrivate::submit(ConformerEntry *entry,
+                                      const QVector<int> &choice)
+  {
+    // Compare against a snapshot without holding the lock, then against
+    // whatever was accepted in the meantime
+    mutex.lock();
+    QVector<ConformerEntry *> snapshot = entries;
+    mutex.unlock();
+    bool unique = isUnique(*entry, snapshot, 0);
+
+    QMutexLocker locker(&mutex);
+    if (unique)
+      unique = isUnique(*entry, entries, snapshot.size());
+
+    if (method == ConformerSearch::Weighted
+        && (entries.isEmpty() || entry->energy < lowestEnergy + WEIGHTED_ENERGY_WINDOW))
+      for (int r = 0; r < choice.size(); ++r)
+        weights[r][choice[r]] += 1.0;
+
+    if (!unique) {
+      delete entry;
+      return;
+    }
+    if (entries.isEmpty() || entry->energy < lowestEnergy)
+      lowestEnergy = entry->energy;
+    entries.append(entry);
+    acceptedCondition.wakeAll();
+  }
+
+  void ConformerSearchPrivate::work(ConformerSearchPrivate *d)
+  {
+    OBMol mol = d->mol;
+    const int numAtoms = mol.NumAtoms();
+    QVector<double> start(3 * numAtoms);
+    memcpy(start.data(), mol.GetCoordinates(), start.size() * sizeof(double));
+
+    // Private force field, the shared prototype is not thread safe
+    OBForceField *ff = d->prototype->MakeNewInstance();
+    ForceField native;
+    native.setMultithreaded(false);
+    bool useNative = d->native && native.setup(mol, ff);
+    bool ok = useNative || ff->Setup(mol, d->constraints);
+    double scale = ff->GetUnit().find("kcal") != std::string::npos ? KCAL_TO_KJ : 1.0;
+
+    QVector<OBAtom *> rotorAtoms;
+    foreach (const QVector<int> &atoms, d->rotorAtoms)
+      for (int k = 0; k < 4; ++k)
+        rotorAtoms.append(mol.GetAtom(atoms[k]));
+    QVector<int> choice(d->rotorValues.size());
+
+    while (ok && !d->stop) {
+      int index = d->next.fetchAndAddOrdered(1);
+      if (index >= d->numCandidates)
+        break;
+
+      d->choose(index, choice);
+      memcpy(mol.GetCoordinates(), start.constData(), start.size() * sizeof(double));
+      for (int r = 0; r < choice.size(); ++r)
+        mol.SetTorsion(rotorAtoms[4*r], rotorAtoms[4*r+1], rotorAtoms[4*r+2],
+                       rotorAtoms[4*r+3], d->rotorValues[r][choice[r]]);
+
+      ConformerEntry *entry = new ConformerEntry;
+      if (useNative) {
+        native.setCoordinates(mol.GetCoordinates());
+        native.minimize(ForceField::LBFGS, d->steps);
+        entry->coordinates = native.coordinates();
+        entry->energy = native.energy();
+      }
+      else {
+        ff->SetCoordinates(mol);
+        ff->ConjugateGradients(d->steps);
+        ff->GetCoordinates(mol);
+        entry->coordinates.resize(start.size());
+        memcpy(entry->coordinates.data(), mol.GetCoordinates(),
+               start.size() * sizeof(double));
+        entry->energy = ff->Energy(false) * scale;
+      }
+
+      entry->heavy.resize(3 * d->heavyAtoms.size());
+      for (int i = 0; i < d->heavyAtoms.size(); ++i)
+        for (int k = 0; k < 3; ++k)
+          entry->heavy[3*i+k] = entry->coordinates[3*d->heavyAtoms[i]+k];
+      Superposition::center(entry->heavy.data(), d->heavyAtoms.size());
+      entry->inner = Superposition::innerProduct(entry->heavy.constData(),
+                                                 d->heavyAtoms.size());
+
+      d->processed.ref();
+      d->submit(entry, choice);
+    }
+
+    delete ff;
+
+    QMutexLocker locker(&d->mutex);
+    if (--d->running == 0)
+      d->elapsed = d->timer.elapsed();
+    d->acceptedCondition.wakeAll();
+  }
+
+  ConformerSearch::ConformerSearch() : d(new ConformerSearchPrivate)
+  {
+  }
+
+  ConformerSearch::~ConformerSearch()
+  {
+    stop();
+    foreach (QFuture<void> future, d->futures)
+      future.waitForFinished();
+    qDeleteAll(d->entries);
+    delete d;
+  }
+
+  bool ConformerSearch::setup(const OBMol &mol, OBForceField *forceField,
+                              const OBFFConstraints &constraints,
+                              Method method, int numConformers, int steps)
+  {
+    if (!forceField || d->running)
+      return false;
+
+    d->mol = mol;
+    d->prototype = forceField;
+    d->constraints = constraints;
+    d->method = method;
+    d->steps = steps;
+
+    // The native evaluator has no constraints
+    OBFFConstraints copy = constraints;
+    d->native = QString(forceField->GetID()).toUpper() == "UFF"
+      && copy.Size() == 0 && copy.GetIgnoredBitVec().IsEmpty();
+
+    d->heavyAtoms.clear();
+    FOR_ATOMS_OF_MOL (atom, d->mol)
+      if (!atom->IsHydrogen())
+        d->heavyAtoms.append(atom->GetIdx() - 1);
+
+    d->rotorAtoms.clear();
+    d->rotorValues.clear();
+    d->weights.clear();
+    OBRotorList rl;
+    rl.Setup(d->mol);
+    OBRotorIterator ri;
+    OBRotor *rotor = rl.BeginRotor(ri);
+    for (int i = 1; i < rl.Size() + 1; ++i, rotor = rl.NextRotor(ri)) {
+      if (rotor->GetResolution().empty())
+        continue;
+      int ref[4];
+      rotor->GetDihedralAtoms(ref);
+      QVector<int> atoms(4);
+      for (int k = 0; k < 4; ++k)
+        atoms[k] = ref[k];
+      d->rotorAtoms.append(atoms);
+      QVector<double> values;
+      for (unsigned int j = 0; j < rotor->GetResolution().size(); ++j)
+        values.append(rotor->GetResolution()[j]);
+      d->rotorValues.append(values);
+      d->weights.append(QVector<double>(values.size(), 1.0));
+    }
+
+    if (method == Systematic) {
+      // Every combination, capped to keep the index an int
+      double total = 1.0;
+      foreach (const QVector<double> &values, d->rotorValues)
+        total *= values.size();
+      d->numCandidates = static_cast<int>(qMin(total, 1.0e9));
+    }
+    else
+      d->numCandidates = d->rotorValues.isEmpty() ? 1 : numConformers;
+
+    return true;
+  }
+
+  void ConformerSearch::setRmsdThreshold(double threshold)
+  {
+    d->rmsdThreshold = threshold;
+  }
+
+  double ConformerSearch::rmsdThreshold() const
+  {
+    return d->rmsdThreshold;
+  }
+
+  int ConformerSearch::numCandidates() const
+  {
+    return d->numCandidates;
+  }
+
+  void ConformerSearch::start()
+  {
+    if (!d->prototype || d->running)
+      return;
+
+    d->stop = false;
+    d->next = 0;
+    d->processed = 0;
+    d->elapsed = -1;
+    d->timer.start();
+
+    int numWorkers = qBound(1, QThread::idealThreadCount(), d->numCandidates);
+    d->running = numWorkers;
+    for (int i = 0; i < numWorkers; ++i)
+      d->futures.append(QtConcurrent::run(ConformerSearchPrivate::work, d));
+  }
+
+  void ConformerSearch::stop()
+  {
+    d->stop = true;
+  }
+
+  bool ConformerSearch::waitForConformers(unsigned long timeout)
+  {
+    QMutexLocker locker(&d->mutex);
+    if (d->numTaken < d->entries.size())
+      return true;
+    if (!d->running)
+      return false;
+    d->acceptedCondition.wait(&d->mutex, timeout);
+    return d->running || d->numTaken < d->entries.size();
+  }
+
+  QList<ConformerSearch::Conformer> ConformerSearch::takeConformers()
+  {
+    QMutexLocker locker(&d->mutex);
+    QList<Conformer> conformers;
+    for (int i = d->numTaken; i < d->entries.size(); ++i) {
+      Conformer conformer;
+      conformer.coordinates = d->entries[i]->coordinates;
+      conformer.energy = d->entries[i]->energy;
+      conformers.append(conformer);
+    }
+    d->numTaken = d->entries.size();
+    return conformers;
+  }
+
+  int ConformerSearch::numProcessed() const
+  {
+    return d->processed;
+  }
+
+  int ConformerSearch::numAccepted() const
+  {
+    QMutexLocker locker(&d->mutex);
+    return d->entries.size();
+  }
+
+  double ConformerSearch::throughput() const
+  {
+    QMutexLocker locker(&d->mutex);
+    int ms = d->elapsed >= 0 ? d->elapsed : d->timer.elapsed();
+    if (ms <= 0)
+      return 0.0;
+    return 1000.0 * static_cast<int>(d->processed) / ms;
+  }
+
+} // end namespace Avogadro
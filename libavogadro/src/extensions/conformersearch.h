@@ -0,0 +1,136 @@
+/**********************************************************************
+  ConformerSearch - Parallel rotor search for the force field extension
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Some code is based on Open Babel
+  For more information, see <http://openbabel.sourceforge.net/>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation version 2 of the License.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ ***********************************************************************/
+
+#ifndef CONFORMERSEARCH_H
+#define CONFORMERSEARCH_H
+
+#include <QList>
+#include <QVector>
+
+namespace OpenBabel {
+  class OBMol;
+  class OBForceField;
+  class OBFFConstraints;
+}
+
+namespace Avogadro
+{
+  class ConformerSearchPrivate;
+
+  /**
+   * @class ConformerSearch
+   * @brief Generates and minimizes rotor conformers on all cores.
+   *
+   * Every worker owns a copy of the molecule and its own force field
+   * instance, pulls candidate indices from a shared counter, sets the
+   * torsions of the candidate and minimizes it. Unconstrained UFF searches
+   * use the native Avogadro::ForceField, anything else a private
+   * OBForceField made with MakeNewInstance().
+   *
+   * Minimized candidates are compared with the conformers accepted so far
+   * by the heavy atom RMSD after optimal superposition and only kept if
+   * they differ by more than rmsdThreshold(). The caller collects accepted
+   * conformers while the search runs with waitForConformers() and
+   * takeConformers().
+   */
+  class ConformerSearch
+  {
+    public:
+      enum Method {
+        Systematic = 1, // same values as ForceFieldThread tasks
+        Random,
+        Weighted
+      };
+
+      struct Conformer
+      {
+        QVector<double> coordinates; // x, y, z in atom index order
+        double energy;               // kJ/mol
+      };
+
+      ConformerSearch();
+      ~ConformerSearch();
+
+      /**
+       * Find the rotors of @p mol and prepare one force field per worker.
+       * @p forceField is only used as a prototype.
+       * @param numConformers the number of candidates for the random and
+       * weighted searches, the systematic search tries every combination.
+       * @param steps the number of minimization steps per candidate.
+       */
+      bool setup(const OpenBabel::OBMol &mol,
+                 OpenBabel::OBForceField *forceField,
+                 const OpenBabel::OBFFConstraints &constraints,
+                 Method method, int numConformers, int steps);
+
+      void setRmsdThreshold(double threshold);
+      double rmsdThreshold() const;
+
+      /**
+       * @return the number of candidates that will be generated.
+       */
+      int numCandidates() const;
+
+      /**
+       * Start the workers on the global thread pool and return.
+       */
+      void start();
+
+      /**
+       * Ask the workers to finish their current candidate and quit.
+       */
+      void stop();
+
+      /**
+       * Block until a new conformer is accepted, the search ends or
+       * @p timeout milliseconds passed.
+       * @return false once all workers have finished.
+       */
+      bool waitForConformers(unsigned long timeout);
+
+      /**
+       * @return the conformers accepted since the last call.
+       */
+      QList<Conformer> takeConformers();
+
+      /**
+       * @return the number of candidates minimized so far.
+       */
+      int numProcessed() const;
+
+      /**
+       * @return the number of unique conformers so far.
+       */
+      int numAccepted() const;
+
+      /**
+       * @return minimized candidates per second since start().
+       */
+      double throughput() const;
+
+    private:
+      ConformerSearchPrivate * const d;
+      Q_DISABLE_COPY(ConformerSearch)
+  };
+
+} // end namespace Avogadro
+
+#endif
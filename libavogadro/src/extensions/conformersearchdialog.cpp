@@ -153,6 +153,8 @@ namespace Avogadro {
 
     ((ForceFieldCommand*)m_forceFieldCommand)->setTask(m_method);
     ((ForceFieldCommand*)m_forceFieldCommand)->setNumConformers(m_numConformers);
+    ((ForceFieldCommand*)m_forceFieldCommand)->setRmsdThreshold(ui.rmsdSpin->value());
+    ((ForceFieldCommand*)m_forceFieldCommand)->setClusterThreshold(ui.clusterSpin->value());
     m_forceFieldCommand->redo();
     
 
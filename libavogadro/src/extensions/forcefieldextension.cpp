@@ -21,22 +21,26 @@
  ***********************************************************************/
 
 #include "forcefieldextension.h"
+#include "conformersearch.h"
 #include <avogadro/primitive.h>
 #include <avogadro/color.h>
 #include <avogadro/glwidget.h>
 #include <avogadro/atom.h>
 #include <avogadro/primitivelist.h>
+#include <avogadro/conformerclustering.h>
 
 #include <QProgressDialog>
 #include <QWriteLocker>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QtAlgorithms>
 #include <QAbstractTableModel>
 #include <QMessageBox>
 #include <QDebug>
 
 using namespace std;
 using namespace OpenBabel;
+using Eigen::Vector3d;
 
 namespace Avogadro
 {
@@ -288,6 +292,8 @@ namespace Avogadro
     m_algorithm = algorithm;
     m_convergence = convergence;
     m_task = task;
+    m_rmsdThreshold = 0.5;
+    m_clusterThreshold = 0.0;
     m_stop = false;
   }
 
@@ -306,39 +312,122 @@ namespace Avogadro
     m_numConformers = numConformers;
   }
 
-  void ForceFieldThread::copyConformers()
-  {
-    OBMol obmol = m_molecule->OBMol();
-    // copy conformers to obmol
-    m_forceField->GetConformers( obmol );
-    // set the current conformer
-    obmol.SetConformer(m_cycles);
-    // copy the coordinates
-    double *coordPtr = obmol.GetCoordinates();
-    std::vector<Eigen::Vector3d> conformer;
-    foreach (Atom *atom, m_molecule->atoms()) {
-      while (conformer.size() < atom->id())
-        conformer.push_back(Eigen::Vector3d(0.0, 0.0, 0.0));
-      conformer.push_back(Eigen::Vector3d(coordPtr));
-      coordPtr += 3;
-    }
+  void ForceFieldThread::setRmsdThreshold(double threshold)
+  {
+    m_rmsdThreshold = threshold;
+  }
 
-    // add the conformer to m_molecule
-    m_molecule->addConformer(conformer, m_cycles);
-    // set it to the current conformer
-    m_molecule->setConformer(m_cycles);
-
-    // copy the conformer energies
-    if (obmol.HasData(OBGenericDataType::ConformerData)) {
-      OBConformerData *cd = (OBConformerData*) obmol.GetData(OBGenericDataType::ConformerData);
-      // Check to see if the force field is in kcal/mol (i.e., MMFF94)
-      std::vector<double> energies = cd->GetEnergies();
-      if (m_forceField->GetUnit().find("kcal") != string::npos) {
-        for (unsigned int i = 0; i < energies.size(); ++i)
-          energies[i] *= KCAL_TO_KJ;
+  void ForceFieldThread::setClusterThreshold(double threshold)
+  {
+    m_clusterThreshold = threshold;
+  }
+
+  void ForceFieldThread::conformerSearch(OBMol &mol)
+  {
+    ConformerSearch search;
+    if (!search.setup(mol, m_forceField, m_constraints->constraints(),
+                      static_cast<ConformerSearch::Method>(m_task),
+                      m_numConformers, m_nSteps)) {
+      qWarning() << "ForceFieldThread: Could not set up the conformer search";
+      return;
+    }
+    search.setRmsdThreshold(m_rmsdThreshold);
+
+    const int numCandidates = search.numCandidates();
+    std::vector<double> energies;
+    int lowest = 0;
+    search.start();
+
+    // Stream the accepted conformers into the molecule as the workers
+    // find them, conformer positions are indexed by atom id
+    bool running = true;
+    while (running) {
+      running = search.waitForConformers(250);
+
+      QList<ConformerSearch::Conformer> conformers = search.takeConformers();
+      if (!conformers.isEmpty()) {
+        m_molecule->lock()->lockForWrite();
+        foreach (const ConformerSearch::Conformer &found, conformers) {
+          std::vector<Eigen::Vector3d> conformer(m_molecule->conformerSize(),
+                                                 Eigen::Vector3d::Zero());
+          const double *coordPtr = found.coordinates.constData();
+          foreach (Atom *atom, m_molecule->atoms()) {
+            conformer[atom->id()] = Eigen::Vector3d(coordPtr);
+            coordPtr += 3;
+          }
+          m_molecule->addConformer(conformer, m_cycles);
+          energies.push_back(found.energy);
+          if (found.energy < energies[lowest])
+            lowest = m_cycles;
+          ++m_cycles;
+        }
+        m_molecule->setEnergies(energies);
+        m_molecule->setConformer(lowest);
+        m_molecule->lock()->unlock();
+        m_molecule->update();
       }
-      m_molecule->setEnergies(energies);
+
+      emit stepsTaken(numCandidates ? search.numProcessed() * 100 / numCandidates : 100);
+      emit progressText(tr("%1 of %2 candidates, %3 conformers, %L4 conformers/s")
+                        .arg(search.numProcessed()).arg(numCandidates)
+                        .arg(search.numAccepted())
+                        .arg(search.throughput(), 0, 'f', 1));
+
+      m_mutex.lock();
+      if (m_stop)
+        search.stop();
+      m_mutex.unlock();
+    }
+
+    if (m_clusterThreshold > 0.0 && energies.size() > 1) {
+      emit progressText(tr("Clustering %1 conformers").arg(energies.size()));
+      clusterConformers(energies);
+      lowest = 0;
+    }
+
+    if (!energies.empty())
+      m_molecule->setEnergy(energies[lowest]);
+  }
+
+  void ForceFieldThread::clusterConformers(std::vector<double> &energies)
+  {
+    // Leaders are taken in order of energy, so each cluster is represented
+    // by its lowest energy conformer and the representatives stay sorted
+    QList<QPair<double, int> > byEnergy;
+    for (unsigned int i = 0; i < energies.size(); ++i)
+      byEnergy.append(qMakePair(energies[i], static_cast<int>(i)));
+    qSort(byEnergy);
+    QList<int> order;
+    for (int i = 0; i < byEnergy.size(); ++i)
+      order.append(byEnergy[i].second);
+
+    // This thread is the only writer of the conformers
+    m_molecule->lock()->lockForRead();
+    std::vector<std::vector<Eigen::Vector3d> *> conformers(
+      m_molecule->conformers().begin(),
+      m_molecule->conformers().begin() + energies.size());
+    ConformerClustering clustering;
+    clustering.setConformers(m_molecule, conformers);
+    QList<int> kept = ConformerClustering::representatives(
+      clustering.leaderClusters(m_clusterThreshold, order));
+
+    std::vector<std::vector<Eigen::Vector3d> *> representatives;
+    std::vector<double> keptEnergies;
+    foreach (int i, kept) {
+      representatives.push_back(new std::vector<Eigen::Vector3d>(*conformers[i]));
+      keptEnergies.push_back(energies[i]);
     }
+    m_molecule->lock()->unlock();
+
+    m_molecule->lock()->lockForWrite();
+    m_molecule->setAllConformers(representatives);
+    m_molecule->setEnergies(keptEnergies);
+    m_molecule->setConformer(0);
+    m_molecule->lock()->unlock();
+    m_molecule->update();
+
+    energies = keptEnergies;
+    m_cycles = static_cast<int>(energies.size());
   }
 
   void ForceFieldThread::run()
@@ -397,6 +486,7 @@ namespace Avogadro
               atom->setPos(Eigen::Vector3d(coordPtr));
               coordPtr += 3;
             }
+            m_molecule->publishSnapshot();
             m_molecule->lock()->unlock();
             m_molecule->update();
           }
@@ -440,6 +530,7 @@ namespace Avogadro
               atom->setPos(Eigen::Vector3d(coordPtr));
               coordPtr += 3;
             }
+            m_molecule->publishSnapshot();
             m_molecule->lock()->unlock();
             m_molecule->update();
           }
@@ -455,44 +546,16 @@ namespace Avogadro
           emit stepsTaken( steps );
         }
       }
-    } else if ( m_task == 1 ) {
-      int n = m_forceField->SystematicRotorSearchInitialize(m_nSteps);
-      while (m_forceField->SystematicRotorSearchNextConformer(m_nSteps)) {
-        copyConformers();
-        m_molecule->update();
-        m_cycles++;
-        m_mutex.lock();
-        if ( m_stop ) {
-          m_mutex.unlock();
-          break;
-        }
-        m_mutex.unlock();
-        emit stepsTaken( (int) ((double) m_cycles / n * 100));
-      }
-    } else if ( m_task == 2 ) {
-      m_forceField->RandomRotorSearchInitialize(m_numConformers, m_nSteps);
-      while (m_forceField->RandomRotorSearchNextConformer(m_nSteps)) {
-        copyConformers();
-        m_molecule->update();
-        m_cycles++;
-        m_mutex.lock();
-        if ( m_stop ) {
-          m_mutex.unlock();
-          break;
-        }
-        m_mutex.unlock();
-        emit stepsTaken( m_cycles );
-      }
-    } else if ( m_task == 3 ) {
-      m_forceField->WeightedRotorSearch(m_numConformers, m_nSteps);
-      m_forceField->ConjugateGradients(250);
-      copyConformers();
+    } else {
+      conformerSearch(mol);
     }
 
-    double energy = m_forceField->Energy();
-    if (m_forceField->GetUnit().find("kcal") != string::npos)
-      energy *= KCAL_TO_KJ;
-    m_molecule->setEnergy(energy);
+    if ( m_task == 0 ) {
+      double energy = m_forceField->Energy();
+      if (m_forceField->GetUnit().find("kcal") != string::npos)
+        energy *= KCAL_TO_KJ;
+      m_molecule->setEnergy(energy);
+    }
     m_molecule->update();
 
     emit message( QObject::tr( buff.str().c_str() ) );
@@ -516,10 +579,13 @@ namespace Avogadro
                                         int convergence, int task ) :
     m_nSteps( nSteps ),
     m_task( task ),
+    m_rmsdThreshold( 0.5 ),
+    m_clusterThreshold( 0.0 ),
     m_molecule( molecule ),
     m_constraints( constraints ),
     m_thread( 0 ),
     m_dialog( 0 ),
+    m_undone( false ),
     m_detached( false )
   {
     m_thread = new ForceFieldThread( molecule, forceField, constraints,
@@ -527,8 +593,6 @@ namespace Avogadro
                                      convergence, task );
 
     connect(m_thread, SIGNAL(message(QString)), this, SIGNAL(message(QString)));
-
-    m_moleculeCopy = *molecule;
   }
 
   ForceFieldCommand::~ForceFieldCommand()
@@ -556,8 +620,31 @@ namespace Avogadro
     m_numConformers = numConformers;
   }
 
+  void ForceFieldCommand::setRmsdThreshold(double threshold)
+  {
+    m_rmsdThreshold = threshold;
+  }
+
+  void ForceFieldCommand::setClusterThreshold(double threshold)
+  {
+    m_clusterThreshold = threshold;
+  }
+
   void ForceFieldCommand::redo()
   {
+    // Redo after an undo puts the optimized positions back
+    if ( m_undone ) {
+      std::vector<Vector3d> *pos = positions();
+      if ( pos ) {
+        m_molecule->lock()->lockForWrite();
+        m_delta.apply( *pos );
+        m_molecule->lock()->unlock();
+        m_molecule->update();
+      }
+      m_undone = false;
+      return;
+    }
+
     if(!m_dialog) {
       if ( m_task == 0 )
         m_dialog = new QProgressDialog( QObject::tr( "Forcefield Optimization" ),
@@ -570,18 +657,27 @@ namespace Avogadro
                                         QObject::tr( "Cancel" ), 0,  100 );
       else if ( m_task == 3) {
         m_dialog = new QProgressDialog( QObject::tr( "Weighted Rotor Search" ),
-                                        QObject::tr( "Cancel" ), 0,  0 );
-        m_dialog->show();
+                                        QObject::tr( "Cancel" ), 0,  100 );
       }
 
 
       QObject::connect( m_thread, SIGNAL( stepsTaken( int ) ), m_dialog, SLOT( setValue( int ) ) );
+      QObject::connect( m_thread, SIGNAL( progressText( QString ) ), m_dialog, SLOT( setLabelText( QString ) ) );
       QObject::connect( m_dialog, SIGNAL( canceled() ), m_thread, SLOT( stop() ) );
       QObject::connect( m_thread, SIGNAL( finished() ), m_dialog, SLOT( close() ) );
     }
 
+    // Only optimizations move the atoms of the current conformer, the
+    // conformer searches replace the conformers and are never undone
+    if ( m_task == 0 && positions() ) {
+      m_positions = *positions();
+      QObject::connect( m_thread, SIGNAL( finished() ), this, SLOT( recordDelta() ) );
+    }
+
     m_thread->setTask(m_task);
     m_thread->setNumConformers(m_numConformers);
+    m_thread->setRmsdThreshold(m_rmsdThreshold);
+    m_thread->setClusterThreshold(m_clusterThreshold);
     m_thread->start();
   }
 
@@ -590,7 +686,14 @@ namespace Avogadro
     m_thread->stop();
     m_thread->wait();
 
-    *m_molecule = m_moleculeCopy;
+    recordDelta();
+    std::vector<Vector3d> *pos = positions();
+    if ( pos ) {
+      m_molecule->lock()->lockForWrite();
+      m_delta.revert( *pos );
+      m_molecule->lock()->unlock();
+    }
+    m_undone = true;
     m_molecule->update();
   }
 
@@ -598,16 +701,48 @@ namespace Avogadro
   {
     const ForceFieldCommand *gc = dynamic_cast<const ForceFieldCommand *>( command );
     if ( gc ) {
+      // Keep our starting point: the other run started where ours ended
+      if ( m_positions.empty() ) {
+        std::vector<Vector3d> before = gc->m_positions;
+        m_delta.revert( before );
+        m_positions.swap( before );
+      }
+      m_delta.clear();
+
       // delete our current info
       cleanup();
       gc->detach();
       m_thread = gc->thread();
       m_dialog = gc->progressDialog();
+      if ( !m_positions.empty() )
+        QObject::connect( m_thread, SIGNAL( finished() ), this, SLOT( recordDelta() ) );
     }
     // received another of the same call
     return true;
   }
 
+  void ForceFieldCommand::recordDelta()
+  {
+    // The thread may have been replaced by a merged one that still runs
+    if ( m_positions.empty() || m_thread->isRunning() )
+      return;
+    std::vector<Vector3d> *pos = positions();
+    if ( pos ) {
+      // Optimized positions need no more than a micro-Angstrom to be undone
+      m_molecule->lock()->lockForRead();
+      m_delta.record( m_positions, *pos, 1.0e-6 );
+      m_molecule->lock()->unlock();
+    }
+    std::vector<Vector3d>().swap( m_positions );
+  }
+
+  std::vector<Vector3d> * ForceFieldCommand::positions() const
+  {
+    const std::vector<std::vector<Vector3d> *> &all = m_molecule->conformers();
+    unsigned int current = m_molecule->currentConformer();
+    return current < all.size() ? all[current] : 0;
+  }
+
   ForceFieldThread *ForceFieldCommand::thread() const
   {
     return m_thread;
@@ -31,6 +31,7 @@
 #include <openbabel/forcefield.h>
 
 #include <avogadro/molecule.h>
+#include <avogadro/undosequence.h>
 #include <avogadro/glwidget.h>
 #include <avogadro/extension.h>
 
@@ -95,16 +96,20 @@ namespace Avogadro {
       int cycles() const;
       void setTask(int task);
       void setNumConformers(int numConformers);
+      void setRmsdThreshold(double threshold);
+      void setClusterThreshold(double threshold);
 
     Q_SIGNALS:
       void stepsTaken(int steps);
+      void progressText(const QString &text);
       void message(const QString &m);
 
     public Q_SLOTS:
       void stop();
 
     private:
-      void copyConformers();
+      void conformerSearch(OpenBabel::OBMol &mol);
+      void clusterConformers(std::vector<double> &energies);
 
       Molecule *m_molecule;
       ConstraintsModel* m_constraints;
@@ -118,6 +123,8 @@ namespace Avogadro {
       int m_convergence;
       int m_task;
       int m_numConformers;
+      double m_rmsdThreshold;
+      double m_clusterThreshold;
 
       OpenBabel::OBForceField* m_forceField;
       //ForceFieldDialog *m_Dialog;
@@ -147,6 +154,8 @@ namespace Avogadro {
      void cleanup();
      void setTask(int task);
      void setNumConformers(int numConformers);
+     void setRmsdThreshold(double threshold);
+     void setClusterThreshold(double threshold);
 
      ForceFieldThread *thread() const;
      QProgressDialog *progressDialog() const;
@@ -154,12 +163,24 @@ namespace Avogadro {
    Q_SIGNALS:
      void message(const QString &m);
 
+   private Q_SLOTS:
+     /**
+      * Encode the change made by the thread once it has finished.
+      */
+     void recordDelta();
+
    private:
-     Molecule m_moleculeCopy;
+     std::vector<Eigen::Vector3d> * positions() const;
+
+     std::vector<Eigen::Vector3d> m_positions; // until the delta is recorded
+     PositionDelta m_delta;
+     bool m_undone;
 
      int m_nSteps;
      int m_task;
      int m_numConformers;
+     double m_rmsdThreshold;
+     double m_clusterThreshold;
      Molecule *m_molecule;
      ConstraintsModel* m_constraints;
 
@@ -25,6 +25,7 @@
 #include <avogadro/molecule.h>
 #include <avogadro/atom.h>
 #include <avogadro/primitivelist.h>
+#include <avogadro/undosequence.h>
 
 #include <openbabel/mol.h>
 #include <openbabel/obiter.h>
@@ -78,6 +79,9 @@ namespace Avogadro {
     m_molecule(molecule), m_moleculeCopy(new Molecule(*molecule)),
     m_SelectedList(widget->selectedPrimitives())
   {
+    // Undo restores the copy, which must not skip over merged moves
+    PositionUndoCommand::mergeBarrier(molecule);
+
     // save the selection from the current view widget
     // (i.e., only modify a few hydrogens)
     //      m_SelectedList = widget->selectedPrimitives;
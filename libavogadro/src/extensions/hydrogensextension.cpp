@@ -26,6 +26,7 @@
 #include <avogadro/glwidget.h>
 #include <avogadro/molecule.h>
 #include <avogadro/atom.h>
+#include <avogadro/undosequence.h>
 
 #include <openbabel/mol.h>
 
@@ -105,6 +106,9 @@ namespace Avogadro {
     m_molecule(molecule), m_moleculeCopy(new Molecule(*molecule)),
     m_SelectedList(widget->selectedPrimitives()), m_action(action), m_pH(pH)
   {
+    // Undo restores the copy, which must not skip over merged moves
+    PositionUndoCommand::mergeBarrier(molecule);
+
     // save the selection from the current view widget
     // (i.e., only modify a few hydrogens)
     //      m_SelectedList = widget->selectedPrimitives;
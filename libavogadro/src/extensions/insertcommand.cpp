@@ -31,6 +31,7 @@
 #include <avogadro/primitivelist.h>
 #include <avogadro/glwidget.h>
 #include <avogadro/toolgroup.h>
+#include <avogadro/undosequence.h>
 
 
 namespace Avogadro {
@@ -61,6 +62,8 @@ namespace Avogadro {
     d->moleculeCopy = *molecule;
     d->generatedMolecule = generatedMolecule;
     d->widget = widget;
+    // Undo restores the copy, which must not skip over merged moves
+    PositionUndoCommand::mergeBarrier(molecule);
   }
 
   InsertFragmentCommand::~InsertFragmentCommand()
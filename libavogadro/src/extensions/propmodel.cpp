@@ -652,6 +652,7 @@ namespace Avogadro {
 
         zMatrixTree.populate(bond->beginAtom(), bond, m_molecule);
         zMatrixTree.skeletonTranslate(bondDirection);
+        m_molecule->update();
         emit dataChanged(index, index);
         return true;
 
@@ -690,6 +691,7 @@ namespace Avogadro {
 
         zMatrixTree.populate(vertex, bond, m_molecule);
         zMatrixTree.skeletonRotate(rotationAdjustment, crossProductVector, *(vertex->pos()));
+        m_molecule->update();
 
         emit dataChanged(index, index);
         return true;
@@ -730,6 +732,7 @@ namespace Avogadro {
 
         zMatrixTree.populate(b, bond, m_molecule);
         zMatrixTree.skeletonRotate(rotationAdjustment, bcVector, *(b->pos()));
+        m_molecule->update();
 
         emit dataChanged(index, index);
         return true;
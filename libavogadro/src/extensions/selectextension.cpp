@@ -262,6 +262,33 @@ namespace Avogadro {
         }
       }
     }
+
+    // Water read without residues, as fragments of one O and two H atoms
+    foreach (const QList<unsigned long> &fragment,
+             m_molecule->fragmentAtomLists()) {
+      if (fragment.size() != 3)
+        continue;
+      int oxygens = 0, hydrogens = 0;
+      foreach (unsigned long id, fragment) {
+        Atom *atom = m_molecule->atomById(id);
+        if (atom->atomicNumber() == 8 && !atom->residue())
+          ++oxygens;
+        else if (atom->isHydrogen() && !atom->residue())
+          ++hydrogens;
+      }
+      if (oxygens != 1 || hydrogens != 2)
+        continue;
+      foreach (unsigned long id, fragment) {
+        Atom *atom = m_molecule->atomById(id);
+        selectedAtoms.push_back(atom);
+        // Each bond once, from its begin atom
+        foreach (unsigned long bondId, atom->bonds()) {
+          Bond *bond = m_molecule->bondById(bondId);
+          if (bond && bond->beginAtomId() == id)
+            selectedAtoms.push_back(bond);
+        }
+      }
+    }
     widget->clearSelected();
     widget->setSelected(selectedAtoms, true);
     widget->update();
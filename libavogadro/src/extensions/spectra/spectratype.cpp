@@ -23,23 +23,202 @@
 
 #include <QtCore/QList>
 #include <QtCore/QObject>
+#include <QtCore/QPair>
 #include <QtCore/QString>
 #include <QtCore/QTextStream>
 #include <QtCore/QDebug>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QThread>
+#include <QtCore/QtConcurrentMap>
+#include <QtCore/QtConcurrentRun>
 
 #include <avogadro/primitive.h>
 #include <avogadro/plotwidget.h>
 #include <avogadro/molecule.h>
 
+#include <cmath>
+
 namespace Avogadro {
 
-  SpectraType::SpectraType( SpectraDialog *parent ) : QObject(parent), m_dialog(parent)
+  // Spectra with more point-peak pairs than this are broadened in a thread
+  static const double asyncBroadeningWork = 2.0e6;
+
+  // The parameters of a broadened spectrum, and the spectrum
+  struct BroadenedSpectrum
+  {
+    BroadenedSpectrum() : fwhm(0.0), dotsPerPeak(0), shape(SpectraType::Gaussian) {}
+
+    bool sameParameters(const BroadenedSpectrum &other) const
+    {
+      return fwhm == other.fwhm && dotsPerPeak == other.dotsPerPeak
+          && shape == other.shape && centers == other.centers
+          && heights == other.heights;
+    }
+
+    QList<double> centers, heights;
+    double fwhm;
+    uint dotsPerPeak;
+    SpectraType::LineShape shape;
+    QVector<double> xPoints, yPoints;
+  };
+
+  class SpectraBroadening
+  {
+    public:
+      BroadenedSpectrum cached;    // last spectrum computed
+      BroadenedSpectrum running;   // being computed in the worker thread
+      BroadenedSpectrum wanted;    // asked for while the worker was busy
+      bool hasWanted;
+      QFutureWatcher<QVector<double> > watcher;
+  };
+
+  // A run of points and the peaks they see
+  struct BroadeningChunk
+  {
+    const double *points;
+    const double *centers;   // sorted
+    const double *heights;
+    int numPeaks;
+    int begin;
+    int end;
+    double fwhm;
+    double cutoff;
+    SpectraType::LineShape shape;
+    double *y;
+  };
+
+  static void broadenChunk(BroadeningChunk &chunk)
+  {
+    // exp(-g d^2) and 1 / (1 + l d^2) both have their half maximum at fwhm/2
+    const double g = 4.0 * log(2.0) / (chunk.fwhm * chunk.fwhm);
+    const double l = 4.0 / (chunk.fwhm * chunk.fwhm);
+    const double *c = chunk.centers;
+    const double *h = chunk.heights;
+
+    // Both the points and the peaks are sorted, so the window of peaks
+    // within the cutoff only moves forward
+    int first = 0, last = 0;
+    for (int i = chunk.begin; i < chunk.end; ++i) {
+      const double x = chunk.points[i];
+      while (first < chunk.numPeaks && c[first] < x - chunk.cutoff)
+        ++first;
+      if (last < first)
+        last = first;
+      while (last < chunk.numPeaks && c[last] <= x + chunk.cutoff)
+        ++last;
+
+      double y = 0.0;
+      switch (chunk.shape) {
+      case SpectraType::Gaussian:
+        for (int j = first; j < last; ++j) {
+          const double d = x - c[j];
+          y += h[j] * exp(-g * d * d);
+        }
+        break;
+      case SpectraType::Lorentzian:
+        for (int j = first; j < last; ++j) {
+          const double d = x - c[j];
+          y += h[j] / (1.0 + l * d * d);
+        }
+        break;
+      case SpectraType::PseudoVoigt:
+        for (int j = first; j < last; ++j) {
+          const double d2 = (x - c[j]) * (x - c[j]);
+          y += h[j] * 0.5 * (exp(-g * d2) + 1.0 / (1.0 + l * d2));
+        }
+        break;
+      }
+      chunk.y[i] = y;
+    }
+  }
+
+  QVector<double> SpectraType::broaden(const QVector<double> &points,
+                                       const QList<double> &centers,
+                                       const QList<double> &heights,
+                                       double fwhm, LineShape shape)
+  {
+    QVector<double> y(points.size(), 0.0);
+    const int numPeaks = qMin(centers.size(), heights.size());
+    if (points.isEmpty() || !numPeaks || fwhm <= 0.0)
+      return y;
+
+    // The peaks sorted by center, in plain arrays
+    QVector<QPair<double, double> > peaks(numPeaks);
+    for (int j = 0; j < numPeaks; ++j)
+      peaks[j] = qMakePair(centers.at(j), heights.at(j));
+    qSort(peaks);
+    QVector<double> c(numPeaks), h(numPeaks);
+    for (int j = 0; j < numPeaks; ++j) {
+      c[j] = peaks.at(j).first;
+      h[j] = peaks.at(j).second;
+    }
+
+    // A Gaussian is down to 1e-11 of its height at 3 FWHM, a Lorentzian
+    // only to 2.5e-5 at 100 FWHM, so that the cut tails of thousands of
+    // peaks still add up to less than a pixel
+    const double cutoff = (shape == Gaussian ? 3.0 : 100.0) * fwhm;
+
+    const int numChunks = points.size() * double(numPeaks) > asyncBroadeningWork / 16
+      ? 4 * qMax(1, QThread::idealThreadCount()) : 1;
+    const int perChunk = (points.size() + numChunks - 1) / numChunks;
+    QVector<BroadeningChunk> chunks(numChunks);
+    for (int k = 0; k < numChunks; ++k) {
+      BroadeningChunk &chunk = chunks[k];
+      chunk.points = points.constData();
+      chunk.centers = c.constData();
+      chunk.heights = h.constData();
+      chunk.numPeaks = numPeaks;
+      chunk.begin = qMin(points.size(), k * perChunk);
+      chunk.end = qMin(points.size(), chunk.begin + perChunk);
+      chunk.fwhm = fwhm;
+      chunk.cutoff = cutoff;
+      chunk.shape = shape;
+      chunk.y = y.data();
+    }
+    if (numChunks == 1)
+      broadenChunk(chunks[0]);
+    else
+      QtConcurrent::blockingMap(chunks, broadenChunk);
+    return y;
+  }
+
+  static QVector<double> broadenSpectrum(const BroadenedSpectrum &spectrum)
+  {
+    return SpectraType::broaden(spectrum.xPoints, spectrum.centers,
+                                spectrum.heights, spectrum.fwhm, spectrum.shape);
+  }
+
+  static QVector<double> peakPoints(const QList<double> &centers, double FWHM,
+                                    uint dotsPerPeak)
+  {
+    QVector<double> xPoints;
+    xPoints.reserve(centers.size() * dotsPerPeak);
+    for (int i = 0; i < centers.size(); i++) {
+      double x = centers.at(i) - (2*FWHM);
+      for (uint j = 0; j < dotsPerPeak; j++) {
+        xPoints << x;
+        x += 4*FWHM / (int(dotsPerPeak));
+      }
+    }
+    qSort(xPoints);
+    return xPoints;
+  }
+
+  SpectraType::SpectraType( SpectraDialog *parent ) : QObject(parent), m_dialog(parent),
+    m_lineShape(Gaussian), m_broadening(new SpectraBroadening)
   {
     m_tab_widget = new QWidget;
+    m_broadening->hasWanted = false;
+    connect(&m_broadening->watcher, SIGNAL(finished()),
+            this, SLOT(broadeningFinished()));
   }
   
   SpectraType::~SpectraType()
   {
+    disconnect(&m_broadening->watcher, SIGNAL(finished()),
+               this, SLOT(broadeningFinished()));
+    m_broadening->watcher.waitForFinished();
+    delete m_broadening;
     clear();
     disconnect(m_dialog->getUi()->combo_spectra, SIGNAL(currentIndexChanged(QString)),
         m_dialog, SLOT(updateCurrentSpectra(QString)));    
@@ -118,16 +297,59 @@ namespace Avogadro {
 
   QList<double> SpectraType::getXPoints(double FWHM, uint dotsPerPeak)
   {
-    QList<double> xPoints;
-    for (int i = 0; i < m_xList.size(); i++) {
-      double x = m_xList.at(i) - (2*FWHM);
-      for (uint j = 0; j < dotsPerPeak; j++) {
-        xPoints << x;
-        x += 4*FWHM / (int(dotsPerPeak));
+    return peakPoints(m_xList, FWHM, dotsPerPeak).toList();
+  }
+
+  void SpectraType::getBroadenedPoints(const QList<double> &centers,
+                                       const QList<double> &heights, double FWHM,
+                                       uint dotsPerPeak, QVector<double> &xPoints,
+                                       QVector<double> &yPoints)
+  {
+    BroadenedSpectrum wanted;
+    wanted.centers = centers;
+    wanted.heights = heights;
+    wanted.fwhm = FWHM;
+    wanted.dotsPerPeak = dotsPerPeak;
+    wanted.shape = m_lineShape;
+
+    BroadenedSpectrum &cached = m_broadening->cached;
+    if (!cached.sameParameters(wanted)) {
+      wanted.xPoints = peakPoints(centers, FWHM, dotsPerPeak);
+      if (wanted.xPoints.size() * double(centers.size()) < asyncBroadeningWork) {
+        wanted.yPoints = broadenSpectrum(wanted);
+        cached = wanted;
+        m_broadening->hasWanted = false;
+      }
+      else if (m_broadening->watcher.isRunning()) {
+        // Only the latest parameters are worth computing next
+        if (!m_broadening->running.sameParameters(wanted)) {
+          m_broadening->wanted = wanted;
+          m_broadening->hasWanted = true;
+        }
+      }
+      else {
+        m_broadening->running = wanted;
+        m_broadening->watcher.setFuture(QtConcurrent::run(broadenSpectrum,
+                                                          m_broadening->running));
       }
     }
-    qSort(xPoints);
-    return xPoints;
+
+    xPoints = cached.xPoints;
+    yPoints = cached.yPoints;
+  }
+
+  void SpectraType::broadeningFinished()
+  {
+    BroadenedSpectrum &running = m_broadening->running;
+    running.yPoints = m_broadening->watcher.result();
+    m_broadening->cached = running;
+
+    if (m_broadening->hasWanted) {
+      m_broadening->hasWanted = false;
+      running = m_broadening->wanted;
+      m_broadening->watcher.setFuture(QtConcurrent::run(broadenSpectrum, running));
+    }
+    emit plotDataChanged();
   }
 }
 
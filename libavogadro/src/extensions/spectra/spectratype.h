@@ -25,6 +25,7 @@
 #include <QtCore/QHash>
 #include <QtCore/QVariant>
 #include <QtCore/QSettings>
+#include <QtCore/QVector>
 
 #include <avogadro/primitive.h>
 #include <avogadro/plotwidget.h>
@@ -36,6 +37,7 @@
 namespace Avogadro {
 
   class SpectraDialog;
+  class SpectraBroadening;
 
   // Abstract data type - no instance of it can be created
   class SpectraType : public QObject
@@ -43,6 +45,10 @@ namespace Avogadro {
     Q_OBJECT
 
    public:
+    // Line shapes of broadened peaks, with pseudo-Voigt half Gaussian and
+    // half Lorentzian
+    enum LineShape { Gaussian, Lorentzian, PseudoVoigt };
+
     SpectraType( SpectraDialog *parent );
     virtual ~SpectraType();
 
@@ -65,13 +71,38 @@ namespace Avogadro {
     QString getTSV(QString xTitle, QString yTitle);
     void clear();
 
+    // Sum the peaks at centers with the given heights, each broadened to
+    // fwhm, at the sorted points. The kernels are cut off where they have
+    // fallen below the plot resolution, so each point only sees the peaks
+    // next to it.
+    static QVector<double> broaden(const QVector<double> &points,
+                                   const QList<double> &centers,
+                                   const QList<double> &heights,
+                                   double fwhm, LineShape shape = Gaussian);
+
   signals:
     void plotDataChanged();
 
   protected:
+    // Broaden the peaks in m_lineShape at the points of getXPoints() around
+    // centers. Results are cached, and large spectra are computed in a
+    // worker thread: until it is done the last spectrum is returned, empty
+    // if there is none, and plotDataChanged() is emitted when it is ready.
+    void getBroadenedPoints(const QList<double> &centers,
+                            const QList<double> &heights, double FWHM,
+                            uint dotsPerPeak, QVector<double> &xPoints,
+                            QVector<double> &yPoints);
+
     SpectraDialog *m_dialog;
     QWidget *m_tab_widget;
     QList<double> m_xList, m_yList, m_xList_imp, m_yList_imp;
+    LineShape m_lineShape;
+
+  private slots:
+    void broadeningFinished();
+
+  private:
+    SpectraBroadening *m_broadening;
   };
 }
 
@@ -136,18 +136,13 @@ namespace Avogadro {
       // convert FWHM to sigma squared
       double s2	= pow( (FWHM / (2.0 * sqrt(2.0 * log(2.0)))), 2.0);
 
-      // create points
-      QList<double> xPoints = getXPoints(FWHM, 25);
+      QVector<double> xPoints, yPoints;
+      getBroadenedPoints(m_xList, m_yList, FWHM, 25, xPoints, yPoints);
       for (int i = 0; i < xPoints.size(); i++) {
         double x = xPoints.at(i);
-        double y = 0.0;
-        for (int j = 0; j < m_yList.size(); j++) {
-          double t = m_yList.at(j);
-          double w = m_xList.at(j);
-          y += t * exp( - ( pow( (x - w), 2 ) ) / (2 * s2) ) / 
-            (22.97 * x / 1241) // <-- normalization constant (22.97 / X_0)
-            / sqrt(2 * M_PI * s2); // <-- gaussian normalization
-        }
+        double y = yPoints.at(i) /
+          (22.97 * x / 1241) // <-- normalization constant (22.97 / X_0)
+          / sqrt(2 * M_PI * s2); // <-- gaussian normalization
         plotObject->addPoint(x,y);
       }
     }
@@ -59,6 +59,8 @@ namespace Avogadro {
             this, SLOT(updateYAxis(QString)));
     connect(ui.combo_scalingType, SIGNAL(currentIndexChanged(int)),
             this, SLOT(changeScalingType(int)));
+    connect(ui.combo_lineShape, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(changeLineShape(int)));
     }
 
   void AbstractIRSpectra::rescaleFrequencies()
@@ -147,6 +149,13 @@ namespace Avogadro {
     rescaleFrequencies();
   }    
 
+  void AbstractIRSpectra::changeLineShape(int shape) {
+    if (m_lineShape == shape)
+      return;
+    m_lineShape = LineShape(shape);
+    emit plotDataChanged();
+  }
+
   double AbstractIRSpectra::scale(double w)
   {
     switch(m_scalingType) {
@@ -183,6 +192,7 @@ namespace Avogadro {
 
     settings.setValue("spectra/IR/scale", m_scale);
     settings.setValue("spectra/IR/gaussianWidth", m_fwhm);
+    settings.setValue("spectra/IR/lineShape", int(m_lineShape));
     settings.setValue("spectra/IR/labelPeaks", ui.cb_labelPeaks->isChecked());
     settings.setValue("spectra/IR/yAxisUnits", ui.combo_yaxis->currentText());
   }
@@ -195,6 +205,7 @@ namespace Avogadro {
     m_fwhm = settings.value("spectra/IR/gaussianWidth",0.0).toDouble();
     ui.spin_FWHM->setValue(m_fwhm);
     updateFWHMSlider(m_fwhm);
+    ui.combo_lineShape->setCurrentIndex(settings.value("spectra/IR/lineShape", 0).toInt());
     ui.cb_labelPeaks->setChecked(settings.value("spectra/IR/labelPeaks",false).toBool());
     QString yunit = settings.value("spectra/IR/yAxisUnits",tr("Transmittance (%)")).toString();
     updateYAxis(yunit);
@@ -296,22 +307,18 @@ namespace Avogadro {
     } // End singlets
 
     else { // Get gaussians
-      // convert FWHM to sigma squared
-      //double FWHM = ui.spin_FWHM->value();
-      double s2	= pow( (m_fwhm / (2.0 * sqrt(2.0 * log(2.0)))), 2.0);
-
-      // create points
-      QList<double> xPoints = getXPoints(m_fwhm, 10);
-      for (int i = 0; i < xPoints.size(); i++) {
-        double x = xPoints.at(i);// already scaled!
-        double y = 100;
-        for (int j = 0; j < m_yList.size(); j++) {
-          double t = m_yList.at(j);
-          double w = m_xList.at(j);// already scaled!
-          y += (t-100) * exp( - ( pow( (x - w), 2 ) ) / (2 * s2) );
-        }
-        plotObject->addPoint(x,y);
-      }
+      // Absorption peaks down from 100% transmittance
+      QList<double> depths;
+      for (int j = 0; j < m_yList.size(); j++)
+        depths << m_yList.at(j) - 100;
+
+      // m_xList is already scaled!
+      QVector<double> xPoints, yPoints;
+      getBroadenedPoints(m_xList, depths, m_fwhm, 10, xPoints, yPoints);
+      if (xPoints.isEmpty())
+        return;
+      for (int i = 0; i < xPoints.size(); i++)
+        plotObject->addPoint(xPoints.at(i), 100 + yPoints.at(i));
 
       // Normalization is probably screwed up, so renormalize the data
       double min, max;
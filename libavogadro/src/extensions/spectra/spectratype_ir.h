@@ -52,6 +52,7 @@ namespace Avogadro {
     void fwhmSliderPressed();
     void fwhmSliderReleased();    
     void changeScalingType(int);
+    void changeLineShape(int);
     void updateYAxis(QString);
     void rescaleFrequencies();
 
@@ -118,22 +118,22 @@ namespace Avogadro {
     } // End singlets
 
     else { // Get gaussians
-      // convert FWHM to sigma squared
       double FWHM = ui.spin_FWHM->value();
-      double s2	= pow( (FWHM / (2.0 * sqrt(2.0 * log(2.0)))), 2.0);
-
-      // create points
-      QList<double> xPoints = getXPoints(FWHM, 10);
-      for (int i = 0; i < xPoints.size(); i++) {
-        double x = xPoints.at(i);
-        double y = 0;
-        for (int j = 0; j < m_xList.size(); j++) {
-          double t = 1.0; //m_NMRintensities.at(i);
-          double w = m_xList.at(j) - m_ref;
-          y += t * exp( - ( pow( (x - w), 2 ) ) / (2 * s2) );
-        }
-        plotObject->addPoint(x,y);
+      QList<double> shifts, intensities;
+      for (int j = 0; j < m_xList.size(); j++) {
+        shifts << m_xList.at(j) - m_ref;
+        intensities << 1.0; //m_NMRintensities.at(j);
+      }
+
+      // The points are taken around the shifts, not the raw shieldings
+      QVector<double> xPoints, yPoints;
+      getBroadenedPoints(shifts, intensities, FWHM, 10, xPoints, yPoints);
+      if (xPoints.isEmpty()) {
+        updatePlotAxes();
+        return;
       }
+      for (int i = 0; i < xPoints.size(); i++)
+        plotObject->addPoint(xPoints.at(i), yPoints.at(i));
 
       // Normalization is probably screwed up, so renormalize the data
       double max = plotObject->points().first()->y();
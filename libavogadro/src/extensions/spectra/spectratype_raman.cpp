@@ -58,6 +58,7 @@ namespace Avogadro {
 
     settings.setValue("spectra/Raman/scale", m_scale);
     settings.setValue("spectra/Raman/gaussianWidth", m_fwhm);
+    settings.setValue("spectra/Raman/lineShape", int(m_lineShape));
     settings.setValue("spectra/Raman/experimentTemperature", m_T);
     settings.setValue("spectra/Raman/laserWavenumber", m_W);
     settings.setValue("spectra/Raman/labelPeaks", ui.cb_labelPeaks->isChecked());
@@ -72,6 +73,7 @@ namespace Avogadro {
     m_fwhm = settings.value("spectra/Raman/gaussianWidth",0.0).toDouble();
     ui.spin_FWHM->setValue(m_fwhm);
     updateFWHMSlider(m_fwhm);
+    ui.combo_lineShape->setCurrentIndex(settings.value("spectra/Raman/lineShape", 0).toInt());
     m_T = settings.value("spectra/Raman/experimentTemperature", 298.15).toDouble();
     ui.spin_T->setValue(m_T);
     m_W = settings.value("spectra/Raman/laserWavenumber", 9398.5).toDouble();
@@ -185,22 +187,14 @@ namespace Avogadro {
     } // End singlets
 
     else { // Get gaussians
-      // convert FWHM to sigma squared
       double FWHM = ui.spin_FWHM->value();
-      double s2	= pow( (FWHM / (2.0 * sqrt(2.0 * log(2.0)))), 2.0);
-
-      // create points
-      QList<double> xPoints = getXPoints(FWHM, 10);
-      for (int i = 0; i < xPoints.size(); i++) {
-        double x = xPoints.at(i);// already scaled!
-        double y = 0;
-        for (int j = 0; j < m_yList.size(); j++) {
-          double t = m_yList.at(j);
-          double w = m_xList.at(j);// already scaled!
-          y += t * exp( - ( pow( (x - w), 2 ) ) / (2 * s2) );
-        }
-        plotObject->addPoint(x,y);
-      }
+      // m_xList is already scaled!
+      QVector<double> xPoints, yPoints;
+      getBroadenedPoints(m_xList, m_yList, FWHM, 10, xPoints, yPoints);
+      if (xPoints.isEmpty())
+        return;
+      for (int i = 0; i < xPoints.size(); i++)
+        plotObject->addPoint(xPoints.at(i), yPoints.at(i));
 
       // Normalization is probably screwed up, so renormalize the data
       double min, max;
@@ -117,21 +117,13 @@ namespace Avogadro {
       // convert FWHM to sigma squared
       double sigma = FWHM / (2.0 * sqrt(2.0 * log(2.0)));
       double s2	= pow( sigma, 2.0 );
+      // Normalization factor: (CP, 224 (1997) 143-155)
+      double norm = 2.87e4 / sqrt(2 * M_PI * s2);
 
-      // create points
-      QList<double> xPoints = getXPoints(FWHM, 25);
-      for (int i = 0; i < xPoints.size(); i++) {
-        double x = xPoints.at(i);
-        double y = 0.0;
-        for (int j = 0; j < m_yList.size(); j++) {
-          double t = m_yList.at(j);
-          double w = m_xList.at(j);
-          y += t * exp( - ( pow( (x - w), 2 ) ) / (2 * s2) ) *
-            // Normalization factor: (CP, 224 (1997) 143-155)
-            2.87e4 / sqrt(2 * M_PI * s2);
-        }
-        plotObject->addPoint(x,y);
-      }
+      QVector<double> xPoints, yPoints;
+      getBroadenedPoints(m_xList, m_yList, FWHM, 25, xPoints, yPoints);
+      for (int i = 0; i < xPoints.size(); i++)
+        plotObject->addPoint(xPoints.at(i), yPoints.at(i) * norm);
     }
     else {
       for (int i = 0; i < m_yList.size(); i++) {
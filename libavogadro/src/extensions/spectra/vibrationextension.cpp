@@ -195,43 +195,26 @@ namespace Avogadro {
     //      return;
     //    }
 
-    vector3 obDisplacement;
-    Eigen::Vector3d displacement, atomPos;
-
-    // delete any old frames
-    clearAnimationFrames();
-    // We do 4 "phases" of vibrations
-    for (unsigned int frame = 0; frame < m_framesPerStep * 4; ++frame)
-      m_animationFrames.push_back( new vector<Vector3d>(m_molecule->numAtoms()) );
+    // The animation computes the displaced positions of each frame itself,
+    // so nothing but the mode vectors is stored
+    vector<Vector3d> displacements(m_molecule->numAtoms(), Vector3d::Zero());
+    foreach (Atom *atom, m_molecule->atoms()) {
+      if (static_cast<unsigned int>(atom->index()) >= displacementVectors.size())
+        continue;
+      const vector3 &obDisplacement = displacementVectors[atom->index()];
+      displacements[atom->index()] = Vector3d(obDisplacement.x(), obDisplacement.y(),
+                                              obDisplacement.z());
+    }
 
-    if (m_displayVectors)
+    if (m_displayVectors) {
       setDisplayForceVectors(true);
+      foreach (Atom *atom, m_molecule->atoms())
+        atom->setForceVector(displacements[atom->index()]);
+    }
 
-    foreach (Atom *atom, m_molecule->atoms()) {
-      obDisplacement = displacementVectors[atom->index()];
-      displacement = Eigen::Vector3d(obDisplacement.x(), obDisplacement.y(), obDisplacement.z());
-
-      if (m_displayVectors)
-        atom->setForceVector(displacement);
-
-      // We'll create frames for 4 "steps"
-      // 1) current coordinates -> + displacement
-      // 2)  + displacement -> original coords
-      // 3) original coords ->  - displacement
-      // 4)  - displacement -> original coords
-      for (unsigned int frame = 0; frame < m_framesPerStep; ++frame) {
-        atomPos = *(atom->pos());
-        m_animationFrames[frame]->at(atom->index()) = atomPos + displacement * (m_scale * frame/m_framesPerStep);
-        m_animationFrames[frame + 1*m_framesPerStep]->at(atom->index()) = atomPos + displacement * ( m_scale * (m_framesPerStep - frame) / m_framesPerStep);
-        m_animationFrames[frame + 2*m_framesPerStep]->at(atom->index()) = atomPos - displacement * (m_scale * frame / m_framesPerStep);
-        m_animationFrames[frame + 3*m_framesPerStep]->at(atom->index()) = atomPos - displacement * (m_scale * (m_framesPerStep - frame) / m_framesPerStep);
-      } // foreach frame set
-
-    } // foreach atom
-
-    // and we remove the first frame (duplicate)
-    m_animationFrames.erase(m_animationFrames.begin());
-    m_animation->setFrames(m_animationFrames);
+    // A period is the 4 "steps": out to + displacement, back, out to
+    // - displacement and back
+    m_animation->setDisplacements(displacements, m_scale, m_framesPerStep * 4);
     if (m_animationSpeed) {
       // vibrations per femtosecond
       // wavenumber * 3.0e10 cm/s * 1e-15 s/fs = 3e-5 fs-1
@@ -240,8 +223,8 @@ namespace Avogadro {
         // 10fs = 4000 cm-1 gets 1 second apparent vibration
         // fs-1 above * 10fs / 1 s => per second * frames = fps
         double fps = vibPerFs * 10.0;
-        m_animation->setFps(fps * m_animationFrames.size());
-        qDebug() << vibPerFs << " fps " << fps * m_animationFrames.size();
+        m_animation->setFps(fps * m_animation->numFrames());
+        qDebug() << vibPerFs << " fps " << fps * m_animation->numFrames();
       }
     }
     if (m_animating && !m_paused) {
@@ -253,7 +236,9 @@ namespace Avogadro {
   void VibrationExtension::setScale(double scale)
   {
     m_scale = scale;
-    updateMode(m_mode);
+    // Takes effect on the next frame, nothing is recomputed
+    if (m_animation)
+      m_animation->setAmplitude(scale);
   }
 
   void VibrationExtension::setDisplayForceVectors(bool enabled)
@@ -286,7 +271,7 @@ namespace Avogadro {
   {
     QSettings settings;
     
-    if (m_animationFrames.size() == 0) {
+    if (m_mode == -1 || !m_animation) {
       m_dialog->animateButtonClicked(false);
       return;
     }
@@ -324,7 +309,9 @@ namespace Avogadro {
 
   void VibrationExtension::clearAnimationFrames()
   {
-    m_animationFrames.clear();
+    m_mode = -1;
+    if (m_animation)
+      m_animation->setDisplacements(std::vector<Vector3d>(), m_scale, 0);
   }
 
   void VibrationExtension::showSpectra()
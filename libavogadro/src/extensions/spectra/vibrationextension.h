@@ -69,7 +69,7 @@ namespace Avogadro {
       void showSpectra();
 
     private:
-      void updateForcesAndFrames(); // helper when settings change
+      void updateForcesAndFrames(); // helper when the mode changes
 
       OpenBabel::OBVibrationData *m_vibrations;
       int m_mode;
@@ -85,8 +85,6 @@ namespace Avogadro {
       bool m_animationSpeed;
       bool m_animating;
       bool m_paused;
-
-      std::vector< std::vector< Eigen::Vector3d> *> m_animationFrames;
   };
 
   class VibrationExtensionFactory : public QObject, public PluginFactory
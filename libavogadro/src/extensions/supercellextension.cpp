@@ -30,7 +30,7 @@
 #include <avogadro/atom.h>
 #include <avogadro/bond.h>
 #include <avogadro/glwidget.h>
-#include <avogadro/neighborlist.h>
+#include <avogadro/bondperception.h>
 
 #include <openbabel/mol.h>
 #include <openbabel/generic.h>
@@ -243,34 +243,22 @@ namespace Avogadro {
   void SuperCellExtension::connectTheDots()
   {
     // Add single bonds between all atoms closer than their combined atomic
-    // covalent radii.
-    vector<double> rad;
-    NeighborList nbrs(m_molecule, 2.2);
-
-    rad.reserve(m_molecule->numAtoms());
-
-    foreach (Atom *atom, m_molecule->atoms())
-      rad.push_back(OpenBabel::etab.GetCovalentRad(atom->atomicNumber()));
-
-    foreach (Atom *atom1, m_molecule->atoms()) {
-      foreach (Atom *atom2, nbrs.nbrs(atom1)) {
-        if (m_molecule->bond(atom1, atom2))
-          continue;
-        if (atom1->isHydrogen() && atom2->isHydrogen())
-          continue;
-        // bonded if closer than elemental Rcov + tolerance
-        double cutoff = (rad[atom1->index()] + rad[atom2->index()] + 0.45)
-               * (rad[atom1->index()] + rad[atom2->index()] + 0.45);
-
-        double d2  = ((*atom1->pos()) - (*atom2->pos())).squaredNorm();
-
-        if (d2 > cutoff || d2 < 0.40)
-          continue;
-
-        Bond *bond = m_molecule->addBond();
-        bond->setAtoms(atom1->id(), atom2->id(), 1);
-      }
-      QCoreApplication::processEvents();
+    // covalent radii. The images are already atoms of the super cell.
+    BondPerception perception;
+    perception.setMolecule(m_molecule);
+    perception.setPeriodic(false);
+    QList<Atom *> atoms = m_molecule->atoms();
+    QVector<QPair<int, int> > pairs = perception.perceive();
+    for (int i = 0; i < pairs.size(); ++i) {
+      Atom *atom1 = atoms.at(pairs.at(i).first);
+      Atom *atom2 = atoms.at(pairs.at(i).second);
+      if (atom1->isHydrogen() && atom2->isHydrogen())
+        continue;
+      if (m_molecule->bond(atom1, atom2))
+        continue;
+
+      Bond *bond = m_molecule->addBond();
+      bond->setAtoms(atom1->id(), atom2->id(), 1);
     }
   }
 
@@ -664,6 +664,11 @@ namespace Avogadro
     m_mesh1 = 0;
     m_mesh2 = 0;
 
+    // The charges for the ESP are calculated in the background alongside
+    // the surface
+    if (m_molecule && m_surfaceDialog->cubeColorType() == Cube::ESP)
+      m_molecule->requestPartialCharges();
+
     // Now attempt to begin the calculation
     bool calculateCube = false;
     m_cube = startCubeCalculation(m_surfaceDialog->cubeType(),
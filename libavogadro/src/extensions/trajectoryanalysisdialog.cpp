@@ -0,0 +1,305 @@
+/**********************************************************************
+  TrajectoryAnalysisDialog - Plot properties of trajectory frames
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "trajectoryanalysisdialog.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/glwidget.h>
+#include <avogadro/molecule.h>
+#include <avogadro/plotwidget.h>
+#include <avogadro/plotobject.h>
+#include <avogadro/plotaxis.h>
+
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QReadWriteLock>
+#include <QtCore/QtConcurrentRun>
+
+namespace Avogadro
+{
+  TrajectoryAnalysisDialog::TrajectoryAnalysisDialog( QWidget *parent, Qt::WindowFlags f )
+    : QDialog( parent, f ), m_rdfDone(false), m_contactsDone(false),
+      m_source(0), m_locked(false)
+  {
+    ui.setupUi(this);
+
+    ui.plot->setAntialiasing(true);
+    ui.plot->setDefaultLimits(0.0, 1.0, 0.0, 1.0);
+
+    connect(ui.browseButton, SIGNAL(clicked()), this, SLOT(browseClicked()));
+    connect(ui.addMeasurementButton, SIGNAL(clicked()),
+            this, SLOT(addMeasurementClicked()));
+    connect(ui.removeMeasurementButton, SIGNAL(clicked()),
+            this, SLOT(removeMeasurementClicked()));
+    connect(ui.analyzeButton, SIGNAL(clicked()), this, SLOT(analyzeClicked()));
+    connect(ui.plotCombo, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(plotChanged(int)));
+    connect(&m_watcher, SIGNAL(finished()), this, SLOT(analysisFinished()));
+  }
+
+  TrajectoryAnalysisDialog::~TrajectoryAnalysisDialog()
+  {
+    m_watcher.waitForFinished();
+    if (m_locked && m_molecule)
+      m_molecule->lock()->unlock();
+    delete m_source;
+  }
+
+  void TrajectoryAnalysisDialog::setMolecule(Molecule *molecule)
+  {
+    if (m_molecule == molecule)
+      return;
+    m_molecule = molecule;
+    m_measurements.clear();
+    ui.measurementList->clear();
+  }
+
+  void TrajectoryAnalysisDialog::setWidget(GLWidget *widget)
+  {
+    m_widget = widget;
+  }
+
+  QList<int> TrajectoryAnalysisDialog::selectedAtoms() const
+  {
+    QList<int> indices;
+    if (!m_widget)
+      return indices;
+    foreach (Primitive *primitive,
+             m_widget->selectedPrimitives().subList(Primitive::AtomType))
+      indices.append(static_cast<Atom *>(primitive)->index());
+    return indices;
+  }
+
+  void TrajectoryAnalysisDialog::browseClicked()
+  {
+    QString fileName = QFileDialog::getOpenFileName(this,
+      tr("Open Trajectory"), ui.fileEdit->text(),
+      tr("Trajectories") + " (*.xyz *.pdb *.gro *.arc);;" + tr("All Files") + " (*)");
+    if (fileName.isEmpty())
+      return;
+    ui.fileEdit->setText(fileName);
+    ui.fileRadio->setChecked(true);
+  }
+
+  void TrajectoryAnalysisDialog::addMeasurementClicked()
+  {
+    QList<int> atoms = selectedAtoms();
+    if (atoms.size() < 2 || atoms.size() > 4) {
+      QMessageBox::warning(this, tr("Avogadro"),
+        tr("Select two atoms for a distance, three for an angle or four for a dihedral."));
+      return;
+    }
+    m_measurements.append(atoms);
+
+    TrajectoryAnalysis names;
+    names.addMeasurement(atoms);
+    ui.measurementList->addItem(names.measurementName(0));
+  }
+
+  void TrajectoryAnalysisDialog::removeMeasurementClicked()
+  {
+    int row = ui.measurementList->currentRow();
+    if (row < 0)
+      return;
+    m_measurements.removeAt(row);
+    delete ui.measurementList->takeItem(row);
+  }
+
+  void TrajectoryAnalysisDialog::analyzeClicked()
+  {
+    if (!m_molecule || m_watcher.isRunning())
+      return;
+
+    delete m_source;
+    m_source = 0;
+    if (ui.fileRadio->isChecked()) {
+      FileFrameSource *file = new FileFrameSource(ui.fileEdit->text());
+      if (!file->isValid()) {
+        delete file;
+        QMessageBox::warning(this, tr("Avogadro"),
+          tr("Cannot read trajectory file %1.").arg(ui.fileEdit->text()));
+        return;
+      }
+      m_source = file;
+    }
+    else
+      m_source = new ConformerFrameSource(m_molecule);
+
+    // The atoms, and the conformers, are read while the analysis runs
+    m_molecule->lock()->lockForRead();
+    m_locked = true;
+
+    m_analysis.setMolecule(m_molecule);
+    m_analysis.setFitAtoms(ui.fitSelectedCheck->isChecked() ? selectedAtoms()
+                                                            : QList<int>());
+    m_analysis.clearMeasurements();
+    foreach (const QList<int> &atoms, m_measurements)
+      m_analysis.addMeasurement(atoms);
+
+    m_rdfDone = ui.rdfCheck->isChecked();
+    if (m_rdfDone) {
+      m_rdf.setMolecule(m_molecule);
+      m_rdf.setRange(ui.rdfRangeSpin->value(), 200);
+    }
+    m_contactsDone = ui.contactCheck->isChecked() && m_molecule->numResidues();
+    if (m_contactsDone) {
+      m_contacts.setMolecule(m_molecule);
+      m_contacts.setCutoff(ui.contactCutoffSpin->value());
+    }
+
+    ui.analyzeButton->setEnabled(false);
+    ui.statusLabel->setText(tr("Analyzing..."));
+    m_watcher.setFuture(QtConcurrent::run(this, &TrajectoryAnalysisDialog::runAnalysis));
+  }
+
+  bool TrajectoryAnalysisDialog::runAnalysis()
+  {
+    // Each pass rewinds the source
+    if (!m_analysis.run(m_source))
+      return false;
+    if (m_rdfDone && !m_rdf.run(m_source))
+      return false;
+    if (m_contactsDone && !m_contacts.run(m_source))
+      return false;
+    return true;
+  }
+
+  void TrajectoryAnalysisDialog::analysisFinished()
+  {
+    if (m_locked) {
+      if (m_molecule)
+        m_molecule->lock()->unlock();
+      m_locked = false;
+    }
+    delete m_source;
+    m_source = 0;
+    ui.analyzeButton->setEnabled(true);
+
+    if (!m_watcher.result()) {
+      ui.statusLabel->setText(tr("The frames do not match the molecule."));
+      return;
+    }
+    ui.statusLabel->setText(tr("%n frame(s) analyzed.", "", m_analysis.numFrames()));
+
+    int current = ui.plotCombo->currentIndex();
+    ui.plotCombo->blockSignals(true);
+    ui.plotCombo->clear();
+    ui.plotCombo->addItem(tr("RMSD"), RmsdPlot);
+    ui.plotCombo->addItem(tr("Radius of Gyration"), RadiusPlot);
+    ui.plotCombo->addItem(tr("RMSF per Atom"), RmsfPlot);
+    if (m_rdfDone)
+      ui.plotCombo->addItem(tr("Radial Distribution"), RdfPlot);
+    if (m_contactsDone)
+      ui.plotCombo->addItem(tr("Residue Contacts"), ContactPlot);
+    for (int i = 0; i < m_analysis.numMeasurements(); ++i)
+      ui.plotCombo->addItem(m_analysis.measurementName(i), MeasurementPlot + i);
+    ui.plotCombo->setCurrentIndex(qBound(0, current, ui.plotCombo->count() - 1));
+    ui.plotCombo->blockSignals(false);
+    plotChanged(ui.plotCombo->currentIndex());
+  }
+
+  void TrajectoryAnalysisDialog::plotChanged(int index)
+  {
+    if (index < 0 || m_watcher.isRunning())
+      return;
+
+    const int type = ui.plotCombo->itemData(index).toInt();
+    if (type == ContactPlot) {
+      plotContacts();
+      return;
+    }
+
+    QVector<double> values, positions;
+    QString xLabel = tr("Frame"), yLabel;
+    if (type == RmsdPlot) {
+      values = m_analysis.rmsd();
+      yLabel = tr("RMSD (Angstrom)");
+    }
+    else if (type == RadiusPlot) {
+      values = m_analysis.radiusOfGyration();
+      yLabel = tr("Radius of Gyration (Angstrom)");
+    }
+    else if (type == RmsfPlot) {
+      values = m_analysis.rmsf();
+      xLabel = tr("Atom");
+      yLabel = tr("RMSF (Angstrom)");
+    }
+    else if (type == RdfPlot) {
+      values = m_rdf.distribution();
+      positions = m_rdf.radii();
+      xLabel = tr("Distance (Angstrom)");
+      yLabel = tr("g(r)");
+    }
+    else {
+      int i = type - MeasurementPlot;
+      values = m_analysis.measurement(i);
+      yLabel = m_analysis.measurementAtoms(i).size() == 2 ? tr("Distance (Angstrom)")
+                                                         : tr("Degrees");
+    }
+    if (values.isEmpty())
+      return;
+
+    // Frames and atoms are numbered from 1
+    if (positions.isEmpty())
+      for (int i = 0; i < values.size(); ++i)
+        positions.append(i + 1);
+
+    PlotObject *object = new PlotObject(Qt::red, PlotObject::Lines, 2);
+    double minimum = values[0], maximum = values[0];
+    for (int i = 0; i < values.size(); ++i) {
+      object->addPoint(positions[i], values[i]);
+      minimum = qMin(minimum, values[i]);
+      maximum = qMax(maximum, values[i]);
+    }
+    double margin = qMax(0.05 * (maximum - minimum), 1.0e-3);
+
+    ui.plot->removeAllPlotObjects();
+    ui.plot->addPlotObject(object);
+    ui.plot->setDefaultLimits(positions.first(),
+                              qMax(positions.last(), positions.first() + 1.0),
+                              minimum - margin, maximum + margin);
+    ui.plot->axis(PlotWidget::BottomAxis)->setLabel(xLabel);
+    ui.plot->axis(PlotWidget::LeftAxis)->setLabel(yLabel);
+    ui.plot->update();
+  }
+
+  void TrajectoryAnalysisDialog::plotContacts()
+  {
+    // Residue pairs in contact in at least half of the frames
+    const int n = m_contacts.numResidues();
+    const QVector<double> frequencies = m_contacts.frequencies();
+    PlotObject *object = new PlotObject(Qt::red, PlotObject::Points, 3);
+    for (int i = 0; i < n; ++i)
+      for (int j = 0; j < n; ++j)
+        if (frequencies[i * n + j] >= 0.5)
+          object->addPoint(i + 1, j + 1);
+
+    ui.plot->removeAllPlotObjects();
+    ui.plot->addPlotObject(object);
+    ui.plot->setDefaultLimits(0.5, n + 0.5, 0.5, n + 0.5);
+    ui.plot->axis(PlotWidget::BottomAxis)->setLabel(tr("Residue"));
+    ui.plot->axis(PlotWidget::LeftAxis)->setLabel(tr("Residue"));
+    ui.plot->update();
+  }
+}
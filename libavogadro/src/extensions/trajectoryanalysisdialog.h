@@ -0,0 +1,90 @@
+/**********************************************************************
+  TrajectoryAnalysisDialog - Plot properties of trajectory frames
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef TRAJECTORYANALYSISDIALOG_H
+#define TRAJECTORYANALYSISDIALOG_H
+
+#include "ui_trajectoryanalysisdialog.h"
+
+#include <avogadro/trajectoryanalysis.h>
+#include <avogadro/radialdistribution.h>
+#include <avogadro/contactmap.h>
+
+#include <QDialog>
+#include <QFutureWatcher>
+#include <QPointer>
+
+namespace Avogadro
+{
+  class GLWidget;
+  class Molecule;
+
+  class TrajectoryAnalysisDialog : public QDialog
+  {
+  Q_OBJECT
+
+  public:
+    explicit TrajectoryAnalysisDialog( QWidget *parent = 0, Qt::WindowFlags f = 0 );
+    ~TrajectoryAnalysisDialog();
+
+    void setMolecule(Molecule *molecule);
+    //! The widget whose selection gives the fit atoms and measurements
+    void setWidget(GLWidget *widget);
+
+  private Q_SLOTS:
+    void browseClicked();
+    void addMeasurementClicked();
+    void removeMeasurementClicked();
+    void analyzeClicked();
+    void analysisFinished();
+    void plotChanged(int index);
+
+  private:
+    //! The indices of the selected atoms
+    QList<int> selectedAtoms() const;
+    //! Run the requested analyses, called in a worker thread
+    bool runAnalysis();
+    //! Plot the residue pairs that are mostly in contact
+    void plotContacts();
+
+    enum PlotType { RmsdPlot, RadiusPlot, RmsfPlot, RdfPlot, ContactPlot,
+                    MeasurementPlot };
+
+    Ui::TrajectoryAnalysisDialog ui;
+
+    QPointer<Molecule> m_molecule;
+    QPointer<GLWidget> m_widget;
+    QList<QList<int> > m_measurements;
+
+    TrajectoryAnalysis m_analysis;
+    RadialDistribution m_rdf;
+    ContactMap m_contacts;
+    bool m_rdfDone, m_contactsDone;
+    TrajectoryFrameSource *m_source;
+    bool m_locked;      // a read lock on the molecule is held during a run
+    QFutureWatcher<bool> m_watcher;
+  };
+}
+
+#endif
@@ -0,0 +1,80 @@
+/**********************************************************************
+  TrajectoryAnalysisExtension - Analysis of trajectories and conformers
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "trajectoryanalysisextension.h"
+#include "trajectoryanalysisdialog.h"
+
+#include <avogadro/glwidget.h>
+#include <avogadro/molecule.h>
+
+#include <QAction>
+
+namespace Avogadro {
+
+  TrajectoryAnalysisExtension::TrajectoryAnalysisExtension(QObject *parent)
+    : Extension(parent), m_dialog(0), m_molecule(0)
+  {
+    QAction *action = new QAction(this);
+    action->setText(tr("Trajectory Analysis..."));
+    m_actions.append(action);
+  }
+
+  TrajectoryAnalysisExtension::~TrajectoryAnalysisExtension()
+  {
+    if (m_dialog)
+      m_dialog->deleteLater();
+  }
+
+  QList<QAction *> TrajectoryAnalysisExtension::actions() const
+  {
+    return m_actions;
+  }
+
+  QString TrajectoryAnalysisExtension::menuPath(QAction *) const
+  {
+    return tr("E&xtensions");
+  }
+
+  void TrajectoryAnalysisExtension::setMolecule(Molecule *molecule)
+  {
+    m_molecule = molecule;
+    if (m_dialog)
+      m_dialog->setMolecule(molecule);
+  }
+
+  QUndoCommand* TrajectoryAnalysisExtension::performAction(QAction *, GLWidget *widget)
+  {
+    if (!m_dialog)
+      m_dialog = new TrajectoryAnalysisDialog(qobject_cast<QWidget*>(parent()));
+
+    m_dialog->setMolecule(m_molecule);
+    m_dialog->setWidget(widget);
+    m_dialog->show();
+
+    return 0;
+  }
+
+} // end namespace Avogadro
+
+Q_EXPORT_PLUGIN2(trajectoryanalysisextension, Avogadro::TrajectoryAnalysisExtensionFactory)
@@ -0,0 +1,66 @@
+/**********************************************************************
+  TrajectoryAnalysisExtension - Analysis of trajectories and conformers
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef TRAJECTORYANALYSISEXTENSION_H
+#define TRAJECTORYANALYSISEXTENSION_H
+
+#include <avogadro/extension.h>
+
+namespace Avogadro {
+
+  class TrajectoryAnalysisDialog;
+
+  class TrajectoryAnalysisExtension : public Extension
+  {
+  Q_OBJECT
+  AVOGADRO_EXTENSION("TrajectoryAnalysis", tr("Trajectory Analysis"),
+                     tr("Plot RMSD, RMSF, radius of gyration and geometry along trajectories"))
+  public:
+    //! Constructor
+    TrajectoryAnalysisExtension(QObject *parent=0);
+    //! Destructor
+    ~TrajectoryAnalysisExtension();
+
+    //! Perform Action
+    QList<QAction *> actions() const;
+    QUndoCommand* performAction(QAction *action, GLWidget *widget);
+    QString menuPath(QAction *action) const;
+    void setMolecule(Molecule *molecule);
+
+  private:
+    QList<QAction *> m_actions;
+    TrajectoryAnalysisDialog *m_dialog;
+    Molecule *m_molecule;
+  };
+
+  class TrajectoryAnalysisExtensionFactory : public QObject, public PluginFactory
+  {
+    Q_OBJECT
+    Q_INTERFACES(Avogadro::PluginFactory)
+    AVOGADRO_EXTENSION_FACTORY(TrajectoryAnalysisExtension)
+  };
+
+} // end namespace Avogadro
+
+#endif
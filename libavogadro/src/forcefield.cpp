@@ -0,0 +1,1238 @@
+/**********************************************************************
+  ForceField - Native multithreaded force field evaluator and minimizers
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "forcefield.h"
+
+#include <avogadro/molecule.h>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QThread>
+#include <QtCore/QtConcurrentMap>
+#include <QDebug>
+
+#include <openbabel/mol.h>
+#include <openbabel/data.h>
+#include <openbabel/generic.h>
+#include <openbabel/forcefield.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  // Conversion used by OpenBabel, the UFF parameters are in kcal/mol
+  static const double CAL_TO_J = 4.1868;
+  static const double COULOMB = 332.0637 * CAL_TO_J;
+
+  // Below this many pairs the thread pool costs more than it saves
+  static const int PARALLEL_THRESHOLD = 2000;
+
+  struct UFFParameter
+  {
+    double r1;      // bond radius
+    double theta0;  // natural angle in degrees
+    double x1;      // van der Waals distance
+    double D1;      // van der Waals well depth
+    double Z1;      // effective charge
+    double Vi;      // sp3 torsional barrier
+    double Uj;      // sp2 torsional barrier
+    double Xi;      // GMP electronegativity
+  };
+
+  struct BondCalc
+  {
+    int a, b;
+    double r0, kb;
+  };
+
+  struct AngleCalc
+  {
+    int a, b, c;        // b is the vertex
+    int coordination;   // 1, 2, 4 or 6 select the special forms
+    double ka, c0, c1, c2;
+  };
+
+  struct TorsionCalc
+  {
+    int a, b, c, d;
+    double n, V, cosNPhi0;
+  };
+
+  struct InversionCalc
+  {
+    int center, a, b, out;  // out of the plane of center, a and b
+    double koop, c0, c1, c2;
+  };
+
+  struct NonbondedPair
+  {
+    int i, j;
+  };
+
+  class ForceFieldPrivate;
+
+  struct EvaluationBlock
+  {
+    ForceFieldPrivate *d;
+    int term;
+    int begin, end;
+    bool gradient;
+    double energy;
+    QVector<double> grad;
+  };
+
+  class ForceFieldPrivate
+  {
+  public:
+    ForceFieldPrivate() : setup(false), numAtoms(0), cutoff(10.0), skin(1.0),
+      electrostatics(false), multithreaded(true), pairsDirty(true),
+      rmsGradient(0.0) {}
+
+    bool setup;
+    int numAtoms;
+    double cutoff;
+    double skin;
+    bool electrostatics;
+    bool multithreaded;
+
+    QVector<double> coords;
+    QVector<bool> fixed;
+
+    // Interaction terms, indices are 0 based atom indices into coords
+    QVector<BondCalc> bonds;
+    QVector<AngleCalc> angles;
+    QVector<TorsionCalc> torsions;
+    QVector<InversionCalc> inversions;
+
+    // Nonbonded parameters per atom, stored as square roots so that the
+    // combination rules are plain products
+    QVector<double> sqrtX;
+    QVector<double> sqrtD;
+    QVector<double> charges;  // scaled by sqrt(COULOMB)
+    QVector<QVector<int> > excluded;  // sorted 1-2 and 1-3 partners
+
+    // Verlet list, everything within cutoff + skin of the reference coords
+    QVector<NonbondedPair> pairs;
+    QVector<double> pairCoords;
+    bool pairsDirty;
+
+    QVector<EvaluationBlock> blocks;
+    double rmsGradient;
+
+    void clear();
+    bool isExcluded(int i, int j) const;
+    void updatePairs();
+    void buildPairs();
+
+    double evaluate(double *gradient, int terms);
+    static void runBlock(EvaluationBlock &block);
+
+    double bondEnergy(const double *x, double *g, int begin, int end) const;
+    double angleEnergy(const double *x, double *g, int begin, int end) const;
+    double torsionEnergy(const double *x, double *g, int begin, int end) const;
+    double inversionEnergy(const double *x, double *g, int begin, int end) const;
+    double nonbondedEnergy(const double *x, double *g, int begin, int end,
+                           int terms) const;
+
+    bool lineSearch(const QVector<double> &direction, double &energy,
+                    QVector<double> &gradient, double &step);
+    double rms(const QVector<double> &gradient) const;
+  };
+
+  static inline Vector3d position(const double *x, int i)
+  {
+    return Vector3d(x[3*i], x[3*i+1], x[3*i+2]);
+  }
+
+  static inline void addGradient(double *g, int i, const Vector3d &v)
+  {
+    g[3*i] += v.x();
+    g[3*i+1] += v.y();
+    g[3*i+2] += v.z();
+  }
+
+  static inline double dot(const QVector<double> &a, const QVector<double> &b)
+  {
+    double sum = 0.0;
+    for (int i = 0; i < a.size(); ++i)
+      sum += a[i] * b[i];
+    return sum;
+  }
+
+  void ForceFieldPrivate::clear()
+  {
+    setup = false;
+    numAtoms = 0;
+    coords.clear();
+    fixed.clear();
+    bonds.clear();
+    angles.clear();
+    torsions.clear();
+    inversions.clear();
+    sqrtX.clear();
+    sqrtD.clear();
+    charges.clear();
+    excluded.clear();
+    pairs.clear();
+    pairCoords.clear();
+    pairsDirty = true;
+  }
+
+  bool ForceFieldPrivate::isExcluded(int i, int j) const
+  {
+    const QVector<int> &list = excluded[i];
+    return std::binary_search(list.constBegin(), list.constEnd(), j);
+  }
+
+  void ForceFieldPrivate::updatePairs()
+  {
+    if (!pairsDirty) {
+      // The list stays valid until an atom moved by half the skin
+      double limit = 0.25 * skin * skin;
+      for (int i = 0; i < numAtoms; ++i) {
+        double dx = coords[3*i] - pairCoords[3*i];
+        double dy = coords[3*i+1] - pairCoords[3*i+1];
+        double dz = coords[3*i+2] - pairCoords[3*i+2];
+        if (dx*dx + dy*dy + dz*dz > limit) {
+          pairsDirty = true;
+          break;
+        }
+      }
+    }
+    if (pairsDirty)
+      buildPairs();
+  }
+
+  void ForceFieldPrivate::buildPairs()
+  {
+    pairs.clear();
+    const double *x = coords.constData();
+
+    if (cutoff <= 0.0) {
+      for (int i = 0; i < numAtoms; ++i)
+        for (int j = i + 1; j < numAtoms; ++j)
+          if (!isExcluded(i, j)) {
+            NonbondedPair pair = {i, j};
+            pairs.append(pair);
+          }
+    }
+    else if (numAtoms) {
+      double listCutoff = cutoff + skin;
+      double listCutoff2 = listCutoff * listCutoff;
+
+      Vector3d min = position(x, 0), max = min;
+      for (int i = 1; i < numAtoms; ++i) {
+        Vector3d p = position(x, i);
+        for (int k = 0; k < 3; ++k) {
+          if (p[k] < min[k]) min[k] = p[k];
+          if (p[k] > max[k]) max[k] = p[k];
+        }
+      }
+
+      // Cells at least as large as the list cutoff so only the 27
+      // surrounding cells need to be searched, grown for sparse systems
+      double cellSize = listCutoff;
+      int dim[3];
+      for (;;) {
+        for (int k = 0; k < 3; ++k)
+          dim[k] = static_cast<int>((max[k] - min[k]) / cellSize) + 1;
+        if (static_cast<double>(dim[0]) * dim[1] * dim[2] <= 8.0 * numAtoms + 27)
+          break;
+        cellSize *= 2.0;
+      }
+
+      QVector<int> cell(numAtoms);
+      QVector<int> head(dim[0] * dim[1] * dim[2], -1);
+      QVector<int> next(numAtoms, -1);
+      for (int i = 0; i < numAtoms; ++i) {
+        Vector3d p = position(x, i) - min;
+        int cx = static_cast<int>(p.x() / cellSize);
+        int cy = static_cast<int>(p.y() / cellSize);
+        int cz = static_cast<int>(p.z() / cellSize);
+        cell[i] = (cx * dim[1] + cy) * dim[2] + cz;
+        next[i] = head[cell[i]];
+        head[cell[i]] = i;
+      }
+
+      for (int i = 0; i < numAtoms; ++i) {
+        Vector3d p = position(x, i);
+        int cx = cell[i] / (dim[1] * dim[2]);
+        int cy = (cell[i] / dim[2]) % dim[1];
+        int cz = cell[i] % dim[2];
+        for (int ix = qMax(cx - 1, 0); ix <= qMin(cx + 1, dim[0] - 1); ++ix)
+          for (int iy = qMax(cy - 1, 0); iy <= qMin(cy + 1, dim[1] - 1); ++iy)
+            for (int iz = qMax(cz - 1, 0); iz <= qMin(cz + 1, dim[2] - 1); ++iz)
+              for (int j = head[(ix * dim[1] + iy) * dim[2] + iz]; j != -1;
+                   j = next[j]) {
+                if (j <= i)
+                  continue;
+                if ((position(x, j) - p).squaredNorm() > listCutoff2)
+                  continue;
+                if (isExcluded(i, j))
+                  continue;
+                NonbondedPair pair = {i, j};
+                pairs.append(pair);
+              }
+      }
+    }
+
+    pairCoords = coords;
+    pairsDirty = false;
+  }
+
+  double ForceFieldPrivate::bondEnergy(const double *x, double *g,
+                                       int begin, int end) const
+  {
+    double energy = 0.0;
+    for (int n = begin; n < end; ++n) {
+      const BondCalc &bond = bonds[n];
+      Vector3d ab = position(x, bond.a) - position(x, bond.b);
+      double r = ab.norm();
+      double delta = r - bond.r0;
+      energy += bond.kb * delta * delta;
+      if (g && r > 1.0e-10) {
+        Vector3d f = (2.0 * bond.kb * delta / r) * ab;
+        addGradient(g, bond.a, f);
+        addGradient(g, bond.b, -f);
+      }
+    }
+    return energy;
+  }
+
+  double ForceFieldPrivate::angleEnergy(const double *x, double *g,
+                                        int begin, int end) const
+  {
+    // Written in terms of cos(theta) throughout, which avoids dividing by
+    // sin(theta) for linear angles
+    double energy = 0.0;
+    for (int n = begin; n < end; ++n) {
+      const AngleCalc &angle = angles[n];
+      Vector3d vertex = position(x, angle.b);
+      Vector3d ba = position(x, angle.a) - vertex;
+      Vector3d bc = position(x, angle.c) - vertex;
+      double la = ba.norm(), lc = bc.norm();
+      if (la < 1.0e-10 || lc < 1.0e-10)
+        continue;
+      double c = ba.dot(bc) / (la * lc);
+      if (c > 1.0) c = 1.0;
+      if (c < -1.0) c = -1.0;
+
+      double e, dEdc;
+      const double k = angle.ka;
+      switch (angle.coordination) {
+        case 1: // linear, K (1 + cos theta)
+          e = k * (1.0 + c);
+          dEdc = k;
+          break;
+        case 2: // trigonal planar, K/9 (1 - cos 3 theta)
+          e = k / 9.0 * (1.0 - (4.0 * c * c * c - 3.0 * c));
+          dEdc = k / 9.0 * (3.0 - 12.0 * c * c);
+          break;
+        case 4: // square planar and octahedral, K/16 (1 - cos 4 theta)
+        case 6:
+          e = k / 16.0 * (8.0 * c * c - 8.0 * c * c * c * c);
+          dEdc = k * (c - 2.0 * c * c * c);
+          break;
+        default: // K (C0 + C1 cos theta + C2 cos 2 theta)
+          e = k * (angle.c0 + angle.c1 * c + angle.c2 * (2.0 * c * c - 1.0));
+          dEdc = k * (angle.c1 + 4.0 * angle.c2 * c);
+      }
+      energy += e;
+
+      if (g) {
+        Vector3d ua = ba / la, uc = bc / lc;
+        Vector3d ga = (dEdc / la) * (uc - c * ua);
+        Vector3d gc = (dEdc / lc) * (ua - c * uc);
+        addGradient(g, angle.a, ga);
+        addGradient(g, angle.c, gc);
+        addGradient(g, angle.b, -(ga + gc));
+      }
+    }
+    return energy;
+  }
+
+  double ForceFieldPrivate::torsionEnergy(const double *x, double *g,
+                                          int begin, int end) const
+  {
+    double energy = 0.0;
+    for (int n = begin; n < end; ++n) {
+      const TorsionCalc &torsion = torsions[n];
+      Vector3d pb = position(x, torsion.b), pc = position(x, torsion.c);
+      Vector3d b1 = pb - position(x, torsion.a);
+      Vector3d b2 = pc - pb;
+      Vector3d b3 = position(x, torsion.d) - pc;
+      Vector3d m = b1.cross(b2), nn = b2.cross(b3);
+      double m2 = m.squaredNorm(), n2 = nn.squaredNorm();
+      if (m2 < 1.0e-12 || n2 < 1.0e-12)
+        continue;
+      double lb2 = b2.norm();
+      double phi = atan2(lb2 * b1.dot(nn), m.dot(nn));
+
+      energy += torsion.V * (1.0 - torsion.cosNPhi0 * cos(torsion.n * phi));
+
+      if (g) {
+        double dEdphi = torsion.V * torsion.cosNPhi0 * torsion.n
+          * sin(torsion.n * phi);
+        Vector3d ga = (-lb2 / m2) * m;
+        Vector3d gd = (lb2 / n2) * nn;
+        double p = b1.dot(b2) / (lb2 * lb2);
+        double q = b3.dot(b2) / (lb2 * lb2);
+        Vector3d gb = q * gd - (p + 1.0) * ga;
+        Vector3d gc = p * ga - (q + 1.0) * gd;
+        addGradient(g, torsion.a, dEdphi * ga);
+        addGradient(g, torsion.b, dEdphi * gb);
+        addGradient(g, torsion.c, dEdphi * gc);
+        addGradient(g, torsion.d, dEdphi * gd);
+      }
+    }
+    return energy;
+  }
+
+  double ForceFieldPrivate::inversionEnergy(const double *x, double *g,
+                                            int begin, int end) const
+  {
+    // Y is the angle between the bond to the out of plane atom and the
+    // plane of the other two bonds, s = sin Y = n.u
+    double energy = 0.0;
+    for (int n = begin; n < end; ++n) {
+      const InversionCalc &inv = inversions[n];
+      Vector3d center = position(x, inv.center);
+      Vector3d a = position(x, inv.a) - center;
+      Vector3d b = position(x, inv.b) - center;
+      Vector3d c = position(x, inv.out) - center;
+      Vector3d m = a.cross(b);
+      double lm = m.norm(), lc = c.norm();
+      if (lm < 1.0e-10 || lc < 1.0e-10)
+        continue;
+      Vector3d normal = m / lm, u = c / lc;
+      double s = normal.dot(u);
+      if (s > 1.0) s = 1.0;
+      if (s < -1.0) s = -1.0;
+      double cosY = sqrt(1.0 - s * s);
+
+      energy += inv.koop * (inv.c0 + inv.c1 * cosY + inv.c2 * (1.0 - 2.0 * s * s));
+
+      if (g) {
+        double dEds = -4.0 * inv.koop * inv.c2 * s;
+        if (cosY > 1.0e-8)
+          dEds -= inv.koop * inv.c1 * s / cosY;
+        Vector3d gout = (dEds / lc) * (normal - s * u);
+        Vector3d ga = (dEds / lm) * (b.cross(u) - s * b.cross(normal));
+        Vector3d gb = (dEds / lm) * (u.cross(a) - s * normal.cross(a));
+        addGradient(g, inv.out, gout);
+        addGradient(g, inv.a, ga);
+        addGradient(g, inv.b, gb);
+        addGradient(g, inv.center, -(gout + ga + gb));
+      }
+    }
+    return energy;
+  }
+
+  double ForceFieldPrivate::nonbondedEnergy(const double *x, double *g,
+                                            int begin, int end, int terms) const
+  {
+    const double cutoff2 = cutoff > 0.0 ? cutoff * cutoff : 0.0;
+    const bool vdw = terms & ForceField::VanDerWaals;
+    const bool coulomb = electrostatics && (terms & ForceField::Electrostatic);
+
+    double energy = 0.0;
+    for (int n = begin; n < end; ++n) {
+      const int i = pairs[n].i, j = pairs[n].j;
+      double dx = x[3*i] - x[3*j];
+      double dy = x[3*i+1] - x[3*j+1];
+      double dz = x[3*i+2] - x[3*j+2];
+      double r2 = dx*dx + dy*dy + dz*dz;
+      if (cutoff2 > 0.0 && r2 > cutoff2)
+        continue;
+      if (r2 < 1.0e-10)
+        continue;
+
+      // dE/dr divided by r, so the gradient is this times the separation
+      double dEdr = 0.0;
+      if (vdw) {
+        // Lennard-Jones 12-6, D [(x/r)^12 - 2 (x/r)^6]
+        double xij = sqrtX[i] * sqrtX[j];
+        double Dij = sqrtD[i] * sqrtD[j];
+        double t2 = xij * xij / r2;
+        double t6 = t2 * t2 * t2;
+        double t12 = t6 * t6;
+        energy += Dij * (t12 - 2.0 * t6);
+        dEdr += 12.0 * Dij * (t6 - t12) / r2;
+      }
+      if (coulomb) {
+        double e = charges[i] * charges[j] / sqrt(r2);
+        energy += e;
+        dEdr -= e / r2;
+      }
+
+      if (g) {
+        g[3*i] += dEdr * dx;
+        g[3*i+1] += dEdr * dy;
+        g[3*i+2] += dEdr * dz;
+        g[3*j] -= dEdr * dx;
+        g[3*j+1] -= dEdr * dy;
+        g[3*j+2] -= dEdr * dz;
+      }
+    }
+    return energy;
+  }
+
+  void ForceFieldPrivate::runBlock(EvaluationBlock &block)
+  {
+    const ForceFieldPrivate *d = block.d;
+    double *g = 0;
+    if (block.gradient) {
+      block.grad.fill(0.0, 3 * d->numAtoms);
+      g = block.grad.data();
+    }
+    const double *x = d->coords.constData();
+
+    switch (block.term) {
+      case ForceField::BondStretch:
+        block.energy = d->bondEnergy(x, g, block.begin, block.end);
+        break;
+      case ForceField::AngleBend:
+        block.energy = d->angleEnergy(x, g, block.begin, block.end);
+        break;
+      case ForceField::Torsion:
+        block.energy = d->torsionEnergy(x, g, block.begin, block.end);
+        break;
+      case ForceField::Inversion:
+        block.energy = d->inversionEnergy(x, g, block.begin, block.end);
+        break;
+      default:
+        block.energy = d->nonbondedEnergy(x, g, block.begin, block.end,
+                                          block.term);
+    }
+  }
+
+  double ForceFieldPrivate::evaluate(double *gradient, int terms)
+  {
+    const int nonbondedTerms = ForceField::VanDerWaals | ForceField::Electrostatic;
+    if (terms & nonbondedTerms)
+      updatePairs();
+
+    // One block per bonded term, the nonbonded pairs are split evenly over
+    // the threads. Every block owns its gradient buffer so that no locking
+    // is needed, they are summed afterwards.
+    bool parallel = multithreaded && pairs.size() > PARALLEL_THRESHOLD;
+    int nonbondedBlocks = 0;
+    if (terms & nonbondedTerms && !pairs.isEmpty())
+      nonbondedBlocks = parallel ? qMax(QThread::idealThreadCount(), 1) : 1;
+
+    int numBlocks = 0;
+    const int bondedTerms[4] = { ForceField::BondStretch, ForceField::AngleBend,
+                                 ForceField::Torsion, ForceField::Inversion };
+    const int bondedCounts[4] = { bonds.size(), angles.size(),
+                                  torsions.size(), inversions.size() };
+    blocks.resize(4 + nonbondedBlocks);
+    for (int t = 0; t < 4; ++t) {
+      if (!(terms & bondedTerms[t]) || !bondedCounts[t])
+        continue;
+      EvaluationBlock &block = blocks[numBlocks++];
+      block.term = bondedTerms[t];
+      block.begin = 0;
+      block.end = bondedCounts[t];
+    }
+    for (int b = 0; b < nonbondedBlocks; ++b) {
+      EvaluationBlock &block = blocks[numBlocks++];
+      block.term = terms & nonbondedTerms;
+      block.begin = pairs.size() * b / nonbondedBlocks;
+      block.end = pairs.size() * (b + 1) / nonbondedBlocks;
+    }
+    blocks.resize(numBlocks);
+    for (int b = 0; b < numBlocks; ++b) {
+      blocks[b].d = this;
+      blocks[b].gradient = gradient != 0;
+    }
+
+    if (parallel && numBlocks > 1)
+      QtConcurrent::blockingMap(blocks, runBlock);
+    else
+      for (int b = 0; b < numBlocks; ++b)
+        runBlock(blocks[b]);
+
+    double energy = 0.0;
+    for (int b = 0; b < numBlocks; ++b)
+      energy += blocks[b].energy;
+
+    if (gradient) {
+      const int size = 3 * numAtoms;
+      for (int k = 0; k < size; ++k)
+        gradient[k] = 0.0;
+      for (int b = 0; b < numBlocks; ++b) {
+        const double *g = blocks[b].grad.constData();
+        for (int k = 0; k < size; ++k)
+          gradient[k] += g[k];
+      }
+      for (int i = 0; i < numAtoms; ++i)
+        if (fixed[i])
+          gradient[3*i] = gradient[3*i+1] = gradient[3*i+2] = 0.0;
+    }
+
+    return energy;
+  }
+
+  double ForceFieldPrivate::rms(const QVector<double> &gradient) const
+  {
+    if (!numAtoms)
+      return 0.0;
+    return sqrt(dot(gradient, gradient) / (3 * numAtoms));
+  }
+
+  bool ForceFieldPrivate::lineSearch(const QVector<double> &direction,
+                                     double &energy, QVector<double> &gradient,
+                                     double &step)
+  {
+    // Backtracking until the Armijo condition holds
+    const double slope = dot(gradient, direction);
+    if (slope >= 0.0)
+      return false;
+
+    // Never move an atom by more than 0.3 Angstrom in one step, far from
+    // the minimum the gradient can be huge
+    double maxDisplacement2 = 0.0;
+    for (int i = 0; i < numAtoms; ++i) {
+      double d2 = direction[3*i] * direction[3*i]
+        + direction[3*i+1] * direction[3*i+1]
+        + direction[3*i+2] * direction[3*i+2];
+      if (d2 > maxDisplacement2)
+        maxDisplacement2 = d2;
+    }
+    const double maxStep = 0.3;
+    if (step * step * maxDisplacement2 > maxStep * maxStep)
+      step = maxStep / sqrt(maxDisplacement2);
+
+    QVector<double> start = coords;
+    QVector<double> trialGradient(gradient.size());
+    for (int trial = 0; trial < 30; ++trial) {
+      for (int k = 0; k < coords.size(); ++k)
+        coords[k] = start[k] + step * direction[k];
+      double trialEnergy = evaluate(trialGradient.data(), ForceField::AllTerms);
+      if (trialEnergy <= energy + 1.0e-4 * step * slope) {
+        energy = trialEnergy;
+        qSwap(gradient, trialGradient);
+        return true;
+      }
+      step *= 0.5;
+    }
+
+    coords = start;
+    return false;
+  }
+
+  ForceField::ForceField() : d(new ForceFieldPrivate)
+  {
+  }
+
+  ForceField::~ForceField()
+  {
+    delete d;
+  }
+
+  bool ForceField::isSetup() const
+  {
+    return d->setup;
+  }
+
+  int ForceField::numAtoms() const
+  {
+    return d->numAtoms;
+  }
+
+  void ForceField::setCutoff(double cutoff)
+  {
+    if (cutoff == d->cutoff)
+      return;
+    d->cutoff = cutoff;
+    d->pairsDirty = true;
+  }
+
+  double ForceField::cutoff() const
+  {
+    return d->cutoff;
+  }
+
+  void ForceField::setElectrostatics(bool enabled)
+  {
+    d->electrostatics = enabled;
+  }
+
+  bool ForceField::electrostatics() const
+  {
+    return d->electrostatics;
+  }
+
+  void ForceField::setMultithreaded(bool enabled)
+  {
+    d->multithreaded = enabled;
+  }
+
+  bool ForceField::isMultithreaded() const
+  {
+    return d->multithreaded;
+  }
+
+  void ForceField::setFixedAtom(int index, bool fixed)
+  {
+    if (index >= 0 && index < d->numAtoms)
+      d->fixed[index] = fixed;
+  }
+
+  void ForceField::clearFixedAtoms()
+  {
+    d->fixed.fill(false);
+  }
+
+  void ForceField::setCoordinates(const double *coordinates)
+  {
+    for (int k = 0; k < d->coords.size(); ++k)
+      d->coords[k] = coordinates[k];
+  }
+
+  const QVector<double> & ForceField::coordinates() const
+  {
+    return d->coords;
+  }
+
+  double ForceField::energy(int terms)
+  {
+    if (!d->setup)
+      return 0.0;
+    return d->evaluate(0, terms);
+  }
+
+  double ForceField::energy(QVector<double> &gradient, int terms)
+  {
+    gradient.resize(3 * d->numAtoms);
+    if (!d->setup)
+      return 0.0;
+    return d->evaluate(gradient.data(), terms);
+  }
+
+  int ForceField::minimize(Algorithm algorithm, int maxSteps,
+                           double gradientTolerance)
+  {
+    if (!d->setup || !d->numAtoms)
+      return 0;
+
+    const int size = 3 * d->numAtoms;
+    QVector<double> gradient(size);
+    double energy = d->evaluate(gradient.data(), AllTerms);
+    QVector<double> direction(size);
+    double step = 0.1;
+    int steps = 0;
+
+    // History for CG and L-BFGS
+    QVector<double> lastGradient;
+    const int memory = 8;
+    QVector<QVector<double> > sHistory, yHistory;
+    QVector<double> rhoHistory;
+    QVector<double> lastCoords;
+    bool steepest = true;
+
+    while (steps < maxSteps) {
+      d->rmsGradient = d->rms(gradient);
+      if (d->rmsGradient < gradientTolerance)
+        break;
+
+      switch (algorithm) {
+        case SteepestDescent:
+          for (int k = 0; k < size; ++k)
+            direction[k] = -gradient[k];
+          step = qMin(step * 1.2, 1.0);
+          steepest = true;
+          break;
+
+        case ConjugateGradients:
+          steepest = lastGradient.isEmpty() || steps % size == 0;
+          if (steepest) {
+            for (int k = 0; k < size; ++k)
+              direction[k] = -gradient[k];
+          }
+          else {
+            // Polak-Ribiere, reset whenever it is negative
+            double beta = (dot(gradient, gradient) - dot(gradient, lastGradient))
+              / dot(lastGradient, lastGradient);
+            if (beta < 0.0)
+              beta = 0.0;
+            for (int k = 0; k < size; ++k)
+              direction[k] = -gradient[k] + beta * direction[k];
+            if (dot(direction, gradient) >= 0.0) {
+              steepest = true;
+              for (int k = 0; k < size; ++k)
+                direction[k] = -gradient[k];
+            }
+          }
+          lastGradient = gradient;
+          step = qMin(step * 2.0, 1.0);
+          break;
+
+        case LBFGS: {
+          // Two loop recursion over the stored curvature pairs
+          for (int k = 0; k < size; ++k)
+            direction[k] = -gradient[k];
+          int count = sHistory.size();
+          steepest = count == 0;
+          QVector<double> alpha(count);
+          for (int h = count - 1; h >= 0; --h) {
+            alpha[h] = rhoHistory[h] * dot(sHistory[h], direction);
+            for (int k = 0; k < size; ++k)
+              direction[k] -= alpha[h] * yHistory[h][k];
+          }
+          if (count) {
+            double gamma = dot(sHistory.last(), yHistory.last())
+              / dot(yHistory.last(), yHistory.last());
+            for (int k = 0; k < size; ++k)
+              direction[k] *= gamma;
+          }
+          for (int h = 0; h < count; ++h) {
+            double beta = rhoHistory[h] * dot(yHistory[h], direction);
+            for (int k = 0; k < size; ++k)
+              direction[k] += (alpha[h] - beta) * sHistory[h][k];
+          }
+          if (dot(direction, gradient) >= 0.0) {
+            sHistory.clear();
+            yHistory.clear();
+            rhoHistory.clear();
+            steepest = true;
+            for (int k = 0; k < size; ++k)
+              direction[k] = -gradient[k];
+          }
+          lastGradient = gradient;
+          lastCoords = d->coords;
+          step = steepest ? 0.1 : 1.0;
+          break;
+        }
+      }
+
+      ++steps;
+      if (!d->lineSearch(direction, energy, gradient, step)) {
+        // No progress along this direction, start again from steepest
+        // descent once before giving up
+        if (steepest)
+          break;
+        lastGradient.clear();
+        sHistory.clear();
+        yHistory.clear();
+        rhoHistory.clear();
+        continue;
+      }
+
+      if (algorithm == LBFGS) {
+        QVector<double> s(size), y(size);
+        for (int k = 0; k < size; ++k) {
+          s[k] = d->coords[k] - lastCoords[k];
+          y[k] = gradient[k] - lastGradient[k];
+        }
+        double sy = dot(s, y);
+        if (sy > 1.0e-10) {
+          if (sHistory.size() == memory) {
+            sHistory.remove(0);
+            yHistory.remove(0);
+            rhoHistory.remove(0);
+          }
+          sHistory.append(s);
+          yHistory.append(y);
+          rhoHistory.append(1.0 / sy);
+        }
+      }
+    }
+
+    d->rmsGradient = d->rms(gradient);
+    return steps;
+  }
+
+  double ForceField::rmsGradient() const
+  {
+    return d->rmsGradient;
+  }
+
+  int ForceField::numNonbondedPairs()
+  {
+    if (!d->setup)
+      return 0;
+    d->updatePairs();
+    // The list includes the skin, count what is actually within the cutoff
+    if (d->cutoff <= 0.0)
+      return d->pairs.size();
+    const double cutoff2 = d->cutoff * d->cutoff;
+    const double *x = d->coords.constData();
+    int count = 0;
+    foreach (const NonbondedPair &pair, d->pairs)
+      if ((position(x, pair.i) - position(x, pair.j)).squaredNorm() <= cutoff2)
+        ++count;
+    return count;
+  }
+
+  QString ForceField::unit() const
+  {
+    return QString("kJ/mol");
+  }
+
+  /////////////////////////////////////////////////////////////////////////
+  // Setup from OpenBabel atom types and the UFF parameter file
+  /////////////////////////////////////////////////////////////////////////
+
+  static QHash<QString, UFFParameter> *uffParameters()
+  {
+    // Parsed once and shared by all instances
+    static QMutex mutex;
+    static QHash<QString, UFFParameter> *parameters = 0;
+    QMutexLocker locker(&mutex);
+    if (parameters)
+      return parameters;
+
+    parameters = new QHash<QString, UFFParameter>;
+    std::ifstream ifs;
+    if (OpenBabel::OpenDatafile(ifs, "UFF.prm").length() == 0) {
+      qWarning() << "ForceField: could not open UFF.prm";
+      return parameters;
+    }
+
+    // param  Atom r1 theta0 x1 D1 zeta Z1 Vi Uj Xi Hard Radius
+    std::string line;
+    while (std::getline(ifs, line)) {
+      QStringList fields = QString(line.c_str()).simplified().split(' ');
+      if (fields.size() < 11 || fields[0] != "param")
+        continue;
+      UFFParameter p;
+      p.r1 = fields[2].toDouble();
+      p.theta0 = fields[3].toDouble();
+      p.x1 = fields[4].toDouble();
+      p.D1 = fields[5].toDouble();
+      p.Z1 = fields[7].toDouble();
+      p.Vi = fields[8].toDouble();
+      p.Uj = fields[9].toDouble();
+      p.Xi = fields[10].toDouble();
+      parameters->insert(fields[1], p);
+    }
+    return parameters;
+  }
+
+  static double uffBondOrder(OpenBabel::OBBond *bond)
+  {
+    if (bond->IsAromatic())
+      return 1.5;
+    if (bond->IsAmide())
+      return 1.41;
+    return bond->GetBondOrder();
+  }
+
+  static double uffBondLength(const UFFParameter &i, const UFFParameter &j,
+                              double bondOrder)
+  {
+    // r0 = ri + rj + rBO - rEN
+    double rbo = -0.1332 * (i.r1 + j.r1) * log(bondOrder);
+    double sqrtDiff = sqrt(i.Xi) - sqrt(j.Xi);
+    double ren = i.r1 * j.r1 * sqrtDiff * sqrtDiff / (i.Xi * i.r1 + j.Xi * j.r1);
+    return i.r1 + j.r1 + rbo - ren;
+  }
+
+  static inline bool isGroup16(int atomicNumber)
+  {
+    return atomicNumber == 8 || atomicNumber == 16 || atomicNumber == 34
+      || atomicNumber == 52 || atomicNumber == 84;
+  }
+
+  bool ForceField::setup(const Molecule *molecule,
+                         OpenBabel::OBForceField *forceField)
+  {
+    if (!molecule)
+      return false;
+    OpenBabel::OBMol mol = molecule->OBMol();
+    return setup(mol, forceField);
+  }
+
+  bool ForceField::setup(OpenBabel::OBMol &mol,
+                         OpenBabel::OBForceField *forceField)
+  {
+    d->clear();
+
+    if (!forceField)
+      forceField = OpenBabel::OBForceField::FindForceField("UFF");
+    if (!forceField || QString(forceField->GetID()).toUpper() != "UFF") {
+      qDebug() << "ForceField: only UFF is implemented natively";
+      return false;
+    }
+
+    QHash<QString, UFFParameter> *parameters = uffParameters();
+    if (parameters->isEmpty())
+      return false;
+
+    // The only use of OpenBabel: atom typing and, for electrostatics, the
+    // partial charges
+    if (!forceField->Setup(mol) || !forceField->GetAtomTypes(mol))
+      return false;
+
+    const int n = mol.NumAtoms();
+    QVector<QString> types(n);
+    QVector<UFFParameter> atomParameters(n);
+    QVector<QVector<int> > neighbors(n);
+    d->coords.resize(3 * n);
+    d->sqrtX.resize(n);
+    d->sqrtD.resize(n);
+    d->charges.resize(n);
+
+    FOR_ATOMS_OF_MOL (atom, mol) {
+      int i = atom->GetIdx() - 1;
+      OpenBabel::OBPairData *type =
+        static_cast<OpenBabel::OBPairData *>(atom->GetData("FFAtomType"));
+      if (!type || !parameters->contains(type->GetValue().c_str())) {
+        qDebug() << "ForceField: no UFF parameters for atom" << i + 1;
+        return false;
+      }
+      types[i] = type->GetValue().c_str();
+      atomParameters[i] = parameters->value(types[i]);
+      d->coords[3*i] = atom->x();
+      d->coords[3*i+1] = atom->y();
+      d->coords[3*i+2] = atom->z();
+      d->sqrtX[i] = sqrt(atomParameters[i].x1);
+      d->sqrtD[i] = sqrt(atomParameters[i].D1 * CAL_TO_J);
+      d->charges[i] = atom->GetPartialCharge() * sqrt(COULOMB);
+      FOR_NBORS_OF_ATOM (nbr, &*atom)
+        neighbors[i].append(nbr->GetIdx() - 1);
+    }
+
+    // Bond stretching, E = 1/2 kb (r - r0)^2
+    FOR_BONDS_OF_MOL (bond, mol) {
+      BondCalc calc;
+      calc.a = bond->GetBeginAtomIdx() - 1;
+      calc.b = bond->GetEndAtomIdx() - 1;
+      const UFFParameter &pa = atomParameters[calc.a];
+      const UFFParameter &pb = atomParameters[calc.b];
+      calc.r0 = uffBondLength(pa, pb, uffBondOrder(&*bond));
+      calc.kb = 0.5 * CAL_TO_J * 664.12 * pa.Z1 * pb.Z1
+        / (calc.r0 * calc.r0 * calc.r0);
+      d->bonds.append(calc);
+    }
+
+    // Angle bending around every atom
+    for (int b = 0; b < n; ++b) {
+      const QString &type = types[b];
+      const UFFParameter &pb = atomParameters[b];
+      double theta0 = pb.theta0 * M_PI / 180.0;
+      double cosT0 = cos(theta0), sinT0 = sin(theta0);
+      int coordination = 3;
+      if (type.size() > 2) {
+        QChar hybrid = type[2];
+        if (hybrid == '1')
+          coordination = 1;
+        else if (hybrid == '2' || hybrid == 'R')
+          coordination = 2;
+        else if (hybrid == '4')
+          coordination = 4;
+        else if (hybrid == '6')
+          coordination = 6;
+      }
+
+      for (int i = 0; i < neighbors[b].size(); ++i)
+        for (int j = i + 1; j < neighbors[b].size(); ++j) {
+          AngleCalc calc;
+          calc.a = neighbors[b][i];
+          calc.b = b;
+          calc.c = neighbors[b][j];
+          calc.coordination = coordination;
+          const UFFParameter &pa = atomParameters[calc.a];
+          const UFFParameter &pc = atomParameters[calc.c];
+          double rab = uffBondLength(pa, pb,
+            uffBondOrder(mol.GetBond(calc.a + 1, b + 1)));
+          double rbc = uffBondLength(pb, pc,
+            uffBondOrder(mol.GetBond(b + 1, calc.c + 1)));
+          double rac = sqrt(rab * rab + rbc * rbc - 2.0 * rab * rbc * cosT0);
+          calc.ka = CAL_TO_J * 664.12 * pa.Z1 * pc.Z1 / pow(rac, 5.0)
+            * (3.0 * rab * rbc * (1.0 - cosT0 * cosT0) - rac * rac * cosT0);
+          calc.c2 = 1.0 / (4.0 * sinT0 * sinT0);
+          calc.c1 = -4.0 * calc.c2 * cosT0;
+          calc.c0 = calc.c2 * (2.0 * cosT0 * cosT0 + 1.0);
+          d->angles.append(calc);
+        }
+    }
+
+    // Torsions around every bond between sp2 or sp3 atoms
+    FOR_BONDS_OF_MOL (bond, mol) {
+      int b = bond->GetBeginAtomIdx() - 1;
+      int c = bond->GetEndAtomIdx() - 1;
+      if (neighbors[b].size() < 2 || neighbors[c].size() < 2)
+        continue;
+      QChar hb = types[b].size() > 2 ? types[b][2] : QChar(' ');
+      QChar hc = types[c].size() > 2 ? types[c][2] : QChar(' ');
+      bool sp3b = hb == '3', sp3c = hc == '3';
+      bool sp2b = hb == '2' || hb == 'R', sp2c = hc == '2' || hc == 'R';
+      if (!(sp3b || sp2b) || !(sp3c || sp2c))
+        continue;
+
+      const UFFParameter &pb = atomParameters[b];
+      const UFFParameter &pc = atomParameters[c];
+      int zb = mol.GetAtom(b + 1)->GetAtomicNum();
+      int zc = mol.GetAtom(c + 1)->GetAtomicNum();
+      double bondOrder = uffBondOrder(&*bond);
+
+      TorsionCalc calc;
+      double V, cosNPhi0;
+      if (sp3b && sp3c) {
+        // Staggered, except between two group 16 atoms (e.g. H2O2)
+        V = sqrt(pb.Vi * pc.Vi);
+        calc.n = 3.0;
+        cosNPhi0 = -1.0;
+        if (isGroup16(zb) && isGroup16(zc)) {
+          double vb = zb == 8 ? 2.0 : 6.8;
+          double vc = zc == 8 ? 2.0 : 6.8;
+          V = sqrt(vb * vc);
+          calc.n = 2.0;
+          cosNPhi0 = -1.0;
+        }
+      }
+      else if (sp2b && sp2c) {
+        V = 5.0 * sqrt(pb.Uj * pc.Uj) * (1.0 + 4.18 * log(bondOrder));
+        calc.n = 2.0;
+        cosNPhi0 = 1.0;
+      }
+      else {
+        // sp2-sp3
+        V = 1.0;
+        calc.n = 6.0;
+        cosNPhi0 = 1.0;
+        int sp3Atom = sp3b ? b : c, sp2Atom = sp3b ? c : b;
+        int zSp3 = sp3b ? zb : zc;
+        if (isGroup16(zSp3)) {
+          V = 5.0 * sqrt(pb.Uj * pc.Uj) * (1.0 + 4.18 * log(bondOrder));
+          calc.n = 2.0;
+          cosNPhi0 = -1.0;
+        }
+        else {
+          // Propene like, the sp2 atom is bonded to another sp2 atom
+          foreach (int nbr, neighbors[sp2Atom]) {
+            if (nbr == sp3Atom || types[nbr].size() < 3)
+              continue;
+            if (types[nbr][2] == '2' || types[nbr][2] == 'R') {
+              V = 2.0;
+              calc.n = 3.0;
+              cosNPhi0 = -1.0;
+              break;
+            }
+          }
+        }
+      }
+
+      // Shared between all the torsions about this bond
+      double count = (neighbors[b].size() - 1) * (neighbors[c].size() - 1);
+      calc.V = 0.5 * CAL_TO_J * V / count;
+      calc.cosNPhi0 = cosNPhi0;
+      calc.b = b;
+      calc.c = c;
+      foreach (int a, neighbors[b]) {
+        if (a == c)
+          continue;
+        foreach (int dd, neighbors[c]) {
+          if (dd == b || dd == a)
+            continue;
+          calc.a = a;
+          calc.d = dd;
+          d->torsions.append(calc);
+        }
+      }
+    }
+
+    // Inversions on sp2 carbon and nitrogen and the group 15 centers
+    for (int i = 0; i < n; ++i) {
+      if (neighbors[i].size() != 3)
+        continue;
+      const QString &type = types[i];
+      InversionCalc calc;
+      if (type == "C_2" || type == "C_R") {
+        calc.c0 = 1.0;
+        calc.c1 = -1.0;
+        calc.c2 = 0.0;
+        calc.koop = 6.0;
+        foreach (int nbr, neighbors[i])
+          if (types[nbr] == "O_2")
+            calc.koop = 50.0;
+      }
+      else if (type == "N_2" || type == "N_R") {
+        calc.c0 = 1.0;
+        calc.c1 = -1.0;
+        calc.c2 = 0.0;
+        calc.koop = 6.0;
+      }
+      else {
+        double omega0;
+        if (type == "P_3+3")
+          omega0 = 84.4339;
+        else if (type == "As3+3")
+          omega0 = 86.9735;
+        else if (type == "Sb3+3")
+          omega0 = 87.7047;
+        else if (type == "Bi3+3")
+          omega0 = 90.0;
+        else
+          continue;
+        omega0 *= M_PI / 180.0;
+        calc.c1 = -4.0 * cos(omega0);
+        calc.c2 = 1.0;
+        calc.c0 = -calc.c1 * cos(omega0) + calc.c2 * cos(2.0 * omega0);
+        calc.koop = 22.0 / (calc.c0 + calc.c1 + calc.c2);
+      }
+      // Averaged over the three choices of the out of plane atom
+      calc.koop *= CAL_TO_J / 3.0;
+      calc.center = i;
+      for (int k = 0; k < 3; ++k) {
+        calc.a = neighbors[i][k];
+        calc.b = neighbors[i][(k + 1) % 3];
+        calc.out = neighbors[i][(k + 2) % 3];
+        d->inversions.append(calc);
+      }
+    }
+
+    // Van der Waals and electrostatics skip 1-2 and 1-3 pairs
+    d->excluded.resize(n);
+    for (int i = 0; i < n; ++i) {
+      QVector<int> &list = d->excluded[i];
+      foreach (int j, neighbors[i]) {
+        list.append(j);
+        foreach (int k, neighbors[j])
+          if (k != i)
+            list.append(k);
+      }
+      std::sort(list.begin(), list.end());
+      list.erase(std::unique(list.begin(), list.end()), list.end());
+    }
+
+    d->numAtoms = n;
+    d->fixed.fill(false, n);
+    d->pairsDirty = true;
+    d->setup = true;
+    return true;
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,205 @@
+/**********************************************************************
+  ForceField - Native multithreaded force field evaluator and minimizers
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef FORCEFIELD_H
+#define FORCEFIELD_H
+
+#include <avogadro/global.h>
+
+#include <QVector>
+#include <QString>
+
+namespace OpenBabel {
+  class OBMol;
+  class OBForceField;
+}
+
+namespace Avogadro {
+
+  class Molecule;
+  class ForceFieldPrivate;
+
+  /**
+   * @class ForceField forcefield.h <avogadro/forcefield.h>
+   * @brief Native force field energies, gradients and minimization.
+   *
+   * OpenBabel is only used once, in setup(), to assign the atom types. The
+   * parameters are then resolved into flat arrays of bond, angle, torsion
+   * and inversion terms, and the nonbonded pairs are found with a cell list
+   * that is only rebuilt when an atom moved more than half the skin
+   * distance. Evaluation is split into blocks that run on all cores with
+   * QtConcurrent, each block accumulating into its own gradient buffer.
+   *
+   * The functional forms and parameters are those of UFF (Rappe et al.,
+   * J. Am. Chem. Soc. 1992, 114, 10024) as implemented by OpenBabel, so that
+   * energies can be checked against OBForceField. setup() fails for other
+   * force fields and callers should fall back to OBForceField. Since the
+   * OBForceField is set up on @p mol, pass a private instance (see
+   * OBForceField::MakeNewInstance()) when several threads call setup().
+   *
+   * Coordinates are flat arrays of x, y, z in atom index order, energies
+   * are in kJ/mol and gradients in kJ/mol/Angstrom.
+   *
+   * @code
+   * ForceField ff;
+   * if (ff.setup(molecule)) {
+   *   ff.minimize(ForceField::LBFGS, 500);
+   *   molecule->setAtomPositions(ff.coordinates().constData());
+   * }
+   * @endcode
+   */
+  class A_EXPORT ForceField
+  {
+  public:
+    /**
+     * Energy terms, combine them to evaluate part of the energy.
+     */
+    enum Term {
+      BondStretch = 0x01,
+      AngleBend = 0x02,
+      Torsion = 0x04,
+      Inversion = 0x08,
+      VanDerWaals = 0x10,
+      Electrostatic = 0x20,
+      AllTerms = 0x3f
+    };
+
+    enum Algorithm {
+      SteepestDescent = 0,
+      ConjugateGradients,
+      LBFGS
+    };
+
+    ForceField();
+    ~ForceField();
+
+    /**
+     * Type the atoms of @p mol with @p forceField, or UFF if it is 0, and
+     * build the interaction terms from its current coordinates. The atom
+     * types are written to @p mol as "FFAtomType" pair data.
+     * @return false if the force field is not supported natively or some
+     * atom could not be parametrized.
+     */
+    bool setup(OpenBabel::OBMol &mol, OpenBabel::OBForceField *forceField = 0);
+
+    /**
+     * Convenience overload that sets up from Molecule::OBMol().
+     */
+    bool setup(const Molecule *molecule, OpenBabel::OBForceField *forceField = 0);
+
+    /**
+     * @return true if setup() succeeded.
+     */
+    bool isSetup() const;
+
+    /**
+     * @return The number of atoms of the molecule that was set up.
+     */
+    int numAtoms() const;
+
+    /**
+     * Set the cutoff distance for the nonbonded terms in Angstrom, 0 or a
+     * negative value includes all pairs. The default is 10 Angstrom.
+     */
+    void setCutoff(double cutoff);
+    double cutoff() const;
+
+    /**
+     * Include the Coulomb interaction between the partial charges assigned
+     * by the force field. UFF does not use it and the default is false.
+     */
+    void setElectrostatics(bool enabled);
+    bool electrostatics() const;
+
+    /**
+     * Spread the evaluation over the global QThreadPool, the default. Turn
+     * it off when running one force field per worker thread.
+     */
+    void setMultithreaded(bool enabled);
+    bool isMultithreaded() const;
+
+    /**
+     * Keep the atom with @p index (0 based) in place during minimization.
+     */
+    void setFixedAtom(int index, bool fixed = true);
+
+    /**
+     * Release all fixed atoms.
+     */
+    void clearFixedAtoms();
+
+    /**
+     * Replace the coordinates, @p coordinates must hold 3 * numAtoms()
+     * values.
+     */
+    void setCoordinates(const double *coordinates);
+
+    /**
+     * @return The current coordinates.
+     */
+    const QVector<double> & coordinates() const;
+
+    /**
+     * @return The energy of the current coordinates restricted to @p terms.
+     */
+    double energy(int terms = AllTerms);
+
+    /**
+     * @return The energy of the current coordinates and its gradient in
+     * @p gradient, which is resized to 3 * numAtoms(). Fixed atoms have a
+     * zero gradient.
+     */
+    double energy(QVector<double> &gradient, int terms = AllTerms);
+
+    /**
+     * Minimize the energy in place, stopping after @p maxSteps iterations
+     * or once the RMS gradient falls below @p gradientTolerance.
+     * @return The number of steps taken.
+     */
+    int minimize(Algorithm algorithm, int maxSteps,
+                 double gradientTolerance = 1.0e-3);
+
+    /**
+     * @return The RMS gradient at the end of the last minimize() call.
+     */
+    double rmsGradient() const;
+
+    /**
+     * @return The number of nonbonded pairs within the cutoff.
+     */
+    int numNonbondedPairs();
+
+    /**
+     * @return "kJ/mol".
+     */
+    QString unit() const;
+
+  private:
+    ForceFieldPrivate * const d;
+    Q_DISABLE_COPY(ForceField)
+  };
+
+} // End namespace Avogadro
+
+#endif
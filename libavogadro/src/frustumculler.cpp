@@ -0,0 +1,355 @@
+/**********************************************************************
+  FrustumCuller - Camera-aware visibility and level of detail service
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "frustumculler.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+#include <avogadro/camera.h>
+#include <avogadro/molecule.h>
+
+#include <QHash>
+#include <QVector>
+
+#include <cmath>
+#include <cstring>
+
+// Smallest edge of a grid cell in Angstrom
+#define CULLER_MIN_CELL_SIZE 4.0
+// Largest number of cells along each axis of the grid
+#define CULLER_MAX_CELLS_PER_AXIS 64
+// Padding added to the cell bounding spheres, large enough to cover the
+// largest VdW radius plus the selection halo
+#define CULLER_CELL_MARGIN 3.5
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  class FrustumCullerPrivate
+  {
+  public:
+    FrustumCullerPrivate() : enabled(true), gridDirty(true), cellsDirty(true),
+      coarseThreshold(3.0), molecule(0), numAtoms(0), firstPos(0),
+      projectionScale(0.0), height(0)
+    {
+      memset(mvp, 0, sizeof(mvp));
+      memset(modelview, 0, sizeof(modelview));
+    }
+
+    bool enabled;
+    bool gridDirty;
+    bool cellsDirty;
+    double coarseThreshold;
+
+    // What the grid was built from, to catch changes nobody told us about
+    const Molecule *molecule;
+    unsigned int numAtoms;
+    const Vector3d *firstPos;
+
+    // The view the cells were last tested against
+    double mvp[16];
+    double modelview[16];
+    double projectionScale;
+    int height;
+
+    QVector<int> atomCell;          // cell index indexed by atom id, -1 if none
+    QVector<Vector3d> cellCenters;  // bounding sphere of each occupied cell
+    QVector<double> cellRadii;
+    QVector<char> cellDetail;       // FrustumCuller::Detail of each cell
+
+    void buildGrid();
+    void testCells();
+
+    inline FrustumCuller::Detail detail(unsigned long id) const
+    {
+      if (static_cast<int>(id) >= atomCell.size() || atomCell[id] < 0)
+        return FrustumCuller::Full; // Unknown atom, never cull it
+      return static_cast<FrustumCuller::Detail>(cellDetail[atomCell[id]]);
+    }
+  };
+
+  void FrustumCullerPrivate::buildGrid()
+  {
+    atomCell.clear();
+    cellCenters.clear();
+    cellRadii.clear();
+    cellDetail.clear();
+
+    QList<Atom *> atoms = molecule->atoms();
+    numAtoms = atoms.size();
+    firstPos = numAtoms ? atoms.first()->pos() : 0;
+    if (!numAtoms)
+      return;
+
+    // Bounding box of the molecule
+    Vector3d min = *atoms.first()->pos();
+    Vector3d max = min;
+    unsigned long maxId = 0;
+    foreach (const Atom *a, atoms) {
+      const Vector3d &pos = *a->pos();
+      for (int i = 0; i < 3; ++i) {
+        if (pos[i] < min[i]) min[i] = pos[i];
+        if (pos[i] > max[i]) max[i] = pos[i];
+      }
+      if (a->id() > maxId)
+        maxId = a->id();
+    }
+
+    // Pick a cell size that keeps the grid bounded for very large systems
+    Vector3d extent = max - min;
+    double longest = qMax(extent.x(), qMax(extent.y(), extent.z()));
+    double cellSize = qMax(CULLER_MIN_CELL_SIZE,
+                           longest / CULLER_MAX_CELLS_PER_AXIS);
+    int dim = static_cast<int>(longest / cellSize) + 1;
+
+    // Bin the atoms, only occupied cells are stored
+    atomCell.fill(-1, maxId + 1);
+    QHash<int, int> cellIndex;
+    QVector<Vector3d> cellMin, cellMax;
+    foreach (const Atom *a, atoms) {
+      const Vector3d &pos = *a->pos();
+      int i = static_cast<int>((pos.x() - min.x()) / cellSize);
+      int j = static_cast<int>((pos.y() - min.y()) / cellSize);
+      int k = static_cast<int>((pos.z() - min.z()) / cellSize);
+      int key = (i * dim + j) * dim + k;
+
+      QHash<int, int>::const_iterator it = cellIndex.constFind(key);
+      int cell;
+      if (it == cellIndex.constEnd()) {
+        cell = cellMin.size();
+        cellIndex.insert(key, cell);
+        cellMin.push_back(pos);
+        cellMax.push_back(pos);
+      }
+      else {
+        cell = it.value();
+        Vector3d &cmin = cellMin[cell];
+        Vector3d &cmax = cellMax[cell];
+        for (int c = 0; c < 3; ++c) {
+          if (pos[c] < cmin[c]) cmin[c] = pos[c];
+          if (pos[c] > cmax[c]) cmax[c] = pos[c];
+        }
+      }
+      atomCell[a->id()] = cell;
+    }
+
+    // Bounding spheres of the atoms actually in each cell
+    int numCells = cellMin.size();
+    cellCenters.resize(numCells);
+    cellRadii.resize(numCells);
+    cellDetail.fill(FrustumCuller::Full, numCells);
+    for (int c = 0; c < numCells; ++c) {
+      cellCenters[c] = (cellMin[c] + cellMax[c]) * 0.5;
+      cellRadii[c] = (cellMax[c] - cellMin[c]).norm() * 0.5 + CULLER_CELL_MARGIN;
+    }
+  }
+
+  void FrustumCullerPrivate::testCells()
+  {
+    // The six frustum planes from the combined projection and modelview
+    // matrix (column major), normalized so that distances are in Angstrom
+    double planes[6][4];
+    for (int p = 0; p < 6; ++p) {
+      int row = p / 2;
+      double sign = (p % 2) ? -1.0 : 1.0;
+      for (int c = 0; c < 4; ++c)
+        planes[p][c] = mvp[c*4 + 3] + sign * mvp[c*4 + row];
+      double norm = sqrt(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1]
+                         + planes[p][2] * planes[p][2]);
+      if (norm > 0.0)
+        for (int c = 0; c < 4; ++c)
+          planes[p][c] /= norm;
+    }
+
+    for (int cell = 0; cell < cellCenters.size(); ++cell) {
+      const Vector3d &center = cellCenters[cell];
+      double radius = cellRadii[cell];
+
+      FrustumCuller::Detail detail = FrustumCuller::Full;
+      for (int p = 0; p < 6; ++p) {
+        if (planes[p][0] * center.x() + planes[p][1] * center.y()
+            + planes[p][2] * center.z() + planes[p][3] < -radius) {
+          detail = FrustumCuller::Hidden;
+          break;
+        }
+      }
+
+      if (detail == FrustumCuller::Full && coarseThreshold > 0.0) {
+        // Depth of the closest atom of the cell along the viewing direction
+        double depth = -(modelview[2] * center.x() + modelview[6] * center.y()
+                         + modelview[10] * center.z() + modelview[14])
+                       - (radius - CULLER_CELL_MARGIN);
+        if (depth > 0.0 && projectionScale / depth < coarseThreshold)
+          detail = FrustumCuller::Coarse;
+      }
+      cellDetail[cell] = detail;
+    }
+  }
+
+  FrustumCuller::FrustumCuller() : d(new FrustumCullerPrivate)
+  {
+  }
+
+  FrustumCuller::~FrustumCuller()
+  {
+    delete d;
+  }
+
+  void FrustumCuller::setEnabled(bool enabled)
+  {
+    d->enabled = enabled;
+  }
+
+  bool FrustumCuller::isEnabled() const
+  {
+    return d->enabled;
+  }
+
+  void FrustumCuller::setCoarseThreshold(double pixelsPerAngstrom)
+  {
+    d->coarseThreshold = pixelsPerAngstrom;
+    d->cellsDirty = true;
+  }
+
+  double FrustumCuller::coarseThreshold() const
+  {
+    return d->coarseThreshold;
+  }
+
+  void FrustumCuller::invalidate()
+  {
+    d->gridDirty = true;
+  }
+
+  void FrustumCuller::update(const Molecule *molecule, const Camera *camera,
+                             int height)
+  {
+    if (!molecule || !camera)
+      return;
+
+    // Adding atoms or switching conformers without an update signal
+    if (molecule != d->molecule || molecule->numAtoms() != d->numAtoms
+        || (d->numAtoms && molecule->atoms().first()->pos() != d->firstPos))
+      d->gridDirty = true;
+
+    if (d->gridDirty) {
+      d->molecule = molecule;
+      d->buildGrid();
+      d->gridDirty = false;
+      d->cellsDirty = true;
+    }
+
+    Matrix4d mvp = camera->projection().matrix() * camera->modelview().matrix();
+    if (height != d->height || memcmp(mvp.data(), d->mvp, sizeof(d->mvp))) {
+      memcpy(d->mvp, mvp.data(), sizeof(d->mvp));
+      memcpy(d->modelview, camera->modelview().matrix().data(),
+             sizeof(d->modelview));
+      // Pixels covered by one Angstrom at unit depth
+      d->height = height;
+      d->projectionScale = camera->projection().matrix()(1, 1) * height * 0.5;
+      d->cellsDirty = true;
+    }
+
+    if (d->cellsDirty) {
+      d->testCells();
+      d->cellsDirty = false;
+    }
+  }
+
+  FrustumCuller::Detail FrustumCuller::detail(const Atom *atom) const
+  {
+    if (!d->enabled)
+      return Full;
+    return d->detail(atom->id());
+  }
+
+  FrustumCuller::Detail FrustumCuller::detail(const Bond *bond) const
+  {
+    if (!d->enabled)
+      return Full;
+    return qMax(d->detail(bond->beginAtomId()), d->detail(bond->endAtomId()));
+  }
+
+  QList<Atom *> FrustumCuller::visibleAtoms(const QList<Atom *> &atoms,
+                                            QList<Atom *> *coarse) const
+  {
+    if (!d->enabled)
+      return atoms;
+
+    QList<Atom *> visible;
+    foreach (Atom *a, atoms) {
+      switch (d->detail(a->id())) {
+        case Full:
+          visible.append(a);
+          break;
+        case Coarse:
+          if (coarse)
+            coarse->append(a);
+          else
+            visible.append(a);
+          break;
+        default:
+          break;
+      }
+    }
+    return visible;
+  }
+
+  QList<Bond *> FrustumCuller::visibleBonds(const QList<Bond *> &bonds,
+                                            QList<Bond *> *coarse) const
+  {
+    if (!d->enabled)
+      return bonds;
+
+    QList<Bond *> visible;
+    foreach (Bond *b, bonds) {
+      switch (detail(b)) {
+        case Full:
+          visible.append(b);
+          break;
+        case Coarse:
+          if (coarse)
+            coarse->append(b);
+          else
+            visible.append(b);
+          break;
+        default:
+          break;
+      }
+    }
+    return visible;
+  }
+
+  int FrustumCuller::numberOfCells() const
+  {
+    return d->cellDetail.size();
+  }
+
+  int FrustumCuller::numberOfCells(Detail detail) const
+  {
+    return d->cellDetail.count(static_cast<char>(detail));
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,158 @@
+/**********************************************************************
+  FrustumCuller - Camera-aware visibility and level of detail service
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef FRUSTUMCULLER_H
+#define FRUSTUMCULLER_H
+
+#include <avogadro/global.h>
+
+#include <QList>
+
+namespace Avogadro {
+
+  class Atom;
+  class Bond;
+  class Camera;
+  class Molecule;
+  class FrustumCullerPrivate;
+
+  /**
+   * @class FrustumCuller frustumculler.h <avogadro/frustumculler.h>
+   * @brief Visibility and level of detail service shared by the engines.
+   *
+   * The atoms of the Molecule are binned into a uniform spatial grid, and
+   * the bounding sphere of each occupied cell is tested against the view
+   * frustum of the Camera. Cells outside the frustum are hidden, cells so
+   * far away that an atom covers only a few pixels are flagged as coarse so
+   * that engines can draw them with a cheaper representation (points or
+   * lines).
+   *
+   * The grid is only rebuilt after invalidate() has been called, and the
+   * cell tests are only redone when the camera moves, so querying the
+   * visible subset is cheap once per frame.
+   *
+   * Engines normally access the culler through
+   * PainterDevice::visibleAtoms() and PainterDevice::visibleBonds().
+   */
+  class A_EXPORT FrustumCuller
+  {
+  public:
+    /**
+     * The level of detail a primitive should be rendered at.
+     */
+    enum Detail {
+      Hidden = 0, /// Outside of the view frustum, do not render
+      Coarse,     /// Far from the viewer, render a cheap representation
+      Full        /// Render normally
+    };
+
+    FrustumCuller();
+    ~FrustumCuller();
+
+    /**
+     * Enable or disable the culler. A disabled culler reports every
+     * primitive as fully visible. Culling must be disabled when the
+     * rendered geometry is reused under a different transformation, e.g.
+     * in display lists replayed while rotating or for crystal cells.
+     */
+    void setEnabled(bool enabled);
+
+    /**
+     * @return true if the culler is enabled.
+     */
+    bool isEnabled() const;
+
+    /**
+     * Set the scale below which cells are considered coarse, in pixels per
+     * Angstrom at the closest point of the cell (default 3.0). Use 0.0 to
+     * disable the level of detail fallback.
+     */
+    void setCoarseThreshold(double pixelsPerAngstrom);
+
+    /**
+     * @return the coarse level of detail threshold in pixels per Angstrom.
+     */
+    double coarseThreshold() const;
+
+    /**
+     * Mark the spatial grid as out of date. This must be called whenever
+     * atoms are added, removed or moved.
+     */
+    void invalidate();
+
+    /**
+     * Bring the culler up to date for the supplied molecule and view,
+     * rebuilding the spatial grid if it was invalidated and retesting the
+     * cells if the camera or viewport changed.
+     * @param molecule the molecule being rendered.
+     * @param camera the camera the scene is viewed through.
+     * @param height the height of the viewport in pixels.
+     */
+    void update(const Molecule *molecule, const Camera *camera, int height);
+
+    /**
+     * @return the level of detail the atom should be rendered at.
+     */
+    Detail detail(const Atom *atom) const;
+
+    /**
+     * @return the level of detail the bond should be rendered at, the
+     * finer level of detail of its two atoms.
+     */
+    Detail detail(const Bond *bond) const;
+
+    /**
+     * @return the atoms of @p atoms that should be rendered at full detail.
+     * @param coarse if non-zero the atoms that should be rendered coarsely
+     * are appended to it, otherwise they are included in the returned list.
+     */
+    QList<Atom *> visibleAtoms(const QList<Atom *> &atoms,
+                               QList<Atom *> *coarse = 0) const;
+
+    /**
+     * @return the bonds of @p bonds that should be rendered at full detail.
+     * @param coarse if non-zero the bonds that should be rendered coarsely
+     * are appended to it, otherwise they are included in the returned list.
+     */
+    QList<Bond *> visibleBonds(const QList<Bond *> &bonds,
+                               QList<Bond *> *coarse = 0) const;
+
+    /**
+     * @return the number of occupied grid cells.
+     */
+    int numberOfCells() const;
+
+    /**
+     * @return the number of grid cells at the given level of detail.
+     */
+    int numberOfCells(Detail detail) const;
+
+  private:
+    FrustumCullerPrivate * const d;
+    Q_DISABLE_COPY(FrustumCuller)
+  };
+
+} // End namespace Avogadro
+
+#endif
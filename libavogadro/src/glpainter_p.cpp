@@ -24,6 +24,12 @@
   02110-1301, USA.
  **********************************************************************/
 
+#include "config.h"
+
+#ifdef ENABLE_GLSL
+  #include <GL/glew.h>
+#endif
+
 #include "glpainter_p.h"
 #include "glwidget.h"
 #include "camera.h"
@@ -101,7 +107,14 @@ namespace Avogadro
     GLPainterPrivate() : widget ( 0 ), newQuality(-1), quality ( 0 ), overflow(0),
                          spheres ( 0 ), cylinders ( 0 ),
                          textRenderer ( new TextRenderer ), initialized ( false ), sharing ( 0 ),
-                         type(Primitive::OtherType), id ( -1 ), color(0)  {};
+                         type(Primitive::OtherType), id ( -1 ), color(0),
+                         primitives(0), vertices(0)
+    {
+      for (int q = 0; q < PAINTER_GLOBAL_QUALITY_SETTINGS; ++q) {
+        sphereSets[q] = 0;
+        cylinderSets[q] = 0;
+      }
+    }
     ~GLPainterPrivate()
     {
       deleteObjects();
@@ -127,6 +140,15 @@ namespace Avogadro
      */
     Cylinder **cylinders;
 
+    /** The spheres and cylinders of each quality that was used. Widgets
+     * sharing the painter may draw at different qualities, and their
+     * display lists call those of the spheres and cylinders, so the sets
+     * are kept until the painter is deleted. spheres and cylinders point
+     * to the set of the current quality.
+     */
+    Sphere **sphereSets[PAINTER_GLOBAL_QUALITY_SETTINGS];
+    Cylinder **cylinderSets[PAINTER_GLOBAL_QUALITY_SETTINGS];
+
     TextRenderer *textRenderer;
 
     bool initialized;
@@ -145,6 +167,15 @@ namespace Avogadro
     Primitive::Type type;
     int id;
     Color color;
+
+    // Running totals of what has been sent to OpenGL, for the profiler
+    int primitives;
+    int vertices;
+    inline void count(int prims, int verts)
+    {
+      primitives += prims;
+      vertices += verts;
+    }
   };
 
   inline bool GLPainterPrivate::isValid()
@@ -168,8 +199,6 @@ namespace Avogadro
     {
       if(newQuality != quality)
       {
-        qDebug() << "updateObjects()";
-        deleteObjects();
         quality = newQuality;
         createObjects();
       }
@@ -181,46 +210,54 @@ namespace Avogadro
   void GLPainterPrivate::deleteObjects()
   {
     int level, lastLevel, n;
-    // delete the spheres. One has to be wary that more than one sphere
-    // pointer may have the same value. One wants to avoid deleting twice the same sphere.
-    if (spheres) {
-      lastLevel = -1;
-      for (n = 0; n < PAINTER_DETAIL_LEVELS; ++n) {
-        level = PAINTER_SPHERES_LEVELS_ARRAY[quality][n];
-        if (level != lastLevel) {
-          lastLevel = level;
-          if (spheres[n]) {
-            delete spheres[n];
-            spheres[n] = 0;
+    for (int q = 0; q < PAINTER_GLOBAL_QUALITY_SETTINGS; ++q) {
+      // delete the spheres. One has to be wary that more than one sphere
+      // pointer may have the same value. One wants to avoid deleting twice the same sphere.
+      if (Sphere **set = sphereSets[q]) {
+        lastLevel = -1;
+        for (n = 0; n < PAINTER_DETAIL_LEVELS; ++n) {
+          level = PAINTER_SPHERES_LEVELS_ARRAY[q][n];
+          if (level != lastLevel) {
+            lastLevel = level;
+            if (set[n]) {
+              delete set[n];
+              set[n] = 0;
+            }
           }
         }
+        delete[] set;
+        sphereSets[q] = 0;
       }
-      delete[] spheres;
-      spheres = 0;
-    }
 
-    // delete the cylinders. One has to be wary that more than one cylinder
-    // pointer may have the same value. One wants to avoid deleting twice the same cylinder.
-    if (cylinders)
-    {
-      lastLevel = -1;
-      for (n = 0; n < PAINTER_DETAIL_LEVELS; ++n) {
-        level = PAINTER_CYLINDERS_LEVELS_ARRAY[quality][n];
-        if (level != lastLevel) {
-          lastLevel = level;
-          if (cylinders[n]) {
-            delete cylinders[n];
-            cylinders[n] = 0;
+      // delete the cylinders. One has to be wary that more than one cylinder
+      // pointer may have the same value. One wants to avoid deleting twice the same cylinder.
+      if (Cylinder **set = cylinderSets[q])
+      {
+        lastLevel = -1;
+        for (n = 0; n < PAINTER_DETAIL_LEVELS; ++n) {
+          level = PAINTER_CYLINDERS_LEVELS_ARRAY[q][n];
+          if (level != lastLevel) {
+            lastLevel = level;
+            if (set[n]) {
+              delete set[n];
+              set[n] = 0;
+            }
           }
         }
+        delete[] set;
+        cylinderSets[q] = 0;
       }
-      delete[] cylinders;
-      cylinders = 0;
     }
+    spheres = 0;
+    cylinders = 0;
   }
 
   void GLPainterPrivate::createObjects()
   {
+    // Sets of qualities used before are reused
+    spheres = sphereSets[quality];
+    cylinders = cylinderSets[quality];
+
     // create the spheres. More than one sphere detail level may have the same value.
     // in that case we want to reuse the corresponding sphere by just copying the pointer,
     // instead of creating redundant spheres.
@@ -261,6 +298,8 @@ namespace Avogadro
         }
       }
     }
+    sphereSets[quality] = spheres;
+    cylinderSets[quality] = cylinders;
   }
 
   GLPainter::GLPainter(int quality) : d(new GLPainterPrivate),
@@ -342,6 +381,34 @@ namespace Avogadro
     pushName();
     d->spheres[detailLevel]->draw (center, radius);
     popName();
+    d->count(1, d->spheres[detailLevel]->vertexCount());
+  }
+
+  void GLPainter::drawPoint(const Eigen::Vector3d &center, double radius)
+  {
+    if(!d->isValid())
+      return;
+
+    // Apparent diameter of the sphere in pixels
+    const Camera *camera = d->widget->camera();
+    double distance = camera->distance(center);
+    double size = 1.0;
+    if (distance > 0.0)
+      size = radius * camera->projection().matrix()(1, 1)
+             * d->widget->height() / distance;
+    if (size < 1.0)
+      size = 1.0;
+
+    glDisable(GL_LIGHTING);
+    d->color.apply();
+    glPointSize(size);
+    pushName();
+    glBegin(GL_POINTS);
+    glVertex3dv(center.data());
+    glEnd();
+    popName();
+    d->count(1, 1);
+    glEnable(GL_LIGHTING);
   }
 
   void GLPainter::drawCylinder ( const Eigen::Vector3d &end1, const Eigen::Vector3d &end2,
@@ -368,6 +435,7 @@ namespace Avogadro
     pushName();
     d->cylinders[detailLevel]->draw ( end1, end2, radius );
     popName();
+    d->count(1, d->cylinders[detailLevel]->vertexCount());
   }
 
   void GLPainter::drawMultiCylinder ( const Eigen::Vector3d &end1, const Eigen::Vector3d &end2,
@@ -395,6 +463,8 @@ namespace Avogadro
     d->cylinders[detailLevel]->drawMulti ( end1, end2, radius, order,
                                            shift, d->widget->normalVector() );
     popName();
+    int cylinders = order > 1 ? order : 1;
+    d->count(cylinders, cylinders * d->cylinders[detailLevel]->vertexCount());
   }
 
   void GLPainter::drawCone(const Eigen::Vector3d &base,
@@ -446,6 +516,7 @@ namespace Avogadro
       glVertex3dv(v.data());
     }
     glEnd();
+    d->count(1, 4 * CONE_TESS_LEVEL + 2);
   }
 
   void GLPainter::drawLine(const Eigen::Vector3d &start, const Eigen::Vector3d &end,
@@ -464,6 +535,7 @@ namespace Avogadro
     glVertex3dv(start.data());
     glVertex3dv(end.data());
     glEnd();
+    d->count(1, 2);
 
     glEnable(GL_LIGHTING);
   }
@@ -537,6 +609,8 @@ namespace Avogadro
     }
     glDisable(GL_LINE_STIPPLE);
     glPopMatrix();
+    int lines = order > 1 ? order : 1;
+    d->count(lines, 2 * lines);
 
     glEnable(GL_LIGHTING);
   }
@@ -579,6 +653,7 @@ namespace Avogadro
     glVertex3dv(tp2.data());
     glVertex3dv(tp3.data());
     glEnd();
+    d->count(1, 3);
   }
 
   void GLPainter::drawTriangle(const Eigen::Vector3d &p1, const Eigen::Vector3d &p2,
@@ -596,6 +671,7 @@ namespace Avogadro
     glVertex3dv(p2.data());
     glVertex3dv(p3.data());
     glEnd();
+    d->count(1, 3);
   }
 
   void GLPainter::drawSpline(const QVector<Eigen::Vector3d>& pts, double radius)
@@ -988,6 +1064,7 @@ namespace Avogadro
     glDrawArrays(GL_TRIANGLES, 0, v.size());
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_NORMAL_ARRAY);
+    d->count(v.size() / 3, v.size());
 
     glPolygonMode(GL_FRONT, GL_FILL);
     glEnable(GL_LIGHTING);
@@ -1042,13 +1119,24 @@ namespace Avogadro
 
     float alpha = d->color.alpha();
 
+    // The diffuse color also comes through the color material, which the
+    // transparency shaders can read per vertex unlike the materials
+    glColorMaterial(GL_FRONT, GL_DIFFUSE);
+    glEnable(GL_COLOR_MATERIAL);
+    setColorMaterialUniform(true);
+
     glBegin(GL_TRIANGLES);
     for(unsigned int i = 0; i < v.size(); ++i) {
       applyAsMaterials(c[i], alpha);
+      glColor4f(c[i].red(), c[i].green(), c[i].blue(), alpha);
       glNormal3fv(n[i].data());
       glVertex3fv(v[i].data());
     }
     glEnd();
+    d->count(v.size() / 3, v.size());
+
+    setColorMaterialUniform(false);
+    glDisable(GL_COLOR_MATERIAL);
 
     glPolygonMode(GL_FRONT, GL_FILL);
     glEnable(GL_LIGHTING);
@@ -1083,6 +1171,17 @@ namespace Avogadro
     return val;
   }
 
+  int GLPainter::drawTextBatch ( const QVector<Eigen::Vector3d> &positions,
+                                 const QVector<QString> &strings,
+                                 bool cullOverlaps )
+  {
+    if(!d->isValid()) { return 0; }
+    d->textRenderer->begin ( d->widget );
+    int val = d->textRenderer->drawBatch ( positions, strings, cullOverlaps );
+    d->textRenderer->end( );
+    return val;
+  }
+
   void GLPainter::drawBox(const Eigen::Vector3d &,
                           const Eigen::Vector3d &)
   {
@@ -1177,6 +1276,24 @@ namespace Avogadro
     glColor3fv(color.data());
   }
 
+  void GLPainter::setColorMaterialUniform(bool enabled)
+  {
+#ifdef ENABLE_GLSL
+    // Shaders can not query GL_COLOR_MATERIAL, those that need to know
+    // declare a colorMaterial uniform
+    if (!GLEW_ARB_shader_objects)
+      return;
+    GLhandleARB program = glGetHandleARB(GL_PROGRAM_OBJECT_ARB);
+    if (!program)
+      return;
+    GLint location = glGetUniformLocationARB(program, "colorMaterial");
+    if (location >= 0)
+      glUniform1iARB(location, enabled ? 1 : 0);
+#else
+    Q_UNUSED(enabled);
+#endif
+  }
+
   inline void GLPainter::applyAsMaterials(const Color3f &c, float alpha)
   {
     float color[] = {c.red(), c.green(), c.blue(), alpha};
@@ -1207,4 +1324,14 @@ namespace Avogadro
     m_dynamicScaling = scaling;
   }
 
+  int GLPainter::primitivesDrawn() const
+  {
+    return d->primitives;
+  }
+
+  int GLPainter::verticesDrawn() const
+  {
+    return d->vertices;
+  }
+
 } // end namespace Avogadro
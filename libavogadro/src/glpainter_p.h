@@ -66,7 +66,9 @@ namespace Avogadro
     /**
      * Sets the global quality setting. This influences the detail level of the
      * geometric objects (spheres and cylinders). Values range from 0 to
-     * PAINTER_GLOBAL_QUALITY_SETTINGS-1.
+     * PAINTER_GLOBAL_QUALITY_SETTINGS-1. It takes effect with the next
+     * begin(). The objects of each quality are kept once created, so
+     * widgets sharing the painter can each set their own before drawing.
      */
     void setQuality(int quality);
 
@@ -118,6 +120,14 @@ namespace Avogadro
      */
     void drawSphere(const Eigen::Vector3d &center, double radius);
 
+    /**
+     * Draws a sphere far away from the viewer as a single unlit point of the
+     * apparent diameter of the sphere.
+     * @param center the position of the center of the sphere.
+     * @param radius the radius of the sphere.
+     */
+    void drawPoint(const Eigen::Vector3d &center, double radius);
+
     /**
      * Draws a cylinder, leaving the Painter choose the appropriate detail level based on the
      * apparent radius (ratio of radius over distance) and the global quality setting.
@@ -344,6 +354,20 @@ namespace Avogadro
      */
     int drawText(const Eigen::Vector3d & pos, const QString &string);
 
+    /**
+     * Draws a batch of labels inside the scene. The glyphs of all labels come
+     * from one texture atlas and the whole batch is drawn in a single call.
+     * The layout is cached until the labels, the color or the camera change.
+     * @param positions the scene coordinates of the labels.
+     * @param strings the labels to render, one per position.
+     * @param cullOverlaps if true, labels overlapping a label closer to the
+     * camera are skipped.
+     * @return the number of labels drawn.
+     */
+    int drawTextBatch(const QVector<Eigen::Vector3d> &positions,
+                      const QVector<QString> &strings,
+                      bool cullOverlaps = true);
+
     /**
      * Placeholder to draw a box.
      * @param corner1 First corner of the box.
@@ -408,6 +432,18 @@ namespace Avogadro
      */
     void setDynamicScaling(bool scaling);
 
+    /**
+     * @return the number of primitives drawn since the Painter was created,
+     * spheres, cylinders, lines, triangles etc each count as one.
+     */
+    int primitivesDrawn() const;
+
+    /**
+     * @return the number of vertices sent to OpenGL since the Painter was
+     * created.
+     */
+    int verticesDrawn() const;
+
   protected:
     GLPainterPrivate * const d;
 
@@ -454,6 +490,12 @@ namespace Avogadro
      * specular colors. This is only useful if lighting is enabled.
      */
     void applyAsMaterials(const Color3f &color, float alpha = 1.0);
+
+    /**
+     * Tells the current shader program, if it has a colorMaterial uniform,
+     * whether GL_COLOR_MATERIAL is enabled.
+     */
+    void setColorMaterialUniform(bool enabled);
   };
 } // end namespace Avogadro
 
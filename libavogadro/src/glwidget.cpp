@@ -32,6 +32,8 @@
 #include "camera.h"
 #include "glpainter_p.h"
 #include "glhit.h"
+#include "renderprofiler_p.h"
+#include "transparencypass_p.h"
 
 #ifdef ENABLE_PYTHON
   #include "pythonthread_p.h"
@@ -39,6 +41,7 @@
 #endif
 
 #include <avogadro/painterdevice.h>
+#include <avogadro/frustumculler.h>
 #include <avogadro/tool.h>
 #include <avogadro/toolgroup.h>
 #include <avogadro/extension.h>
@@ -47,6 +50,7 @@
 #include <avogadro/residue.h>
 #include <avogadro/molecule.h>
 #include <avogadro/color.h>
+#include <avogadro/selection.h>
 
 // Include static engine headers
 #include "engines/bsdyengine.h"
@@ -58,7 +62,10 @@
 #include <QDir>
 #include <QPluginLoader>
 #include <QTime>
+#include <QTimer>
+#include <QGLFramebufferObject>
 #include <QReadWriteLock>
+#include <QSet>
 #include <QMessageBox>
 
 #ifdef ENABLE_THREADED_GL
@@ -75,8 +82,35 @@
 using namespace OpenBabel;
 using namespace Eigen;
 
+// Interval between the refinement steps once the view has settled (ms)
+#define GOVERNOR_REFINE_INTERVAL 150
+
 namespace Avogadro {
 
+  /**
+   * Levels of the adaptive render governor, from full quality to the
+   * cheapest interactive rendering. The governor steps up a level while
+   * interactive frames take longer than the target frame time and back
+   * down when there is plenty of headroom.
+   */
+  struct RenderLevel
+  {
+    int qualityDrop;        // Painter quality levels below the user setting
+    bool cull;              // Render each frame with culling, not the display list
+    double coarseThreshold; // Culler LOD threshold in pixels per Angstrom
+    double resolution;      // Fraction of the widget resolution rendered
+  };
+
+  static const RenderLevel GOVERNOR_LEVELS[] = {
+    { 0, false,  3.0, 1.0  },
+    { 1, false,  3.0, 1.0  },
+    { 4, true,   6.0, 1.0  },
+    { 4, true,  10.0, 0.7  },
+    { 4, true,  16.0, 0.5  }
+  };
+  static const int GOVERNOR_MAX_LEVEL =
+    sizeof(GOVERNOR_LEVELS) / sizeof(RenderLevel) - 1;
+
   bool engineLessThan( const Engine* lhs, const Engine* rhs )
   {
     Engine::Layers lhsLayers = lhs->layers();
@@ -118,23 +152,43 @@ namespace Avogadro {
   class GLPainterDevice : public PainterDevice
   {
   public:
-    GLPainterDevice(GLWidget *gl) { widget = gl; }
+    GLPainterDevice(GLWidget *gl) : oit(false), snap(0) { widget = gl; }
     ~GLPainterDevice() {}
 
     Painter *painter() const { return widget->painter(); }
     Camera *camera() const { return widget->camera(); }
     bool isSelected( const Primitive *p ) const { return widget->isSelected(p); }
+    bool isSelected(Primitive::Type type, unsigned long id) const
+    { return widget->selection().contains(type, id); }
     double radius( const Primitive *p ) const { return widget->radius(p); }
     const Molecule *molecule() const { return widget->molecule(); }
     Color *colorMap() const { return widget->colorMap(); }
+    const FrustumCuller *culler() const { return &frustumCuller; }
+    const DepthSorter *depthSorter() const
+    { return sorter.isEnabled() ? &sorter : 0; }
+    bool orderIndependentTransparency() const { return oit; }
+    const MoleculeSnapshot *snapshot() const { return snap; }
 
     int width() { return widget->width(); }
     int height() { return widget->height(); }
 
+    FrustumCuller frustumCuller;
+    DepthSorter sorter;
+    bool oit; // Is the transparency pass active?
+    const MoleculeSnapshot *snap; // Set while rendering a snapshot
+
   private:
     GLWidget *widget;
   };
 
+  // The atoms and bonds of a named selection by id, like Selection
+  struct NamedSelection
+  {
+    QString name;
+    QBitArray atoms;
+    QBitArray bonds;
+  };
+
   class GLWidgetPrivate
   {
   public:
@@ -146,6 +200,7 @@ namespace Avogadro {
                         toolGroup( 0 ),
                         selectBuf( 0 ),
                         selectBufSize( -1 ),
+                        selectionChangePending(false),
                         undoStack(0),
 #ifdef ENABLE_THREADED_GL
                         thread( 0 ),
@@ -163,8 +218,13 @@ namespace Avogadro {
                         renderAxes(false),
                         renderDebug(false),
                         dlistQuick(0), dlistOpaque(0), dlistTransparent(0),
-                        pd(0)
+                        pd(0), quality(-1), painterQuality(-1), renderLevel(0), targetFrameRate(30),
+                        refineTimer(0), lowResBuffer(0), fpsFrames(0),
+                        fpsFrameTime(0), fps(0.0), frameTime(0.0),
+                        fpsUpdated(false), profiling(false),
+                        transparencyMode(GLWidget::OrderIndependentTransparency)
     {
+      fpsTime.start();
     }
 
     ~GLWidgetPrivate()
@@ -179,9 +239,26 @@ namespace Avogadro {
         glDeleteLists(dlistOpaque, 1);
       if (dlistTransparent)
         glDeleteLists(dlistTransparent, 1);
+
+      delete lowResBuffer;
+      transparencyPass.release();
     }
 
     void updateListQuick();
+    void drawLowResBuffer(int width, int height);
+
+    inline void profileBegin(const QString &name, const QString &category)
+    {
+      if (profiler.isEnabled())
+        profiler.begin(name, category, painter->primitivesDrawn(),
+                       painter->verticesDrawn());
+    }
+
+    inline void profileEnd()
+    {
+      if (profiler.isEnabled())
+        profiler.end(painter->primitivesDrawn(), painter->verticesDrawn());
+    }
 
     QList<Engine *>        engines;
 
@@ -208,8 +285,9 @@ namespace Avogadro {
     GLuint                *selectBuf;
     int                    selectBufSize;
 
-    QList<QPair<QString, QPair<QList<unsigned int>, QList<unsigned int> > > > namedSelections;
-    PrimitiveList          selectedPrimitives;
+    QList<NamedSelection>  namedSelections;
+    Selection              selection;
+    bool                   selectionChangePending; // see unselectPrimitive()
 
     QUndoStack            *undoStack;
 
@@ -241,8 +319,73 @@ namespace Avogadro {
       * Member GLPainterDevice which is passed to the engines.
       */
     GLPainterDevice *pd;
+
+    int                    quality;         // Quality requested by the user
+    int                    painterQuality;  // Governed quality, set on the
+                                            // shared painter for each frame
+    int                    renderLevel;     // Governor level, 0 is full quality
+    int                    targetFrameRate; // Interactive frame rate, 0 is off
+    QTimer                *refineTimer;     // Refines once the view settles
+    QGLFramebufferObject  *lowResBuffer;    // Reduced resolution render target
+    QTime                  frameTimer;      // Cost of the current frame
+
+    // Frame counter, averaged over windows of 200+ ms
+    QTime                  fpsTime;
+    int                    fpsFrames;
+    int                    fpsFrameTime;
+    double                 fps;
+    double                 frameTime;
+    bool                   fpsUpdated;
+
+    RenderProfiler         profiler;        // Per engine timings
+    bool                   profiling;       // Profiling requested by the user
+
+    GLWidget::TransparencyMode transparencyMode;
+    TransparencyPass       transparencyPass;
   };
 
+  void GLWidgetPrivate::drawLowResBuffer(int width, int height)
+  {
+    // Upscale the low resolution frame to the whole widget
+    lowResBuffer->release();
+    glViewport(0, 0, width, height);
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_CURRENT_BIT);
+
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, lowResBuffer->texture());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glColor4f(1.0, 1.0, 1.0, 1.0);
+
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0, 0.0);
+    glVertex2f(-1.0, -1.0);
+    glTexCoord2f(1.0, 0.0);
+    glVertex2f(1.0, -1.0);
+    glTexCoord2f(1.0, 1.0);
+    glVertex2f(1.0, 1.0);
+    glTexCoord2f(0.0, 1.0);
+    glVertex2f(-1.0, 1.0);
+    glEnd();
+
+    glPopAttrib();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+  }
+
   void GLWidgetPrivate::updateListQuick()
   {
     // Create a display list cache
@@ -255,14 +398,15 @@ namespace Avogadro {
       // Don't use dynamic scaling when rendering quickly
       painter->setDynamicScaling(false);
 
+      // render() already holds the read lock
       glNewList(dlistQuick, GL_COMPILE);
       foreach(Engine *engine, engines)
       {
         if(engine->isEnabled())
         {
-          molecule->lock()->lockForRead();
+          profileBegin(engine->alias(), "renderQuick");
           engine->renderQuick(pd);
-          molecule->lock()->unlock();
+          profileEnd();
         }
       }
       glEndList();
@@ -329,6 +473,8 @@ namespace Avogadro {
       m_widget->qglClearColor(d->background);
       m_widget->paintGL();
       m_widget->swapBuffers();
+      m_widget->computeFramesPerSecond();
+      m_widget->updateRenderLevel();
       m_widget->doneCurrent();
       d->renderMutex.unlock();
     }
@@ -412,6 +558,14 @@ namespace Avogadro {
       d->painter = new GLPainter();
     }
     d->painter->incrementShare();
+    d->quality = d->painter->quality();
+    d->painterQuality = d->quality;
+
+    // Progressive refinement after interactive rendering
+    d->refineTimer = new QTimer(this);
+    d->refineTimer->setSingleShot(true);
+    d->refineTimer->setInterval(GOVERNOR_REFINE_INTERVAL);
+    connect(d->refineTimer, SIGNAL(timeout()), this, SLOT(refineRender()));
 
     setAutoFillBackground( false );
     setSizePolicy( QSizePolicy::MinimumExpanding,QSizePolicy::MinimumExpanding );
@@ -524,7 +678,26 @@ namespace Avogadro {
 
   void GLWidget::paintGL()
   {
-    resizeGL(width(), height()); // fix for bug #1797069. don't remove!
+    d->frameTimer.start();
+
+    // The governor may render interactive frames at a reduced resolution
+    double resolution = d->quickRender ?
+      GOVERNOR_LEVELS[d->renderLevel].resolution : 1.0;
+    QSize size(qMax(1, static_cast<int>(width() * resolution)),
+               qMax(1, static_cast<int>(height() * resolution)));
+    bool lowRes = resolution < 1.0
+      && QGLFramebufferObject::hasOpenGLFramebufferObjects();
+    if (lowRes) {
+      if (!d->lowResBuffer || d->lowResBuffer->size() != size) {
+        delete d->lowResBuffer;
+        d->lowResBuffer = new QGLFramebufferObject(size,
+                                      QGLFramebufferObject::Depth);
+      }
+      d->lowResBuffer->bind();
+      glViewport(0, 0, size.width(), size.height());
+    }
+    else
+      resizeGL(width(), height()); // fix for bug #1797069. don't remove!
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
     // setup the OpenGL projection matrix using the camera
@@ -538,6 +711,11 @@ namespace Avogadro {
     d->camera->applyModelview();
 
     render();
+
+    // render() normally scales the frame up before drawing the overlays,
+    // unless it returned early
+    if (lowRes && d->lowResBuffer->isBound())
+      d->drawLowResBuffer(width(), height());
   }
 
   void GLWidget::paintGL2()
@@ -589,6 +767,8 @@ namespace Avogadro {
       qglClearColor(d->background);
       paintGL();
       swapBuffers();
+      computeFramesPerSecond();
+      updateRenderLevel();
 #endif
     }
   }
@@ -656,14 +836,87 @@ namespace Avogadro {
 
   void GLWidget::setQuality(int quality)
   {
-    // Invalidate the display lists and change the painter quality level
-    invalidateDLs();
-    d->painter->setQuality(quality);
+    // Invalidate the display lists and change the painter quality level,
+    // the governor may be rendering below the requested quality
+    d->quality = quality;
+    applyRenderLevel();
   }
 
   int GLWidget::quality() const
   {
-    return d->painter->quality();
+    return d->quality;
+  }
+
+  void GLWidget::setTargetFrameRate(int fps)
+  {
+    d->targetFrameRate = fps;
+    if (fps <= 0 && d->renderLevel) {
+      d->renderLevel = 0;
+      applyRenderLevel();
+      update();
+    }
+  }
+
+  int GLWidget::targetFrameRate() const
+  {
+    return d->targetFrameRate;
+  }
+
+  void GLWidget::setTransparencyMode(TransparencyMode mode)
+  {
+    d->transparencyMode = mode;
+    update();
+  }
+
+  GLWidget::TransparencyMode GLWidget::transparencyMode() const
+  {
+    return d->transparencyMode;
+  }
+
+  void GLWidget::applyRenderLevel()
+  {
+    const RenderLevel &level = GOVERNOR_LEVELS[d->renderLevel];
+    invalidateDLs();
+    // The painter may be shared with other widgets, so the quality is only
+    // set on it for the frames of this one
+    d->painterQuality = qMax(0, d->quality - level.qualityDrop);
+    d->pd->frustumCuller.setCoarseThreshold(level.coarseThreshold);
+  }
+
+  void GLWidget::updateRenderLevel()
+  {
+    // Only interactive frames are governed, and only on fresh measurements
+    if (!d->fpsUpdated || !d->quickRender || d->targetFrameRate <= 0
+        || d->refineTimer->isActive())
+      return;
+    d->fpsUpdated = false;
+
+    // Compare what frames cost, not how often they were requested
+    double target = 1000.0 / d->targetFrameRate;
+    int level = d->renderLevel;
+    if (d->frameTime > target && level < GOVERNOR_MAX_LEVEL)
+      ++level;
+    else if (d->frameTime < 0.4 * target && level > 0)
+      --level;
+
+    if (level != d->renderLevel) {
+      d->renderLevel = level;
+      applyRenderLevel();
+    }
+  }
+
+  void GLWidget::refineRender()
+  {
+    // Step back towards full quality, one level per refinement step
+    if (d->renderLevel > 0) {
+      --d->renderLevel;
+      applyRenderLevel();
+    }
+    if (d->renderLevel > 0)
+      d->refineTimer->start();
+    else
+      d->quickRender = false;
+    update();
   }
 
   void GLWidget::setFogLevel(int level)
@@ -690,6 +943,8 @@ namespace Avogadro {
   void GLWidget::setRenderDebug(bool renderDebug)
   {
     d->renderDebug = renderDebug;
+    // The overlay lists the time taken by each engine
+    d->profiler.setEnabled(d->renderDebug || d->profiling);
     update();
   }
 
@@ -698,6 +953,35 @@ namespace Avogadro {
     return d->renderDebug;
   }
 
+  void GLWidget::setProfiling(bool profiling)
+  {
+#ifdef ENABLE_THREADED_GL
+    d->renderMutex.lock();
+#endif
+    d->profiling = profiling;
+    d->profiler.setEnabled(d->renderDebug || d->profiling);
+#ifdef ENABLE_THREADED_GL
+    d->renderMutex.unlock();
+#endif
+  }
+
+  bool GLWidget::profiling() const
+  {
+    return d->profiler.isEnabled();
+  }
+
+  bool GLWidget::saveProfile(const QString &fileName) const
+  {
+#ifdef ENABLE_THREADED_GL
+    d->renderMutex.lock();
+#endif
+    bool success = d->profiler.saveTrace(fileName);
+#ifdef ENABLE_THREADED_GL
+    d->renderMutex.unlock();
+#endif
+    return success;
+  }
+
   void GLWidget::render()
   {
     if (!d->molecule) {
@@ -705,11 +989,15 @@ namespace Avogadro {
       return;
     }
     if (!d->molecule->lock()->tryLockForRead()) {
-      qDebug() << "GLWidget::render(): Could not get read lock on molecule.";
+      // Draw what another thread last published instead of waiting for it
+      // to finish writing
+      renderSnapshot();
       return;
     }
 
+    d->painter->setQuality(d->painterQuality);
     d->painter->begin(this);
+    d->profiler.beginFrame();
 
     if (d->painter->quality() >= 3) {
       glEnable(GL_LIGHT1);
@@ -736,17 +1024,49 @@ namespace Avogadro {
       glDisable(GL_FOG);
     }
 
+    // Cull against the current view, unless the geometry is compiled into
+    // display lists that are replayed from other view points or cells
+    d->pd->frustumCuller.setEnabled(!hasUnitCell && (!d->quickRender
+                                     || GOVERNOR_LEVELS[d->renderLevel].cull));
+    // Interactive frames may be drawn into the smaller low resolution buffer
+    bool lowRes = d->lowResBuffer && d->lowResBuffer->isBound();
+    if (d->pd->frustumCuller.isEnabled())
+      d->pd->frustumCuller.update(d->molecule, d->camera,
+                                  lowRes ? d->lowResBuffer->height() : height());
+
+    // Sort the transparent primitives on a worker thread while the opaque
+    // layer renders, if exact blending was asked for or is the fallback
+    bool sortTransparency = !d->quickRender
+      && (d->transparencyMode == SortedTransparency
+          || (d->transparencyMode == OrderIndependentTransparency
+              && !d->transparencyPass.isSupported()));
+    d->pd->sorter.setEnabled(sortTransparency);
+    if (sortTransparency)
+      d->pd->sorter.update(d->molecule, d->camera);
+
     // Use renderQuick if the view is being moved, otherwise full render
-    if (d->quickRender) {
+    if (d->quickRender && d->pd->frustumCuller.isEnabled()) {
+      // The governor has given up on the display list, redraw only what is
+      // in view each frame
+      d->painter->setDynamicScaling(false);
+      foreach(Engine *engine, d->engines)
+        if(engine->isEnabled()) {
+          d->profileBegin(engine->alias(), "renderQuick");
+          engine->renderQuick(d->pd);
+          d->profileEnd();
+        }
+      d->painter->setDynamicScaling(true);
+    }
+    else if (d->quickRender) {
       d->updateListQuick();
+      // The engines are only timed when the list is rebuilt, replaying it is
+      // timed as a whole
+      d->profileBegin(tr("Quick display list"), "renderQuick");
       glCallList(d->dlistQuick);
       if (hasUnitCell) {
         renderCrystal(d->dlistQuick);
       }
-      // Render the active tool
-      if ( d->tool ) {
-        d->tool->paint( this );
-      }
+      d->profileEnd();
     }
     else {
       // we save a display list if we're doing a crystal
@@ -762,50 +1082,86 @@ namespace Avogadro {
 #ifdef ENABLE_GLSL
           if (m_glslEnabled) glUseProgramObjectARB(engine->shader());
 #endif
+          d->profileBegin(engine->alias(), "renderOpaque");
           engine->renderOpaque(d->pd);
+          d->profileEnd();
         }
 #ifdef ENABLE_GLSL
           if (m_glslEnabled) glUseProgramObjectARB(0);
 #endif
       if (hasUnitCell) { // end the main list and render the opaque crystal
         glEndList();
+        d->profileBegin(tr("Crystal cells"), "renderOpaque");
         renderCrystal(d->dlistOpaque);
+        d->profileEnd();
       }
 
       // Render the active tool
       if ( d->tool ) {
+        d->profileBegin(d->tool->name(), "tool");
         d->tool->paint( this );
+        d->profileEnd();
       }
 
 #ifdef ENABLE_PYTHON
       // Render the extensions (for now: python only)
       foreach (Extension *extension, d->extensions) {
         PythonExtension *pyext = qobject_cast<PythonExtension*>(extension);
-        if (pyext)
+        if (pyext) {
+          d->profileBegin(pyext->name(), "python");
           pyext->paint(this);
+          d->profileEnd();
+        }
       }
 #endif
 
 
-      // Now render transparent
+      // Now render transparent, either accumulated in the order independent
+      // pass and composited in one step or blended directly
+      bool oit = d->transparencyMode == OrderIndependentTransparency
+        && d->transparencyPass.begin();
+      d->pd->oit = oit;
       glEnable(GL_BLEND);
       if (hasUnitCell)
         glNewList(d->dlistTransparent, GL_COMPILE);
       foreach(Engine *engine, d->engines) {
         if(engine->isEnabled() && engine->layers() & Engine::Transparent) {
 #ifdef ENABLE_GLSL
-          if (m_glslEnabled) glUseProgramObjectARB(engine->shader());
+          if (m_glslEnabled && !oit) glUseProgramObjectARB(engine->shader());
 #endif
+          d->profileBegin(engine->alias(), "renderTransparent");
           engine->renderTransparent(d->pd);
+          d->profileEnd();
         }
       }
-      glDisable(GL_BLEND);
+      if (!oit)
+        glDisable(GL_BLEND);
 #ifdef ENABLE_GLSL
-          if (m_glslEnabled) glUseProgramObjectARB(0);
+          if (m_glslEnabled && !oit) glUseProgramObjectARB(0);
 #endif
       if (hasUnitCell) { // end the main list and render the transparent bits
         glEndList();
+        d->profileBegin(tr("Crystal cells"), "renderTransparent");
         renderCrystal(d->dlistTransparent);
+        d->profileEnd();
+      }
+      if (oit) {
+        d->profileBegin(tr("Transparency composite"), "renderTransparent");
+        d->transparencyPass.end();
+        d->profileEnd();
+        d->pd->oit = false;
+      }
+    }
+    if (d->quickRender) {
+      // Scale a low resolution frame up first, so the tools and overlays
+      // are drawn and their text placed at the widget's resolution
+      if (lowRes)
+        d->drawLowResBuffer(width(), height());
+      // Render the active tool
+      if ( d->tool ) {
+        d->profileBegin(d->tool->name(), "tool");
+        d->tool->paint( this );
+        d->profileEnd();
       }
     }
     // Render all the inactive tools
@@ -813,7 +1169,9 @@ namespace Avogadro {
       QList<Tool *> tools = d->toolGroup->tools();
       foreach( Tool *tool, tools ) {
         if ( tool != d->tool ) {
+          d->profileBegin(tool->name(), "tool");
           tool->paint( this );
+          d->profileEnd();
         }
       }
     }
@@ -821,6 +1179,9 @@ namespace Avogadro {
     // If enabled draw the axes
     if (d->renderAxes) renderAxesOverlay();
 
+    // The overlay below is not part of the profiled frame
+    d->profiler.endFrame();
+
     // If enabled show debug information
     if (d->renderDebug) renderDebugOverlay();
 
@@ -828,6 +1189,46 @@ namespace Avogadro {
     d->molecule->lock()->unlock();
   }
 
+  void GLWidget::renderSnapshot()
+  {
+    // Asking for the snapshot has the writer publish a new one before it
+    // unlocks, and its Molecule::update() then repaints
+    const MoleculeSnapshot snapshot = d->molecule->snapshot();
+    if (!snapshot.isValid())
+      return;
+
+    d->painter->setQuality(d->painterQuality);
+    d->painter->begin(this);
+    d->profiler.beginFrame();
+
+    if (d->painter->quality() >= 3) {
+      glEnable(GL_LIGHT1);
+    }
+    else {
+      glDisable(GL_LIGHT1);
+    }
+
+    d->pd->snap = &snapshot;
+    d->painter->setDynamicScaling(false);
+    foreach(Engine *engine, d->engines)
+      if(engine->isEnabled()) {
+        d->profileBegin(engine->alias(), "renderSnapshot");
+        engine->renderSnapshot(d->pd);
+        d->profileEnd();
+      }
+    d->painter->setDynamicScaling(true);
+    d->pd->snap = 0;
+
+    if (d->quickRender && d->lowResBuffer && d->lowResBuffer->isBound())
+      d->drawLowResBuffer(width(), height());
+
+    // If enabled draw the axes
+    if (d->renderAxes) renderAxesOverlay();
+
+    d->profiler.endFrame();
+    d->painter->end();
+  }
+
   void GLWidget::renderCrystal(GLuint displayList)
   {
     std::vector<vector3> cellVectors = d->molecule->OBUnitCell()->GetCellVectors();
@@ -1023,7 +1424,9 @@ namespace Avogadro {
 
     int x = 5, y = 5;
     y += d->pd->painter()->drawText(x, y, "---- " + tr("Debug Information") + " ----");
-    y += d->pd->painter()->drawText(x, y, tr("FPS: %L1").arg(computeFramesPerSecond(), 0, 'g', 3));
+    y += d->pd->painter()->drawText(x, y, tr("FPS: %L1").arg(d->fps, 0, 'g', 3));
+    y += d->pd->painter()->drawText(x, y, tr("Frame Time: %L1 ms").arg(d->frameTime, 0, 'g', 3));
+    y += d->pd->painter()->drawText(x, y, tr("Render Level: %L1").arg(d->renderLevel));
 
     y += d->pd->painter()->drawText(x, y,
                                     tr("View Size: %L1 x %L2").arg(d->pd->width()).arg(d->pd->height()) );
@@ -1037,6 +1440,22 @@ namespace Avogadro {
 
 //    list = primitives().subList(Primitive::BondType);
     y += d->pd->painter()->drawText(x, y, tr("Bonds: %L1").arg(d->molecule->numBonds()));
+
+    // Timings of the last frame the GPU has finished with
+    QList<RenderProfiler::Span> spans = d->profiler.summary();
+    if (spans.isEmpty())
+      return;
+    y += d->pd->painter()->drawText(x, y, "---- " + tr("Render Profile") + " ----");
+    foreach (const RenderProfiler::Span &span, spans) {
+      QString line = tr("%1 (%2): %L3 ms").arg(span.name).arg(span.category)
+        .arg(span.cpuTime / 1000.0, 0, 'f', 2);
+      if (span.gpuTime >= 0)
+        line += tr(", GPU %L1 ms").arg(span.gpuTime / 1000.0, 0, 'f', 2);
+      if (span.primitives)
+        line += tr(", %L1 primitives, %L2 vertices").arg(span.primitives)
+          .arg(span.vertices);
+      y += d->pd->painter()->drawText(x, y, line);
+    }
   }
 
   bool GLWidget::event( QEvent *event )
@@ -1092,8 +1511,12 @@ namespace Avogadro {
 #ifdef ENABLE_THREADED_GL
     d->renderMutex.lock();
 #endif
-    // Stop using quickRender
-    d->quickRender = false;
+    // Stop using quickRender, if the governor lowered the quality refine the
+    // view progressively instead of jumping straight to the full render
+    if (d->renderLevel > 0)
+      d->refineTimer->start();
+    else
+      d->quickRender = false;
 #ifdef ENABLE_THREADED_GL
     d->renderMutex.unlock();
 #endif
@@ -1111,8 +1534,10 @@ namespace Avogadro {
     d->renderMutex.lock();
 #endif
     // Use quick render while the mouse is down
-    if (d->allowQuickRender)
+    if (d->allowQuickRender) {
       d->quickRender = true;
+      d->refineTimer->stop();
+    }
 #ifdef ENABLE_THREADED_GL
     d->renderMutex.unlock();
 #endif
@@ -1196,7 +1621,10 @@ namespace Avogadro {
     d->molecule = molecule;
 
     // Clear the selection list
-    d->selectedPrimitives.clear();
+    if (!d->selection.isEmpty()) {
+      d->selection.clear();
+      emit selectionChanged();
+    }
 
     // compute the molecule's geometric info
     updateGeometry();
@@ -1207,6 +1635,21 @@ namespace Avogadro {
     connect(d->molecule, SIGNAL(updated()), this, SLOT(invalidateDLs()));
     connect(d->molecule, SIGNAL(updated()), this, SLOT(updateGeometry()));
     connect(d->molecule, SIGNAL(updated()), this, SLOT(update()));
+    // Charges calculated in the background change the colors
+    connect(d->molecule, SIGNAL(partialChargesChanged()),
+            this, SLOT(invalidateDLs()));
+    connect(d->molecule, SIGNAL(partialChargesChanged()), this, SLOT(update()));
+
+    // Any change to the atoms invalidates the culling grid and depth order
+    d->pd->frustumCuller.invalidate();
+    d->pd->sorter.invalidate();
+    connect(d->molecule, SIGNAL(updated()), this, SLOT(invalidateCulling()));
+    connect(d->molecule, SIGNAL(atomAdded(Atom*)),
+            this, SLOT(invalidateCulling()));
+    connect(d->molecule, SIGNAL(atomUpdated(Atom*)),
+            this, SLOT(invalidateCulling()));
+    connect(d->molecule, SIGNAL(atomRemoved(Atom*)),
+            this, SLOT(invalidateCulling()));
 
     // If primitives, atoms, or bonds are removed, we need to delete them from the selected list
     connect(d->molecule, SIGNAL(primitiveRemoved(Primitive*)),
@@ -1215,6 +1658,9 @@ namespace Avogadro {
             this, SLOT(unselectAtom(Atom*)));
     connect(d->molecule, SIGNAL(bondRemoved(Bond*)),
             this, SLOT(unselectBond(Bond*)));
+    // The selection is kept by id, which a large change may renumber
+    connect(d->molecule, SIGNAL(moleculeChanged()),
+            this, SLOT(remapSelection()));
 
     // setup the camera to have a nice viewpoint on the molecule
     d->camera->initializeViewPoint();
@@ -1224,13 +1670,28 @@ namespace Avogadro {
 
   void GLWidget::unselectPrimitive(Primitive *p)
   {
-    d->selectedPrimitives.removeAll( p );
+    if (!d->selection.remove(p))
+      return;
     // The engine caches must be invalidated
     d->updateCache = true;
+    // Clearing a molecule removes its primitives one by one, so the
+    // notification is sent once control returns to the event loop
+    if (!d->selectionChangePending) {
+      d->selectionChangePending = true;
+      QTimer::singleShot(0, this, SLOT(emitSelectionChanged()));
+    }
 
     // TODO: remove also from named selections
   }
 
+  void GLWidget::emitSelectionChanged()
+  {
+    if (!d->selectionChangePending)
+      return;
+    d->selectionChangePending = false;
+    emit selectionChanged();
+  }
+
   void GLWidget::unselectAtom(Atom *a)
   {
     unselectPrimitive(a);
@@ -1241,6 +1702,36 @@ namespace Avogadro {
     unselectPrimitive(b);
   }
 
+  void GLWidget::remapSelection()
+  {
+    if (d->selection.isEmpty() || !d->molecule)
+      return;
+
+    // Only primitives still in the molecule are looked at, the others may
+    // already be deleted
+    QSet<Primitive *> present;
+    foreach (Atom *atom, d->molecule->atoms())
+      present.insert(atom);
+    foreach (Bond *bond, d->molecule->bonds())
+      present.insert(bond);
+    foreach (Residue *residue, d->molecule->residues())
+      present.insert(residue);
+
+    PrimitiveList kept;
+    for (int type = Primitive::FirstType; type < Primitive::LastType; ++type)
+      foreach (Primitive *p,
+               d->selection.subList(static_cast<Primitive::Type>(type)))
+        if (present.contains(p))
+          kept.append(p);
+
+    // Selecting them again picks up their current ids
+    const int before = d->selection.count();
+    d->selection = Selection(kept);
+    d->updateCache = true;
+    if (d->selection.count() != before)
+      emit selectionChanged();
+  }
+
   const Molecule* GLWidget::molecule() const
   {
     return d->molecule;
@@ -1276,16 +1767,28 @@ namespace Avogadro {
     if (!d->molecule)
       return;
 
-    // Try to get a read lock for the molecule
-    if (!d->molecule->lock()->tryLockForRead())
-      return;
+    // While another thread is writing, read the last snapshot rather than
+    // leave the geometry out of date
+    const bool locked = d->molecule->lock()->tryLockForRead();
+    MoleculeSnapshot snapshot;
+    if (!locked) {
+      snapshot = d->molecule->snapshot();
+      if (!snapshot.isValid())
+        return;
+    }
+    const Vector3d center = locked ? d->molecule->center() : snapshot.center();
+    const Vector3d normalVector = locked ? d->molecule->normalVector()
+                                         : snapshot.normalVector();
+    const double radius = locked ? d->molecule->radius() : snapshot.radius();
+    const Atom *farthestAtom = locked ? d->molecule->farthestAtom()
+      : d->molecule->atomById(snapshot.farthestAtomId());
 
     if (!d->molecule->OBUnitCell()) {
       // Plain molecule, no crystal cell
-      d->center = d->molecule->center();
-      d->normalVector = d->molecule->normalVector();
-      d->radius = d->molecule->radius();
-      d->farthestAtom = d->molecule->farthestAtom();
+      d->center = center;
+      d->normalVector = normalVector;
+      d->radius = radius;
+      d->farthestAtom = farthestAtom;
     }
     else {
       // render a crystal (so most geometry comes from the cell vectors)
@@ -1301,23 +1804,23 @@ namespace Avogadro {
                               + b * (d->bCells - 1)
                               + c * (d->cCells - 1) ) / 2.0;
       // the center is the center of the molecule translated by centerOffset
-      d->center = d->molecule->center() + centerOffset;
+      d->center = center + centerOffset;
       // the radius is the length of centerOffset plus the molecule radius
-      d->radius = d->molecule->radius() + centerOffset.norm();
+      d->radius = radius + centerOffset.norm();
       // for the normal vector, we just ask for the molecule's normal vector,
       // crossing our fingers hoping that it will give a nice viewpoint not only
       // with respect to the molecule but also with respect to the cells.
-      d->normalVector = d->molecule->normalVector();
+      d->normalVector = normalVector;
       // Computation of the farthest atom.
       // First case: the molecule is empty
-      if(d->molecule->numAtoms() == 0)
+      if(locked ? d->molecule->numAtoms() == 0 : snapshot.numAtoms() == 0)
       d->farthestAtom = 0;
       // Second case: there is no repetition of the molecule
       else if(d->aCells <= 1 && d->bCells <= 1 && d->cCells <= 1)
-        d->farthestAtom = d->molecule->farthestAtom();
+        d->farthestAtom = farthestAtom;
       // General case: the farthest atom is the one that is located the
       // farthest in the direction pointed to by centerOffset.
-      else {
+      else if (locked) {
         QList<Atom *> atoms = d->molecule->atoms();
         double x, max_x;
 
@@ -1330,9 +1833,26 @@ namespace Avogadro {
             d->farthestAtom = atom;
           }
         } // end foreach
+      }
+      else {
+        const QVector<Vector3d> &positions = snapshot.atomPositions();
+        double x, max_x;
+
+        int farthest = 0;
+        max_x = centerOffset.dot(positions.at(0));
+        for (int i = 1; i < positions.size(); ++i) {
+          x = centerOffset.dot(positions.at(i));
+          if (x > max_x) {
+            max_x = x;
+            farthest = i;
+          }
+        } // end for
+        d->farthestAtom = d->molecule->atomById(snapshot.atomIds().at(farthest));
       } // end general repeat (many atoms, multiple cells)
     } // End the case for unit cells
-    d->molecule->lock()->unlock();
+
+    if (locked)
+      d->molecule->lock()->unlock();
   }
 
   Camera * GLWidget::camera() const
@@ -1486,6 +2006,7 @@ namespace Avogadro {
     d->camera->applyModelview();
 
     // now actually render using low quality, "pickrender"
+    d->painter->setQuality(d->painterQuality);
     d->painter->begin(this);
 #ifdef ENABLE_GLSL
         if (m_glslEnabled) glUseProgramObjectARB(0);
@@ -1632,88 +2153,84 @@ namespace Avogadro {
 
   void GLWidget::setSelected(PrimitiveList primitives, bool select)
   {
-    foreach(Primitive *item, primitives) {
-      if (select && !d->selectedPrimitives.contains(item))
-          d->selectedPrimitives.append( item );
-      else if (!select)
-        d->selectedPrimitives.removeAll( item );
+    const int changed = select ? d->selection.add(primitives)
+                               : d->selection.remove(primitives);
+    if (changed) {
       // The engine caches must be invalidated
       d->updateCache = true;
-      item->update();
+      emit selectionChanged();
     }
   }
 
   PrimitiveList GLWidget::selectedPrimitives() const
   {
-    return d->selectedPrimitives.list();
+    return d->selection.primitives();
   }
 
-  void GLWidget::toggleSelected( PrimitiveList primitives )
+  const Selection & GLWidget::selection() const
   {
-    foreach(Primitive *item, primitives)
-    {
-      if (d->selectedPrimitives.contains(item))
-        d->selectedPrimitives.removeAll( item );
-      else
-        d->selectedPrimitives.append(item);
-    }
+    return d->selection;
+  }
+
+  void GLWidget::setSelection(const Selection &selection)
+  {
+    if (d->selection.isEmpty() && selection.isEmpty())
+      return;
+    d->selection = selection;
     // The engine caches must be invalidated
     d->updateCache = true;
+    emit selectionChanged();
+  }
+
+  void GLWidget::toggleSelected( PrimitiveList primitives )
+  {
+    if (d->selection.toggle(primitives)) {
+      // The engine caches must be invalidated
+      d->updateCache = true;
+      emit selectionChanged();
+    }
   }
 
   void GLWidget::toggleSelected()
   {
     if (!d->molecule) return;
     // Currently handle atoms and bonds
-    foreach(Atom *a, d->molecule->atoms()) {
-      Primitive *p = static_cast<Primitive *>(a);
-      if (d->selectedPrimitives.contains(p))
-        d->selectedPrimitives.removeAll(p);
-      else
-        d->selectedPrimitives.append(p);
-    }
-    foreach(Bond *b, d->molecule->bonds()) {
-      Primitive *p = static_cast<Primitive *>(b);
-      if (d->selectedPrimitives.contains(p))
-        d->selectedPrimitives.removeAll(p);
-      else
-        d->selectedPrimitives.append(p);
-    }
-    // The engine caches must be invalidated
-    d->updateCache = true;
+    PrimitiveList all;
+    foreach(Atom *a, d->molecule->atoms())
+      all.append(a);
+    foreach(Bond *b, d->molecule->bonds())
+      all.append(b);
+    toggleSelected(all);
   }
 
   void GLWidget::clearSelected()
   {
-    d->selectedPrimitives.clear();
+    if (d->selection.isEmpty())
+      return;
+    d->selection.clear();
     // The engine caches must be invalidated
     d->updateCache = true;
+    emit selectionChanged();
   }
 
   bool GLWidget::isSelected( const Primitive *p ) const
   {
     // Return true if the item is selected
-    return d->selectedPrimitives.contains(const_cast<Primitive *>(p));
+    return d->selection.contains(p);
   }
 
   bool GLWidget::addNamedSelection(const QString &name, PrimitiveList &primitives)
   {
     // make sure the name is unique
     for (int i = 0; i < d->namedSelections.size(); ++i)
-      if (d->namedSelections.at(i).first == name)
+      if (d->namedSelections.at(i).name == name)
         return false;
 
-    QList<unsigned int> atomIds;
-    QList<unsigned int> bondIds;
-    foreach(Primitive *item, primitives) {
-      if (item->type() == Primitive::AtomType)
-        atomIds.append(item->id());
-      if (item->type() == Primitive::BondType)
-        bondIds.append(item->id());
-    }
-
-    QPair<QList<unsigned int>,QList<unsigned int> > pair(atomIds, bondIds);
-    QPair<QString, QPair<QList<unsigned int>,QList<unsigned int> > > namedSelection(name, pair);
+    Selection selection(primitives);
+    NamedSelection namedSelection;
+    namedSelection.name = name;
+    namedSelection.atoms = selection.bits(Primitive::AtomType);
+    namedSelection.bonds = selection.bits(Primitive::BondType);
     d->namedSelections.append(namedSelection);
 
     emit namedSelectionsChanged();
@@ -1723,7 +2240,7 @@ namespace Avogadro {
   void GLWidget::removeNamedSelection(const QString &name)
   {
     for (int i = 0; i < d->namedSelections.size(); ++i)
-      if (d->namedSelections.at(i).first == name) {
+      if (d->namedSelections.at(i).name == name) {
         d->namedSelections.removeAt(i);
         emit namedSelectionsChanged();
         return;
@@ -1740,9 +2257,7 @@ namespace Avogadro {
     if (name.isEmpty())
       return;
 
-    QPair<QString, QPair<QList<unsigned int>,QList<unsigned int> > > pair = d->namedSelections.takeAt(index);
-    pair.first = name;
-    d->namedSelections.insert(index, pair);
+    d->namedSelections[index].name = name;
     emit namedSelectionsChanged();
   }
 
@@ -1750,7 +2265,7 @@ namespace Avogadro {
   {
     QList<QString> names;
     for (int i = 0; i < d->namedSelections.size(); ++i)
-      names.append(d->namedSelections.at(i).first);
+      names.append(d->namedSelections.at(i).name);
 
     return names;
   }
@@ -1758,7 +2273,7 @@ namespace Avogadro {
   PrimitiveList GLWidget::namedSelectionPrimitives(const QString &name)
   {
     for (int i = 0; i < d->namedSelections.size(); ++i)
-      if (d->namedSelections.at(i).first == name) {
+      if (d->namedSelections.at(i).name == name) {
     return namedSelectionPrimitives(i);
     }
 
@@ -1771,14 +2286,20 @@ namespace Avogadro {
     if (!d->molecule)
       return list;
 
-    for (int j = 0; j < d->namedSelections.at(index).second.first.size(); ++j) {
-      Atom *atom = d->molecule->atomById(d->namedSelections.at(index).second.first.at(j));
+    const QBitArray &atoms = d->namedSelections.at(index).atoms;
+    for (int id = 0; id < atoms.size(); ++id) {
+      if (!atoms.testBit(id))
+        continue;
+      Atom *atom = d->molecule->atomById(id);
       if (atom)
         list.append(atom);
     }
 
-    for (int j = 0; j < d->namedSelections.at(index).second.second.size(); ++j) {
-      Bond *bond = d->molecule->bondById(d->namedSelections.at(index).second.second.at(j));
+    const QBitArray &bonds = d->namedSelections.at(index).bonds;
+    for (int id = 0; id < bonds.size(); ++id) {
+      if (!bonds.testBit(id))
+        continue;
+      Bond *bond = d->molecule->bondById(id);
       if (bond)
         list.append(bond);
     }
@@ -1820,39 +2341,31 @@ namespace Avogadro {
 
   inline double GLWidget::computeFramesPerSecond()
   {
-    static QTime time;
-    static bool firstTime = true;
-    static int old_time, new_time;
-    static int frames;
-    static double fps;
-
-    if( firstTime )
-    {
-      time.start();
-      firstTime = false;
-      old_time = time.elapsed();
-      frames = 0;
-      fps = 0;
-    }
-
-    new_time = time.elapsed();
-    frames++;
+    // Called once per frame after the buffers are swapped, also accumulates
+    // the time the frames took to render for the governor
+    d->fpsFrames++;
+    d->fpsFrameTime += d->frameTimer.elapsed();
 
-    if( new_time - old_time > 200 )
+    int elapsed = d->fpsTime.elapsed();
+    if( elapsed > 200 )
     {
-      fps = 1000.0 * frames / double( new_time - old_time );
-      frames = 0;
-      time.restart();
-      old_time = time.elapsed();
+      d->fps = 1000.0 * d->fpsFrames / double( elapsed );
+      d->frameTime = d->fpsFrameTime / double( d->fpsFrames );
+      d->fpsUpdated = true;
+      d->fpsFrames = 0;
+      d->fpsFrameTime = 0;
+      d->fpsTime.restart();
     }
 
-    return fps;
+    return d->fps;
   }
 
   void GLWidget::writeSettings(QSettings &settings) const
   {
     settings.setValue("background", d->background);
-    settings.setValue("quality", d->painter->quality());
+    settings.setValue("quality", d->quality);
+    settings.setValue("targetFrameRate", d->targetFrameRate);
+    settings.setValue("transparencyMode", d->transparencyMode);
     settings.setValue("fogLevel", d->fogLevel);
     settings.setValue("renderAxes", d->renderAxes);
     settings.setValue("renderDebug", d->renderDebug);
@@ -1875,6 +2388,9 @@ namespace Avogadro {
     // Make sure to provide some default values for any settings.value("", DEFAULT) call
     setQuality(settings.value("quality", 2).toInt());
     setFogLevel(settings.value("fogLevel", 0).toInt());
+    setTargetFrameRate(settings.value("targetFrameRate", 30).toInt());
+    d->transparencyMode = static_cast<TransparencyMode>(
+      settings.value("transparencyMode", OrderIndependentTransparency).toInt());
     d->background = settings.value("background", QColor(0,0,0,0)).value<QColor>();
     d->renderAxes = settings.value("renderAxes", 1).value<bool>();
     d->renderDebug = settings.value("renderDebug", 0).value<bool>();
@@ -1983,6 +2499,14 @@ namespace Avogadro {
     // Something changed and we need to invalidate the display lists
     d->updateCache = true;
   }
+
+  void GLWidget::invalidateCulling()
+  {
+    // Atoms were added, removed or moved, the culling grid and the depth
+    // order must be rebuilt
+    d->pd->frustumCuller.invalidate();
+    d->pd->sorter.invalidate();
+  }
 }
 
 #include "glwidget.moc"
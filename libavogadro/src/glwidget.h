@@ -60,6 +60,7 @@ namespace Avogadro {
   class Engine;
   class Painter;
   class PrimitiveList;
+  class Selection;
 
   /**
    * @class GLWidget glwidget.h <avogadro/glwidget.h>
@@ -91,6 +92,20 @@ namespace Avogadro {
 //    Q_PROPERTY(float scale READ scale WRITE setScale)
 
     public:
+      /**
+       * How the transparent layer of the engines is composited.
+       */
+      enum TransparencyMode {
+        /// Blend in the order the engines draw, fastest but order dependent
+        UnsortedTransparency = 0,
+        /// Weighted blended order independent transparency, falls back to
+        /// SortedTransparency if the OpenGL implementation lacks support
+        OrderIndependentTransparency,
+        /// Blend atoms and bonds sorted back to front, exact but the sort
+        /// is redone whenever the view changes
+        SortedTransparency
+      };
+
       /**
        * Constructor.
        * @param parent the widget parent.
@@ -129,6 +144,30 @@ namespace Avogadro {
        */
       bool quickRender() const;
 
+      /**
+       * Set the frame rate the render governor aims for while the view is
+       * being moved. Interactive frames that are slower than this are drawn
+       * at progressively lower quality, level of detail and resolution, and
+       * refined back to full quality once the view settles.
+       * @param fps the target frame rate, 0 disables the governor.
+       */
+      void setTargetFrameRate(int fps);
+
+      /**
+       * @return the target interactive frame rate, 0 if the governor is off.
+       */
+      int targetFrameRate() const;
+
+      /**
+       * Set how the transparent layer is composited over the opaque scene.
+       */
+      void setTransparencyMode(TransparencyMode mode);
+
+      /**
+       * @return how the transparent layer is composited.
+       */
+      TransparencyMode transparencyMode() const;
+
       /**
       * @param enabled True if we should render the unit cell axes
       */
@@ -302,6 +341,27 @@ namespace Avogadro {
        */
       bool renderDebug();
 
+      /**
+       * Enable per engine profiling of each frame. The time taken by every
+       * engine render call, tool and extension paint is recorded on the CPU
+       * and, where GL_EXT_timer_query is available, on the GPU along with
+       * the number of primitives and vertices drawn. Profiling is always on
+       * while the debug overlay is shown.
+       */
+      void setProfiling(bool profiling);
+
+      /**
+       * @return true if frames are being profiled.
+       */
+      bool profiling() const;
+
+      /**
+       * Save the profiled frames as a Chrome trace (chrome://tracing) JSON
+       * file.
+       * @return true on success.
+       */
+      bool saveProfile(const QString &fileName) const;
+
       /**
        * Set the ToolGroup of the GLWidget.
        */
@@ -339,6 +399,17 @@ namespace Avogadro {
        */
       PrimitiveList selectedPrimitives() const;
 
+      /**
+       * @return The current selection, for set operations with other
+       * selections.
+       */
+      const Selection & selection() const;
+
+      /**
+       * Replace the current selection with @p selection.
+       */
+      void setSelection(const Selection &selection);
+
       /**
        * Toggle the selection for the atoms in the supplied list.
        * That is, if the primitive is selected, deselect it and vice-versa.
@@ -349,7 +420,8 @@ namespace Avogadro {
 
       /**
        * Toggle the selection for the GLWidget, that is if the primitive is
-       * selected, deselect it and vice-versa.
+       * selected, deselect it and vice-versa. Only atoms and bonds are
+       * toggled.
        */
       void toggleSelected();
 
@@ -368,7 +440,8 @@ namespace Avogadro {
       void clearSelected();
 
       /**
-       * @return true if the Primitive is selected.
+       * @return true if the Primitive is selected. This takes constant time,
+       * however large the selection.
        */
       bool isSelected(const Primitive *p) const;
 
@@ -564,6 +637,13 @@ namespace Avogadro {
        */
       virtual void render();
 
+      /**
+       * Render the last snapshot of the molecule, called by render() while
+       * another thread is writing to the molecule. Only the engines and the
+       * axes are drawn, the tools need the molecule itself.
+       */
+      virtual void renderSnapshot();
+
       /**
        * Render a full crystal cell
        * Called by render() automatically
@@ -611,9 +691,36 @@ namespace Avogadro {
        */
       inline double computeFramesPerSecond();
 
+      /**
+       * Apply the quality and level of detail of the current governor level.
+       */
+      void applyRenderLevel();
+
+      /**
+       * Pick the governor level from the measured interactive frame time.
+       */
+      void updateRenderLevel();
+
       bool              m_glslEnabled;
       Tool*             m_navigateTool; /// NavigateTool is a super tool
 
+    private Q_SLOTS:
+      /**
+       * Step the governor back towards full quality once the view settled.
+       */
+      void refineRender();
+
+      /**
+       * Rebuild the selection from the primitives still in the molecule,
+       * as their ids may have changed, see Molecule::compactIds().
+       */
+      void remapSelection();
+
+      /**
+       * Emit the selectionChanged() deferred by unselectPrimitive().
+       */
+      void emitSelectionChanged();
+
     public Q_SLOTS:
 
       /**
@@ -676,6 +783,12 @@ namespace Avogadro {
        */
       void invalidateDLs();
 
+      /**
+       * Signal that atoms were added, removed or moved and the frustum
+       * culling grid and transparency depth order should be rebuilt.
+       */
+      void invalidateCulling();
+
       /**
        * update the Molecule geometry.
        */
@@ -733,6 +846,12 @@ namespace Avogadro {
        */
       void namedSelectionsChanged();
 
+      /**
+       * The selection has changed. Emitted once for each call that changes
+       * it, however many primitives were selected or deselected.
+       */
+      void selectionChanged();
+
       /**
        * Signal that this GLWidget was activated.
        */
@@ -32,11 +32,14 @@
 #include "fragment.h"
 #include "residue.h"
 #include "zmatrix.h"
+#include "ringperception_p.h"
+#include "partialcharges_p.h"
 
 #include <Eigen/Geometry>
 #include <Eigen/LeastSquares>
 
 #include <vector>
+#include <climits>
 
 #include <openbabel/mol.h>
 #include <openbabel/math/vector3.h>
@@ -49,16 +52,28 @@
 #include <QDir>
 #include <QDebug>
 #include <QVariant>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+#include <QtCore/QtConcurrentRun>
 
 namespace Avogadro{
 
   using std::vector;
   using Eigen::Vector3d;
+  using Eigen::Matrix3d;
 
   class MoleculePrivate {
     public:
-      MoleculePrivate() : farthestAtom(0), invalidGeomInfo(true),
-                          invalidRings(true), obmol(0), obunitcell(0),
+      MoleculePrivate() : radius(1.0), farthestAtom(0), geometryUpdates(0),
+                          invalidGeomInfo(true), invalidSphere(true),
+                          invalidNormal(true), groupIndicesVersion(0),
+                          topologyVersion(1), ringsVersion(0),
+                          aromaticityVersion(0), chargesVersion(0),
+                          pendingChargesVersion(0), revision(0),
+                          fragmentStamp(0),
+                          obmol(0), obunitcell(0),
                           obvibdata(0)
 #ifdef OPENBABEL_IS_NEWER_THAN_2_2_99
                         , obdosdata(0), obelectronictransitiondata(0)
@@ -67,12 +82,60 @@ namespace Avogadro{
     // These are logically cached variables and thus are marked as mutable.
     // Const objects should be logically constant (and not mutable)
     // http://www.highprogrammer.com/alan/rants/mutable.html
-      mutable Eigen::Vector3d       center;
-      mutable Eigen::Vector3d       normalVector;
+      // The sums of the positions and of their outer products, kept up to
+      // date as atoms move and found again after enough moves to bound the
+      // rounding
+      mutable Eigen::Vector3d       positionSum;
+      mutable Eigen::Matrix3d       positionSquares;
+      // A sphere around all atoms, fitted around the center at the time
+      mutable Eigen::Vector3d       sphereCenter;
       mutable double                radius;
       mutable Atom *                farthestAtom;
+      mutable Eigen::Vector3d       normalVector;
+      mutable unsigned int          geometryUpdates;
       mutable bool                  invalidGeomInfo;
-      mutable bool                  invalidRings;
+      mutable bool                  invalidSphere;
+      mutable bool                  invalidNormal;
+      mutable unsigned long         groupIndicesVersion;
+      // Rings, aromaticity and partial charges are valid for the topology
+      // version they were found for
+      unsigned long                 topologyVersion;
+      mutable unsigned long         ringsVersion;
+      mutable unsigned long         aromaticityVersion;
+      mutable unsigned long         chargesVersion;
+      // Of the charges being calculated in the background, 0 if none
+      mutable unsigned long         pendingChargesVersion;
+      mutable QFutureWatcher<QVector<double> > chargesWatcher;
+
+      // Increased by every change to the positions or topology
+      mutable unsigned long         revision;
+      // The published snapshot is only ever copied or replaced under
+      // snapshotMutex, and snapshots are only taken under publishMutex
+      mutable MoleculeSnapshot      snapshot;
+      mutable QMutex                snapshotMutex;
+      mutable QMutex                publishMutex;
+      // Set when a reader got an out of date snapshot, so that the next
+      // writer or the thread of the molecule takes a new one
+      mutable QAtomicInt            snapshotRequested;
+      // Set while publishRequestedSnapshot() is queued on the thread
+      mutable QAtomicInt            publishQueued;
+
+      // Fragments of atoms connected by bonds, by unique atom id. A bond
+      // moves the atoms of the smaller fragment into the larger, and a
+      // removed bond splits off whichever side runs out first when both
+      // are searched in turn, so an edit only visits the atoms it moves.
+      QVector<int>                  fragmentOf;     // -1 if no atom
+      QVector<int>                  fragmentSlot;   // in its fragment
+      QVector<QVector<unsigned long> > fragments;
+      QVector<int>                  freeFragments;
+      QVector<unsigned int>         fragmentStamps; // of the split searches
+      unsigned int                  fragmentStamp;
+
+      int newFragment();
+      void addToFragment(unsigned long id, int fragment);
+      void removeFromFragment(unsigned long id);
+      void moveToFragment(const QVector<unsigned long> &ids, int fragment);
+
       mutable std::vector<double>   energies;
 
       // std::vector used over QVector due to index issues, QVector uses ints
@@ -104,17 +167,67 @@ namespace Avogadro{
 #endif
   };
 
+  int MoleculePrivate::newFragment()
+  {
+    if (!freeFragments.isEmpty()) {
+      const int fragment = freeFragments.last();
+      freeFragments.pop_back();
+      return fragment;
+    }
+    fragments.resize(fragments.size() + 1);
+    return fragments.size() - 1;
+  }
+
+  void MoleculePrivate::addToFragment(unsigned long id, int fragment)
+  {
+    if (id >= static_cast<unsigned long>(fragmentOf.size())) {
+      // Any ids skipped over are not atoms
+      fragmentOf.insert(fragmentOf.size(), id + 1 - fragmentOf.size(), -1);
+      fragmentSlot.resize(id + 1);
+    }
+    fragmentOf[id] = fragment;
+    fragmentSlot[id] = fragments.at(fragment).size();
+    fragments[fragment].append(id);
+  }
+
+  void MoleculePrivate::removeFromFragment(unsigned long id)
+  {
+    const int fragment = fragmentOf.value(id, -1);
+    if (fragment < 0)
+      return;
+    QVector<unsigned long> &atoms = fragments[fragment];
+    // Move the last atom into the gap
+    const unsigned long last = atoms.last();
+    atoms[fragmentSlot.at(id)] = last;
+    fragmentSlot[last] = fragmentSlot.at(id);
+    atoms.pop_back();
+    fragmentOf[id] = -1;
+    if (atoms.isEmpty()) {
+      atoms.squeeze();
+      freeFragments.append(fragment);
+    }
+  }
+
+  void MoleculePrivate::moveToFragment(const QVector<unsigned long> &ids,
+                                       int fragment)
+  {
+    foreach (unsigned long id, ids) {
+      removeFromFragment(id);
+      addToFragment(id, fragment);
+    }
+  }
+
   Molecule::Molecule(QObject *parent) : Primitive(MoleculeType, parent),
                                         d_ptr(new MoleculePrivate),
                                         m_atomPos(0),
                                         m_currentConformer(0),
                                         m_estimatedDipoleMoment(true),
                                         m_dipoleMoment(0),
-                                        m_invalidPartialCharges(true),
-                                        m_invalidAromaticity(true),
                                         m_lock(new QReadWriteLock)
   {
     connect(this, SIGNAL(updated()), this, SLOT(updatePrimitive()));
+    connect(&d_ptr->chargesWatcher, SIGNAL(finished()),
+            this, SLOT(partialChargesFinished()));
     // Assign a default path and file name to new molecules.
     m_fileName = QDir::homePath() + '/' +
                  tr("untitled", "Name of a new, untitled molecule file") +
@@ -123,11 +236,12 @@ namespace Avogadro{
 
   Molecule::Molecule(const Molecule &other) :
     Primitive(MoleculeType, other.parent()), d_ptr(new MoleculePrivate),
-    m_atomPos(0), m_dipoleMoment(0), m_invalidPartialCharges(true),
-    m_invalidAromaticity(true), m_lock(new QReadWriteLock)
+    m_atomPos(0), m_dipoleMoment(0), m_lock(new QReadWriteLock)
   {
     *this = other;
     connect(this, SIGNAL(updated()), this, SLOT(updatePrimitive()));
+    connect(&d_ptr->chargesWatcher, SIGNAL(finished()),
+            this, SLOT(partialChargesFinished()));
   }
 
   Molecule::~Molecule()
@@ -159,6 +273,7 @@ namespace Avogadro{
     // do some fancy footwork when we add an atom previously created
   Atom *Molecule::addAtom(unsigned long id)
   {
+    Q_D(Molecule);
     Atom *atom = new Atom(this);
 
     if (!m_atomPos) {
@@ -178,17 +293,22 @@ namespace Avogadro{
 
     atom->setId(id);
     atom->setIndex(m_atomList.size()-1);
+    invalidateTopology();
+    d->addToFragment(id, d->newFragment());
+    updateGeomInfo(Vector3d::Zero(), (*m_atomPos)[id], 1);
     // now that the id is correct, emit the signal
     connect(atom, SIGNAL(updated()), this, SLOT(updateAtom()));
     emit atomAdded(atom);
-    calculateGroupIndices();
     return atom;
   }
 
   void Molecule::setAtomPos(unsigned long id, const Eigen::Vector3d& vec)
   {
-    if (id < m_atomPos->size())
+    if (id < m_atomPos->size()) {
+      if (id < m_atoms.size() && m_atoms[id])
+        updateGeomInfo((*m_atomPos)[id], vec);
       (*m_atomPos)[id] = vec;
+    }
   }
 
   void Molecule::setAtomPos(unsigned long id, const Eigen::Vector3d *vec)
@@ -197,25 +317,44 @@ namespace Avogadro{
       setAtomPos(id, *vec);
   }
 
+  void Molecule::setAtomPositions(const double *coordinates)
+  {
+    if (!m_atomPos || !coordinates)
+      return;
+    foreach (const Atom *atom, m_atomList) {
+      Vector3d &pos = (*m_atomPos)[atom->id()];
+      const Vector3d to(coordinates);
+      updateGeomInfo(pos, to);
+      pos = to;
+      coordinates += 3;
+    }
+  }
+
   void Molecule::removeAtom(Atom *atom)
   {
     if(atom) {
+      Q_D(Molecule);
       // When deleting an atom this also implicitly deletes any bonds to the atom
       foreach (unsigned long bond, atom->bonds()) {
         removeBond(bond);
       }
 
       m_atoms[atom->id()] = 0;
+      invalidateTopology();
+      // Without its bonds the atom is a fragment of its own
+      d->removeFromFragment(atom->id());
       // 1 based arrays stored/shown to user
       int index = atom->index();
       m_atomList.removeAt(index);
       for (int i = index; i < m_atomList.size(); ++i)
         m_atomList[i]->setIndex(i);
+      updateGeomInfo(*atom->pos(), Vector3d::Zero(), -1);
+      if (d->farthestAtom == atom)
+        d->invalidSphere = true;
       atom->deleteLater();
 
       disconnect(atom, SIGNAL(updated()), this, SLOT(updateAtom()));
       emit atomRemoved(atom);
-      calculateGroupIndices();
     }
   }
 
@@ -224,6 +363,54 @@ namespace Avogadro{
     removeAtom(atomById(id));
   }
 
+  void Molecule::removeAtoms(const QList<unsigned long> &ids)
+  {
+    Q_D(Molecule);
+    QList<Atom *> removed;
+    QList<unsigned long> bonds;
+    QList<int> fragments;
+    foreach (unsigned long id, ids) {
+      Atom *atom = atomById(id);
+      if (!atom)
+        continue;
+      // Taken out straight away, so that repeated ids are skipped and the
+      // bonds are not detached from atoms that are going anyway
+      m_atoms[id] = 0;
+      removed.append(atom);
+      bonds += atom->bonds();
+      fragments.append(d->fragmentOf.at(id));
+    }
+    if (removed.isEmpty())
+      return;
+
+    // When deleting atoms this also implicitly deletes any bonds to them
+    takeBonds(bonds, fragments);
+    invalidateTopology();
+
+    // Close up the list and renumber the atoms left in one pass
+    int index = 0;
+    for (int i = 0; i < m_atomList.size(); ++i) {
+      Atom *atom = m_atomList.at(i);
+      if (m_atoms[atom->id()] == atom) {
+        atom->setIndex(index);
+        m_atomList[index++] = atom;
+      }
+    }
+    m_atomList.erase(m_atomList.begin() + index, m_atomList.end());
+
+    foreach (Atom *atom, removed) {
+      d->removeFromFragment(atom->id());
+      updateGeomInfo(*atom->pos(), Vector3d::Zero(), -1);
+      if (d->farthestAtom == atom)
+        d->invalidSphere = true;
+      atom->deleteLater();
+
+      disconnect(atom, SIGNAL(updated()), this, SLOT(updateAtom()));
+      emit atomRemoved(atom);
+    }
+    splitFragments(fragments);
+  }
+
   Bond *Molecule::addBond()
   {
     return addBond(m_bonds.size());
@@ -234,9 +421,7 @@ namespace Avogadro{
     Q_D(Molecule);
     Bond *bond = new Bond(this);
 
-    d->invalidRings = true;
-    m_invalidPartialCharges = true;
-    m_invalidAromaticity = true;
+    invalidateTopology();
     if(id >= m_bonds.size())
       m_bonds.resize(id+1,0);
     m_bonds[id] = bond;
@@ -264,9 +449,7 @@ namespace Avogadro{
       if (m_bonds[id] == 0)
         return;
 
-      d->invalidRings = true;
-      m_invalidPartialCharges = true;
-      m_invalidAromaticity = true;
+      invalidateTopology();
       Bond *bond = m_bonds[id];
       m_bonds[id] = 0;
       // Delete the bond from the list and reorder the remaining bonds
@@ -285,6 +468,7 @@ namespace Avogadro{
         if (m_atoms[bond->endAtomId()])
           m_atoms[bond->endAtomId()]->removeBond(id);
       }
+      disconnectAtoms(bond->beginAtomId(), bond->endAtomId());
 
       disconnect(bond, SIGNAL(updated()), this, SLOT(updateBond()));
       emit bondRemoved(bond);
@@ -292,6 +476,56 @@ namespace Avogadro{
     }
   }
 
+  void Molecule::removeBonds(const QList<unsigned long> &ids)
+  {
+    QList<int> fragments;
+    takeBonds(ids, fragments);
+    splitFragments(fragments);
+  }
+
+  void Molecule::takeBonds(const QList<unsigned long> &ids,
+                           QList<int> &fragments)
+  {
+    Q_D(Molecule);
+    QList<Bond *> removed;
+    foreach (unsigned long id, ids) {
+      Bond *bond = bondById(id);
+      if (!bond)
+        continue;
+      m_bonds[id] = 0;
+      removed.append(bond);
+
+      // Also delete the bond from the attached atoms
+      Atom *atom = atomById(bond->beginAtomId());
+      if (atom) {
+        atom->removeBond(id);
+        fragments.append(d->fragmentOf.at(atom->id()));
+      }
+      atom = atomById(bond->endAtomId());
+      if (atom)
+        atom->removeBond(id);
+    }
+    if (removed.isEmpty())
+      return;
+    invalidateTopology();
+
+    int index = 0;
+    for (int i = 0; i < m_bondList.size(); ++i) {
+      Bond *bond = m_bondList.at(i);
+      if (m_bonds[bond->id()] == bond) {
+        bond->setIndex(index);
+        m_bondList[index++] = bond;
+      }
+    }
+    m_bondList.erase(m_bondList.begin() + index, m_bondList.end());
+
+    foreach (Bond *bond, removed) {
+      disconnect(bond, SIGNAL(updated()), this, SLOT(updateBond()));
+      emit bondRemoved(bond);
+      bond->deleteLater();
+    }
+  }
+
   Residue *Molecule::residue(int index)
   {
     Q_D(Molecule);
@@ -677,10 +911,6 @@ namespace Avogadro{
         bond->setBegin(Molecule::atom(next->GetIdx()-1));
       }
     }
-    for (unsigned int i = 1; i <= numberAtoms; ++i) {
-      // Warning -- OB atom index off-by-one here
-      atom(i-1)->setPartialCharge(obmol.GetAtom(i)->GetPartialCharge());
-    }
   }
 
   void Molecule::removeHydrogens(Atom *atom)
@@ -753,73 +983,118 @@ namespace Avogadro{
     }
   }
 
+  // Set the charges by atom index, if they are for as many atoms
+  static bool setPartialCharges(const Molecule *molecule,
+                                const QVector<double> &charges)
+  {
+    if (charges.size() != static_cast<int>(molecule->numAtoms()))
+      return false;
+    for (int i = 0; i < charges.size(); ++i)
+      molecule->atom(i)->setPartialCharge(charges.at(i));
+    return true;
+  }
+
   void Molecule::calculatePartialCharges() const
   {
-    if (numAtoms() < 1 || !m_invalidPartialCharges) {
+    Q_D(const Molecule);
+    if (numAtoms() < 1 || d->chargesVersion == d->topologyVersion)
       return;
+
+    // Take the result of a calculation in the background for this
+    // topology rather than starting over
+    if (d->pendingChargesVersion == d->topologyVersion) {
+      d->chargesWatcher.waitForFinished();
+      if (setPartialCharges(this, d->chargesWatcher.result())) {
+        d->chargesVersion = d->topologyVersion;
+        return;
+      }
     }
-    OpenBabel::OBMol obmol = OBMol();
-    for (unsigned int i = 0; i < numAtoms(); ++i) {
-      // Warning: OB off-by-one index
-      atom(i)->setPartialCharge(obmol.GetAtom(i+1)->GetPartialCharge());
+    setPartialCharges(this, Avogadro::calculateCharges(chargeTopology(this),
+                                                       GasteigerCharges));
+    d->chargesVersion = d->topologyVersion;
+  }
+
+  void Molecule::requestPartialCharges() const
+  {
+    Q_D(const Molecule);
+    if (numAtoms() < 1 || d->chargesVersion == d->topologyVersion
+        || d->pendingChargesVersion == d->topologyVersion)
+      return;
+
+    // A calculation still running for an older topology is dropped
+    d->pendingChargesVersion = d->topologyVersion;
+    d->chargesWatcher.setFuture(QtConcurrent::run(Avogadro::calculateCharges,
+                                                  chargeTopology(this),
+                                                  GasteigerCharges));
+  }
+
+  bool Molecule::hasPartialCharges() const
+  {
+    Q_D(const Molecule);
+    return d->chargesVersion == d->topologyVersion;
+  }
+
+  void Molecule::partialChargesFinished()
+  {
+    Q_D(Molecule);
+    const unsigned long version = d->pendingChargesVersion;
+    d->pendingChargesVersion = 0;
+    // The topology changed while they were calculated, or they were
+    // already taken by calculatePartialCharges()
+    if (version != d->topologyVersion || d->chargesVersion == version)
+      return;
+    if (setPartialCharges(this, d->chargesWatcher.result())) {
+      d->chargesVersion = version;
+      emit partialChargesChanged();
     }
-    m_invalidPartialCharges = false;
   }
 
   void Molecule::calculateAromaticity() const
   {
-    if (numBonds() < 1 || !m_invalidAromaticity)
+    Q_D(const Molecule);
+    if (numBonds() < 1 || d->aromaticityVersion == d->topologyVersion)
       return;
 
-    OpenBabel::OBMol obmol = OBMol();
-    for (unsigned int i = 0; i < obmol.NumBonds(); ++i) {
-      bond(i)->setAromaticity(obmol.GetBond(i)->IsAromatic());
-    }
-    m_invalidAromaticity = false;
+    QVector<bool> aromatic = RingPerception(this).aromaticBonds();
+    for (int i = 0; i < aromatic.size(); ++i)
+      bond(i)->setAromaticity(aromatic.at(i));
+    d->aromaticityVersion = d->topologyVersion;
+  }
+
+  unsigned long Molecule::topologyVersion() const
+  {
+    Q_D(const Molecule);
+    return d->topologyVersion;
+  }
+
+  void Molecule::invalidateTopology()
+  {
+    Q_D(Molecule);
+    ++d->topologyVersion;
+    ++d->revision;
   }
 
   void Molecule::calculateGroupIndices() const
   {
-/*    OpenBabel::OBMol obmol = OBMol();
-#ifdef OPENBABEL_IS_NEWER_THAN_2_2_99
-    for (unsigned int i = 0; i < obmol.NumAtoms(); ++i) {
-      atom(i)->setGroupIndex(obmol.GetAtomGroupNumbers().at(i));
-    }
-#endif*/
-    QVector<unsigned int> group_number;   // numbers of atoms in each group
-    QVector<unsigned int> group_ele;    // elements of each group
-    QVector<unsigned int> atomGroupNumber;
-    atomGroupNumber.resize(numAtoms());
-
-    for (unsigned int i = 0; i < numAtoms(); ++i) {
-      bool match = false;
-      for (unsigned int j=0; j<group_number.size(); j++) {
-          if ((atom(i)->atomicNumber()) == group_ele.at(j)) {
-            group_number[j] += 1;
-            atomGroupNumber[i] = group_number[j];
-            match = true;
-          }
-      }
-      if (!match) {
-        group_ele.push_back(atom(i)->atomicNumber());
-        group_number.push_back(1);
-        atomGroupNumber[i] = 1;
-      }
+    Q_D(const Molecule);
+    if (d->groupIndicesVersion == d->topologyVersion)
+      return;
+
+    // Atoms are numbered in order within their element, and elements with
+    // only one atom are not numbered
+    QHash<int, unsigned int> elementCounts;
+    foreach (const Atom *atom, m_atomList)
+      ++elementCounts[atom->atomicNumber()];
+    QHash<int, unsigned int> groupNumbers;
+    foreach (Atom *atom, m_atomList) {
+      const int element = atom->atomicNumber();
+      if (elementCounts.value(element) == 1)
+        atom->setGroupIndex(0);
+      else
+        atom->setGroupIndex(++groupNumbers[element]);
     }
-    
-    for (unsigned int i = 0; i < numAtoms(); ++i) {
-      bool match = false;
-      for (unsigned int j=0; j<group_number.size(); j++) {
-        if ((atom(i)->atomicNumber()) == group_ele.at(j) && (group_number.at(j) == 1))
-          match = true;
-      }
-      if (match) {
-        atom(i)->setGroupIndex(0);
-      } else {
-        atom(i)->setGroupIndex(atomGroupNumber.at(i));
-      }
-    } 
-  }    
+    d->groupIndicesVersion = d->topologyVersion;
+  }
 
   unsigned int Molecule::numAtoms() const
   {
@@ -855,28 +1130,152 @@ namespace Avogadro{
     return d->ringList.size();
   }
 
-  void Molecule::updateMolecule()
+  unsigned int Molecule::numFragments() const
+  {
+    Q_D(const Molecule);
+    return d->fragments.size() - d->freeFragments.size();
+  }
+
+  QList<unsigned long> Molecule::fragmentAtoms(unsigned long atomId) const
+  {
+    Q_D(const Molecule);
+    QList<unsigned long> atoms;
+    const int fragment = atomId < static_cast<unsigned long>(d->fragmentOf.size())
+                         ? d->fragmentOf.at(atomId) : -1;
+    if (fragment >= 0)
+      foreach (unsigned long id, d->fragments.at(fragment))
+        atoms.append(id);
+    return atoms;
+  }
+
+  QList<QList<unsigned long> > Molecule::fragmentAtomLists() const
+  {
+    Q_D(const Molecule);
+    QList<QList<unsigned long> > lists;
+    foreach (const QVector<unsigned long> &fragment, d->fragments)
+      if (!fragment.isEmpty())
+        lists.append(fragment.toList());
+    return lists;
+  }
+
+  void Molecule::connectAtoms(unsigned long id1, unsigned long id2)
   {
     Q_D(Molecule);
-    d->invalidGeomInfo = true;
+    if (!atomById(id1) || !atomById(id2))
+      return;
+    int a = d->fragmentOf.at(id1), b = d->fragmentOf.at(id2);
+    if (a == b)
+      return;
+    if (d->fragments.at(a).size() < d->fragments.at(b).size())
+      qSwap(a, b);
+    // Copied as the atoms are removed from it as they move
+    const QVector<unsigned long> smaller = d->fragments.at(b);
+    d->moveToFragment(smaller, a);
+  }
+
+  void Molecule::disconnectAtoms(unsigned long id1, unsigned long id2)
+  {
+    Q_D(Molecule);
+    if (id1 == id2 || !atomById(id1) || !atomById(id2)
+        || d->fragmentOf.at(id1) != d->fragmentOf.at(id2))
+      return;
+
+    // Search from both atoms in turn, stamping what each side reaches. If
+    // they meet the fragment is still connected, otherwise the side that
+    // runs out first is split off, having visited no more than the other.
+    if (d->fragmentStamps.size() < static_cast<int>(m_atoms.size()))
+      d->fragmentStamps.resize(m_atoms.size());
+    if (d->fragmentStamp > UINT_MAX - 2) {
+      d->fragmentStamps.fill(0);
+      d->fragmentStamp = 0;
+    }
+    const unsigned int stamps[2] = { d->fragmentStamp + 1,
+                                     d->fragmentStamp + 2 };
+    d->fragmentStamp += 2;
+    QVector<unsigned long> found[2];
+    int next[2] = { 0, 0 };
+    found[0].append(id1);
+    found[1].append(id2);
+    d->fragmentStamps[id1] = stamps[0];
+    d->fragmentStamps[id2] = stamps[1];
+
+    for (int side = 0; ; side = 1 - side) {
+      if (next[side] == found[side].size()) {
+        d->moveToFragment(found[side], d->newFragment());
+        return;
+      }
+      const Atom *atom = m_atoms[found[side].at(next[side]++)];
+      foreach (unsigned long bondId, atom->bonds()) {
+        const Bond *bond = bondById(bondId);
+        if (!bond)
+          continue;
+        const unsigned long other = bond->otherAtom(atom->id());
+        if (other >= static_cast<unsigned long>(d->fragmentStamps.size()))
+          continue;
+        const unsigned int stamp = d->fragmentStamps.at(other);
+        if (stamp == stamps[1 - side])
+          return;   // the two searches met
+        if (stamp != stamps[side]) {
+          d->fragmentStamps[other] = stamps[side];
+          found[side].append(other);
+        }
+      }
+    }
+  }
+
+  void Molecule::splitFragments(const QList<int> &fragments)
+  {
+    Q_D(Molecule);
+    // Take the atoms out of the fragments, each fragment once
+    QVector<unsigned long> atoms;
+    foreach (int fragment, fragments) {
+      if (fragment < 0 || d->fragments.at(fragment).isEmpty())
+        continue;
+      atoms += d->fragments.at(fragment);
+      foreach (unsigned long id, d->fragments.at(fragment))
+        d->fragmentOf[id] = -1;
+      d->fragments[fragment].clear();
+      d->freeFragments.append(fragment);
+    }
+
+    // and search from each atom not yet back in one, with the list of the
+    // new fragment as the queue
+    foreach (unsigned long id, atoms) {
+      if (d->fragmentOf.at(id) >= 0)
+        continue;
+      const int fragment = d->newFragment();
+      d->addToFragment(id, fragment);
+      for (int next = 0; next < d->fragments.at(fragment).size(); ++next) {
+        const Atom *atom = m_atoms[d->fragments.at(fragment).at(next)];
+        foreach (unsigned long bondId, atom->bonds()) {
+          const Bond *bond = bondById(bondId);
+          if (!bond)
+            continue;
+          const unsigned long other = bond->otherAtom(atom->id());
+          if (other < static_cast<unsigned long>(d->fragmentOf.size())
+              && d->fragmentOf.at(other) < 0)
+            d->addToFragment(other, fragment);
+        }
+      }
+    }
+  }
+
+  void Molecule::updateMolecule()
+  {
+    invalidateGeomInfo();
     emit moleculeChanged();
     emit updated();
   }
 
   void Molecule::updatePrimitive()
   {
-    Q_D(Molecule);
     Primitive *primitive = qobject_cast<Primitive *>(sender());
-    d->invalidGeomInfo = true;
     emit primitiveUpdated(primitive);
   }
 
   void Molecule::updateAtom()
   {
-    Q_D(Molecule);
     Atom *atom = qobject_cast<Atom *>(sender());
-    d->invalidGeomInfo = true;
-    calculateGroupIndices();
     emit atomUpdated(atom);
   }
 
@@ -936,8 +1335,11 @@ namespace Avogadro{
 
   vector<Vector3d> * Molecule::addConformer(unsigned int index)
   {
-    if (index < m_atomConformers.size())
+    if (index < m_atomConformers.size()) {
+      if (m_atomConformers[index] == m_atomPos)
+        invalidateGeomInfo();
       return m_atomConformers[index];
+    }
     else {
       unsigned int size = m_atomConformers.size();
       m_atomConformers.resize(index+1);
@@ -949,16 +1351,23 @@ namespace Avogadro{
 
   vector<Vector3d> * Molecule::conformer(unsigned int index)
   {
-    if (index && index < m_atomConformers.size())
+    if (index && index < m_atomConformers.size()) {
+      if (m_atomConformers[index] == m_atomPos)
+        invalidateGeomInfo();
       return m_atomConformers[index];
-    else if (index == 0)
+    }
+    else if (index == 0) {
+      invalidateGeomInfo();
       return m_atomPos;
+    }
     else
       return NULL;
   }
 
   const std::vector<std::vector<Eigen::Vector3d> *>& Molecule::conformers() const
   {
+    // The current positions may be written through these
+    invalidateGeomInfo();
     return m_atomConformers;
   }
 
@@ -978,6 +1387,7 @@ namespace Avogadro{
         m_atomPos->push_back(Eigen::Vector3d::Zero());
       // set the current conformer index
       m_currentConformer = index;
+      invalidateGeomInfo();
       return true;
     }
   }
@@ -1007,6 +1417,7 @@ namespace Avogadro{
 
     m_atomPos = m_atomConformers[0];
     m_currentConformer = 0;
+    invalidateGeomInfo();
     return true;
   }
 
@@ -1019,6 +1430,7 @@ namespace Avogadro{
       m_atomPos = m_atomConformers[0];
     }
     m_currentConformer = 0;
+    invalidateGeomInfo();
   }
 
   unsigned int Molecule::numConformers() const
@@ -1110,21 +1522,18 @@ namespace Avogadro{
   {
     Q_D(Molecule);
     // Check is the rings need updating before returning the list
-    if(d->invalidRings) {
+    if (d->ringsVersion != d->topologyVersion) {
       // Now update the rings
       foreach(Fragment *ring, d->ringList) {
         removeRing(ring);
       }
-      OpenBabel::OBMol obmol = OBMol();
-      std::vector<OpenBabel::OBRing *> rings;
-      rings = obmol.GetSSSR();
-      foreach(OpenBabel::OBRing *r, rings) {
+      RingPerception perception(this);
+      foreach (const QVector<int> &r, perception.rings()) {
         Fragment *ring = addRing();
-        foreach(int index, r->_path) {
-          ring->addAtom(atom(index-1)->id());
-        }
+        foreach (int index, r)
+          ring->addAtom(atom(index)->id());
       }
-      d->invalidRings = false;
+      d->ringsVersion = d->topologyVersion;
     }
     return d->ringList;
   }
@@ -1402,28 +1811,55 @@ namespace Avogadro{
   const Eigen::Vector3d Molecule::center() const
   {
     Q_D(const Molecule);
-    if( d->invalidGeomInfo ) computeGeomInfo();
-    return d->center;
+    if (d->invalidGeomInfo)
+      computeGeomInfo();
+    if (numAtoms() < 2)
+      return Vector3d::Zero();
+    return d->positionSum / static_cast<double>(numAtoms());
   }
 
   const Eigen::Vector3d Molecule::normalVector() const
   {
     Q_D(const Molecule);
-    if( d->invalidGeomInfo ) computeGeomInfo();
+    if (d->invalidGeomInfo)
+      computeGeomInfo();
+    if (d->invalidNormal) {
+      // The normal to the best-fitting plane is the direction of least
+      // variance, as in Eigen::fitHyperplane but from the running sums
+      d->normalVector.setZero();
+      const unsigned int nAtoms = numAtoms();
+      if (nAtoms > 1) {
+        const Matrix3d covariance = d->positionSquares
+          - d->positionSum * d->positionSum.transpose() / static_cast<double>(nAtoms);
+        Eigen::SelfAdjointEigenSolver<Matrix3d> eigen(covariance);
+        d->normalVector = eigen.eigenvectors().col(0);
+      }
+      d->invalidNormal = false;
+    }
     return d->normalVector;
   }
 
   double Molecule::radius() const
   {
     Q_D(const Molecule);
-    if( d->invalidGeomInfo ) computeGeomInfo();
-    return d->radius;
+    if (d->invalidGeomInfo)
+      computeGeomInfo();
+    if (d->invalidSphere)
+      fitBoundingSphere();
+    if (numAtoms() < 2)
+      return d->radius;
+    // The sphere is around the center when it was fitted, grow it to
+    // reach all atoms from the current center
+    return d->radius + (center() - d->sphereCenter).norm();
   }
 
   const Atom * Molecule::farthestAtom() const
   {
     Q_D(const Molecule);
-    if( d->invalidGeomInfo ) computeGeomInfo();
+    if (d->invalidGeomInfo)
+      computeGeomInfo();
+    if (d->invalidSphere)
+      fitBoundingSphere();
     return d->farthestAtom;
   }
 
@@ -1433,11 +1869,17 @@ namespace Avogadro{
       return; // nothing to do
 
     Q_D(const Molecule);
-    d->invalidGeomInfo = true;
     foreach (Atom *atom, m_atomList) {
       (*m_atomPos)[atom->id()] += offset;
       emit atomUpdated(atom);
     }
+    // Shift the sums and the sphere, the plane keeps its normal
+    const double n = numAtoms();
+    d->positionSquares += offset * d->positionSum.transpose()
+      + d->positionSum * offset.transpose() + n * offset * offset.transpose();
+    d->positionSum += n * offset;
+    d->sphereCenter += offset;
+    ++d->revision;
   }
 
   void Molecule::clear()
@@ -1491,6 +1933,84 @@ namespace Avogadro{
       emit primitiveRemoved(ring);
     }
     d->ringList.clear();
+    invalidateTopology();
+    invalidateGeomInfo();
+
+    d->fragmentOf.clear();
+    d->fragmentSlot.clear();
+    d->fragments.clear();
+    d->freeFragments.clear();
+    d->fragmentStamps.clear();
+  }
+
+  void Molecule::compactIds()
+  {
+    Q_D(Molecule);
+    // The new ids are the indices, removed atoms and bonds map to FALSE_ID
+    QVector<unsigned long> atomIds(m_atoms.size(), FALSE_ID);
+    QVector<unsigned long> bondIds(m_bonds.size(), FALSE_ID);
+    foreach (Atom *atom, m_atomList)
+      atomIds[atom->id()] = atom->index();
+    foreach (Bond *bond, m_bondList)
+      bondIds[bond->id()] = bond->index();
+
+    // The positions of every conformer, the current one in place
+    for (unsigned int i = 0; i < m_atomConformers.size(); ++i) {
+      vector<Vector3d> &positions = *m_atomConformers[i];
+      vector<Vector3d> compacted(m_atomList.size(), Vector3d::Zero());
+      foreach (Atom *atom, m_atomList)
+        if (atom->id() < positions.size())
+          compacted[atom->index()] = positions[atom->id()];
+      positions.swap(compacted);
+    }
+
+    // The fragments are kept, under the new ids
+    QVector<int> fragmentOf(m_atomList.size()), fragmentSlot(m_atomList.size());
+    foreach (Atom *atom, m_atomList) {
+      fragmentOf[atom->index()] = d->fragmentOf.at(atom->id());
+      fragmentSlot[atom->index()] = d->fragmentSlot.at(atom->id());
+    }
+    d->fragmentOf = fragmentOf;
+    d->fragmentSlot = fragmentSlot;
+    for (int i = 0; i < d->fragments.size(); ++i)
+      for (int j = 0; j < d->fragments.at(i).size(); ++j)
+        d->fragments[i][j] = atomIds.at(d->fragments.at(i).at(j));
+    d->fragmentStamps.clear();
+
+    m_atoms.resize(m_atomList.size());
+    foreach (Atom *atom, m_atomList) {
+      for (int i = 0; i < atom->m_bonds.size(); ++i)
+        atom->m_bonds[i] = bondIds.at(atom->m_bonds.at(i));
+      atom->setId(atom->index());
+      m_atoms[atom->id()] = atom;
+    }
+    m_bonds.resize(m_bondList.size());
+    foreach (Bond *bond, m_bondList) {
+      bond->m_beginAtomId = atomIds.value(bond->m_beginAtomId, FALSE_ID);
+      bond->m_endAtomId = atomIds.value(bond->m_endAtomId, FALSE_ID);
+      bond->setId(bond->index());
+      m_bonds[bond->id()] = bond;
+    }
+
+    // Residues keep their atom names in step with the atoms, so atoms that
+    // are gone stay in the list as FALSE_ID
+    foreach (Residue *residue, d->residueList) {
+      for (int i = 0; i < residue->m_atoms.size(); ++i)
+        residue->m_atoms[i] = atomIds.value(residue->m_atoms.at(i), FALSE_ID);
+      QList<unsigned long> bonds;
+      foreach (unsigned long id, residue->m_bonds)
+        if (bondIds.value(id, FALSE_ID) != FALSE_ID)
+          bonds.append(bondIds.at(id));
+      residue->m_bonds = bonds;
+    }
+    foreach (ZMatrix *zmatrix, d->zMatrixList)
+      for (int i = 0; i < zmatrix->m_items.size(); ++i)
+        zmatrix->m_items[i].atomIndex =
+          atomIds.value(zmatrix->m_items.at(i).atomIndex, FALSE_ID);
+
+    invalidateTopology();
+    // Anything keyed by id, such as the selection, must be rebuilt
+    updateMolecule();
   }
 
   QReadWriteLock * Molecule::lock() const
@@ -1498,10 +2018,68 @@ namespace Avogadro{
     return m_lock;
   }
 
+  MoleculeSnapshot Molecule::snapshot() const
+  {
+    Q_D(const Molecule);
+    // Edits made on this thread show up straight away, unless another
+    // thread is writing. Other threads only ask for a new snapshot, as
+    // this thread edits the molecule without taking the lock.
+    if (QThread::currentThread() == thread() && m_lock->tryLockForRead()) {
+      d->snapshotMutex.lock();
+      const bool stale = !d->snapshot.isValid()
+                         || d->snapshot.revision() != d->revision;
+      d->snapshotMutex.unlock();
+      if (stale)
+        takeSnapshot();
+      m_lock->unlock();
+    }
+    else {
+      d->snapshotRequested.fetchAndStoreOrdered(1);
+      if (QThread::currentThread() != thread()
+          && !d->publishQueued.fetchAndStoreOrdered(1))
+        QMetaObject::invokeMethod(const_cast<Molecule *>(this),
+                                  "publishRequestedSnapshot",
+                                  Qt::QueuedConnection);
+    }
+    QMutexLocker locker(&d->snapshotMutex);
+    return d->snapshot;
+  }
+
+  void Molecule::publishSnapshot() const
+  {
+    Q_D(const Molecule);
+    // Nothing to do until a reader has been handed an out of date one
+    if (d->snapshotRequested)
+      takeSnapshot();
+  }
+
+  void Molecule::publishRequestedSnapshot()
+  {
+    Q_D(Molecule);
+    d->publishQueued.fetchAndStoreOrdered(0);
+    // A writer holding the lock publishes it before unlocking instead
+    if (m_lock->tryLockForRead()) {
+      publishSnapshot();
+      m_lock->unlock();
+    }
+  }
+
+  void Molecule::takeSnapshot() const
+  {
+    Q_D(const Molecule);
+    QMutexLocker publishLocker(&d->publishMutex);
+    d->snapshotRequested.fetchAndStoreOrdered(0);
+    // The old snapshot is let go of outside the mutex
+    MoleculeSnapshot snapshot(this, d->revision, d->snapshot);
+    d->snapshotMutex.lock();
+    qSwap(d->snapshot, snapshot);
+    d->snapshotMutex.unlock();
+  }
+
   Molecule &Molecule::operator=(const Molecule& other)
   {
     // FIXME: Copy all the other stuff in the molecule!
-    //Q_D(Molecule);
+    Q_D(Molecule);
     clear();
     //const MoleculePrivate *e = other.d_func();
     m_atoms.resize(other.m_atoms.size(), 0);
@@ -1528,6 +2106,7 @@ namespace Avogadro{
         atom->setIndex(other.m_atoms[i]->index());
         m_atoms[i] = atom;
         m_atomList.push_back(atom);
+        d->addToFragment(atom->id(), d->newFragment());
         *atom = *(other.m_atoms[i]);
         emit primitiveAdded(atom);
       }
@@ -1545,6 +2124,7 @@ namespace Avogadro{
         // Add the bond to it's atoms
         bond->beginAtom()->addBond(bond);
         bond->endAtom()->addBond(bond);
+        connectAtoms(bond->beginAtomId(), bond->endAtomId());
         emit primitiveAdded(bond);
       }
     }
@@ -1603,11 +2183,9 @@ namespace Avogadro{
   void Molecule::computeGeomInfo() const
   {
     Q_D(const Molecule);
-    d->invalidGeomInfo = true;
-    d->farthestAtom = 0;
-    d->center.setZero();
-    d->normalVector.setZero();
-    d->radius = 1.0;
+    d->positionSum.setZero();
+    d->positionSquares.setZero();
+    d->geometryUpdates = 0;
 
     /// FIXME This leads to the dipole moment always getting invalidated
     /// as the geometry information must be computed on load
@@ -1618,37 +2196,70 @@ namespace Avogadro{
       m_estimatedDipoleMoment = true;
     }
 
-    unsigned int nAtoms = numAtoms();
-    // In order to calculate many parameters we need at least two atoms
-    if(nAtoms > 1) {
-      // Compute the normal vector to the molecule's best-fitting plane
-      int i = 0;
-      Vector3d ** atomPositions = new Vector3d*[nAtoms];
-      // Calculate the center of the molecule too
-      foreach (Atom *atom, m_atomList) {
-        Vector3d *pos = &(*m_atomPos)[atom->id()];
-        d->center += *pos;
-        atomPositions[i++] = pos;
-      }
-      d->center /= static_cast<double>(nAtoms);
-      Eigen::Hyperplane<double, 3> planeCoeffs;
-      Eigen::fitHyperplane(numAtoms(), atomPositions, &planeCoeffs);
-      delete[] atomPositions;
-      d->normalVector = planeCoeffs.normal();
-
-      // compute radius and the farthest atom
-      d->radius = -1.0; // so that ( squaredDistanceToCenter > d->radius ) is true for at least one atom.
-      foreach (Atom *atom, m_atomList) {
-        double distanceToCenter = (*atom->pos() - d->center).norm();
-        if(distanceToCenter > d->radius) {
-          d->radius = distanceToCenter;
-          d->farthestAtom = atom;
-        }
-      }
-      
-      calculateGroupIndices();
+    foreach (Atom *atom, m_atomList) {
+      const Vector3d &pos = (*m_atomPos)[atom->id()];
+      d->positionSum += pos;
+      d->positionSquares += pos * pos.transpose();
     }
     d->invalidGeomInfo = false;
+    d->invalidNormal = true;
+    fitBoundingSphere();
+  }
+
+  void Molecule::updateGeomInfo(const Eigen::Vector3d &from,
+                                const Eigen::Vector3d &to, int count) const
+  {
+    Q_D(const Molecule);
+    ++d->revision;
+    if (m_dipoleMoment) {
+      delete m_dipoleMoment;
+      m_dipoleMoment = 0;
+      m_estimatedDipoleMoment = true;
+    }
+    if (d->invalidGeomInfo)
+      return;
+    // Rounding builds up in the sums, find them again now and then
+    if (++d->geometryUpdates > 16 * numAtoms() + 1024u) {
+      d->invalidGeomInfo = true;
+      return;
+    }
+
+    d->positionSum += to - from;
+    d->positionSquares += to * to.transpose() - from * from.transpose();
+    d->invalidNormal = true;
+    // Removing an atom leaves the others inside the sphere, and the
+    // sphere of fewer than two atoms is only a placeholder
+    if ((count >= 0 && (to - d->sphereCenter).squaredNorm() > d->radius * d->radius)
+        || numAtoms() < 3)
+      d->invalidSphere = true;
+  }
+
+  void Molecule::invalidateGeomInfo() const
+  {
+    Q_D(const Molecule);
+    d->invalidGeomInfo = true;
+    ++d->revision;
+  }
+
+  void Molecule::fitBoundingSphere() const
+  {
+    Q_D(const Molecule);
+    d->farthestAtom = 0;
+    d->radius = 1.0;
+    d->sphereCenter = center();
+    d->invalidSphere = false;
+    if (numAtoms() < 2)
+      return;
+
+    double radius2 = -1.0;
+    foreach (Atom *atom, m_atomList) {
+      const double distance2 = ((*m_atomPos)[atom->id()] - d->sphereCenter).squaredNorm();
+      if (distance2 > radius2) {
+        radius2 = distance2;
+        d->farthestAtom = atom;
+      }
+    }
+    d->radius = std::sqrt(radius2);
   }
 
 } // End namespace Avogadro
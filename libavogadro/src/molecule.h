@@ -27,6 +27,7 @@
 #define MOLECULE_H
 
 #include <avogadro/primitive.h>
+#include <avogadro/moleculesnapshot.h>
 
 // Used by the inline functions
 #include <QReadWriteLock>
@@ -136,6 +137,14 @@ namespace Avogadro {
      */
     void removeAtom(unsigned long id);
 
+    /**
+     * Delete the atoms with the unique ids @p ids, and their bonds. The
+     * remaining atoms are renumbered once for all of them, so this is much
+     * faster than removing many atoms one at a time. Ids of atoms that do
+     * not exist are skipped.
+     */
+    void removeAtoms(const QList<unsigned long> &ids);
+
     /**
      * @return The Atom at the supplied index.
      * @note Replaces GetAtom.
@@ -166,6 +175,14 @@ namespace Avogadro {
      */
     void setAtomPos(unsigned long id, const Eigen::Vector3d *vec);
 
+    /**
+     * Set the positions of all atoms in one pass, no signals are emitted so
+     * call update() once done.
+     * @param coordinates x, y and z of each Atom in the order of atoms(),
+     * must hold 3 * numAtoms() values.
+     */
+    void setAtomPositions(const double *coordinates);
+
     /**
      * Get the position vector of the supplied Atom.
      * @param id Unique id of the Atom.
@@ -209,6 +226,12 @@ namespace Avogadro {
      */
     void removeBond(unsigned long id);
 
+    /**
+     * Delete the bonds with the unique ids @p ids, renumbering the
+     * remaining bonds once. Ids of bonds that do not exist are skipped.
+     */
+    void removeBonds(const QList<unsigned long> &ids);
+
     /**
      * @return The Bond at the supplied index.
      * @note Replaces GetBond.
@@ -323,6 +346,23 @@ namespace Avogadro {
      * @return The total number of rings in the molecule.
      */
     unsigned int numRings() const;
+
+    /**
+     * @return The number of fragments, the groups of atoms connected by
+     * bonds. They are kept up to date as bonds are added and removed.
+     */
+    unsigned int numFragments() const;
+
+    /**
+     * @return The unique ids of the atoms in the fragment of the atom with
+     * unique id @p atomId, in no particular order.
+     */
+    QList<unsigned long> fragmentAtoms(unsigned long atomId) const;
+
+    /**
+     * @return The unique atom ids of each fragment.
+     */
+    QList<QList<unsigned long> > fragmentAtomLists() const;
     /** @} */
 
     /** @name Cube properties
@@ -491,17 +531,43 @@ namespace Avogadro {
     Eigen::Vector3d dipoleMoment(bool *estimate = 0) const;
 
     /**
-     * Calculate the partial charges on each atom.
+     * Calculate the Gasteiger partial charges on each atom, if the
+     * topology changed since they were last calculated. Moving atoms does
+     * not change them. If a calculation for the current topology is
+     * already running in the background this waits for it.
      */
     void calculatePartialCharges() const;
 
     /**
-     * Calculate the aromaticity of the bonds.
+     * Start calculating the partial charges on a worker thread if they are
+     * out of date. partialChargesChanged() is emitted when they are set.
+     * Use it to avoid stalling the GUI thread on a large molecule.
+     */
+    void requestPartialCharges() const;
+
+    /**
+     * @return True if the partial charges of the atoms are up to date, so
+     * Atom::partialCharge() returns without calculating them.
+     */
+    bool hasPartialCharges() const;
+
+    /**
+     * Calculate the aromaticity of the bonds. This is only done again after
+     * the topology changed.
      */
     void calculateAromaticity() const;
 
     /**
-     * Calculate the indices of atoms in groups of atoms of the same element.
+     * @return A counter increased whenever atoms or bonds are added or
+     * removed, bonds change their atoms or order, or atoms their element or
+     * formal charge. Properties of the bond graph, such as the rings, are
+     * cached against it, so moving atoms never invalidates them.
+     */
+    unsigned long topologyVersion() const;
+
+    /**
+     * Calculate the indices of atoms in groups of atoms of the same element,
+     * if the topology changed since. Atom::groupIndex() calls it.
      */
 	void calculateGroupIndices() const;
 
@@ -589,6 +655,9 @@ namespace Avogadro {
      * @note Conformer atom positions are indexed by their unique id (Atom::id()).
      * Use conformerSize() to check the current size needed to accommodate all
      * atoms.
+     * @note Positions written directly into the current conformer through
+     * this or conformer() are not tracked, the geometry information is
+     * found again from scratch after either is called.
      */
     const std::vector<std::vector<Eigen::Vector3d> *>& conformers() const;
 
@@ -670,11 +739,39 @@ namespace Avogadro {
      */
     void clear();
 
+    /**
+     * Renumber the unique ids of the atoms and bonds to match their indices,
+     * closing the gaps left by removed atoms and bonds and shrinking the
+     * conformers to match. Residues and z-matrices are updated, and
+     * moleculeChanged() is emitted so that views rebuild what they keep by
+     * id: GLWidget its selection and LabelEngine its labels. Other ids kept
+     * outside the molecule, such as by undo commands or named selections,
+     * no longer refer to the same atoms and bonds.
+     */
+    void compactIds();
+
     /**
      * Provides locking, should be used before reading/writing to the Molecule.
      */
     QReadWriteLock *lock() const;
 
+    /**
+     * @return The last published snapshot of the molecule. Any thread may
+     * call this without the lock, and it never waits for a writer. On the
+     * thread of the molecule the snapshot is brought up to date first,
+     * unless another thread is writing. Otherwise a new snapshot is asked
+     * for, and the next writer or the thread of the molecule publishes it.
+     */
+    MoleculeSnapshot snapshot() const;
+
+    /**
+     * Publish a snapshot of the molecule as it is now, if a reader has asked
+     * for one since the last. Writers on other threads should call this with
+     * the write lock still held once they are done, it costs nothing when
+     * nobody is reading snapshots.
+     */
+    void publishSnapshot() const;
+
     /** @name OpenBabel translation functions
      * These functions are used to exchange information with OpenBabel.
      * @{
@@ -710,6 +807,13 @@ namespace Avogadro {
     /** @name Molecule geometry information and manipulation
      * These functions can be used to retrieve several aspects of Molecule
      * geometry and to manipulate some aspects.
+     *
+     * The sums of the positions and of their squares are kept up to date as
+     * atoms are moved with setAtomPos(), setAtomPositions() and
+     * translate(), so the center and the normal vector cost the same for
+     * any number of atoms. The radius comes from a bounding sphere that is
+     * only fitted again when an atom leaves it, so it may be a little
+     * larger than the distance to the farthest atom.
      * @{
      */
 
@@ -765,8 +869,6 @@ namespace Avogadro {
     mutable unsigned int m_currentConformer;
     mutable bool m_estimatedDipoleMoment;
     mutable Eigen::Vector3d *m_dipoleMoment;
-    mutable bool m_invalidPartialCharges;
-    mutable bool m_invalidAromaticity;
     Q_DECLARE_PRIVATE(Molecule)
 
     std::vector<Atom *>   m_atoms;
@@ -783,6 +885,57 @@ namespace Avogadro {
      */
     void computeGeomInfo() const;
 
+    /**
+     * Update the geometry information for an atom moved from @p from to
+     * @p to, or added (@p from zero and @p count 1) or removed (@p to
+     * zero and @p count -1).
+     */
+    void updateGeomInfo(const Eigen::Vector3d &from, const Eigen::Vector3d &to,
+                        int count = 0) const;
+
+    /**
+     * Fit the bounding sphere around the center, finding the farthest atom.
+     */
+    void fitBoundingSphere() const;
+
+    /**
+     * Take a snapshot of the molecule and publish it.
+     */
+    void takeSnapshot() const;
+
+    /**
+     * Mark the geometry information as out of date, after the positions
+     * changed in a way it cannot follow.
+     */
+    void invalidateGeomInfo() const;
+
+    /**
+     * Increase the topology version.
+     */
+    void invalidateTopology();
+
+    /**
+     * Join the fragments of the atoms now bonded, or split them if they
+     * are no longer connected once a bond between them is gone.
+     */
+    void connectAtoms(unsigned long id1, unsigned long id2);
+    void disconnectAtoms(unsigned long id1, unsigned long id2);
+
+    /**
+     * Remove the bonds with the unique ids @p ids, adding the fragments
+     * they were in to @p fragments.
+     */
+    void takeBonds(const QList<unsigned long> &ids, QList<int> &fragments);
+
+    /**
+     * Find the fragments again among the atoms left in @p fragments, after
+     * several bonds between them are gone.
+     */
+    void splitFragments(const QList<int> &fragments);
+
+    friend class Atom;
+    friend class Bond;
+
   public Q_SLOTS:
     /**
      * Signal that the molecule has been changed in some large way, emits the
@@ -802,6 +955,12 @@ namespace Avogadro {
      */
     void updatePrimitive();
 
+    /**
+     * Publish the snapshot asked for by a reader on another thread, unless
+     * a writer is holding the lock and will do it.
+     */
+    void publishRequestedSnapshot();
+
     /**
      * Slot that handles when an atom has been updated.
      * @sa atomAdded
@@ -818,6 +977,12 @@ namespace Avogadro {
      */
     void updateBond();
 
+    /**
+     * Slot that takes the partial charges calculated in the background.
+     * @sa requestPartialCharges
+     */
+    void partialChargesFinished();
+
   Q_SIGNALS:
     /**
      * Emitted when the Molecule changes in a big way, e.g. thousands of atoms
@@ -879,6 +1044,13 @@ namespace Avogadro {
      * @param Bond pointer to the Bond that was removed.
      */
     void bondRemoved(Bond *bond);
+
+    /**
+     * Emitted when the partial charges calculated in the background have
+     * been set on the atoms.
+     * @sa requestPartialCharges
+     */
+    void partialChargesChanged();
   };
 
   inline Atom * Molecule::atom(int index) const
@@ -0,0 +1,263 @@
+/**********************************************************************
+  MoleculeSnapshot - Immutable copy-on-write view of a molecule
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "moleculesnapshot.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+#include <avogadro/molecule.h>
+
+#include <Eigen/QR>
+
+#include <QSharedData>
+
+#include <cmath>
+
+using Eigen::Vector3d;
+using Eigen::Matrix3d;
+
+namespace Avogadro {
+
+  class MoleculeSnapshotData : public QSharedData
+  {
+  public:
+    MoleculeSnapshotData() : valid(false), revision(0), topologyVersion(0),
+                             center(Vector3d::Zero()),
+                             normalVector(Vector3d::Zero()), radius(0.0),
+                             farthestAtomId(FALSE_ID) {}
+
+    bool valid;
+    unsigned long revision;
+    unsigned long topologyVersion;
+
+    // QVector is implicitly shared too, so snapshots of the same topology
+    // hold one copy of these
+    QVector<unsigned long>   atomIds;
+    QVector<int>             atomicNumbers;
+    QVector<Vector3d>        atomPositions;
+    QVector<double>          partialCharges;
+    QVector<unsigned long>   bondIds;
+    QVector<int>             bondAtoms;
+    QVector<short>           bondOrders;
+
+    Vector3d                 center;
+    Vector3d                 normalVector;
+    double                   radius;
+    unsigned long            farthestAtomId;
+  };
+
+  MoleculeSnapshot::MoleculeSnapshot() : d(new MoleculeSnapshotData)
+  {
+  }
+
+  MoleculeSnapshot::MoleculeSnapshot(const MoleculeSnapshot &other)
+    : d(other.d)
+  {
+  }
+
+  MoleculeSnapshot::MoleculeSnapshot(const Molecule *molecule,
+                                     unsigned long revision,
+                                     const MoleculeSnapshot &previous)
+    : d(new MoleculeSnapshotData)
+  {
+    d->valid = true;
+    d->revision = revision;
+    d->topologyVersion = molecule->topologyVersion();
+
+    const QList<Atom *> atoms = molecule->atoms();
+    d->atomPositions.resize(atoms.size());
+    Vector3d *positions = d->atomPositions.data();
+    foreach (const Atom *atom, atoms)
+      positions[atom->index()] = *atom->pos();
+
+    const MoleculeSnapshotData *last = previous.d.constData();
+    if (last->valid && last->topologyVersion == d->topologyVersion) {
+      d->atomIds = last->atomIds;
+      d->atomicNumbers = last->atomicNumbers;
+      d->bondIds = last->bondIds;
+      d->bondAtoms = last->bondAtoms;
+      d->bondOrders = last->bondOrders;
+      // Only the topology goes into the charges
+      if (!last->partialCharges.isEmpty() || !molecule->hasPartialCharges())
+        d->partialCharges = last->partialCharges;
+    }
+    else {
+      d->atomIds.resize(atoms.size());
+      d->atomicNumbers.resize(atoms.size());
+      foreach (const Atom *atom, atoms) {
+        d->atomIds[atom->index()] = atom->id();
+        d->atomicNumbers[atom->index()] = atom->atomicNumber();
+      }
+
+      const QList<Bond *> bonds = molecule->bonds();
+      d->bondIds.resize(bonds.size());
+      d->bondAtoms.resize(2 * bonds.size());
+      d->bondOrders.resize(bonds.size());
+      foreach (const Bond *bond, bonds) {
+        d->bondIds[bond->index()] = bond->id();
+        const Atom *begin = bond->beginAtom(), *end = bond->endAtom();
+        d->bondAtoms[2 * bond->index()] = begin ? begin->index() : -1;
+        d->bondAtoms[2 * bond->index() + 1] = end ? end->index() : -1;
+        d->bondOrders[bond->index()] = bond->order();
+      }
+    }
+
+    // Never start the calculation just for a snapshot
+    if (d->partialCharges.isEmpty() && molecule->hasPartialCharges()) {
+      d->partialCharges.resize(atoms.size());
+      foreach (const Atom *atom, atoms)
+        d->partialCharges[atom->index()] = atom->partialCharge();
+    }
+
+    computeGeometry();
+  }
+
+  void MoleculeSnapshot::computeGeometry()
+  {
+    // From the copied positions rather than the geometry cached by the
+    // molecule, which its other readers may be filling in at the same time
+    const QVector<Vector3d> &positions = d->atomPositions;
+    const int nAtoms = positions.size();
+    if (nAtoms < 2) {
+      d->radius = 1.0;
+      return;
+    }
+
+    Vector3d sum(Vector3d::Zero());
+    Matrix3d squares(Matrix3d::Zero());
+    foreach (const Vector3d &pos, positions) {
+      sum += pos;
+      squares += pos * pos.transpose();
+    }
+    d->center = sum / static_cast<double>(nAtoms);
+    // The normal to the best-fitting plane, as in Molecule::normalVector()
+    const Matrix3d covariance = squares
+      - sum * sum.transpose() / static_cast<double>(nAtoms);
+    Eigen::SelfAdjointEigenSolver<Matrix3d> eigen(covariance);
+    d->normalVector = eigen.eigenvectors().col(0);
+
+    double radius2 = -1.0;
+    int farthest = 0;
+    for (int i = 0; i < nAtoms; ++i) {
+      const double distance2 = (positions.at(i) - d->center).squaredNorm();
+      if (distance2 > radius2) {
+        radius2 = distance2;
+        farthest = i;
+      }
+    }
+    d->radius = std::sqrt(radius2);
+    d->farthestAtomId = d->atomIds.at(farthest);
+  }
+
+  MoleculeSnapshot::~MoleculeSnapshot()
+  {
+  }
+
+  MoleculeSnapshot &MoleculeSnapshot::operator=(const MoleculeSnapshot &other)
+  {
+    d = other.d;
+    return *this;
+  }
+
+  bool MoleculeSnapshot::isValid() const
+  {
+    return d->valid;
+  }
+
+  unsigned long MoleculeSnapshot::revision() const
+  {
+    return d->revision;
+  }
+
+  unsigned long MoleculeSnapshot::topologyVersion() const
+  {
+    return d->topologyVersion;
+  }
+
+  int MoleculeSnapshot::numAtoms() const
+  {
+    return d->atomIds.size();
+  }
+
+  int MoleculeSnapshot::numBonds() const
+  {
+    return d->bondOrders.size();
+  }
+
+  const QVector<unsigned long> & MoleculeSnapshot::atomIds() const
+  {
+    return d->atomIds;
+  }
+
+  const QVector<int> & MoleculeSnapshot::atomicNumbers() const
+  {
+    return d->atomicNumbers;
+  }
+
+  const QVector<Vector3d> & MoleculeSnapshot::atomPositions() const
+  {
+    return d->atomPositions;
+  }
+
+  const QVector<double> & MoleculeSnapshot::partialCharges() const
+  {
+    return d->partialCharges;
+  }
+
+  const QVector<unsigned long> & MoleculeSnapshot::bondIds() const
+  {
+    return d->bondIds;
+  }
+
+  const QVector<int> & MoleculeSnapshot::bondAtoms() const
+  {
+    return d->bondAtoms;
+  }
+
+  const QVector<short> & MoleculeSnapshot::bondOrders() const
+  {
+    return d->bondOrders;
+  }
+
+  const Vector3d & MoleculeSnapshot::center() const
+  {
+    return d->center;
+  }
+
+  const Vector3d & MoleculeSnapshot::normalVector() const
+  {
+    return d->normalVector;
+  }
+
+  double MoleculeSnapshot::radius() const
+  {
+    return d->radius;
+  }
+
+  unsigned long MoleculeSnapshot::farthestAtomId() const
+  {
+    return d->farthestAtomId;
+  }
+
+} // End namespace Avogadro
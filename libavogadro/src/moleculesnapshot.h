@@ -0,0 +1,153 @@
+/**********************************************************************
+  MoleculeSnapshot - Immutable copy-on-write view of a molecule
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef MOLECULESNAPSHOT_H
+#define MOLECULESNAPSHOT_H
+
+#include <avogadro/global.h>
+
+#include <Eigen/Core>
+
+#include <QSharedDataPointer>
+#include <QVector>
+
+namespace Avogadro {
+
+  class Molecule;
+  class MoleculeSnapshotData;
+
+  /**
+   * @class MoleculeSnapshot moleculesnapshot.h <avogadro/moleculesnapshot.h>
+   * @brief Immutable copy of the atoms, bonds and geometry of a molecule.
+   *
+   * Snapshots are read with Molecule::snapshot(), from any thread and
+   * without the molecule's lock, and taken only when a reader asks for one. They are implicitly shared: copying one is cheap, and
+   * it never changes once published, so a reader sees a consistent state
+   * however long it keeps it. A new snapshot shares the topology arrays
+   * with the one before it when only the positions moved.
+   *
+   * Atoms are in the order of their indices when the snapshot was taken.
+   */
+  class A_EXPORT MoleculeSnapshot
+  {
+  public:
+    /**
+     * Constructs an empty snapshot, of a molecule without atoms.
+     */
+    MoleculeSnapshot();
+    MoleculeSnapshot(const MoleculeSnapshot &other);
+    ~MoleculeSnapshot();
+
+    MoleculeSnapshot &operator=(const MoleculeSnapshot &other);
+
+    /**
+     * @return True if this snapshot was taken from a molecule.
+     */
+    bool isValid() const;
+
+    /**
+     * @return The revision of the molecule the snapshot was taken at. It
+     * increases with every change to the positions or topology.
+     */
+    unsigned long revision() const;
+
+    /**
+     * @return The topology version of the molecule when taken.
+     * @sa Molecule::topologyVersion()
+     */
+    unsigned long topologyVersion() const;
+
+    int numAtoms() const;
+    int numBonds() const;
+
+    /**
+     * @return The unique ids of the atoms, by index.
+     */
+    const QVector<unsigned long> & atomIds() const;
+
+    /**
+     * @return The atomic numbers of the atoms, by index.
+     */
+    const QVector<int> & atomicNumbers() const;
+
+    /**
+     * @return The positions of the atoms in the current conformer, by index.
+     */
+    const QVector<Eigen::Vector3d> & atomPositions() const;
+
+    /**
+     * @return The partial charges of the atoms by index, or an empty vector
+     * if they had not been calculated when the snapshot was taken.
+     */
+    const QVector<double> & partialCharges() const;
+
+    /**
+     * @return The unique ids of the bonds, by index.
+     */
+    const QVector<unsigned long> & bondIds() const;
+
+    /**
+     * @return The atom indices of the bonds, two per bond.
+     */
+    const QVector<int> & bondAtoms() const;
+
+    /**
+     * @return The orders of the bonds, by bond index.
+     */
+    const QVector<short> & bondOrders() const;
+
+    /**
+     * @return The geometry info of the atom positions in the snapshot.
+     * @sa Molecule::center(), Molecule::normalVector(), Molecule::radius()
+     */
+    const Eigen::Vector3d & center() const;
+    const Eigen::Vector3d & normalVector() const;
+    double radius() const;
+
+    /**
+     * @return The unique id of the atom farthest from the center, FALSE_ID
+     * if there is none.
+     */
+    unsigned long farthestAtomId() const;
+
+  private:
+    /**
+     * Take a snapshot of @p molecule at @p revision. The topology and
+     * charges are shared with @p previous if they have not changed.
+     */
+    MoleculeSnapshot(const Molecule *molecule, unsigned long revision,
+                     const MoleculeSnapshot &previous);
+
+    /**
+     * Find the center, normal, radius and farthest atom of the positions.
+     */
+    void computeGeometry();
+
+    QSharedDataPointer<MoleculeSnapshotData> d;
+    friend class Molecule;
+  };
+
+} // End namespace Avogadro
+
+#endif
@@ -52,4 +52,18 @@ namespace Avogadro
     drawSphere(*center, radius);
   }
 
+  void Painter::drawPoint(const Eigen::Vector3d &center, double radius)
+  {
+    drawSphere(center, radius);
+  }
+
+  int Painter::drawTextBatch(const QVector<Eigen::Vector3d> &positions,
+                             const QVector<QString> &strings, bool)
+  {
+    int count = qMin(positions.size(), strings.size());
+    for (int i = 0; i < count; ++i)
+      drawText(positions[i], strings[i]);
+    return count;
+  }
+
 } // end namespace Avogadro
@@ -30,6 +30,8 @@
 #include <avogadro/global.h>
 #include <avogadro/primitive.h>
 
+#include <QVector>
+
 class QColor;
 
 namespace Avogadro
@@ -130,6 +132,15 @@ namespace Avogadro
      */
     virtual void drawSphere(const Eigen::Vector3d *center, double radius);
 
+    /**
+     * Draws a cheap stand-in for a sphere that is far away from the viewer,
+     * e.g. a point covering the apparent size of the sphere. The default
+     * implementation simply calls drawSphere().
+     * @param center the position of the center of the sphere.
+     * @param radius the radius of the sphere.
+     */
+    virtual void drawPoint(const Eigen::Vector3d &center, double radius);
+
     /**
      * Draws a cylinder, leaving the Painter choose the appropriate detail level based on the
      * apparent radius (ratio of radius over distance) and the global quality setting.
@@ -368,6 +379,23 @@ namespace Avogadro
     virtual int drawText(const Eigen::Vector3d & pos,
                           const QString &string) = 0;
 
+    /**
+     * Draws a batch of labels inside the scene, each one centered around its
+     * scene position. Painters able to do so should lay out and draw the
+     * whole batch at once, which is much faster than calling drawText() for
+     * each label. The default implementation simply calls drawText().
+     * @note Calls to drawText methods must be enclosed between begin() and end().
+     * @param positions the scene coordinates of the labels.
+     * @param strings the labels to render, one per position.
+     * @param cullOverlaps if true, labels overlapping a label closer to the
+     * viewer may be skipped so that dense label fields stay readable.
+     * @return the number of labels drawn.
+     * @sa drawText(const Eigen::Vector3d &, const QString &)
+     */
+    virtual int drawTextBatch(const QVector<Eigen::Vector3d> &positions,
+                              const QVector<QString> &strings,
+                              bool cullOverlaps = true);
+
     /**
      * Placeholder to draw a box.
      * @param corner1 First corner of the box.
@@ -26,12 +26,17 @@
 #define PAINTERDEVICE_H
 
 #include <avogadro/painter.h>
+#include <avogadro/frustumculler.h>
+#include <avogadro/depthsorter.h>
 
 namespace Avogadro {
 
+  class Atom;
+  class Bond;
   class Camera;
   class Primitive;
   class Molecule;
+  class MoleculeSnapshot;
   class Color;
   class PrimitiveList;
 
@@ -49,6 +54,98 @@ namespace Avogadro {
     virtual Color* colorMap() const = 0;
     virtual PrimitiveList * primitives() const { return 0; }
 
+    /**
+     * @return the snapshot being rendered while another thread writes to the
+     * molecule, or 0 if the atoms and bonds of the molecule can be read.
+     * @sa Engine::renderSnapshot()
+     */
+    virtual const MoleculeSnapshot * snapshot() const { return 0; }
+
+    /**
+     * @return true if the primitive of @p type with the unique @p id is
+     * selected, for the atoms and bonds of a snapshot.
+     */
+    virtual bool isSelected(Primitive::Type, unsigned long) const
+    { return false; }
+
+    /**
+     * @return the visibility and level of detail service of this device, or
+     * 0 if everything should be rendered (e.g. when ray tracing).
+     */
+    virtual const FrustumCuller * culler() const { return 0; }
+
+    /**
+     * @return the atoms of @p atoms inside the view that should be rendered
+     * at full detail. If @p coarse is non-zero distant atoms that should be
+     * rendered with a cheap representation are appended to it instead.
+     */
+    QList<Atom *> visibleAtoms(const QList<Atom *> &atoms,
+                               QList<Atom *> *coarse = 0) const
+    {
+      const FrustumCuller *c = culler();
+      return c ? c->visibleAtoms(atoms, coarse) : atoms;
+    }
+
+    /**
+     * @return the bonds of @p bonds inside the view that should be rendered
+     * at full detail. If @p coarse is non-zero distant bonds that should be
+     * rendered with a cheap representation are appended to it instead.
+     */
+    QList<Bond *> visibleBonds(const QList<Bond *> &bonds,
+                               QList<Bond *> *coarse = 0) const
+    {
+      const FrustumCuller *c = culler();
+      return c ? c->visibleBonds(bonds, coarse) : bonds;
+    }
+
+    /**
+     * @return the level of detail the primitive should be rendered at.
+     */
+    FrustumCuller::Detail detail(const Atom *atom) const
+    {
+      const FrustumCuller *c = culler();
+      return c ? c->detail(atom) : FrustumCuller::Full;
+    }
+    FrustumCuller::Detail detail(const Bond *bond) const
+    {
+      const FrustumCuller *c = culler();
+      return c ? c->detail(bond) : FrustumCuller::Full;
+    }
+
+    /**
+     * @return the back to front ordering service of this device, or 0 if the
+     * transparent layer does not need sorting.
+     */
+    virtual const DepthSorter * depthSorter() const { return 0; }
+
+    /**
+     * @return true if the transparent layer is composited independently of
+     * the order primitives are drawn in. Engines should then draw all of
+     * their translucent surfaces, including hidden inner ones, rather than
+     * masking them with a depth pre-pass.
+     */
+    virtual bool orderIndependentTransparency() const { return false; }
+
+    /**
+     * @return @p atoms ordered back to front if the transparent layer is
+     * being depth sorted, otherwise @p atoms unchanged.
+     */
+    QList<Atom *> depthSortedAtoms(const QList<Atom *> &atoms) const
+    {
+      const DepthSorter *s = depthSorter();
+      return s ? s->sortedAtoms(atoms) : atoms;
+    }
+
+    /**
+     * @return @p bonds ordered back to front if the transparent layer is
+     * being depth sorted, otherwise @p bonds unchanged.
+     */
+    QList<Bond *> depthSortedBonds(const QList<Bond *> &bonds) const
+    {
+      const DepthSorter *s = depthSorter();
+      return s ? s->sortedBonds(bonds) : bonds;
+    }
+
     virtual int width() = 0;
     virtual int height() = 0;
   };
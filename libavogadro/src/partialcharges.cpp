@@ -0,0 +1,207 @@
+/**********************************************************************
+  PartialCharges - Native partial charge models on flat arrays
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "partialcharges_p.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+#include <avogadro/molecule.h>
+
+namespace Avogadro {
+
+  // Electronegativity chi = a + b q + c q^2 by element and hybridization,
+  // from Gasteiger and Marsili, Tetrahedron 36, 3219 (1980). A
+  // hybridization of 0 matches any.
+  struct GasteigerParameters
+  {
+    int atomicNumber;
+    int hybridization;
+    double a, b, c;
+  };
+
+  static const GasteigerParameters gasteigerTable[] = {
+    {  1, 0,  7.17,  6.24, -0.56 },
+    {  6, 3,  7.98,  9.18,  1.88 },
+    {  6, 2,  8.79,  9.32,  1.51 },
+    {  6, 1, 10.39,  9.45,  0.73 },
+    {  7, 3, 11.54, 10.82,  1.36 },
+    {  7, 2, 12.87, 11.15,  0.85 },
+    {  7, 1, 15.68, 11.70, -0.27 },
+    {  8, 3, 14.18, 12.92,  1.39 },
+    {  8, 2, 17.07, 13.79,  0.47 },
+    {  9, 0, 14.66, 13.85,  2.31 },
+    { 15, 0,  8.90,  8.24,  0.96 },
+    { 16, 0, 10.14,  9.13,  1.38 },
+    { 17, 0, 11.00,  9.69,  1.35 },
+    { 35, 0, 10.08,  8.47,  1.16 },
+    { 53, 0,  9.90,  7.96,  0.96 }
+  };
+  static const int gasteigerTableSize =
+    sizeof(gasteigerTable) / sizeof(GasteigerParameters);
+
+  // The electronegativity of the hydrogen cation is taken as 20.02
+  // rather than a + b + c
+  static const double hydrogenDenominator = 20.02;
+  static const int gasteigerIterations = 6;
+  static const double gasteigerDamping = 0.5;
+
+  static const GasteigerParameters * findParameters(int atomicNumber,
+                                                    int hybridization)
+  {
+    for (int i = 0; i < gasteigerTableSize; ++i) {
+      const GasteigerParameters &p = gasteigerTable[i];
+      if (p.atomicNumber == atomicNumber
+          && (!p.hybridization || p.hybridization == hybridization))
+        return &p;
+    }
+    // Oxygen has no sp parameters, take the nearest
+    if (atomicNumber == 8 && hybridization == 1)
+      return findParameters(8, 2);
+    return 0;
+  }
+
+  ChargeTopology chargeTopology(const Molecule *molecule)
+  {
+    ChargeTopology topology;
+    topology.version = molecule->topologyVersion();
+
+    const int numAtoms = molecule->numAtoms();
+    topology.atomicNumbers.resize(numAtoms);
+    topology.formalCharges.resize(numAtoms);
+    QVector<int> indexOfId(molecule->conformerSize(), -1);
+    foreach (const Atom *atom, molecule->atoms()) {
+      const int i = atom->index();
+      topology.atomicNumbers[i] = atom->atomicNumber();
+      topology.formalCharges[i] = atom->formalCharge();
+      if (atom->id() < static_cast<unsigned long>(indexOfId.size()))
+        indexOfId[atom->id()] = i;
+    }
+
+    topology.bondAtoms.reserve(2 * molecule->numBonds());
+    topology.bondOrders.reserve(molecule->numBonds());
+    foreach (const Bond *bond, molecule->bonds()) {
+      const int a = indexOfId.value(bond->beginAtomId(), -1);
+      const int b = indexOfId.value(bond->endAtomId(), -1);
+      if (a < 0 || b < 0 || a == b)
+        continue;
+      topology.bondAtoms.append(a);
+      topology.bondAtoms.append(b);
+      topology.bondOrders.append(bond->isAromatic() ? 5 : bond->order());
+    }
+    return topology;
+  }
+
+  QVector<double> calculateCharges(const ChargeTopology &topology,
+                                   ChargeModel model)
+  {
+    switch (model) {
+      case GasteigerCharges:
+      default:
+        return gasteigerCharges(topology);
+    }
+  }
+
+  QVector<double> gasteigerCharges(const ChargeTopology &topology)
+  {
+    const int numAtoms = topology.atomicNumbers.size();
+    const int numBonds = topology.bondOrders.size();
+    const int *bondAtoms = topology.bondAtoms.constData();
+    const int *bondOrders = topology.bondOrders.constData();
+
+    // Hybridization from the bond orders: sp for a triple bond or two
+    // double bonds, sp2 for a double or aromatic bond, else sp3. Nitrogen
+    // next to an sp2 atom is conjugated, as in amides and anilines, and
+    // taken as sp2 too.
+    QVector<int> doubles(numAtoms, 0), triples(numAtoms, 0);
+    QVector<bool> aromatic(numAtoms, false);
+    for (int e = 0; e < numBonds; ++e)
+      for (int k = 0; k < 2; ++k) {
+        const int i = bondAtoms[2 * e + k];
+        if (bondOrders[e] == 2)
+          ++doubles[i];
+        else if (bondOrders[e] == 3)
+          ++triples[i];
+        else if (bondOrders[e] == 5)
+          aromatic[i] = true;
+      }
+    QVector<int> hybridization(numAtoms, 3);
+    for (int i = 0; i < numAtoms; ++i) {
+      if (triples.at(i) || doubles.at(i) > 1)
+        hybridization[i] = 1;
+      else if (doubles.at(i) || aromatic.at(i))
+        hybridization[i] = 2;
+    }
+    for (int e = 0; e < numBonds; ++e) {
+      if (bondOrders[e] != 1)
+        continue;
+      for (int k = 0; k < 2; ++k) {
+        const int i = bondAtoms[2 * e + k], j = bondAtoms[2 * e + 1 - k];
+        if (topology.atomicNumbers.at(i) == 7 && hybridization.at(i) == 3
+            && (doubles.at(j) || aromatic.at(j)))
+          hybridization[i] = 2;
+      }
+    }
+
+    // Flat a, b, c and cation electronegativity per atom, zero without
+    // parameters
+    QVector<double> a(numAtoms, 0.0), b(numAtoms, 0.0), c(numAtoms, 0.0);
+    QVector<double> denominator(numAtoms, 0.0);
+    QVector<double> charges(numAtoms, 0.0), chi(numAtoms, 0.0);
+    for (int i = 0; i < numAtoms; ++i) {
+      const int atomicNumber = topology.atomicNumbers.at(i);
+      charges[i] = topology.formalCharges.at(i);
+      const GasteigerParameters *p = findParameters(atomicNumber,
+                                                    hybridization.at(i));
+      if (!p)
+        continue;
+      a[i] = p->a;
+      b[i] = p->b;
+      c[i] = p->c;
+      denominator[i] = atomicNumber == 1 ? hydrogenDenominator
+                                         : p->a + p->b + p->c;
+    }
+
+    double *q = charges.data(), *x = chi.data();
+    double damping = 1.0;
+    for (int iteration = 0; iteration < gasteigerIterations; ++iteration) {
+      for (int i = 0; i < numAtoms; ++i)
+        x[i] = a.at(i) + q[i] * (b.at(i) + c.at(i) * q[i]);
+      damping *= gasteigerDamping;
+      // Charge flows to the more electronegative atom, scaled by the
+      // cation electronegativity of the one giving it up
+      for (int e = 0; e < numBonds; ++e) {
+        const int i = bondAtoms[2 * e], j = bondAtoms[2 * e + 1];
+        if (denominator.at(i) == 0.0 || denominator.at(j) == 0.0)
+          continue;
+        const double difference = x[i] - x[j];
+        const double transfer = damping * difference
+          / (difference >= 0.0 ? denominator.at(j) : denominator.at(i));
+        q[i] -= transfer;
+        q[j] += transfer;
+      }
+    }
+    return charges;
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,74 @@
+/**********************************************************************
+  PartialCharges - Native partial charge models on flat arrays
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef PARTIALCHARGES_P_H
+#define PARTIALCHARGES_P_H
+
+#include <QVector>
+
+namespace Avogadro {
+
+  class Molecule;
+
+  /**
+   * @internal
+   * The elements and bond graph of a molecule, copied out so the charges
+   * can be calculated on another thread while the molecule is edited.
+   * Models that need the geometry, such as QEq, would add the positions.
+   */
+  struct ChargeTopology
+  {
+    unsigned long version;       // topology version of the molecule
+    QVector<int> atomicNumbers;  // by atom index
+    QVector<int> formalCharges;  // by atom index
+    QVector<int> bondAtoms;      // two atom indices per bond
+    QVector<int> bondOrders;     // 5 for aromatic bonds
+  };
+
+  enum ChargeModel {
+    GasteigerCharges
+  };
+
+  /**
+   * Copy the topology of @p molecule. This perceives the aromaticity if
+   * it is out of date, so it must be called from the molecule's thread.
+   */
+  ChargeTopology chargeTopology(const Molecule *molecule);
+
+  /**
+   * @return The partial charges of the atoms by index with @p model.
+   */
+  QVector<double> calculateCharges(const ChargeTopology &topology,
+                                   ChargeModel model);
+
+  /**
+   * @return The Gasteiger-Marsili charges, with the parameters and the
+   * six damped iterations of OpenBabel's implementation. Atoms without
+   * parameters keep their formal charge and take no part.
+   */
+  QVector<double> gasteigerCharges(const ChargeTopology &topology);
+
+} // End namespace Avogadro
+
+#endif
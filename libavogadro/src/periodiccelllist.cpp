@@ -0,0 +1,217 @@
+/**********************************************************************
+  PeriodicCellList - Cell list for pair searches in periodic cells
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "periodiccelllist_p.h"
+
+#include <Eigen/LU>
+
+#include <cmath>
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  // Integer division and remainder rounding towards minus infinity
+  static inline int floorDiv(int a, int b)
+  {
+    return a >= 0 ? a / b : -((b - 1 - a) / b);
+  }
+
+  PeriodicCellList::PeriodicCellList(double cutoff, int cellsPerCutoff)
+    : m_cutoff(cutoff), m_cellsPerCutoff(qMax(1, cellsPerCutoff)),
+      m_periodic(false), m_volume(0.0), m_numCells(0)
+  {
+    m_cell.setIdentity();
+    m_inverse.setIdentity();
+    m_min.setZero();
+    m_edge.setZero();
+    m_dim[0] = m_dim[1] = m_dim[2] = 1;
+  }
+
+  void PeriodicCellList::setCell(const Matrix3d &cell)
+  {
+    m_periodic = true;
+    m_cell = cell;
+    m_inverse = cell.inverse();
+    m_volume = fabs(cell.determinant());
+
+    // Distance between opposite faces along each lattice vector
+    const Vector3d a = cell.col(0), b = cell.col(1), c = cell.col(2);
+    Vector3d widths(m_volume / b.cross(c).norm(), m_volume / c.cross(a).norm(),
+                    m_volume / a.cross(b).norm());
+    setupGrid(widths);
+  }
+
+  void PeriodicCellList::setNonPeriodic()
+  {
+    m_periodic = false;
+    m_cell.setIdentity();
+    m_inverse.setIdentity();
+  }
+
+  void PeriodicCellList::setupGrid(const Vector3d &widths)
+  {
+    const double target = m_cutoff / m_cellsPerCutoff;
+    Vector3i range;
+    for (int k = 0; k < 3; ++k) {
+      m_dim[k] = qMax(1, static_cast<int>(widths[k] / target));
+      m_edge[k] = widths[k] / m_dim[k];
+      // Enough neighbor cells to reach the cutoff, more than
+      // cellsPerCutoff if the cell is thinner than that
+      range[k] = qMax(1, static_cast<int>(ceil(m_cutoff / m_edge[k] - 1.0e-9)));
+    }
+    m_numCells = m_dim[0] * m_dim[1] * m_dim[2];
+
+    // Cells that are not all beyond the cutoff are only known cheaply for
+    // orthogonal axes, triclinic cells search the whole block
+    const Matrix3d metric = m_cell.transpose() * m_cell;
+    const bool orthogonal = !m_periodic ||
+      (fabs(metric(0, 1)) + fabs(metric(0, 2)) + fabs(metric(1, 2))
+       < 1.0e-8 * metric.diagonal().sum());
+    const double cutoff2 = m_cutoff * m_cutoff;
+
+    m_offsets.clear();
+    m_offsets.append(Vector3i::Zero());
+    for (int z = 0; z <= range[2]; ++z)
+      for (int y = (z ? -range[1] : 0); y <= range[1]; ++y)
+        for (int x = (z || y ? -range[0] : 1); x <= range[0]; ++x) {
+          if (orthogonal) {
+            const int o[3] = { x, y, z };
+            double gap2 = 0.0;
+            for (int k = 0; k < 3; ++k) {
+              const double gap = qMax(0, qAbs(o[k]) - 1) * m_edge[k];
+              gap2 += gap * gap;
+            }
+            if (gap2 > cutoff2)
+              continue;
+          }
+          m_offsets.append(Vector3i(x, y, z));
+        }
+  }
+
+  void PeriodicCellList::update(const double *coordinates, const QVector<int> &atoms)
+  {
+    const int n = atoms.size();
+    m_wrapped.resize(3 * n);
+    m_cellOfAtom.resize(n);
+    double *wrapped = m_wrapped.data();
+
+    if (m_periodic) {
+      for (int i = 0; i < n; ++i) {
+        Vector3d f = m_inverse * Vector3d(coordinates + 3 * atoms[i]);
+        int index[3];
+        for (int k = 0; k < 3; ++k) {
+          f[k] -= floor(f[k]);
+          if (f[k] >= 1.0)   // -1e-17 wraps to exactly 1.0
+            f[k] = 0.0;
+          index[k] = qMin(m_dim[k] - 1, static_cast<int>(f[k] * m_dim[k]));
+        }
+        const Vector3d r = m_cell * f;
+        wrapped[3*i] = r.x();
+        wrapped[3*i+1] = r.y();
+        wrapped[3*i+2] = r.z();
+        m_cellOfAtom[i] = index[0] + m_dim[0] * (index[1] + m_dim[1] * index[2]);
+      }
+    }
+    else {
+      Vector3d min, max;
+      min.setZero();
+      max.setZero();
+      for (int i = 0; i < n; ++i) {
+        const Vector3d r(coordinates + 3 * atoms[i]);
+        if (i == 0)
+          min = max = r;
+        for (int k = 0; k < 3; ++k) {
+          min[k] = qMin(min[k], r[k]);
+          max[k] = qMax(max[k], r[k]);
+        }
+      }
+      m_min = min;
+      const Vector3d extent = max - min;
+      m_volume = extent.x() * extent.y() * extent.z();
+
+      const double edge = m_cutoff / m_cellsPerCutoff;
+      const Vector3d widths(qMax(edge, extent.x()), qMax(edge, extent.y()),
+                            qMax(edge, extent.z()));
+      setupGrid(widths);
+
+      for (int i = 0; i < n; ++i) {
+        const double *r = coordinates + 3 * atoms[i];
+        int index[3];
+        for (int k = 0; k < 3; ++k) {
+          wrapped[3*i+k] = r[k];
+          index[k] = qMin(m_dim[k] - 1, static_cast<int>((r[k] - min[k]) / m_edge[k]));
+        }
+        m_cellOfAtom[i] = index[0] + m_dim[0] * (index[1] + m_dim[1] * index[2]);
+      }
+    }
+
+    // Counting sort by cell
+    m_start.fill(0, m_numCells + 1);
+    for (int i = 0; i < n; ++i)
+      ++m_start[m_cellOfAtom[i] + 1];
+    for (int c = 0; c < m_numCells; ++c)
+      m_start[c + 1] += m_start[c];
+
+    m_positions.resize(3 * n);
+    m_slots.resize(n);
+    QVector<int> next = m_start;
+    for (int i = 0; i < n; ++i) {
+      const int j = next[m_cellOfAtom[i]]++;
+      m_positions[3*j] = wrapped[3*i];
+      m_positions[3*j+1] = wrapped[3*i+1];
+      m_positions[3*j+2] = wrapped[3*i+2];
+      m_slots[j] = i;
+    }
+  }
+
+  void PeriodicCellList::halfStencil(int cell, QVector<Neighbor> &neighbors) const
+  {
+    neighbors.clear();
+    const int position[3] = { cell % m_dim[0], (cell / m_dim[0]) % m_dim[1],
+                              cell / (m_dim[0] * m_dim[1]) };
+
+    foreach (const Vector3i &offset, m_offsets) {
+      int index[3], image[3];
+      bool inside = true;
+      for (int k = 0; k < 3; ++k) {
+        const int q = position[k] + offset[k];
+        image[k] = floorDiv(q, m_dim[k]);
+        index[k] = q - image[k] * m_dim[k];
+        if (image[k] && !m_periodic)
+          inside = false;
+      }
+      if (!inside)
+        continue;
+
+      Neighbor neighbor;
+      neighbor.cell = index[0] + m_dim[0] * (index[1] + m_dim[1] * index[2]);
+      neighbor.shift = m_cell * Vector3d(image[0], image[1], image[2]);
+      if (!m_periodic)
+        neighbor.shift.setZero();
+      neighbors.append(neighbor);
+    }
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,130 @@
+/**********************************************************************
+  PeriodicCellList - Cell list for pair searches in periodic cells
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef PERIODICCELLLIST_P_H
+#define PERIODICCELLLIST_P_H
+
+#include <Eigen/Core>
+
+#include <QVector>
+
+namespace Avogadro {
+
+  /**
+   * @class PeriodicCellList
+   * @brief Cell list over a triclinic unit cell for finding pairs within a
+   * cutoff, including pairs with periodic images.
+   * @internal
+   *
+   * Like the ghost map of NeighborList, a neighbor cell past the border is
+   * wrapped around, but here the wrap also gives the lattice translation of
+   * the image, so distances are those between the atom and the image. The
+   * cells are laid out in fractional coordinates, each at least
+   * cutoff / cellsPerCutoff wide perpendicular to its faces, and as many
+   * neighbor cells are searched as the cutoff needs, so cells smaller than
+   * twice the cutoff are handled too.
+   *
+   * update() sorts the positions by cell into one packed array, so a pair
+   * search reads memory in order. Without a unit cell the bounding box of
+   * the atoms is divided instead and no images are made.
+   */
+  class PeriodicCellList
+  {
+    public:
+      struct Neighbor
+      {
+        int cell;
+        Eigen::Vector3d shift;  // lattice translation of the neighbor
+      };
+
+      PeriodicCellList(double cutoff, int cellsPerCutoff = 2);
+
+      /**
+       * Use periodic images of the cell with lattice vectors as the
+       * columns of @p cell.
+       */
+      void setCell(const Eigen::Matrix3d &cell);
+      void setNonPeriodic();
+      bool isPeriodic() const { return m_periodic; }
+
+      /**
+       * @return The volume of the unit cell, or of the bounding box of the
+       * last update() without one.
+       */
+      double volume() const { return m_volume; }
+
+      /**
+       * Sort the atoms with the indices @p atoms of the packed
+       * @p coordinates into the cells. Periodic positions are wrapped into
+       * the unit cell.
+       */
+      void update(const double *coordinates, const QVector<int> &atoms);
+
+      int numCells() const { return m_numCells; }
+      int begin(int cell) const { return m_start[cell]; }
+      int end(int cell) const { return m_start[cell + 1]; }
+
+      /**
+       * @return The positions sorted by cell, three values each.
+       */
+      const double * positions() const { return m_positions.constData(); }
+
+      /**
+       * @return The position in the list given to update() of each sorted
+       * atom.
+       */
+      const int * slots() const { return m_slots.constData(); }
+
+      /**
+       * Fill @p neighbors with the cells to search for pairs of atoms in
+       * @p cell. Each pair of cells, and each image, appears once over all
+       * cells. The first entry is @p cell itself without a shift, in which
+       * each pair of atoms should be taken once.
+       */
+      void halfStencil(int cell, QVector<Neighbor> &neighbors) const;
+
+    private:
+      void setupGrid(const Eigen::Vector3d &widths);
+
+      double m_cutoff;
+      int m_cellsPerCutoff;
+      bool m_periodic;
+      Eigen::Matrix3d m_cell, m_inverse;
+      double m_volume;
+      Eigen::Vector3d m_min;          // corner of the box without a cell
+      Eigen::Vector3d m_edge;         // cell size along each axis
+      int m_dim[3];
+      int m_numCells;
+      QVector<Eigen::Vector3i> m_offsets;   // half stencil, self first
+
+      QVector<int> m_start;
+      QVector<int> m_cellOfAtom;
+      QVector<double> m_wrapped;
+      QVector<double> m_positions;
+      QVector<int> m_slots;
+  };
+
+} // End namespace Avogadro
+
+#endif
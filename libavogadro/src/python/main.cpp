@@ -37,8 +37,10 @@ void export_PluginManager();
 void export_Primitive();
 void export_PrimitiveList();
 void export_Residue();
+void export_Superposition();
 void export_Tool();
 void export_ToolGroup();
+void export_TrajectoryAnalysis();
 
 BOOST_PYTHON_MODULE(Avogadro) {
 
@@ -83,8 +85,10 @@ BOOST_PYTHON_MODULE(Avogadro) {
   export_PluginManager();
   export_PrimitiveList();
   export_Residue();
+  export_Superposition();
   export_Tool();
   export_ToolGroup();
+  export_TrajectoryAnalysis();
 
 
 
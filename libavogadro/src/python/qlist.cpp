@@ -3,6 +3,7 @@
 #include <boost/tuple/tuple.hpp>
 
 #include <QList>
+#include <QVector>
 #include <QColor>
 
 #include <avogadro/atom.h>
@@ -310,6 +311,8 @@ void export_QList()
   export_list< QList<QColor> >();
   export_list< QList<GLHit> >();
   export_list< QList<unsigned long> >();
+  export_list< QList<int> >();
+  export_list< QVector<double> >();
 
   /*  
   class_<QListTest>("QListTest")
@@ -0,0 +1,37 @@
+#include <boost/python.hpp>
+
+#include <avogadro/superposition.h>
+#include <avogadro/molecule.h>
+
+using namespace boost::python;
+using namespace Avogadro;
+
+// default args
+QVector<double> alignConformers_default1(Molecule *molecule)
+{
+  return Superposition::alignConformers(molecule);
+}
+
+QVector<double> alignConformers_default2(Molecule *molecule, const QList<int> &fitAtoms)
+{
+  return Superposition::alignConformers(molecule, fitAtoms);
+}
+
+void export_Superposition()
+{
+
+  class_<Avogadro::Superposition>("Superposition", no_init)
+    .def("alignConformers",
+        &alignConformers_default1)
+    .def("alignConformers",
+        &alignConformers_default2)
+    .def("alignConformers",
+        &Superposition::alignConformers,
+        "Superpose every conformer of the molecule on a reference conformer, "
+        "fitting the atoms with the given indices or all atoms. The conformers "
+        "are changed in place and the molecule is updated once. Returns the "
+        "RMSD of each conformer.")
+    .staticmethod("alignConformers")
+    ;
+
+}
@@ -0,0 +1,186 @@
+#include <boost/python.hpp>
+
+#include <avogadro/trajectoryanalysis.h>
+#include <avogadro/radialdistribution.h>
+#include <avogadro/contactmap.h>
+#include <avogadro/molecule.h>
+
+using namespace boost::python;
+using namespace Avogadro;
+
+void export_TrajectoryAnalysis()
+{
+
+  class_<Avogadro::TrajectoryFrameSource, boost::noncopyable>("TrajectoryFrameSource", no_init)
+    .add_property("numAtoms",
+        &TrajectoryFrameSource::numAtoms,
+        "The number of atoms in every frame.")
+
+    .def("rewind",
+        &TrajectoryFrameSource::rewind,
+        "Go back to the first frame.")
+    ;
+
+  class_<Avogadro::ConformerFrameSource, bases<Avogadro::TrajectoryFrameSource>,
+      boost::noncopyable>("ConformerFrameSource", init<const Molecule*>()[with_custodian_and_ward<1,2>()])
+    ;
+
+  class_<Avogadro::FileFrameSource, bases<Avogadro::TrajectoryFrameSource>,
+      boost::noncopyable>("FileFrameSource", init<const QString&>())
+    .add_property("valid",
+        &FileFrameSource::isValid,
+        "True if the file was opened and its first frame read.")
+    ;
+
+  class_<Avogadro::TrajectoryAnalysis, boost::noncopyable>("TrajectoryAnalysis")
+    .add_property("massWeighted",
+        &TrajectoryAnalysis::massWeighted,
+        &TrajectoryAnalysis::setMassWeighted,
+        "Weight the radius of gyration by the atomic masses.")
+
+    .add_property("fitAtoms",
+        &TrajectoryAnalysis::fitAtoms,
+        &TrajectoryAnalysis::setFitAtoms,
+        "Indices of the atoms to superpose, all atoms if empty.")
+
+    .add_property("chunkSize",
+        &TrajectoryAnalysis::chunkSize,
+        &TrajectoryAnalysis::setChunkSize,
+        "The number of frames read and analysed at a time.")
+
+    .add_property("numFrames",
+        &TrajectoryAnalysis::numFrames,
+        "The number of frames analysed by the last run().")
+
+    .add_property("numMeasurements",
+        &TrajectoryAnalysis::numMeasurements,
+        "The number of distances, angles and dihedrals followed.")
+
+    .def("setMolecule",
+        &TrajectoryAnalysis::setMolecule,
+        "Take the atoms and their masses from the molecule.")
+
+    .def("setReference",
+        &TrajectoryAnalysis::setReference,
+        "Compare against these packed coordinates instead of the first frame.")
+
+    .def("addMeasurement",
+        &TrajectoryAnalysis::addMeasurement,
+        "Follow the distance, angle or dihedral between two, three or four atoms.")
+
+    .def("clearMeasurements",
+        &TrajectoryAnalysis::clearMeasurements)
+
+    .def("measurementName",
+        &TrajectoryAnalysis::measurementName)
+
+    .def("run",
+        &TrajectoryAnalysis::run,
+        "Analyse all frames of the source.")
+
+    .def("rmsd",
+        &TrajectoryAnalysis::rmsd,
+        "The RMSD to the reference of each frame.")
+
+    .def("radiusOfGyration",
+        &TrajectoryAnalysis::radiusOfGyration,
+        "The radius of gyration of each frame.")
+
+    .def("rmsf",
+        &TrajectoryAnalysis::rmsf,
+        "The RMSF of each atom.")
+
+    .def("measurement",
+        &TrajectoryAnalysis::measurement,
+        "The values of a measurement for each frame.")
+    ;
+
+  class_<Avogadro::RadialDistribution, boost::noncopyable>("RadialDistribution")
+    .add_property("periodic",
+        &RadialDistribution::isPeriodic,
+        "True if pairs with periodic images are counted.")
+
+    .add_property("maximum",
+        &RadialDistribution::maximum,
+        "The largest distance in the histogram.")
+
+    .add_property("numBins",
+        &RadialDistribution::numBins,
+        "The number of bins in the histogram.")
+
+    .add_property("numFrames",
+        &RadialDistribution::numFrames,
+        "The number of frames added.")
+
+    .def("setMolecule",
+        &RadialDistribution::setMolecule,
+        "Take the number of atoms and the unit cell from the molecule.")
+
+    .def("setSelections",
+        &RadialDistribution::setSelections,
+        "Count pairs between two lists of atom indices, empty for all atoms.")
+
+    .def("setRange",
+        &RadialDistribution::setRange,
+        "Histogram the distances up to a maximum in a number of bins.")
+
+    .def("clear",
+        &RadialDistribution::clear)
+
+    .def("run",
+        &RadialDistribution::run,
+        "Clear and add all frames of the source.")
+
+    .def("radii",
+        &RadialDistribution::radii,
+        "The distance at the middle of each bin.")
+
+    .def("distribution",
+        &RadialDistribution::distribution,
+        "g(r) of each bin.")
+
+    .def("coordinationNumber",
+        &RadialDistribution::coordinationNumber,
+        "The average number of atoms within the outer radius of each bin.")
+    ;
+
+  class_<Avogadro::ContactMap, boost::noncopyable>("ContactMap")
+    .add_property("cutoff",
+        &ContactMap::cutoff,
+        &ContactMap::setCutoff,
+        "Residues closer than this are in contact.")
+
+    .add_property("heavyAtomsOnly",
+        &ContactMap::heavyAtomsOnly,
+        &ContactMap::setHeavyAtomsOnly,
+        "Leave out hydrogens.")
+
+    .add_property("numFrames",
+        &ContactMap::numFrames,
+        "The number of frames added.")
+
+    .add_property("numResidues",
+        &ContactMap::numResidues,
+        "The number of residues.")
+
+    .def("setMolecule",
+        &ContactMap::setMolecule,
+        "Take the residues and the unit cell from the molecule.")
+
+    .def("clear",
+        &ContactMap::clear)
+
+    .def("run",
+        &ContactMap::run,
+        "Clear and add all frames of the source.")
+
+    .def("frequencies",
+        &ContactMap::frequencies,
+        "The contact frequency of each pair of residues, stored by rows.")
+
+    .def("frequency",
+        &ContactMap::frequency,
+        "The fraction of frames in which two residues are in contact.")
+    ;
+
+}
@@ -0,0 +1,352 @@
+/**********************************************************************
+  RadialDistribution - Radial distribution function of a trajectory
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "radialdistribution.h"
+#include "periodiccelllist_p.h"
+
+#include <avogadro/molecule.h>
+#include <avogadro/trajectoryanalysis.h>
+
+#include <openbabel/generic.h>
+
+#include <QThread>
+#include <QtCore/QtConcurrentMap>
+
+#include <cmath>
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  // Bits of the selection flags of an atom
+  enum { InFirst = 1, InSecond = 2 };
+
+  /**
+   * A range of cells of a frame and the histogram of the pairs found in
+   * them, kept across frames.
+   */
+  struct PairBlock
+  {
+    const PeriodicCellList *cells;
+    const unsigned char *flags;   // selection flags of each slot
+    int firstCell;
+    int endCell;
+    double maximum2;
+    double inverseWidth;
+    int lastBin;
+    QVector<qint64> histogram;
+    QVector<PeriodicCellList::Neighbor> neighbors;
+  };
+
+  static inline void countPair(const PairBlock &block, qint64 *histogram,
+                               const double *a, const double *b,
+                               const Vector3d &shift, int weight)
+  {
+    const double dx = b[0] + shift.x() - a[0];
+    const double dy = b[1] + shift.y() - a[1];
+    const double dz = b[2] + shift.z() - a[2];
+    const double r2 = dx * dx + dy * dy + dz * dz;
+    if (r2 < block.maximum2) {
+      const int bin = static_cast<int>(sqrt(r2) * block.inverseWidth);
+      histogram[qMin(bin, block.lastBin)] += weight;
+    }
+  }
+
+  // Number of ordered (first, second) pairs in the unordered pair of atoms
+  static inline int pairWeight(unsigned char a, unsigned char b)
+  {
+    return ((a & InFirst) && (b & InSecond)) + ((a & InSecond) && (b & InFirst));
+  }
+
+  static void countBlock(PairBlock &block)
+  {
+    const PeriodicCellList *cells = block.cells;
+    const double *positions = cells->positions();
+    const int *slots = cells->slots();
+    const unsigned char *flags = block.flags;
+    qint64 *histogram = block.histogram.data();
+
+    for (int c = block.firstCell; c < block.endCell; ++c) {
+      cells->halfStencil(c, block.neighbors);
+      const int begin = cells->begin(c), end = cells->end(c);
+      if (begin == end)
+        continue;
+
+      // Within the cell each pair once
+      for (int i = begin; i < end; ++i) {
+        const unsigned char fi = flags[slots[i]];
+        for (int j = i + 1; j < end; ++j) {
+          const int weight = pairWeight(fi, flags[slots[j]]);
+          if (weight)
+            countPair(block, histogram, positions + 3 * i, positions + 3 * j,
+                      block.neighbors[0].shift, weight);
+        }
+      }
+
+      for (int k = 1; k < block.neighbors.size(); ++k) {
+        const PeriodicCellList::Neighbor &neighbor = block.neighbors[k];
+        const int nBegin = cells->begin(neighbor.cell), nEnd = cells->end(neighbor.cell);
+        for (int i = begin; i < end; ++i) {
+          const unsigned char fi = flags[slots[i]];
+          for (int j = nBegin; j < nEnd; ++j) {
+            const int weight = pairWeight(fi, flags[slots[j]]);
+            if (weight)
+              countPair(block, histogram, positions + 3 * i, positions + 3 * j,
+                        neighbor.shift, weight);
+          }
+        }
+      }
+    }
+  }
+
+  class RadialDistributionPrivate
+  {
+    public:
+      RadialDistributionPrivate() : numAtoms(0), periodic(false),
+        maximum(10.0), numBins(200), numFirst(0), numSecond(0), numBoth(0),
+        cells(10.0), numFrames(0), volumeSum(0.0) {}
+
+      int numAtoms;
+      bool periodic;
+      Matrix3d cellMatrix;   // lattice vectors as columns
+      QList<int> first, second;
+      double maximum;
+      int numBins;
+
+      // The atoms in either selection, and their flags
+      QVector<int> atoms;
+      QVector<unsigned char> flags;
+      int numFirst, numSecond, numBoth;
+
+      PeriodicCellList cells;
+      QVector<PairBlock> blocks;
+      int numFrames;
+      double volumeSum;
+
+      void setup();
+      void clear();
+      QVector<qint64> histogram() const;
+  };
+
+  void RadialDistributionPrivate::setup()
+  {
+    QVector<unsigned char> all(numAtoms, 0);
+    for (int i = 0; i < numAtoms; ++i)
+      all[i] = (first.isEmpty() ? InFirst : 0) | (second.isEmpty() ? InSecond : 0);
+    foreach (int index, first)
+      if (index >= 0 && index < numAtoms)
+        all[index] |= InFirst;
+    foreach (int index, second)
+      if (index >= 0 && index < numAtoms)
+        all[index] |= InSecond;
+
+    atoms.clear();
+    flags.clear();
+    numFirst = numSecond = numBoth = 0;
+    for (int i = 0; i < numAtoms; ++i) {
+      if (!all[i])
+        continue;
+      atoms.append(i);
+      flags.append(all[i]);
+      numFirst += (all[i] & InFirst) != 0;
+      numSecond += (all[i] & InSecond) != 0;
+      numBoth += all[i] == (InFirst | InSecond);
+    }
+
+    cells = PeriodicCellList(maximum);
+    if (periodic)
+      cells.setCell(cellMatrix);
+    clear();
+  }
+
+  void RadialDistributionPrivate::clear()
+  {
+    numFrames = 0;
+    volumeSum = 0.0;
+    blocks.resize(4 * qMax(1, QThread::idealThreadCount()));
+    for (int b = 0; b < blocks.size(); ++b)
+      blocks[b].histogram.fill(0, numBins);
+  }
+
+  QVector<qint64> RadialDistributionPrivate::histogram() const
+  {
+    QVector<qint64> sum(numBins, 0);
+    foreach (const PairBlock &block, blocks)
+      for (int k = 0; k < numBins; ++k)
+        sum[k] += block.histogram[k];
+    return sum;
+  }
+
+  RadialDistribution::RadialDistribution() : d(new RadialDistributionPrivate)
+  {
+    d->cellMatrix.setIdentity();
+    d->setup();
+  }
+
+  RadialDistribution::~RadialDistribution()
+  {
+    delete d;
+  }
+
+  void RadialDistribution::setMolecule(const Molecule *molecule)
+  {
+    d->numAtoms = molecule ? molecule->numAtoms() : 0;
+    OpenBabel::OBUnitCell *cell = molecule ? molecule->OBUnitCell() : 0;
+    d->periodic = cell != 0;
+    if (cell) {
+      OpenBabel::matrix3x3 ortho = cell->GetOrthoMatrix();
+      for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+          d->cellMatrix(i, j) = ortho.Get(i, j);
+    }
+    d->setup();
+  }
+
+  bool RadialDistribution::isPeriodic() const
+  {
+    return d->periodic;
+  }
+
+  void RadialDistribution::setSelections(const QList<int> &first,
+                                         const QList<int> &second)
+  {
+    d->first = first;
+    d->second = second;
+    d->setup();
+  }
+
+  void RadialDistribution::setRange(double maximum, int bins)
+  {
+    d->maximum = maximum > 0.0 ? maximum : 10.0;
+    d->numBins = qMax(1, bins);
+    d->setup();
+  }
+
+  double RadialDistribution::maximum() const
+  {
+    return d->maximum;
+  }
+
+  int RadialDistribution::numBins() const
+  {
+    return d->numBins;
+  }
+
+  void RadialDistribution::clear()
+  {
+    d->clear();
+  }
+
+  void RadialDistribution::addFrame(const double *coordinates)
+  {
+    if (d->atoms.isEmpty())
+      return;
+    d->cells.update(coordinates, d->atoms);
+
+    // Consecutive runs of cells, more runs than threads to even out the
+    // load of dense and empty regions
+    const int numCells = d->cells.numCells();
+    const int numBlocks = d->blocks.size();
+    const int perBlock = (numCells + numBlocks - 1) / numBlocks;
+    for (int b = 0; b < numBlocks; ++b) {
+      PairBlock &block = d->blocks[b];
+      block.cells = &d->cells;
+      block.flags = d->flags.constData();
+      block.firstCell = qMin(numCells, b * perBlock);
+      block.endCell = qMin(numCells, block.firstCell + perBlock);
+      block.maximum2 = d->maximum * d->maximum;
+      block.inverseWidth = d->numBins / d->maximum;
+      block.lastBin = d->numBins - 1;
+    }
+    QtConcurrent::blockingMap(d->blocks, countBlock);
+
+    ++d->numFrames;
+    d->volumeSum += d->cells.volume();
+  }
+
+  bool RadialDistribution::run(TrajectoryFrameSource *source)
+  {
+    d->clear();
+    if (!source || source->numAtoms() != d->numAtoms || !source->rewind())
+      return false;
+
+    const int chunk = 16;
+    QVector<double> buffer(3 * d->numAtoms * chunk);
+    int read;
+    while ((read = source->readFrames(buffer.data(), chunk)) > 0)
+      for (int f = 0; f < read; ++f)
+        addFrame(buffer.constData() + 3 * d->numAtoms * f);
+    return read == 0;
+  }
+
+  int RadialDistribution::numFrames() const
+  {
+    return d->numFrames;
+  }
+
+  QVector<double> RadialDistribution::radii() const
+  {
+    QVector<double> radii(d->numBins);
+    const double width = d->maximum / d->numBins;
+    for (int k = 0; k < d->numBins; ++k)
+      radii[k] = (k + 0.5) * width;
+    return radii;
+  }
+
+  QVector<double> RadialDistribution::distribution() const
+  {
+    QVector<double> g(d->numBins, 0.0);
+    const double pairs = static_cast<double>(d->numFirst) * d->numSecond - d->numBoth;
+    if (!d->numFrames || pairs <= 0.0 || d->volumeSum <= 0.0)
+      return g;
+
+    // Pairs found over pairs expected at the average density
+    const QVector<qint64> histogram = d->histogram();
+    const double volume = d->volumeSum / d->numFrames;
+    const double width = d->maximum / d->numBins;
+    for (int k = 0; k < d->numBins; ++k) {
+      const double inner = k * width, outer = inner + width;
+      const double shell = 4.0 / 3.0 * M_PI * (outer * outer * outer - inner * inner * inner);
+      g[k] = histogram[k] * volume / (d->numFrames * pairs * shell);
+    }
+    return g;
+  }
+
+  QVector<double> RadialDistribution::coordinationNumber() const
+  {
+    QVector<double> n(d->numBins, 0.0);
+    if (!d->numFrames || !d->numFirst)
+      return n;
+
+    const QVector<qint64> histogram = d->histogram();
+    const double scale = 1.0 / (static_cast<double>(d->numFrames) * d->numFirst);
+    qint64 total = 0;
+    for (int k = 0; k < d->numBins; ++k) {
+      total += histogram[k];
+      n[k] = total * scale;
+    }
+    return n;
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,138 @@
+/**********************************************************************
+  RadialDistribution - Radial distribution function of a trajectory
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef RADIALDISTRIBUTION_H
+#define RADIALDISTRIBUTION_H
+
+#include <avogadro/global.h>
+
+#include <QList>
+#include <QVector>
+
+namespace Avogadro {
+
+  class Molecule;
+  class TrajectoryFrameSource;
+
+  /**
+   * @class RadialDistribution radialdistribution.h <avogadro/radialdistribution.h>
+   * @brief The radial distribution function g(r) between two sets of atoms.
+   *
+   * Pairs are found with a cell list, so a frame takes time proportional to
+   * the number of atoms rather than its square. If the molecule has a unit
+   * cell, distances are to the nearest periodic images within the range and
+   * the density is that of the cell; otherwise the bounding box of the
+   * atoms is used for the density. The cells of each frame are shared out
+   * over all cores, each with its own histogram, and the histograms are
+   * only added up when the results are asked for, so frames can be added
+   * one at a time.
+   *
+   * @code
+   * RadialDistribution rdf;
+   * rdf.setMolecule(molecule);
+   * rdf.setSelections(oxygens, oxygens);
+   * ConformerFrameSource frames(molecule);
+   * if (rdf.run(&frames))
+   *   plot(rdf.radii(), rdf.distribution());
+   * @endcode
+   */
+  class RadialDistributionPrivate;
+  class A_EXPORT RadialDistribution
+  {
+    public:
+      RadialDistribution();
+      ~RadialDistribution();
+
+      /**
+       * Take the number of atoms and the unit cell, if any, from
+       * @p molecule. This clears the histogram.
+       */
+      void setMolecule(const Molecule *molecule);
+
+      /**
+       * @return True if pairs with periodic images are counted.
+       */
+      bool isPeriodic() const;
+
+      /**
+       * Count the pairs between atoms of @p first and atoms of @p second,
+       * given by their indices. An empty list stands for all atoms, the
+       * default. This clears the histogram.
+       */
+      void setSelections(const QList<int> &first, const QList<int> &second);
+
+      /**
+       * Histogram the distances up to @p maximum Angstrom in @p bins bins,
+       * 10 Angstrom in 200 bins by default. This clears the histogram.
+       */
+      void setRange(double maximum, int bins);
+      double maximum() const;
+      int numBins() const;
+
+      /**
+       * Forget all frames added so far.
+       */
+      void clear();
+
+      /**
+       * Add the frame with packed x, y, z @p coordinates in the order of
+       * the atom indices.
+       */
+      void addFrame(const double *coordinates);
+
+      /**
+       * Clear and add all frames of @p source.
+       * @return false if the source does not match the molecule.
+       */
+      bool run(TrajectoryFrameSource *source);
+
+      /**
+       * @return The number of frames added.
+       */
+      int numFrames() const;
+
+      /**
+       * @return The distance at the middle of each bin, in Angstrom.
+       */
+      QVector<double> radii() const;
+
+      /**
+       * @return g(r) of each bin, averaged over the frames.
+       */
+      QVector<double> distribution() const;
+
+      /**
+       * @return The average number of atoms of the second selection within
+       * the outer radius of each bin from an atom of the first.
+       */
+      QVector<double> coordinationNumber() const;
+
+    private:
+      RadialDistributionPrivate * const d;
+      Q_DISABLE_COPY(RadialDistribution)
+  };
+
+} // End namespace Avogadro
+
+#endif
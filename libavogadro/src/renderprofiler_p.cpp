@@ -0,0 +1,394 @@
+/**********************************************************************
+  RenderProfiler - Per-engine frame profiler for the GLWidget
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "renderprofiler_p.h"
+
+#include <QGLWidget> // for OpenGL bits
+#include <QGLContext>
+#include <QVector>
+#include <QFile>
+#include <QTextStream>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+// Number of completed frames kept for the trace
+#define PROFILER_HISTORY_SIZE 600
+// Frames waiting for GPU results before we block on the oldest one
+#define PROFILER_MAX_PENDING 3
+
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+namespace Avogadro {
+
+  typedef void (APIENTRY *GenQueriesFunc)(GLsizei, GLuint *);
+  typedef void (APIENTRY *DeleteQueriesFunc)(GLsizei, const GLuint *);
+  typedef void (APIENTRY *BeginQueryFunc)(GLenum, GLuint);
+  typedef void (APIENTRY *EndQueryFunc)(GLenum);
+  typedef void (APIENTRY *GetQueryObjectivFunc)(GLuint, GLenum, GLint *);
+  typedef void (APIENTRY *GetQueryObjectui64vFunc)(GLuint, GLenum, quint64 *);
+
+  class RenderProfilerPrivate
+  {
+  public:
+    RenderProfilerPrivate() : enabled(false), glInitialized(false),
+      timerQuery(false), inFrame(false), depth(0), frameStart(0),
+      genQueries(0), deleteQueries(0), beginQuery(0), endQuery(0),
+      getQueryObjectiv(0), getQueryObjectui64v(0) {}
+
+    bool enabled;
+    bool glInitialized;
+    bool timerQuery;
+
+    bool inFrame;            // between beginFrame() and endFrame()
+    int depth;               // nesting depth of begin() calls
+    qint64 frameStart;
+    QList<RenderProfiler::Span> spans;     // spans of the current frame
+    QList<RenderProfiler::Frame> pending;  // frames waiting for the GPU
+    QList<RenderProfiler::Frame> history;  // completed frames
+    QVector<GLuint> freeQueries;
+
+    GenQueriesFunc genQueries;
+    DeleteQueriesFunc deleteQueries;
+    BeginQueryFunc beginQuery;
+    EndQueryFunc endQuery;
+    GetQueryObjectivFunc getQueryObjectiv;
+    GetQueryObjectui64vFunc getQueryObjectui64v;
+
+    void initializeGL();
+    GLuint allocateQuery();
+    bool collect(RenderProfiler::Frame &frame, bool wait);
+    void clear();
+  };
+
+  void RenderProfilerPrivate::initializeGL()
+  {
+    glInitialized = true;
+    const QGLContext *context = QGLContext::currentContext();
+    if (!context)
+      return;
+
+    QString extensions(reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS)));
+    if (!extensions.contains("GL_EXT_timer_query")
+        && !extensions.contains("GL_ARB_timer_query"))
+      return;
+
+    QGLContext *ctx = const_cast<QGLContext *>(context);
+    genQueries = (GenQueriesFunc) ctx->getProcAddress("glGenQueries");
+    deleteQueries = (DeleteQueriesFunc) ctx->getProcAddress("glDeleteQueries");
+    beginQuery = (BeginQueryFunc) ctx->getProcAddress("glBeginQuery");
+    endQuery = (EndQueryFunc) ctx->getProcAddress("glEndQuery");
+    getQueryObjectiv = (GetQueryObjectivFunc)
+      ctx->getProcAddress("glGetQueryObjectiv");
+    getQueryObjectui64v = (GetQueryObjectui64vFunc)
+      ctx->getProcAddress("glGetQueryObjectui64vEXT");
+    if (!getQueryObjectui64v)
+      getQueryObjectui64v = (GetQueryObjectui64vFunc)
+        ctx->getProcAddress("glGetQueryObjectui64v");
+
+    timerQuery = genQueries && deleteQueries && beginQuery && endQuery
+      && getQueryObjectiv && getQueryObjectui64v;
+  }
+
+  GLuint RenderProfilerPrivate::allocateQuery()
+  {
+    if (!timerQuery)
+      return 0;
+    GLuint query = 0;
+    if (!freeQueries.isEmpty()) {
+      query = freeQueries.last();
+      freeQueries.pop_back();
+      return query;
+    }
+    genQueries(1, &query);
+    return query;
+  }
+
+  bool RenderProfilerPrivate::collect(RenderProfiler::Frame &frame, bool wait)
+  {
+    if (!wait) {
+      // Only the last query of the frame needs checking, they finish in order
+      for (int i = frame.spans.size() - 1; i >= 0; --i) {
+        if (frame.spans[i].query) {
+          GLint available = 0;
+          getQueryObjectiv(frame.spans[i].query, GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+          if (!available)
+            return false;
+          break;
+        }
+      }
+    }
+
+    for (int i = 0; i < frame.spans.size(); ++i) {
+      RenderProfiler::Span &span = frame.spans[i];
+      if (!span.query)
+        continue;
+      quint64 nanoseconds = 0;
+      getQueryObjectui64v(span.query, GL_QUERY_RESULT, &nanoseconds);
+      span.gpuTime = static_cast<qint64>(nanoseconds / 1000);
+      freeQueries.append(span.query);
+      span.query = 0;
+    }
+    return true;
+  }
+
+  void RenderProfilerPrivate::clear()
+  {
+    // Queries still in flight are simply returned to the pool
+    foreach (const RenderProfiler::Frame &frame, pending)
+      foreach (const RenderProfiler::Span &span, frame.spans)
+        if (span.query)
+          freeQueries.append(span.query);
+    foreach (const RenderProfiler::Span &span, spans)
+      if (span.query)
+        freeQueries.append(span.query);
+    pending.clear();
+    history.clear();
+    spans.clear();
+    inFrame = false;
+    depth = 0;
+  }
+
+  RenderProfiler::RenderProfiler() : d(new RenderProfilerPrivate)
+  {
+  }
+
+  RenderProfiler::~RenderProfiler()
+  {
+    d->clear();
+    if (d->timerQuery && !d->freeQueries.isEmpty()
+        && QGLContext::currentContext())
+      d->deleteQueries(d->freeQueries.size(), d->freeQueries.constData());
+    delete d;
+  }
+
+  void RenderProfiler::setEnabled(bool enabled)
+  {
+    if (d->enabled == enabled)
+      return;
+    d->enabled = enabled;
+    if (!enabled)
+      d->clear();
+  }
+
+  bool RenderProfiler::isEnabled() const
+  {
+    return d->enabled;
+  }
+
+  void RenderProfiler::beginFrame()
+  {
+    if (!d->enabled)
+      return;
+    if (!d->glInitialized)
+      d->initializeGL();
+    d->inFrame = true;
+    d->frameStart = currentTime();
+  }
+
+  void RenderProfiler::endFrame()
+  {
+    if (!d->enabled || !d->inFrame)
+      return;
+    d->inFrame = false;
+
+    Frame frame;
+    frame.start = d->frameStart;
+    frame.duration = currentTime() - d->frameStart;
+    frame.spans = d->spans;
+    d->spans.clear();
+    d->depth = 0;
+    d->pending.append(frame);
+
+    // Move frames whose GPU timings are in to the history, never letting
+    // too many frames pile up
+    while (!d->pending.isEmpty()) {
+      bool wait = d->pending.size() > PROFILER_MAX_PENDING;
+      if (d->timerQuery && !d->collect(d->pending.first(), wait))
+        break;
+      d->history.append(d->pending.takeFirst());
+    }
+    while (d->history.size() > PROFILER_HISTORY_SIZE)
+      d->history.removeFirst();
+  }
+
+  void RenderProfiler::begin(const QString &name, const QString &category,
+                             int primitives, int vertices)
+  {
+    // Spans outside a frame would be charged to the next one
+    if (!d->enabled || !d->inFrame || d->depth++ > 0)
+      return;
+    if (!d->glInitialized)
+      d->initializeGL();
+
+    Span span;
+    span.name = name;
+    span.category = category;
+    span.gpuTime = -1;
+    span.cpuTime = 0;
+    // Store the counters at the start, end() turns them into deltas
+    span.primitives = primitives;
+    span.vertices = vertices;
+    span.query = 0;
+    if (d->timerQuery) {
+      // Queries can not be compiled into display lists, time those on the
+      // CPU only
+      GLint list = 0;
+      glGetIntegerv(GL_LIST_INDEX, &list);
+      if (!list)
+        span.query = d->allocateQuery();
+    }
+    if (span.query)
+      d->beginQuery(GL_TIME_ELAPSED_EXT, span.query);
+    span.start = currentTime();
+    d->spans.append(span);
+  }
+
+  void RenderProfiler::end(int primitives, int vertices)
+  {
+    if (!d->enabled || d->depth == 0 || --d->depth > 0)
+      return;
+
+    Span &span = d->spans.last();
+    span.cpuTime = currentTime() - span.start;
+    if (span.query)
+      d->endQuery(GL_TIME_ELAPSED_EXT);
+    span.primitives = primitives - span.primitives;
+    span.vertices = vertices - span.vertices;
+  }
+
+  QList<RenderProfiler::Span> RenderProfiler::summary() const
+  {
+    QList<Span> merged;
+    if (d->history.isEmpty())
+      return merged;
+
+    foreach (const Span &span, d->history.last().spans) {
+      bool found = false;
+      for (int i = 0; i < merged.size(); ++i) {
+        Span &m = merged[i];
+        if (m.name == span.name && m.category == span.category) {
+          m.cpuTime += span.cpuTime;
+          if (span.gpuTime >= 0)
+            m.gpuTime = (m.gpuTime < 0 ? 0 : m.gpuTime) + span.gpuTime;
+          m.primitives += span.primitives;
+          m.vertices += span.vertices;
+          found = true;
+          break;
+        }
+      }
+      if (!found)
+        merged.append(span);
+    }
+    return merged;
+  }
+
+  qint64 RenderProfiler::lastFrameTime() const
+  {
+    return d->history.isEmpty() ? 0 : d->history.last().duration;
+  }
+
+  bool RenderProfiler::hasGpuTimers() const
+  {
+    return d->timerQuery;
+  }
+
+  static QString jsonString(const QString &string)
+  {
+    QString escaped = string;
+    escaped.replace('\\', "\\\\");
+    escaped.replace('"', "\\\"");
+    return '"' + escaped + '"';
+  }
+
+  bool RenderProfiler::saveTrace(const QString &fileName) const
+  {
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+      return false;
+
+    // CPU spans go on thread 1, the GPU timings of the same spans on thread
+    // 2 starting at the CPU submission time
+    QTextStream out(&file);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+           "\"args\":{\"name\":\"CPU\"}},\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,"
+           "\"args\":{\"name\":\"GPU\"}}";
+
+    int frameNumber = 0;
+    foreach (const Frame &frame, d->history) {
+      out << ",\n{\"name\":\"Frame\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,"
+          << "\"tid\":1,\"ts\":" << frame.start << ",\"dur\":" << frame.duration
+          << ",\"args\":{\"frame\":" << frameNumber++ << "}}";
+      foreach (const Span &span, frame.spans) {
+        out << ",\n{\"name\":" << jsonString(span.name)
+            << ",\"cat\":" << jsonString(span.category)
+            << ",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << span.start
+            << ",\"dur\":" << span.cpuTime
+            << ",\"args\":{\"primitives\":" << span.primitives
+            << ",\"vertices\":" << span.vertices << "}}";
+        if (span.gpuTime >= 0)
+          out << ",\n{\"name\":" << jsonString(span.name)
+              << ",\"cat\":" << jsonString(span.category)
+              << ",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":" << span.start
+              << ",\"dur\":" << span.gpuTime << "}";
+      }
+    }
+    out << "\n]}\n";
+    return true;
+  }
+
+  qint64 RenderProfiler::currentTime()
+  {
+#ifdef WIN32
+    static LARGE_INTEGER frequency = { 0 };
+    if (!frequency.QuadPart)
+      QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return static_cast<qint64>(counter.QuadPart * 1000000.0 / frequency.QuadPart);
+#else
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return static_cast<qint64>(tv.tv_sec) * 1000000 + tv.tv_usec;
+#endif
+  }
+
+} // End namespace Avogadro
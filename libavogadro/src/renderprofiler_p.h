@@ -0,0 +1,154 @@
+/**********************************************************************
+  RenderProfiler - Per-engine frame profiler for the GLWidget
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef RENDERPROFILER_P_H
+#define RENDERPROFILER_P_H
+
+#include <QString>
+#include <QList>
+
+namespace Avogadro {
+
+  class RenderProfilerPrivate;
+
+  /**
+   * @class RenderProfiler
+   * @internal
+   * @brief Records how long the parts of each frame take to render.
+   *
+   * The GLWidget wraps every engine render call, tool paint and extension
+   * paint in a begin()/end() pair. Each span is timed on the CPU and, where
+   * the driver supports GL_EXT_timer_query, on the GPU as well. The GPU
+   * results are collected a frame or two later so that the pipeline is
+   * never stalled. The primitive and vertex counts drawn by the painter
+   * during the span are recorded alongside the timings.
+   *
+   * Completed frames are kept in a bounded history that can be written out
+   * as a Chrome trace (chrome://tracing) JSON file.
+   */
+  class RenderProfiler
+  {
+  public:
+    /**
+     * One timed section of a frame. Times are in microseconds, a GPU time
+     * of -1 means that it is not available.
+     */
+    struct Span
+    {
+      QString name;
+      QString category;
+      qint64 start;
+      qint64 cpuTime;
+      qint64 gpuTime;
+      int primitives;
+      int vertices;
+      unsigned int query;
+    };
+
+    /**
+     * All spans recorded between beginFrame() and endFrame().
+     */
+    struct Frame
+    {
+      qint64 start;
+      qint64 duration;
+      QList<Span> spans;
+    };
+
+    RenderProfiler();
+    ~RenderProfiler();
+
+    /**
+     * Enable or disable profiling, disabling it discards the history.
+     */
+    void setEnabled(bool enabled);
+
+    /**
+     * @return true if profiling is enabled.
+     */
+    bool isEnabled() const;
+
+    /**
+     * Start recording a new frame.
+     */
+    void beginFrame();
+
+    /**
+     * Finish the current frame and collect any GPU timings that became
+     * available. Requires the GL context of the frame to be current.
+     */
+    void endFrame();
+
+    /**
+     * Start a span. Spans do not nest, a span begun while another one is
+     * open is folded into the outer span. Spans outside a frame are ignored.
+     * @param name the name of the span, e.g. the engine alias.
+     * @param category the kind of work, e.g. "renderOpaque".
+     * @param primitives the painter primitive counter when the span starts.
+     * @param vertices the painter vertex counter when the span starts.
+     */
+    void begin(const QString &name, const QString &category,
+               int primitives, int vertices);
+
+    /**
+     * End the current span.
+     * @param primitives the painter primitive counter when the span ends.
+     * @param vertices the painter vertex counter when the span ends.
+     */
+    void end(int primitives, int vertices);
+
+    /**
+     * @return the spans of the last frame with complete timings, spans with
+     * the same name and category are merged.
+     */
+    QList<Span> summary() const;
+
+    /**
+     * @return the duration of the last completed frame in microseconds.
+     */
+    qint64 lastFrameTime() const;
+
+    /**
+     * @return true if GPU timer queries are used.
+     */
+    bool hasGpuTimers() const;
+
+    /**
+     * Write the recorded frames as a Chrome trace JSON file.
+     * @return true on success.
+     */
+    bool saveTrace(const QString &fileName) const;
+
+    /**
+     * @return the current time in microseconds.
+     */
+    static qint64 currentTime();
+
+  private:
+    RenderProfilerPrivate * const d;
+  };
+
+} // End namespace Avogadro
+
+#endif
@@ -0,0 +1,510 @@
+/**********************************************************************
+  RingPerception - Smallest set of smallest rings and aromaticity
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "ringperception_p.h"
+
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+#include <avogadro/molecule.h>
+
+#include <QHash>
+#include <QStack>
+
+#include <algorithm>
+
+namespace Avogadro {
+
+  // Bond order of aromatic bonds read from files
+  static const int aromaticOrder = 5;
+
+  struct RingEdge
+  {
+    int first, second, bond;
+
+    bool operator<(const RingEdge &other) const
+    {
+      if (first != other.first)
+        return first < other.first;
+      if (second != other.second)
+        return second < other.second;
+      return bond < other.bond;
+    }
+  };
+
+  // A step of the depth first search for bridges
+  struct BridgeFrame
+  {
+    int atom, parentEdge, next;
+  };
+
+  // Orders ring indices by the size of the rings
+  struct RingSizeLess
+  {
+    const QList<QVector<int> > *rings;
+
+    bool operator()(int a, int b) const
+    {
+      return rings->at(a).size() < rings->at(b).size();
+    }
+  };
+
+  // A cycle of the cycle space of a ring system as a set of its edges
+  struct CycleVector
+  {
+    QVector<quint64> bits;
+    int pivot;
+  };
+
+  static inline bool testBit(const QVector<quint64> &bits, int i)
+  {
+    return bits.at(i >> 6) & (Q_UINT64_C(1) << (i & 63));
+  }
+
+  static int firstBit(const QVector<quint64> &bits)
+  {
+    for (int w = 0; w < bits.size(); ++w)
+      if (bits.at(w))
+        for (int b = 0; b < 64; ++b)
+          if (bits.at(w) & (Q_UINT64_C(1) << b))
+            return 64 * w + b;
+    return -1;
+  }
+
+  static inline void xorBits(QVector<quint64> &bits, const QVector<quint64> &other)
+  {
+    for (int w = 0; w < bits.size(); ++w)
+      bits[w] ^= other.at(w);
+  }
+
+  // Add cycle to the basis unless it depends on it. The basis is kept
+  // reduced, no vector has the pivot of another set.
+  static bool addIndependent(QList<CycleVector> &basis, QVector<quint64> cycle)
+  {
+    foreach (const CycleVector &v, basis)
+      if (testBit(cycle, v.pivot))
+        xorBits(cycle, v.bits);
+    const int pivot = firstBit(cycle);
+    if (pivot < 0)
+      return false;
+    for (int i = 0; i < basis.size(); ++i)
+      if (testBit(basis.at(i).bits, pivot))
+        xorBits(basis[i].bits, cycle);
+    CycleVector v;
+    v.bits = cycle;
+    v.pivot = pivot;
+    basis.append(v);
+    return true;
+  }
+
+  RingPerception::RingPerception(const Molecule *molecule)
+    : m_molecule(molecule), m_numAtoms(molecule ? molecule->numAtoms() : 0)
+  {
+    if (!molecule)
+      return;
+
+    // One edge for each bonded pair of atoms, the lowest bond index kept
+    QVector<RingEdge> edges;
+    foreach (const Bond *bond, molecule->bonds()) {
+      const Atom *a = bond->beginAtom(), *b = bond->endAtom();
+      if (!a || !b || a == b)
+        continue;
+      const int i = static_cast<int>(a->index()), j = static_cast<int>(b->index());
+      RingEdge edge;
+      edge.first = qMin(i, j);
+      edge.second = qMax(i, j);
+      edge.bond = static_cast<int>(bond->index());
+      edges.append(edge);
+    }
+    std::sort(edges.begin(), edges.end());
+
+    m_adjacencyStart.fill(0, m_numAtoms + 1);
+    for (int i = 0; i < edges.size(); ++i) {
+      const RingEdge &edge = edges.at(i);
+      if (i && edges.at(i - 1).first == edge.first
+          && edges.at(i - 1).second == edge.second)
+        continue;
+      m_edgeAtoms.append(edge.first);
+      m_edgeAtoms.append(edge.second);
+      m_edgeBond.append(edge.bond);
+      m_edgeOrder.append(molecule->bond(edge.bond)->order());
+      ++m_adjacencyStart[edge.first + 1];
+      ++m_adjacencyStart[edge.second + 1];
+    }
+    for (int i = 0; i < m_numAtoms; ++i)
+      m_adjacencyStart[i + 1] += m_adjacencyStart.at(i);
+    m_adjacency.resize(m_adjacencyStart.at(m_numAtoms));
+    QVector<int> next = m_adjacencyStart;
+    for (int e = 0; e < m_edgeBond.size(); ++e) {
+      m_adjacency[next[m_edgeAtoms.at(2 * e)]++] = e;
+      m_adjacency[next[m_edgeAtoms.at(2 * e + 1)]++] = e;
+    }
+
+    findRingSystems();
+
+    // Smallest rings first over all the systems
+    QVector<int> order(m_rings.size());
+    for (int r = 0; r < order.size(); ++r)
+      order[r] = r;
+    RingSizeLess less = { &m_rings };
+    std::stable_sort(order.begin(), order.end(), less);
+    QList<QVector<int> > rings, ringEdges;
+    QVector<int> ringSystem;
+    foreach (int r, order) {
+      rings.append(m_rings.at(r));
+      ringEdges.append(m_ringEdges.at(r));
+      ringSystem.append(m_ringSystem.at(r));
+    }
+    m_rings = rings;
+    m_ringEdges = ringEdges;
+    m_ringSystem = ringSystem;
+  }
+
+  // Edges that are not bridges are in a ring. Bridges are found with
+  // Tarjan's low links, with an explicit stack as chains of atoms in a
+  // protein are too long to recurse along.
+  void RingPerception::findRingSystems()
+  {
+    const int numEdges = m_edgeBond.size();
+    m_ringEdge.fill(true, numEdges);
+
+    QVector<int> discovered(m_numAtoms, -1), low(m_numAtoms, 0);
+    QStack<BridgeFrame> stack;
+    int time = 0;
+    for (int s = 0; s < m_numAtoms; ++s) {
+      if (discovered.at(s) >= 0)
+        continue;
+      discovered[s] = low[s] = time++;
+      BridgeFrame root = { s, -1, m_adjacencyStart.at(s) };
+      stack.push(root);
+      while (!stack.isEmpty()) {
+        BridgeFrame &top = stack.top();
+        const int atom = top.atom;
+        if (top.next < m_adjacencyStart.at(atom + 1)) {
+          const int e = m_adjacency.at(top.next++);
+          if (e == top.parentEdge)
+            continue;
+          const int other = m_edgeAtoms.at(2 * e) == atom ? m_edgeAtoms.at(2 * e + 1)
+                                                          : m_edgeAtoms.at(2 * e);
+          if (discovered.at(other) < 0) {
+            discovered[other] = low[other] = time++;
+            BridgeFrame frame = { other, e, m_adjacencyStart.at(other) };
+            stack.push(frame);
+          }
+          else
+            low[atom] = qMin(low.at(atom), discovered.at(other));
+        }
+        else {
+          const BridgeFrame done = stack.pop();
+          if (stack.isEmpty())
+            continue;
+          const int parent = stack.top().atom;
+          low[parent] = qMin(low.at(parent), low.at(done.atom));
+          if (low.at(done.atom) > discovered.at(parent))
+            m_ringEdge[done.parentEdge] = false;
+        }
+      }
+    }
+
+    // Ring systems are the atoms connected by ring edges
+    QVector<bool> visited(m_numAtoms, false);
+    QVector<bool> edgeSeen(numEdges, false);
+    for (int s = 0; s < m_numAtoms; ++s) {
+      if (visited.at(s))
+        continue;
+      QVector<int> atoms, edges;
+      atoms.append(s);
+      visited[s] = true;
+      for (int i = 0; i < atoms.size(); ++i) {
+        const int atom = atoms.at(i);
+        for (int k = m_adjacencyStart.at(atom); k < m_adjacencyStart.at(atom + 1); ++k) {
+          const int e = m_adjacency.at(k);
+          if (!m_ringEdge.at(e) || edgeSeen.at(e))
+            continue;
+          edgeSeen[e] = true;
+          edges.append(e);
+          const int other = m_edgeAtoms.at(2 * e) == atom ? m_edgeAtoms.at(2 * e + 1)
+                                                          : m_edgeAtoms.at(2 * e);
+          if (!visited.at(other)) {
+            visited[other] = true;
+            atoms.append(other);
+          }
+        }
+      }
+      if (!edges.isEmpty())
+        findRings(atoms, edges);
+    }
+  }
+
+  void RingPerception::findRings(const QVector<int> &atoms, const QVector<int> &edges)
+  {
+    const int numAtoms = atoms.size(), numEdges = edges.size();
+    const int needed = numEdges - numAtoms + 1;
+    const int system = m_ringSystem.isEmpty() ? 0 : m_ringSystem.last() + 1;
+
+    // The ring system with local atom and edge indices
+    QHash<int, int> localAtom;
+    for (int i = 0; i < numAtoms; ++i)
+      localAtom.insert(atoms.at(i), i);
+    QVector<int> start(numAtoms + 1, 0), neighbor(2 * numEdges), edgeOf(2 * numEdges);
+    for (int e = 0; e < numEdges; ++e) {
+      ++start[localAtom.value(m_edgeAtoms.at(2 * edges.at(e))) + 1];
+      ++start[localAtom.value(m_edgeAtoms.at(2 * edges.at(e) + 1)) + 1];
+    }
+    for (int i = 0; i < numAtoms; ++i)
+      start[i + 1] += start.at(i);
+    QVector<int> next = start;
+    for (int e = 0; e < numEdges; ++e) {
+      const int a = localAtom.value(m_edgeAtoms.at(2 * edges.at(e)));
+      const int b = localAtom.value(m_edgeAtoms.at(2 * edges.at(e) + 1));
+      neighbor[next[a]] = b;
+      edgeOf[next[a]++] = e;
+      neighbor[next[b]] = a;
+      edgeOf[next[b]++] = e;
+    }
+
+    // A single ring is walked around
+    if (needed == 1) {
+      QVector<int> ring, ringEdges;
+      int atom = 0, previous = -1;
+      do {
+        ring.append(atoms.at(atom));
+        const int k = neighbor.at(start.at(atom)) == previous ? start.at(atom) + 1
+                                                              : start.at(atom);
+        ringEdges.append(edges.at(edgeOf.at(k)));
+        previous = atom;
+        atom = neighbor.at(k);
+      } while (atom != 0);
+      m_rings.append(ring);
+      m_ringEdges.append(ringEdges);
+      m_ringSystem.append(system);
+      return;
+    }
+
+    // Cycles of each size through each atom along its shortest paths, only
+    // looking as far from it as half the size
+    const int words = (numEdges + 63) / 64;
+    QList<CycleVector> basis;
+    QVector<int> distance(numAtoms, -1), parent(numAtoms), parentEdge(numAtoms),
+      branch(numAtoms), reached;
+    for (int size = 3; size <= numAtoms && basis.size() < needed; ++size) {
+      const int depth = size / 2;
+      for (int v = 0; v < numAtoms && basis.size() < needed; ++v) {
+        reached.clear();
+        reached.append(v);
+        distance[v] = 0;
+        parent[v] = -1;
+        branch[v] = -1;
+        for (int i = 0; i < reached.size(); ++i) {
+          const int x = reached.at(i);
+          if (distance.at(x) == depth)
+            break;
+          for (int k = start.at(x); k < start.at(x + 1); ++k) {
+            const int y = neighbor.at(k);
+            if (distance.at(y) >= 0)
+              continue;
+            distance[y] = distance.at(x) + 1;
+            parent[y] = x;
+            parentEdge[y] = edgeOf.at(k);
+            branch[y] = x == v ? y : branch.at(x);
+            reached.append(y);
+          }
+        }
+
+        for (int i = 0; i < reached.size() && basis.size() < needed; ++i) {
+          const int x = reached.at(i);
+          for (int k = start.at(x); k < start.at(x + 1); ++k) {
+            const int y = neighbor.at(k);
+            if (y < x || distance.at(y) < 0
+                || distance.at(x) + distance.at(y) + 1 != size
+                || parent.at(x) == y || parent.at(y) == x
+                || branch.at(x) == branch.at(y))
+              continue;
+
+            // v to x, the edge to y, then back to v
+            QVector<quint64> bits(words, 0);
+            QVector<int> path, back, ringEdges;
+            for (int a = x; a != v; a = parent.at(a)) {
+              path.prepend(a);
+              ringEdges.append(edges.at(parentEdge.at(a)));
+              bits[parentEdge.at(a) >> 6] |= Q_UINT64_C(1) << (parentEdge.at(a) & 63);
+            }
+            for (int a = y; a != v; a = parent.at(a)) {
+              back.append(a);
+              ringEdges.append(edges.at(parentEdge.at(a)));
+              bits[parentEdge.at(a) >> 6] |= Q_UINT64_C(1) << (parentEdge.at(a) & 63);
+            }
+            bits[edgeOf.at(k) >> 6] |= Q_UINT64_C(1) << (edgeOf.at(k) & 63);
+            ringEdges.append(edges.at(edgeOf.at(k)));
+            if (!addIndependent(basis, bits))
+              continue;
+
+            QVector<int> ring;
+            ring.append(atoms.at(v));
+            foreach (int a, path)
+              ring.append(atoms.at(a));
+            foreach (int a, back)
+              ring.append(atoms.at(a));
+            m_rings.append(ring);
+            m_ringEdges.append(ringEdges);
+            m_ringSystem.append(system);
+            if (basis.size() == needed)
+              break;
+          }
+        }
+
+        foreach (int x, reached)
+          distance[x] = -1;
+      }
+    }
+  }
+
+  int RingPerception::piElectrons(int atom, const QVector<int> &stamp,
+                                  int current) const
+  {
+    const Atom *a = m_molecule->atom(atom);
+    int degree = 0, doubleBonds = 0, doubleEdge = -1;
+    bool aromaticBond = false;
+    for (int k = m_adjacencyStart.at(atom); k < m_adjacencyStart.at(atom + 1); ++k) {
+      const int e = m_adjacency.at(k);
+      const int order = m_edgeOrder.at(e);
+      ++degree;
+      if (order == aromaticOrder)
+        aromaticBond = true;
+      else if (order == 3)
+        return -1;
+      else if (order == 2) {
+        ++doubleBonds;
+        doubleEdge = e;
+      }
+    }
+    if (doubleBonds > 1)
+      return -1;
+
+    const int element = a->atomicNumber();
+    if (doubleBonds == 1) {
+      // An exocyclic double bond to a heteroatom takes the electrons
+      const int partner = m_edgeAtoms.at(2 * doubleEdge) == atom
+        ? m_edgeAtoms.at(2 * doubleEdge + 1) : m_edgeAtoms.at(2 * doubleEdge);
+      if (m_ringEdge.at(doubleEdge) || stamp.at(partner) == current
+          || m_molecule->atom(partner)->atomicNumber() == 6)
+        return 1;
+      return 0;
+    }
+
+    switch (element) {
+      case 7:
+      case 15:
+      case 33:
+        if (aromaticBond && degree < 3)
+          return 1;
+        return degree <= 3 && a->formalCharge() <= 0 ? 2 : -1;
+      case 8:
+      case 16:
+      case 34:
+      case 52:
+        return degree == 2 ? 2 : -1;
+      case 6:
+        if (aromaticBond)
+          return 1;
+        if (a->formalCharge() == -1)
+          return 2;
+        return a->formalCharge() == 1 ? 0 : -1;
+      case 5:
+        return 0;
+      default:
+        return -1;
+    }
+  }
+
+  QVector<bool> RingPerception::aromaticBonds() const
+  {
+    QVector<bool> aromatic(m_molecule ? m_molecule->numBonds() : 0, false);
+    if (m_rings.isEmpty())
+      return aromatic;
+
+    QVector<int> stamp(m_numAtoms, -1);
+    int current = 0;
+    QVector<bool> ringAromatic(m_rings.size(), false);
+
+    // Whether the rings together follow the Hückel rule
+    QVector<int> atoms;
+    for (int r = 0; r < m_rings.size(); ++r) {
+      atoms = m_rings.at(r);
+      ++current;
+      foreach (int atom, atoms)
+        stamp[atom] = current;
+      int electrons = 0;
+      foreach (int atom, atoms) {
+        const int pi = piElectrons(atom, stamp, current);
+        if (pi < 0) {
+          electrons = -1;
+          break;
+        }
+        electrons += pi;
+      }
+      ringAromatic[r] = electrons > 0 && electrons % 4 == 2;
+    }
+
+    // Fused pairs sharing a bond, such as azulene
+    QHash<int, QList<int> > ringsOfEdge;
+    for (int r = 0; r < m_rings.size(); ++r)
+      foreach (int e, m_ringEdges.at(r))
+        ringsOfEdge[e].append(r);
+    QHash<int, QList<int> >::const_iterator it = ringsOfEdge.constBegin();
+    for (; it != ringsOfEdge.constEnd(); ++it) {
+      const QList<int> &shared = it.value();
+      for (int i = 0; i < shared.size(); ++i)
+        for (int j = i + 1; j < shared.size(); ++j) {
+          const int r = shared.at(i), s = shared.at(j);
+          if (ringAromatic.at(r) && ringAromatic.at(s))
+            continue;
+          ++current;
+          atoms.clear();
+          foreach (int atom, m_rings.at(r) + m_rings.at(s))
+            if (stamp.at(atom) != current) {
+              stamp[atom] = current;
+              atoms.append(atom);
+            }
+          int electrons = 0;
+          foreach (int atom, atoms) {
+            const int pi = piElectrons(atom, stamp, current);
+            if (pi < 0) {
+              electrons = -1;
+              break;
+            }
+            electrons += pi;
+          }
+          if (electrons > 0 && electrons % 4 == 2)
+            ringAromatic[r] = ringAromatic[s] = true;
+        }
+    }
+
+    for (int r = 0; r < m_rings.size(); ++r)
+      if (ringAromatic.at(r))
+        foreach (int e, m_ringEdges.at(r))
+          aromatic[m_edgeBond.at(e)] = true;
+    return aromatic;
+  }
+
+} // End namespace Avogadro
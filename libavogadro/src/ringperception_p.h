@@ -0,0 +1,99 @@
+/**********************************************************************
+  RingPerception - Smallest set of smallest rings and aromaticity
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef RINGPERCEPTION_P_H
+#define RINGPERCEPTION_P_H
+
+#include <QList>
+#include <QVector>
+
+namespace Avogadro {
+
+  class Molecule;
+
+  /**
+   * @class RingPerception
+   * @brief The smallest set of smallest rings of the bond graph, and the
+   * aromatic bonds in them.
+   * @internal
+   *
+   * Bridges are found first, so only the ring systems left once they are
+   * cut are searched, and each of those is usually a handful of atoms even
+   * in a protein. The rings of a system are picked greedily by size from
+   * the cycles through each atom along shortest paths, with the sizes
+   * tried in increasing order and only the atoms within half the size
+   * visited, until the cycles found are as many as the system has
+   * independent rings.
+   *
+   * Aromaticity follows the Hückel rule. A ring, or a pair of fused rings
+   * that are not aromatic alone, is aromatic if every atom gives pi
+   * electrons and there are 4n + 2 of them. Atoms in a double bond give
+   * one, except for an exocyclic double bond to a heteroatom, as in a
+   * carbonyl, which gives none. Nitrogen, oxygen, and similar atoms
+   * without a double bond give their lone pair. Carbanions give two
+   * electrons and carbocations give none.
+   */
+  class RingPerception
+  {
+    public:
+      /**
+       * Perceive the rings of the bonds of @p molecule.
+       */
+      explicit RingPerception(const Molecule *molecule);
+
+      /**
+       * @return The atom indices of each ring in order around it, the
+       * smallest rings first.
+       */
+      const QList<QVector<int> > & rings() const { return m_rings; }
+
+      /**
+       * @return Whether each bond is aromatic, by bond index.
+       */
+      QVector<bool> aromaticBonds() const;
+
+    private:
+      void findRingSystems();
+      void findRings(const QVector<int> &atoms, const QVector<int> &edges);
+      // The pi electrons of atom in the ring of the atoms marked current in
+      // stamp, or -1 if it cannot be in an aromatic ring
+      int piElectrons(int atom, const QVector<int> &stamp, int current) const;
+
+      const Molecule *m_molecule;
+      int m_numAtoms;
+      // The bonds as edges between atom indices, without repeats
+      QVector<int> m_edgeAtoms;       // two per edge
+      QVector<int> m_edgeBond;        // bond index of each edge
+      QVector<int> m_edgeOrder;
+      QVector<int> m_adjacencyStart;  // per atom into m_adjacency, then the end
+      QVector<int> m_adjacency;       // edge indices
+      QVector<bool> m_ringEdge;
+      QList<QVector<int> > m_rings;
+      QList<QVector<int> > m_ringEdges;
+      QVector<int> m_ringSystem;      // of each ring
+  };
+
+} // End namespace Avogadro
+
+#endif
@@ -0,0 +1,310 @@
+/**********************************************************************
+  Selection - A set of primitives with constant time membership
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "selection.h"
+
+#include <avogadro/primitivelist.h>
+
+#include <QVector>
+
+namespace Avogadro {
+
+  class SelectionPrivate
+  {
+    public:
+      SelectionPrivate() : size(0)
+      {
+        bits.resize(Primitive::LastType);
+        lists.resize(Primitive::LastType);
+        ids.resize(Primitive::LastType);
+        stale.fill(false, Primitive::LastType);
+      }
+
+      QVector<QBitArray> bits;                // by type, indexed by id
+      // By type, in order added. Removing a primitive only clears its bit,
+      // the lists are compacted when they are next read, so they may hold
+      // primitives that were removed and already deleted. Their ids are
+      // kept next to them to compact without touching them.
+      mutable QVector<QList<Primitive *> > lists;
+      mutable QVector<QList<unsigned long> > ids;
+      mutable QVector<bool> stale;            // by type, lists to compact
+      int size;
+
+      static bool validType(const Primitive *p)
+      {
+        return p && p->type() >= Primitive::FirstType && p->type() < Primitive::LastType;
+      }
+
+      bool testBit(int type, unsigned long id) const
+      {
+        const QBitArray &b = bits.at(type);
+        return id < static_cast<unsigned long>(b.size()) && b.testBit(id);
+      }
+
+      void setBit(int type, unsigned long id)
+      {
+        QBitArray &b = bits[type];
+        if (id >= static_cast<unsigned long>(b.size()))
+          b.resize(qMax(static_cast<int>(id) + 1, 2 * b.size()));
+        b.setBit(id);
+      }
+
+      void append(int type, Primitive *p)
+      {
+        setBit(type, p->id());
+        lists[type].append(p);
+        ids[type].append(p->id());
+        ++size;
+      }
+
+      void removeBit(int type, unsigned long id)
+      {
+        bits[type].clearBit(id);
+        stale[type] = true;
+        --size;
+      }
+
+      void compact(int type) const;
+      void flush() const
+      {
+        for (int type = 0; type < stale.size(); ++type)
+          if (stale.at(type))
+            compact(type);
+      }
+  };
+
+  // Drop the primitives whose bits were cleared, and the earlier entries of
+  // those selected again afterwards, in one pass
+  void SelectionPrivate::compact(int type) const
+  {
+    QList<Primitive *> &list = lists[type];
+    QList<unsigned long> &listIds = ids[type];
+    QBitArray seen(bits.at(type).size());
+    QList<Primitive *> kept;
+    QList<unsigned long> keptIds;
+    for (int i = list.size() - 1; i >= 0; --i) {
+      const unsigned long id = listIds.at(i);
+      if (testBit(type, id) && !seen.testBit(id)) {
+        seen.setBit(id);
+        kept.prepend(list.at(i));
+        keptIds.prepend(id);
+      }
+    }
+    list = kept;
+    listIds = keptIds;
+    stale[type] = false;
+  }
+
+  Selection::Selection() : d(new SelectionPrivate)
+  {
+  }
+
+  Selection::Selection(const Selection &other) : d(new SelectionPrivate)
+  {
+    *d = *other.d;
+  }
+
+  Selection::Selection(const PrimitiveList &primitives) : d(new SelectionPrivate)
+  {
+    add(primitives);
+  }
+
+  Selection::~Selection()
+  {
+    delete d;
+  }
+
+  Selection &Selection::operator=(const Selection &other)
+  {
+    *d = *other.d;
+    return *this;
+  }
+
+  bool Selection::contains(const Primitive *primitive) const
+  {
+    return SelectionPrivate::validType(primitive)
+      && d->testBit(primitive->type(), primitive->id());
+  }
+
+  bool Selection::contains(Primitive::Type type, unsigned long id) const
+  {
+    return type >= Primitive::FirstType && type < Primitive::LastType
+      && d->testBit(type, id);
+  }
+
+  bool Selection::add(Primitive *primitive)
+  {
+    if (!SelectionPrivate::validType(primitive) || contains(primitive))
+      return false;
+    d->append(primitive->type(), primitive);
+    return true;
+  }
+
+  bool Selection::remove(Primitive *primitive)
+  {
+    if (!contains(primitive))
+      return false;
+    // Constant time, so that removing atoms one by one stays linear
+    d->removeBit(primitive->type(), primitive->id());
+    return true;
+  }
+
+  int Selection::add(const PrimitiveList &primitives)
+  {
+    int changed = 0;
+    foreach (Primitive *p, primitives)
+      changed += add(p);
+    return changed;
+  }
+
+  int Selection::remove(const PrimitiveList &primitives)
+  {
+    int changed = 0;
+    foreach (Primitive *p, primitives)
+      changed += remove(p);
+    return changed;
+  }
+
+  int Selection::toggle(const PrimitiveList &primitives)
+  {
+    int changed = 0;
+    foreach (Primitive *p, primitives) {
+      if (!SelectionPrivate::validType(p))
+        continue;
+      if (contains(p))
+        d->removeBit(p->type(), p->id());
+      else
+        d->append(p->type(), p);
+      ++changed;
+    }
+    return changed;
+  }
+
+  int Selection::unite(const Selection &other)
+  {
+    if (&other == this)
+      return 0;
+    int changed = 0;
+    other.d->flush();
+    for (int type = 0; type < Primitive::LastType; ++type)
+      foreach (Primitive *p, other.d->lists.at(type))
+        changed += add(p);
+    return changed;
+  }
+
+  int Selection::intersect(const Selection &other)
+  {
+    if (&other == this)
+      return 0;
+    int changed = 0;
+    for (int type = 0; type < Primitive::LastType; ++type) {
+      if (d->lists.at(type).isEmpty())
+        continue;
+      // Bits past the end of the other array are clear
+      QBitArray &b = d->bits[type];
+      QBitArray o = other.d->bits.at(type);
+      o.resize(b.size());
+      const int before = b.count(true);
+      b &= o;
+      const int removed = before - b.count(true);
+      if (removed) {
+        d->size -= removed;
+        d->stale[type] = true;
+        changed += removed;
+      }
+    }
+    return changed;
+  }
+
+  int Selection::subtract(const Selection &other)
+  {
+    if (&other == this) {
+      const int changed = d->size;
+      clear();
+      return changed;
+    }
+    int changed = 0;
+    other.d->flush();
+    for (int type = 0; type < Primitive::LastType; ++type)
+      foreach (unsigned long id, other.d->ids.at(type))
+        if (d->testBit(type, id)) {
+          d->removeBit(type, id);
+          ++changed;
+        }
+    return changed;
+  }
+
+  void Selection::clear()
+  {
+    for (int type = 0; type < Primitive::LastType; ++type) {
+      d->bits[type].clear();
+      d->lists[type].clear();
+      d->ids[type].clear();
+      d->stale[type] = false;
+    }
+    d->size = 0;
+  }
+
+  PrimitiveList Selection::primitives() const
+  {
+    PrimitiveList list;
+    d->flush();
+    for (int type = 0; type < Primitive::LastType; ++type)
+      foreach (Primitive *p, d->lists.at(type))
+        list.append(p);
+    return list;
+  }
+
+  QList<Primitive *> Selection::subList(Primitive::Type type) const
+  {
+    if (type < Primitive::FirstType || type >= Primitive::LastType)
+      return QList<Primitive *>();
+    if (d->stale.at(type))
+      d->compact(type);
+    return d->lists.at(type);
+  }
+
+  QBitArray Selection::bits(Primitive::Type type) const
+  {
+    if (type < Primitive::FirstType || type >= Primitive::LastType)
+      return QBitArray();
+    return d->bits.at(type);
+  }
+
+  int Selection::count() const
+  {
+    return d->size;
+  }
+
+  int Selection::count(Primitive::Type type) const
+  {
+    return subList(type).size();
+  }
+
+  bool Selection::isEmpty() const
+  {
+    return d->size == 0;
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,159 @@
+/**********************************************************************
+  Selection - A set of primitives with constant time membership
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include <avogadro/global.h>
+#include <avogadro/primitive.h>
+
+#include <QBitArray>
+#include <QList>
+
+namespace Avogadro {
+
+  class PrimitiveList;
+
+  /**
+   * @class Selection selection.h <avogadro/selection.h>
+   * @brief A set of primitives with constant time membership tests.
+   *
+   * Each primitive type has a bit array indexed by the primitive ids, next
+   * to the list of selected primitives in the order they were added.
+   * contains() only looks at the bits, so engines can ask about every atom
+   * and bond of a frame without the cost growing with the selection.
+   * Removing a primitive only clears its bit, and the lists are compacted
+   * in a single pass when they are next read, so removing primitives one
+   * at a time, as when a molecule is cleared, stays linear.
+   *
+   * Ids rather than indices are used as they do not change when other
+   * primitives are removed. Primitives that are deleted must still be
+   * removed from the selection, as GLWidget does.
+   */
+  class SelectionPrivate;
+  class A_EXPORT Selection
+  {
+    public:
+      Selection();
+      Selection(const Selection &other);
+      Selection(const PrimitiveList &primitives);
+      ~Selection();
+
+      Selection &operator=(const Selection &other);
+
+      /**
+       * @return True if @p primitive is in the selection.
+       */
+      bool contains(const Primitive *primitive) const;
+
+      /**
+       * @return True if the primitive of @p type with @p id is in the
+       * selection.
+       */
+      bool contains(Primitive::Type type, unsigned long id) const;
+
+      /**
+       * Add @p primitive to the selection.
+       * @return False if it was already selected.
+       */
+      bool add(Primitive *primitive);
+
+      /**
+       * Remove @p primitive from the selection.
+       * @return False if it was not selected.
+       */
+      bool remove(Primitive *primitive);
+
+      /**
+       * Add, remove or toggle all of @p primitives.
+       * @return The number of primitives whose selection changed.
+       */
+      int add(const PrimitiveList &primitives);
+      int remove(const PrimitiveList &primitives);
+      int toggle(const PrimitiveList &primitives);
+
+      /**
+       * Add the primitives of @p other, keep only those also in @p other or
+       * remove those in @p other.
+       * @return The number of primitives whose selection changed.
+       */
+      int unite(const Selection &other);
+      int intersect(const Selection &other);
+      int subtract(const Selection &other);
+
+      Selection &operator|=(const Selection &other) { unite(other); return *this; }
+      Selection &operator&=(const Selection &other) { intersect(other); return *this; }
+      Selection &operator-=(const Selection &other) { subtract(other); return *this; }
+
+      /**
+       * Remove everything from the selection.
+       */
+      void clear();
+
+      /**
+       * @return All selected primitives, by type and in the order they were
+       * added.
+       */
+      PrimitiveList primitives() const;
+
+      /**
+       * @return The selected primitives of @p type.
+       */
+      QList<Primitive *> subList(Primitive::Type type) const;
+
+      /**
+       * @return The bit array of @p type, with the bits of the ids of the
+       * selected primitives set. It may be shorter than the largest id.
+       */
+      QBitArray bits(Primitive::Type type) const;
+
+      int count() const;
+      int count(Primitive::Type type) const;
+      bool isEmpty() const;
+
+    private:
+      SelectionPrivate * const d;
+  };
+
+  inline Selection operator|(const Selection &a, const Selection &b)
+  {
+    Selection result(a);
+    return result |= b;
+  }
+
+  inline Selection operator&(const Selection &a, const Selection &b)
+  {
+    Selection result(a);
+    return result &= b;
+  }
+
+  inline Selection operator-(const Selection &a, const Selection &b)
+  {
+    Selection result(a);
+    return result -= b;
+  }
+
+} // End namespace Avogadro
+
+#endif
@@ -93,6 +93,12 @@ namespace Avogadro {
     glPopMatrix();
   }
 
+  int Sphere::vertexCount() const
+  {
+    if( d->detail <= 0 ) return 12; // two triangle fans of six vertices
+    return ( 2 * ( 2 * d->detail + 1 ) + 2 ) * 5 * d->detail;
+  }
+
   void Sphere::initialize()
   {
     if( d->detail < 0 ) return;
@@ -79,6 +79,9 @@ namespace Avogadro {
       /** draws the sphere at specified position and with
        * specified radius */
       void draw( const Eigen::Vector3d &center, double radius ) const;
+
+      /** @return the number of vertices sent to OpenGL by draw() */
+      int vertexCount() const;
   };
 
 }
@@ -0,0 +1,327 @@
+/**********************************************************************
+  Superposition - Optimal superposition and RMSD of coordinate sets
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "superposition.h"
+
+#include <avogadro/molecule.h>
+#include <avogadro/atom.h>
+
+#include <Eigen/Geometry>
+#include <Eigen/QR>
+
+#include <QReadWriteLock>
+#include <QtCore/QtConcurrentMap>
+
+#include <cmath>
+#include <vector>
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  /**
+   * Accumulate the correlation matrix sum(a b^T) of two centered sets.
+   * Nine independent accumulators over the packed arrays, which the
+   * compiler keeps in registers and vectorizes.
+   */
+  static void correlation(const double *a, const double *b, int n,
+                          double *S)
+  {
+    double sxx = 0.0, sxy = 0.0, sxz = 0.0;
+    double syx = 0.0, syy = 0.0, syz = 0.0;
+    double szx = 0.0, szy = 0.0, szz = 0.0;
+    for (int i = 0; i < 3 * n; i += 3) {
+      const double ax = a[i], ay = a[i+1], az = a[i+2];
+      const double bx = b[i], by = b[i+1], bz = b[i+2];
+      sxx += ax * bx; sxy += ax * by; sxz += ax * bz;
+      syx += ay * bx; syy += ay * by; syz += ay * bz;
+      szx += az * bx; szy += az * by; szz += az * bz;
+    }
+    S[0] = sxx; S[1] = sxy; S[2] = sxz;
+    S[3] = syx; S[4] = syy; S[5] = syz;
+    S[6] = szx; S[7] = szy; S[8] = szz;
+  }
+
+  /**
+   * Largest eigenvalue of the key matrix of @p S by Newton iteration on the
+   * characteristic polynomial, starting from the upper bound @p E0.
+   */
+  static double largestEigenvalue(const double *S, double E0)
+  {
+    const double Sxx = S[0], Sxy = S[1], Sxz = S[2];
+    const double Syx = S[3], Syy = S[4], Syz = S[5];
+    const double Szx = S[6], Szy = S[7], Szz = S[8];
+
+    const double Sxx2 = Sxx * Sxx, Syy2 = Syy * Syy, Szz2 = Szz * Szz;
+    const double Sxy2 = Sxy * Sxy, Syz2 = Syz * Syz, Sxz2 = Sxz * Sxz;
+    const double Syx2 = Syx * Syx, Szy2 = Szy * Szy, Szx2 = Szx * Szx;
+
+    const double SyzSzymSyySzz2 = 2.0 * (Syz * Szy - Syy * Szz);
+    const double Sxx2Syy2Szz2Syz2Szy2 = Syy2 + Szz2 - Sxx2 + Syz2 + Szy2;
+
+    const double c2 = -2.0 * (Sxx2 + Syy2 + Szz2 + Sxy2 + Syx2 + Sxz2
+                              + Szx2 + Syz2 + Szy2);
+    const double c1 = 8.0 * (Sxx * Syz * Szy + Syy * Szx * Sxz + Szz * Sxy * Syx
+                             - Sxx * Syy * Szz - Syz * Szx * Sxy - Szy * Syx * Sxz);
+
+    const double SxzpSzx = Sxz + Szx, SyzpSzy = Syz + Szy, SxypSyx = Sxy + Syx;
+    const double SyzmSzy = Syz - Szy, SxzmSzx = Sxz - Szx, SxymSyx = Sxy - Syx;
+    const double SxxpSyy = Sxx + Syy, SxxmSyy = Sxx - Syy;
+    const double Sxy2Sxz2Syx2Szx2 = Sxy2 + Sxz2 - Syx2 - Szx2;
+
+    const double c0 = Sxy2Sxz2Syx2Szx2 * Sxy2Sxz2Syx2Szx2
+      + (Sxx2Syy2Szz2Syz2Szy2 + SyzSzymSyySzz2) * (Sxx2Syy2Szz2Syz2Szy2 - SyzSzymSyySzz2)
+      + (-SxzpSzx * SyzmSzy + SxymSyx * (SxxmSyy - Szz))
+        * (-SxzmSzx * SyzpSzy + SxymSyx * (SxxmSyy + Szz))
+      + (-SxzpSzx * SyzpSzy - SxypSyx * (SxxpSyy - Szz))
+        * (-SxzmSzx * SyzmSzy - SxypSyx * (SxxpSyy + Szz))
+      + (SxypSyx * SyzpSzy + SxzpSzx * (SxxmSyy + Szz))
+        * (-SxymSyx * SyzmSzy + SxzpSzx * (SxxpSyy + Szz))
+      + (SxypSyx * SyzmSzy + SxzmSzx * (SxxmSyy - Szz))
+        * (-SxymSyx * SyzpSzy + SxzmSzx * (SxxpSyy - Szz));
+
+    double lambda = E0;
+    for (int i = 0; i < 50; ++i) {
+      const double previous = lambda;
+      const double x2 = lambda * lambda;
+      const double b = (x2 + c2) * lambda;
+      const double a = b + c1;
+      const double denominator = 2.0 * x2 * lambda + b + a;
+      if (denominator == 0.0)
+        break;
+      lambda -= (a * lambda + c0) / denominator;
+      if (fabs(lambda - previous) < fabs(1.0e-11 * lambda))
+        break;
+    }
+    return lambda;
+  }
+
+  Vector3d Superposition::center(double *coordinates, int n)
+  {
+    Vector3d centroid = Vector3d::Zero();
+    if (n <= 0)
+      return centroid;
+    for (int i = 0; i < 3 * n; i += 3)
+      centroid += Vector3d(coordinates + i);
+    centroid /= n;
+    for (int i = 0; i < 3 * n; i += 3) {
+      coordinates[i] -= centroid.x();
+      coordinates[i+1] -= centroid.y();
+      coordinates[i+2] -= centroid.z();
+    }
+    return centroid;
+  }
+
+  double Superposition::innerProduct(const double *coordinates, int n)
+  {
+    double g = 0.0;
+    for (int i = 0; i < 3 * n; ++i)
+      g += coordinates[i] * coordinates[i];
+    return g;
+  }
+
+  double Superposition::centeredRmsd(const double *a, const double *b, int n,
+                                     double innerA, double innerB)
+  {
+    if (n <= 0)
+      return 0.0;
+    double S[9];
+    correlation(a, b, n, S);
+    const double E0 = 0.5 * (innerA + innerB);
+    const double lambda = largestEigenvalue(S, E0);
+    const double r2 = 2.0 * (E0 - lambda) / n;
+    return r2 > 0.0 ? sqrt(r2) : 0.0;
+  }
+
+  double Superposition::rmsd(const double *a, const double *b, int n)
+  {
+    if (n <= 0)
+      return 0.0;
+    Vector3d ca = Vector3d::Zero(), cb = Vector3d::Zero();
+    for (int i = 0; i < 3 * n; i += 3) {
+      ca += Vector3d(a + i);
+      cb += Vector3d(b + i);
+    }
+    ca /= n;
+    cb /= n;
+
+    // Correlation and inner products about the centroids in one pass
+    Matrix3d M = Matrix3d::Zero();
+    double ga = 0.0, gb = 0.0;
+    for (int i = 0; i < 3 * n; i += 3) {
+      Vector3d p = Vector3d(a + i) - ca;
+      Vector3d q = Vector3d(b + i) - cb;
+      M += p * q.transpose();
+      ga += p.squaredNorm();
+      gb += q.squaredNorm();
+    }
+    double S[9];
+    for (int r = 0; r < 3; ++r)
+      for (int c = 0; c < 3; ++c)
+        S[3*r + c] = M(r, c);
+
+    const double E0 = 0.5 * (ga + gb);
+    const double r2 = 2.0 * (E0 - largestEigenvalue(S, E0)) / n;
+    return r2 > 0.0 ? sqrt(r2) : 0.0;
+  }
+
+  double Superposition::fit(const double *a, const double *b, int n,
+                            Matrix3d &rotation, Vector3d &translation)
+  {
+    rotation = Matrix3d::Identity();
+    translation = Vector3d::Zero();
+    if (n <= 0)
+      return 0.0;
+
+    Vector3d ca = Vector3d::Zero(), cb = Vector3d::Zero();
+    for (int i = 0; i < 3 * n; i += 3) {
+      ca += Vector3d(a + i);
+      cb += Vector3d(b + i);
+    }
+    ca /= n;
+    cb /= n;
+
+    Matrix3d M = Matrix3d::Zero();
+    double ga = 0.0, gb = 0.0;
+    for (int i = 0; i < 3 * n; i += 3) {
+      Vector3d p = Vector3d(a + i) - ca;
+      Vector3d q = Vector3d(b + i) - cb;
+      M += p * q.transpose();
+      ga += p.squaredNorm();
+      gb += q.squaredNorm();
+    }
+
+    // The eigenvector of the largest eigenvalue of Horn's key matrix is the
+    // quaternion of the best rotation
+    Matrix4d N;
+    N(0,0) = M(0,0) + M(1,1) + M(2,2);
+    N(1,1) = M(0,0) - M(1,1) - M(2,2);
+    N(2,2) = -M(0,0) + M(1,1) - M(2,2);
+    N(3,3) = -M(0,0) - M(1,1) + M(2,2);
+    N(0,1) = N(1,0) = M(1,2) - M(2,1);
+    N(0,2) = N(2,0) = M(2,0) - M(0,2);
+    N(0,3) = N(3,0) = M(0,1) - M(1,0);
+    N(1,2) = N(2,1) = M(0,1) + M(1,0);
+    N(1,3) = N(3,1) = M(2,0) + M(0,2);
+    N(2,3) = N(3,2) = M(1,2) + M(2,1);
+
+    SelfAdjointEigenSolver<Matrix4d> solver(N);
+    int largest = 0;
+    for (int k = 1; k < 4; ++k)
+      if (solver.eigenvalues()[k] > solver.eigenvalues()[largest])
+        largest = k;
+    Vector4d q = solver.eigenvectors().col(largest);
+    rotation = Quaternion<double>(q[0], q[1], q[2], q[3]).toRotationMatrix();
+    translation = cb - rotation * ca;
+
+    const double r2 = (ga + gb - 2.0 * solver.eigenvalues()[largest]) / n;
+    return r2 > 0.0 ? sqrt(r2) : 0.0;
+  }
+
+  /**
+   * One conformer to superpose on the packed fit atoms of the reference.
+   */
+  struct ConformerFit
+  {
+    std::vector<Vector3d> *conformer;
+    const QVector<unsigned long> *fitIds;
+    const QVector<unsigned long> *ids;     // every atom, moved by the fit
+    const double *reference;
+    double rmsd;
+  };
+
+  static void fitConformer(ConformerFit &job)
+  {
+    std::vector<Vector3d> &conformer = *job.conformer;
+    const QVector<unsigned long> &fitIds = *job.fitIds;
+    const int n = fitIds.size();
+    QVector<double> fit(3 * n);
+    for (int k = 0; k < n; ++k) {
+      const Vector3d &pos = conformer[fitIds[k]];
+      fit[3*k] = pos.x();
+      fit[3*k+1] = pos.y();
+      fit[3*k+2] = pos.z();
+    }
+
+    Matrix3d rotation;
+    Vector3d translation;
+    job.rmsd = Superposition::fit(fit.constData(), job.reference, n,
+                                  rotation, translation);
+    foreach (unsigned long id, *job.ids)
+      conformer[id] = rotation * conformer[id] + translation;
+  }
+
+  QVector<double> Superposition::alignConformers(Molecule *molecule,
+                                                 const QList<int> &fitAtoms,
+                                                 int reference)
+  {
+    QVector<double> rmsds;
+    if (!molecule)
+      return rmsds;
+    const std::vector<std::vector<Vector3d> *> &conformers = molecule->conformers();
+    const int numAtoms = molecule->numAtoms();
+    if (reference < 0 || reference >= static_cast<int>(conformers.size()) || !numAtoms)
+      return rmsds;
+
+    QVector<unsigned long> ids, fitIds;
+    foreach (Atom *atom, molecule->atoms())
+      ids.append(atom->id());
+    if (fitAtoms.isEmpty())
+      fitIds = ids;
+    foreach (int index, fitAtoms) {
+      if (index < 0 || index >= numAtoms)
+        return rmsds;
+      fitIds.append(ids[index]);
+    }
+
+    // A copy, the reference conformer is fitted along with the others
+    const std::vector<Vector3d> &target = *conformers[reference];
+    QVector<double> packed(3 * fitIds.size());
+    for (int k = 0; k < fitIds.size(); ++k) {
+      const Vector3d &pos = target[fitIds[k]];
+      packed[3*k] = pos.x();
+      packed[3*k+1] = pos.y();
+      packed[3*k+2] = pos.z();
+    }
+
+    QVector<ConformerFit> jobs(conformers.size());
+    for (int i = 0; i < jobs.size(); ++i) {
+      jobs[i].conformer = conformers[i];
+      jobs[i].fitIds = &fitIds;
+      jobs[i].ids = &ids;
+      jobs[i].reference = packed.constData();
+      jobs[i].rmsd = 0.0;
+    }
+    molecule->lock()->lockForWrite();
+    QtConcurrent::blockingMap(jobs, fitConformer);
+    molecule->lock()->unlock();
+
+    rmsds.resize(jobs.size());
+    for (int i = 0; i < jobs.size(); ++i)
+      rmsds[i] = jobs[i].rmsd;
+    molecule->update();
+    return rmsds;
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,112 @@
+/**********************************************************************
+  Superposition - Optimal superposition and RMSD of coordinate sets
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef SUPERPOSITION_H
+#define SUPERPOSITION_H
+
+#include <avogadro/global.h>
+
+#include <Eigen/Core>
+
+#include <QList>
+#include <QVector>
+
+namespace Avogadro {
+
+  class Molecule;
+
+  /**
+   * @class Superposition superposition.h <avogadro/superposition.h>
+   * @brief RMSD after optimal superposition of two coordinate sets.
+   *
+   * Coordinates are flat arrays of x, y, z for @p n atoms, paired by their
+   * position in the arrays.
+   *
+   * The RMSD is found with the quaternion characteristic polynomial (QCP)
+   * method of Theobald (Acta Cryst. 2005, A61, 478) and Liu et al.
+   * (J. Comput. Chem. 2010, 31, 1561): the largest eigenvalue of the 4x4
+   * key matrix is found by Newton iteration on its characteristic polynomial,
+   * so no rotation or eigen decomposition is needed. The only O(n) work is
+   * one pass accumulating the correlation matrix. When the same set takes
+   * part in many comparisons, center it once with center() and keep its
+   * innerProduct() so that centeredRmsd() does just that pass.
+   *
+   * fit() also returns the rotation and translation (Kabsch), for aligning
+   * structures rather than only comparing them, and alignConformers() fits
+   * all conformers of a molecule at once.
+   */
+  class A_EXPORT Superposition
+  {
+  public:
+    /**
+     * Move the centroid of @p coordinates to the origin.
+     * @return The centroid that was subtracted.
+     */
+    static Eigen::Vector3d center(double *coordinates, int n);
+
+    /**
+     * @return The sum of the squared coordinates, the inner product used
+     * by centeredRmsd().
+     */
+    static double innerProduct(const double *coordinates, int n);
+
+    /**
+     * @return The RMSD of the centered sets @p a and @p b after the best
+     * rotation, given their inner products @p innerA and @p innerB.
+     */
+    static double centeredRmsd(const double *a, const double *b, int n,
+                               double innerA, double innerB);
+
+    /**
+     * @return The RMSD of @p a and @p b after the best rotation and
+     * translation. The input is not modified.
+     */
+    static double rmsd(const double *a, const double *b, int n);
+
+    /**
+     * Find the rotation and translation that put @p a onto @p b, so that
+     * rotation * a + translation is closest to b.
+     * @return The RMSD after the fit.
+     */
+    static double fit(const double *a, const double *b, int n,
+                      Eigen::Matrix3d &rotation,
+                      Eigen::Vector3d &translation);
+
+    /**
+     * Superpose every conformer of @p molecule on conformer @p reference,
+     * fitting the atoms with the indices @p fitAtoms, or all atoms if it is
+     * empty. All atoms of a conformer are moved, in place and with the
+     * conformers spread over all cores under the write lock of the
+     * molecule, which is updated once at the end.
+     * @return The RMSD over the fit atoms of each conformer after the fit,
+     * empty if an index is out of range.
+     */
+    static QVector<double> alignConformers(Molecule *molecule,
+                                           const QList<int> &fitAtoms = QList<int>(),
+                                           int reference = 0);
+  };
+
+} // End namespace Avogadro
+
+#endif
@@ -30,9 +30,17 @@
 
 #include <QPainter>
 #include <QHash>
+#include <QList>
 #include <QDebug>
 
+#include <cstring>
+
 #define OUTLINE_WIDTH     3
+// Batched labels use one texture atlas, grown up to this size when needed
+#define GLYPH_ATLAS_INITIAL_SIZE 512
+#define GLYPH_ATLAS_MAX_SIZE     2048
+// Number of laid out label batches kept around, e.g. atom and bond labels
+#define LABEL_BATCH_CACHE_SIZE   4
 const int OUTLINE_BRUSH[2*OUTLINE_WIDTH+1][2*OUTLINE_WIDTH+1]
 = { { 10, 30,  45,  50,  45,  30,  10 },
   { 30, 65,  85,  100,  85, 65,  30 },
@@ -140,21 +148,18 @@ namespace Avogadro {
     }
   }
 
-  bool CharRenderer::initialize( QChar c, const QFont &font, GLenum textureTarget )
+  /** @internal
+   * Renders the character @p c using @p font into two alpha bitmaps of
+   * texwidth * texheight pixels, stored bottom row first as OpenGL expects:
+   * the glyph itself and its outline. This is shared by CharRenderer and
+   * GlyphAtlas.
+   */
+  static bool rasterizeChar( QChar c, const QFont &font, int realheight,
+      int texwidth, int texheight,
+      GLubyte *glyphbitmap, GLubyte *outlinebitmap )
   {
-    if( m_quadDisplayList ) return true;
-    m_textureTarget = textureTarget;
     // *** STEP 1 : render the character to a QImage ***
 
-    // compute the size of the image to create
-    const QFontMetrics fontMetrics ( font );
-    m_realwidth = fontMetrics.width(c);
-    m_realheight = fontMetrics.height();
-    if(m_realwidth == 0 || m_realheight == 0) return false;
-    int texwidth  =  m_realwidth + 2 * OUTLINE_WIDTH;
-    int texheight = m_realheight + 2 * OUTLINE_WIDTH;
-    normalizeTexSize(textureTarget, texwidth, texheight);
-
     // create a new image
     QImage image( texwidth, texheight, QImage::Format_RGB32 );
     QPainter painter;
@@ -169,7 +174,7 @@ namespace Avogadro {
     // actually paint the character. The position seems right at least with Helvetica
     // at various sizes, I didn't try other fonts. If in the future a user complains about
     // the text being clamped to the top/bottom, change this line.
-    painter.drawText ( 1, m_realheight
+    painter.drawText ( 1, realheight
         + 2 * OUTLINE_WIDTH
         - painter.fontMetrics().descent(),
         c );
@@ -243,11 +248,6 @@ namespace Avogadro {
     //     the rawbitmap readily gives the luminance channel, while the computation of the
     //     alpha channel is a bit more involved and uses the neighborhood map.
 
-    GLubyte *glyphbitmap = new GLubyte[ texwidth * texheight ];
-    if( ! glyphbitmap ) return false;
-    GLubyte *outlinebitmap = new GLubyte[ texwidth * texheight ];
-    if( ! outlinebitmap ) return false;
-
     for( int n = 0; n < texwidth * texheight; n++ )
     {
       glyphbitmap[n] = static_cast<GLubyte>(rawbitmap[n]);
@@ -261,6 +261,36 @@ namespace Avogadro {
     delete [] rawbitmap;
     delete [] neighborhood;
 
+    return true;
+  }
+
+  bool CharRenderer::initialize( QChar c, const QFont &font, GLenum textureTarget )
+  {
+    if( m_quadDisplayList ) return true;
+    m_textureTarget = textureTarget;
+
+    // compute the size of the image to create
+    const QFontMetrics fontMetrics ( font );
+    m_realwidth = fontMetrics.width(c);
+    m_realheight = fontMetrics.height();
+    if(m_realwidth == 0 || m_realheight == 0) return false;
+    int texwidth  =  m_realwidth + 2 * OUTLINE_WIDTH;
+    int texheight = m_realheight + 2 * OUTLINE_WIDTH;
+    normalizeTexSize(textureTarget, texwidth, texheight);
+
+    GLubyte *glyphbitmap = new GLubyte[ texwidth * texheight ];
+    if( ! glyphbitmap ) return false;
+    GLubyte *outlinebitmap = new GLubyte[ texwidth * texheight ];
+    if( ! outlinebitmap ) return false;
+
+    if( ! rasterizeChar( c, font, m_realheight, texwidth, texheight,
+          glyphbitmap, outlinebitmap ) )
+    {
+      delete [] glyphbitmap;
+      delete [] outlinebitmap;
+      return false;
+    }
+
     // *** STEP 5 : pass the final bitmap to OpenGL for texturing ***
 
     glGenTextures( 1, &m_glyphTexture );
@@ -329,6 +359,195 @@ namespace Avogadro {
     return true;
   }
 
+  /** @internal
+   * This is a helper class for TextRenderer::drawBatch().
+   *
+   * The GlyphAtlas class packs the glyph and outline bitmaps of every
+   * character used by batched labels into one power-of-two texture, so a
+   * whole batch of labels can be drawn with a single texture bound. Glyphs
+   * are packed row by row and never move once inserted. When the texture is
+   * full it is cleared (and grown if possible) and the generation counter is
+   * incremented so cached layouts know their texture coordinates are stale.
+   */
+  class GlyphAtlas
+  {
+    public:
+      struct Glyph
+      {
+        /** Texture coordinates (s0, t0, s1, t1) of the glyph and outline cells */
+        GLfloat glyph[4];
+        GLfloat outline[4];
+        /** Width in pixels of the rendered character (the pen advance) */
+        int advance;
+        /** Size in pixels of each of the two cells, 0 for invisible glyphs */
+        int texwidth, texheight;
+      };
+
+      GlyphAtlas() : texture(0), size(0), generation(0),
+                     penX(0), penY(0), rowHeight(0) {}
+      ~GlyphAtlas()
+      {
+        if( texture ) glDeleteTextures( 1, &texture );
+      }
+
+      /**
+       * Make sure the character @p c is present in the atlas.
+       * @returns false if the atlas had to be cleared to make room, in which
+       * case all glyphs inserted earlier have to be inserted again.
+       */
+      bool insert( QChar c, const QFont &font );
+
+      GLuint texture;
+      int size;
+      int generation;
+      QHash<QChar, Glyph> glyphs;
+
+    private:
+      int penX, penY, rowHeight;
+
+      void reset( int newSize );
+      bool allocate( int w, int h, int &x, int &y );
+  };
+
+  void GlyphAtlas::reset( int newSize )
+  {
+    glyphs.clear();
+    penX = penY = rowHeight = 0;
+    size = newSize;
+    ++generation;
+
+    if( ! texture ) glGenTextures( 1, &texture );
+    QVector<GLubyte> blank( size * size, 0 );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glBindTexture( GL_TEXTURE_2D, texture );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_ALPHA, size, size, 0,
+        GL_ALPHA, GL_UNSIGNED_BYTE, blank.constData() );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+  }
+
+  bool GlyphAtlas::allocate( int w, int h, int &x, int &y )
+  {
+    // simple shelf packing: fill rows from left to right, bottom to top
+    if( penX + w > size ) {
+      penX = 0;
+      penY += rowHeight;
+      rowHeight = 0;
+    }
+    if( w > size || penY + h > size ) return false;
+    x = penX;
+    y = penY;
+    penX += w;
+    rowHeight = qMax( rowHeight, h );
+    return true;
+  }
+
+  bool GlyphAtlas::insert( QChar c, const QFont &font )
+  {
+    if( glyphs.contains( c ) ) return true;
+    if( ! texture ) reset( GLYPH_ATLAS_INITIAL_SIZE );
+
+    const QFontMetrics fontMetrics ( font );
+    Glyph g;
+    g.advance = fontMetrics.width( c );
+    int realheight = fontMetrics.height();
+    g.texwidth = g.advance + 2 * OUTLINE_WIDTH;
+    g.texheight = realheight + 2 * OUTLINE_WIDTH;
+    for( int i = 0; i < 4; ++i )
+      g.glyph[i] = g.outline[i] = 0.0f;
+
+    if( g.advance == 0 || realheight == 0 ) {
+      // nothing to draw, but still advance the pen correctly
+      g.texwidth = g.texheight = 0;
+      glyphs.insert( c, g );
+      return true;
+    }
+
+    // the glyph and its outline are stored side by side
+    bool complete = true;
+    int x, y;
+    if( ! allocate( 2 * g.texwidth, g.texheight, x, y ) ) {
+      GLint maxSize;
+      glGetIntegerv( GL_MAX_TEXTURE_SIZE, &maxSize );
+      int newSize = size < qMin( maxSize, GLYPH_ATLAS_MAX_SIZE ) ? 2 * size : size;
+      reset( newSize );
+      complete = false;
+      if( ! allocate( 2 * g.texwidth, g.texheight, x, y ) ) {
+        g.texwidth = g.texheight = 0;
+        glyphs.insert( c, g );
+        return complete;
+      }
+    }
+
+    GLubyte *glyphbitmap = new GLubyte[ g.texwidth * g.texheight ];
+    GLubyte *outlinebitmap = new GLubyte[ g.texwidth * g.texheight ];
+    if( ! rasterizeChar( c, font, realheight, g.texwidth, g.texheight,
+          glyphbitmap, outlinebitmap ) )
+      g.texwidth = g.texheight = 0;
+    else {
+      glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+      glBindTexture( GL_TEXTURE_2D, texture );
+      glTexSubImage2D( GL_TEXTURE_2D, 0, x, y, g.texwidth, g.texheight,
+          GL_ALPHA, GL_UNSIGNED_BYTE, glyphbitmap );
+      glTexSubImage2D( GL_TEXTURE_2D, 0, x + g.texwidth, y, g.texwidth, g.texheight,
+          GL_ALPHA, GL_UNSIGNED_BYTE, outlinebitmap );
+
+      const GLfloat scale = 1.0f / size;
+      g.glyph[0] = x * scale;
+      g.glyph[1] = y * scale;
+      g.glyph[2] = (x + g.texwidth) * scale;
+      g.glyph[3] = (y + g.texheight) * scale;
+      g.outline[0] = (x + g.texwidth) * scale;
+      g.outline[1] = y * scale;
+      g.outline[2] = (x + 2 * g.texwidth) * scale;
+      g.outline[3] = (y + g.texheight) * scale;
+    }
+    delete [] glyphbitmap;
+    delete [] outlinebitmap;
+
+    glyphs.insert( c, g );
+    return complete;
+  }
+
+  /** @internal
+   * A laid out batch of labels, ready to be drawn with one glDrawArrays()
+   * call. Everything the layout depends upon is stored alongside so that the
+   * batch can be reused as long as nothing changed.
+   */
+  struct LabelBatch
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    QVector<Eigen::Vector3d> positions;
+    QVector<QString> strings;
+    bool cullOverlaps;
+    Eigen::Matrix4d mvp;
+    int width, height;
+    GLfloat color[4];
+    int atlasGeneration;
+
+    QVector<GLfloat> vertices;  // 3 per vertex
+    QVector<GLfloat> texCoords; // 2 per vertex
+    QVector<GLfloat> colors;    // 4 per vertex
+    int labels;
+  };
+
+  /** @internal
+   * A label which survived view frustum culling, in window coordinates.
+   */
+  struct LabelPlacement
+  {
+    int index;
+    double depth;
+    int left, top, width;
+  };
+
+  static bool placementLessThan( const LabelPlacement &lhs,
+      const LabelPlacement &rhs )
+  {
+    return lhs.depth < rhs.depth;
+  }
+
   class TextRendererPrivate
   {
     public:
@@ -351,6 +570,16 @@ namespace Avogadro {
        */
       QHash<QChar, CharRenderer*> charTable;
 
+      /**
+       * The texture atlas holding the glyphs used by drawBatch().
+       */
+      GlyphAtlas atlas;
+
+      /**
+       * The most recently drawn label batches, most recent first.
+       */
+      QList<LabelBatch *> batches;
+
       /**
        * The GLWidget in which to render. This is set
        * once and for all by setup().
@@ -365,6 +594,12 @@ namespace Avogadro {
 
       static int isGLExtensionSupported(const char *extension);
       void do_draw(const QString &string);
+
+      LabelBatch * cachedBatch( const QVector<Eigen::Vector3d> &positions,
+          const QVector<QString> &strings, bool cullOverlaps,
+          const Eigen::Matrix4d &mvp, int width, int height,
+          const GLfloat *color );
+      void layoutBatch( LabelBatch *batch );
   };
 
   TextRenderer::TextRenderer() : d(new TextRendererPrivate)
@@ -381,6 +616,7 @@ namespace Avogadro {
       delete i.value();
       i = d->charTable.erase(i);
     }
+    qDeleteAll(d->batches);
     delete d;
   }
 
@@ -567,6 +803,226 @@ namespace Avogadro {
     return h;
   }
 
+  LabelBatch * TextRendererPrivate::cachedBatch(
+      const QVector<Eigen::Vector3d> &positions,
+      const QVector<QString> &strings, bool cullOverlaps,
+      const Eigen::Matrix4d &mvp, int width, int height,
+      const GLfloat *color )
+  {
+    for( int i = 0; i < batches.size(); ++i ) {
+      LabelBatch *batch = batches[i];
+      if( batch->atlasGeneration != atlas.generation
+          || batch->cullOverlaps != cullOverlaps
+          || batch->width != width || batch->height != height
+          || batch->positions.size() != positions.size()
+          || memcmp( batch->color, color, 4 * sizeof(GLfloat) ) != 0
+          || memcmp( batch->mvp.data(), mvp.data(), 16 * sizeof(double) ) != 0 )
+        continue;
+      // cheap when the caller did not touch its vectors, they are shared
+      if( batch->positions.constData() != positions.constData()
+          && memcmp( batch->positions.constData(), positions.constData(),
+            positions.size() * sizeof(Eigen::Vector3d) ) != 0 )
+        continue;
+      if( batch->strings != strings )
+        continue;
+      // move to the front, it is the most recently used one
+      batches.move( i, 0 );
+      return batch;
+    }
+    return 0;
+  }
+
+  void TextRendererPrivate::layoutBatch( LabelBatch *batch )
+  {
+    const QVector<QString> &strings = batch->strings;
+    const QVector<Eigen::Vector3d> &positions = batch->positions;
+    const Eigen::Matrix4d &mvp = batch->mvp;
+    const int count = qMin( positions.size(), strings.size() );
+
+    // Pass 1: cache the glyphs that are not yet in the atlas. If the atlas
+    // had to be cleared on the way, the glyphs inserted before are gone and
+    // we go through the labels again.
+    for( int attempt = 0; attempt < 2; ++attempt ) {
+      bool complete = true;
+      for( int i = 0; i < count; ++i ) {
+        const QString &string = strings[i];
+        for( int j = 0; j < string.size(); ++j )
+          if( ! atlas.insert( string[j], font ) ) complete = false;
+      }
+      if( complete ) break;
+    }
+    batch->atlasGeneration = atlas.generation;
+
+    // Pass 2: project the labels and drop those outside of the view
+    const QFontMetrics fontMetrics ( font );
+    const int h = fontMetrics.height();
+    QVector<LabelPlacement> placements;
+    placements.reserve( count );
+    for( int i = 0; i < count; ++i ) {
+      const QString &string = strings[i];
+      if( string.isEmpty() ) continue;
+      const Eigen::Vector3d &p = positions[i];
+      double clip[4];
+      for( int r = 0; r < 4; ++r )
+        clip[r] = mvp(r, 0) * p.x() + mvp(r, 1) * p.y()
+          + mvp(r, 2) * p.z() + mvp(r, 3);
+      if( clip[3] <= 0.0 ) continue;
+      double z = clip[2] / clip[3];
+      if( z < -1.0 || z > 1.0 ) continue;
+
+      LabelPlacement placement;
+      placement.index = i;
+      placement.depth = 0.5 * ( z + 1.0 );
+      placement.width = 0;
+      for( int j = 0; j < string.size(); ++j )
+        placement.width += atlas.glyphs.value( string[j] ).advance;
+      // window coordinates, OpenGL convention: (0, 0) is the bottom-left corner
+      double x = 0.5 * ( clip[0] / clip[3] + 1.0 ) * batch->width;
+      double y = 0.5 * ( clip[1] / clip[3] + 1.0 ) * batch->height;
+      placement.left = static_cast<int>( x - placement.width / 2 );
+      placement.top = static_cast<int>( y + h / 2 );
+      if( placement.left > batch->width || placement.left + placement.width < 0
+          || placement.top - h > batch->height || placement.top < 0 )
+        continue;
+      placements.push_back( placement );
+    }
+
+    // Pass 3: keep the closest label when several of them overlap, so that
+    // dense label fields stay readable. Accepted labels are binned in a
+    // coarse screen space grid so each test only looks at its neighbors.
+    if( batch->cullOverlaps && placements.size() > 1 ) {
+      qSort( placements.begin(), placements.end(), placementLessThan );
+      const int cell = qMax( h, 8 );
+      const int gridWidth = batch->width / cell + 1;
+      const int gridHeight = batch->height / cell + 1;
+      QVector< QVector<int> > grid( gridWidth * gridHeight );
+      QVector<LabelPlacement> accepted;
+      accepted.reserve( placements.size() );
+      foreach( const LabelPlacement &placement, placements ) {
+        int x0 = qBound( 0, placement.left / cell, gridWidth - 1 );
+        int x1 = qBound( 0, ( placement.left + placement.width ) / cell, gridWidth - 1 );
+        int y0 = qBound( 0, ( placement.top - h ) / cell, gridHeight - 1 );
+        int y1 = qBound( 0, placement.top / cell, gridHeight - 1 );
+        bool overlaps = false;
+        for( int gy = y0; gy <= y1 && !overlaps; ++gy ) {
+          for( int gx = x0; gx <= x1 && !overlaps; ++gx ) {
+            foreach( int k, grid[gx + gy * gridWidth] ) {
+              const LabelPlacement &other = accepted[k];
+              if( placement.left < other.left + other.width
+                  && other.left < placement.left + placement.width
+                  && placement.top - h < other.top
+                  && other.top - h < placement.top ) {
+                overlaps = true;
+                break;
+              }
+            }
+          }
+        }
+        if( overlaps ) continue;
+        for( int gy = y0; gy <= y1; ++gy )
+          for( int gx = x0; gx <= x1; ++gx )
+            grid[gx + gy * gridWidth].push_back( accepted.size() );
+        accepted.push_back( placement );
+      }
+      placements = accepted;
+    }
+    batch->labels = placements.size();
+
+    // Pass 4: fill the vertex arrays, all the outlines first and then all
+    // the glyphs on top of them, just like do_draw() does for one string
+    batch->vertices.clear();
+    batch->texCoords.clear();
+    batch->colors.clear();
+    for( int pass = 0; pass < 2; ++pass ) {
+      const GLfloat black[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+      const GLfloat *color = pass ? batch->color : black;
+      foreach( const LabelPlacement &placement, placements ) {
+        const QString &string = strings[placement.index];
+        GLfloat pen = placement.left;
+        GLfloat z = -placement.depth;
+        GLfloat top = placement.top;
+        for( int j = 0; j < string.size(); ++j ) {
+          const GlyphAtlas::Glyph g = atlas.glyphs.value( string[j] );
+          if( g.texwidth ) {
+            const GLfloat *tex = pass ? g.glyph : g.outline;
+            GLfloat quad[4][5] = {
+              { pen,              top - g.texheight, z, tex[0], tex[1] },
+              { pen + g.texwidth, top - g.texheight, z, tex[2], tex[1] },
+              { pen + g.texwidth, top,               z, tex[2], tex[3] },
+              { pen,              top,               z, tex[0], tex[3] } };
+            for( int v = 0; v < 4; ++v ) {
+              batch->vertices << quad[v][0] << quad[v][1] << quad[v][2];
+              batch->texCoords << quad[v][3] << quad[v][4];
+              batch->colors << color[0] << color[1] << color[2] << color[3];
+            }
+          }
+          pen += g.advance;
+        }
+      }
+    }
+  }
+
+  int TextRenderer::drawBatch( const QVector<Eigen::Vector3d> &positions,
+                               const QVector<QString> &strings,
+                               bool cullOverlaps )
+  {
+    assert(d->textmode);
+    if( positions.isEmpty() || strings.isEmpty() ) return 0;
+
+    GLfloat color[4];
+    glGetFloatv(GL_CURRENT_COLOR, color);
+
+    const Camera *camera = d->glwidget->camera();
+    Eigen::Matrix4d mvp = camera->projection().matrix()
+      * camera->modelview().matrix();
+    int width = d->glwidget->width();
+    int height = d->glwidget->height();
+
+    LabelBatch *batch = d->cachedBatch( positions, strings, cullOverlaps,
+        mvp, width, height, color );
+    if( ! batch ) {
+      if( d->batches.size() < LABEL_BATCH_CACHE_SIZE )
+        batch = new LabelBatch;
+      else
+        batch = d->batches.takeLast();
+      d->batches.prepend( batch );
+      batch->positions = positions;
+      batch->strings = strings;
+      batch->cullOverlaps = cullOverlaps;
+      batch->mvp = mvp;
+      batch->width = width;
+      batch->height = height;
+      memcpy( batch->color, color, 4 * sizeof(GLfloat) );
+      d->layoutBatch( batch );
+    }
+
+    if( ! batch->vertices.isEmpty() ) {
+      // begin() enabled the texture target used by the per-character path
+      glDisable( d->textureTarget );
+      glEnable( GL_TEXTURE_2D );
+      glBindTexture( GL_TEXTURE_2D, d->atlas.texture );
+
+      glPushMatrix();
+      glLoadIdentity();
+      glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+      glEnableClientState( GL_VERTEX_ARRAY );
+      glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+      glEnableClientState( GL_COLOR_ARRAY );
+      glVertexPointer( 3, GL_FLOAT, 0, batch->vertices.constData() );
+      glTexCoordPointer( 2, GL_FLOAT, 0, batch->texCoords.constData() );
+      glColorPointer( 4, GL_FLOAT, 0, batch->colors.constData() );
+      glDrawArrays( GL_QUADS, 0, batch->vertices.size() / 3 );
+      glPopClientAttrib();
+      glPopMatrix();
+
+      glDisable( GL_TEXTURE_2D );
+      glEnable( d->textureTarget );
+      glColor4fv( color );
+    }
+
+    return batch->labels;
+  }
+
   bool TextRenderer::isActive()
   {
     return d->glwidget;
@@ -29,6 +29,8 @@
 #include <avogadro/global.h>
 #include <Eigen/Core>
 
+#include <QVector>
+
 namespace Avogadro
 {
 /**
@@ -69,6 +71,16 @@ namespace Avogadro
  textRenderer.end();
  * @endcode
  *
+ * To draw a large number of labels inside the scene, e.g. one per atom, do:
+ * @code
+ textRenderer.begin();
+ textRenderer.drawBatch( positions, strings );
+ textRenderer.end();
+ * @endcode
+ * The batch is laid out in one vertex array using a single glyph atlas
+ * texture, and is drawn with one call. The layout is cached and reused
+ * until the labels, the color or the camera change.
+ *
  * In order to set the text color, please call glColor3f or glColor4f before
  * calling draw(). Of course you can
  * also call qglColor or Color::apply(). You can achieve semitransparent text at
@@ -133,6 +145,20 @@ namespace Avogadro
        */
       int draw( int x, int y, const QString &string);
 
+      /**
+       * Draw a batch of labels inside the 3D scene. Must be called between
+       * begin() and end(). Each label is centered around its position, just
+       * like draw(const Eigen::Vector3d &, const QString &).
+       * @param positions the positions of the labels in the scene's coordinate system
+       * @param strings the labels to render, one per position
+       * @param cullOverlaps if true, labels overlapping a label that is closer
+       * to the camera are not drawn
+       * @returns the number of labels actually drawn.
+       */
+      int drawBatch( const QVector<Eigen::Vector3d> &positions,
+                     const QVector<QString> &strings,
+                     bool cullOverlaps = true );
+
       bool isActive();
 
     private:
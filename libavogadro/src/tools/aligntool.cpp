@@ -31,6 +31,7 @@
 #include <avogadro/color.h>
 #include <avogadro/glwidget.h>
 #include <avogadro/painter.h>
+#include <avogadro/superposition.h>
 
 #include <openbabel/mol.h>
 #include <openbabel/obiter.h>
@@ -248,6 +249,28 @@ namespace Avogadro {
     m_numSelectedAtoms = 0;
   }
 
+  void AlignTool::alignConformers()
+  {
+    GLWidget *widget = GLWidget::current();
+    if (widget)
+      m_molecule = widget->molecule();
+    if (m_molecule.isNull() || m_molecule->numConformers() < 2)
+      return;
+
+    // Fit the selected atoms if there are enough to fix an orientation
+    QList<int> fitAtoms;
+    if (widget) {
+      foreach (Primitive *primitive,
+               widget->selectedPrimitives().subList(Primitive::AtomType))
+        fitAtoms.append(static_cast<Atom *>(primitive)->index());
+    }
+    if (fitAtoms.size() < 3)
+      fitAtoms.clear();
+
+    Superposition::alignConformers(m_molecule, fitAtoms,
+                                   m_molecule->currentConformer());
+  }
+
   QWidget* AlignTool::settingsWidget()
   {
     if(!m_settingsWidget) {
@@ -277,6 +300,13 @@ namespace Avogadro {
       buttonAlign->setText(tr("Align"));
       connect(buttonAlign, SIGNAL(clicked()), this, SLOT(align()));
 
+      // Button to superpose all conformers or trajectory frames
+      QPushButton *buttonConformers = new QPushButton(m_settingsWidget);
+      buttonConformers->setText(tr("Align All Frames"));
+      buttonConformers->setToolTip(tr("Superpose every conformer on the current one,\n"
+                                      "fitting the selected atoms if three or more are selected."));
+      connect(buttonConformers, SIGNAL(clicked()), this, SLOT(alignConformers()));
+
       QGridLayout *gridLayout = new QGridLayout();
       gridLayout->addWidget(labelAxis,0, 0, 1, 1, Qt::AlignRight);
       QHBoxLayout *hLayout = new QHBoxLayout;
@@ -291,6 +321,7 @@ namespace Avogadro {
       QHBoxLayout *hLayout3 = new QHBoxLayout();
       hLayout3->addStretch(1);
       hLayout3->addWidget(buttonAlign);
+      hLayout3->addWidget(buttonConformers);
       hLayout3->addStretch(1);
       QVBoxLayout *layout = new QVBoxLayout();
       layout->addLayout(gridLayout);
@@ -65,6 +65,8 @@ namespace Avogadro {
       void axisChanged(int axis);
       void alignChanged(int align);
       void align();
+      //! Superpose all conformers on the current one
+      void alignConformers();
 
     private:
       // Guarded pointers, for storing pointers to things that might go poof...
@@ -43,6 +43,8 @@
 #include <QVBoxLayout>
 #include <QCheckBox>
 
+#include <cstring>
+
 using namespace std;
 using namespace OpenBabel;
 using namespace Eigen;
@@ -52,7 +54,7 @@ namespace Avogadro {
   AutoOptTool::AutoOptTool(QObject *parent) : Tool(parent), m_clickedAtom(0),
   m_leftButtonPressed(false), m_midButtonPressed(false), m_rightButtonPressed(false),
   m_running(false), m_block(false), m_setupFailed(false), m_timerId(0) ,m_toolGroup(0),
-  m_settingsWidget(0), m_lastEnergy(0.0)
+  m_settingsWidget(0), m_command(0), m_lastEnergy(0.0), m_energy(0.0)
   {
     QAction *action = activateAction();
     action->setIcon(QIcon(QString::fromUtf8(":/autoopttool/autoopttool.png")));
@@ -84,7 +86,7 @@ namespace Avogadro {
   AutoOptTool::~AutoOptTool()
   {
     if (m_thread) {
-      m_thread->exit();
+      m_thread->stop();
       m_thread->wait();
       delete m_thread;
       m_thread = 0;
@@ -153,7 +155,7 @@ namespace Avogadro {
 
       if (m_clickedAtom)
       {
-        m_forceField->SetFixAtom(m_clickedAtom->index()+1);
+        m_thread->setFixedAtom(m_clickedAtom->index()+1);
       }
     }
 
@@ -170,7 +172,7 @@ namespace Avogadro {
     m_rightButtonPressed = false;
 
     m_clickedAtom = 0;
-    m_forceField->UnsetFixAtom();
+    m_thread->setFixedAtom(0);
 
     widget->update();
     return 0;
@@ -222,9 +224,9 @@ namespace Avogadro {
       if (m_setupFailed) {
         widget->painter()->drawText(labelPos, tr("AutoOpt: Could not setup force field...."));
       } else {
-        double energy = m_forceField->Energy(false);
-        if (m_forceField->GetUnit().find("kcal") != string::npos)
-          energy *= KCAL_TO_KJ;
+        // Computed by the thread with the last update, the force field
+        // itself is busy in the thread
+        double energy = m_energy;
         widget->molecule()->setEnergy(energy);
         widget->painter()->drawText(labelPos,
             tr("AutoOpt: E = %1 %2 (dE = %3)").arg(energy).
@@ -346,17 +348,24 @@ namespace Avogadro {
     if(!m_running)
     {
       connect(m_glwidget->molecule(), SIGNAL(destroyed()), this, SLOT(abort()));
+      // Let an update still running from the last session finish first
+      m_thread->wait();
+      m_block = false;
+      // Constraints or the molecule may have changed while we were stopped
+      m_thread->invalidateSetup();
       m_thread->setup(m_glwidget->molecule(), m_forceField,
                       m_comboAlgorithm->currentIndex(),
                       m_stepsSpinBox->value());
       m_thread->start();
       m_running = true;
       m_buttonStartStop->setText(tr("Stop"));
+      // The command stays open, disable() records the change of the session
       QUndoStack *stack = m_glwidget->undoStack();
       AutoOptCommand *cmd = new AutoOptCommand(m_glwidget->molecule(),this,0);
       if(stack && cmd)
       {
         stack->push(cmd);
+        m_command = cmd;
       }
       else
       {
@@ -368,8 +377,9 @@ namespace Avogadro {
   void AutoOptTool::abort()
   {
     killTimer(m_timerId);
-    m_thread->quit();
+    m_thread->stop();
     m_running = false;
+    m_command = 0;
   }
 
   void AutoOptTool::disable()
@@ -381,15 +391,19 @@ namespace Avogadro {
         killTimer(m_timerId);
         m_timerId = 0;
       }
-      m_thread->quit();
+      m_thread->stop();
       m_running = false;
       m_setupFailed = false;
+      if (m_command) {
+        m_command->commit();
+        m_command = 0;
+      }
       m_buttonStartStop->setText(tr("Start"));
 
       m_glwidget->update(); // redraw AutoOpt label
 
       m_clickedAtom = 0;
-      m_forceField->UnsetFixAtom();
+      m_thread->setFixedAtom(0);
       m_leftButtonPressed = false;
       m_midButtonPressed = false;
       m_rightButtonPressed = false;
@@ -415,36 +429,26 @@ namespace Avogadro {
     m_thread->setup(m_glwidget->molecule(), m_forceField,
                     m_comboAlgorithm->currentIndex(),
                     m_stepsSpinBox->value());
-    m_thread->update();
+    m_thread->requestUpdate();
   }
   
   void AutoOptTool::finished(bool calculated)
   {
-    if (m_running && calculated)
+    Molecule *molecule = m_glwidget->molecule();
+    if (m_running && calculated
+        && m_thread->takeResults(m_coordinates, m_forces, m_energy)
+        && m_coordinates.size() == 3 * static_cast<int>(molecule->numAtoms()))
     {
-      QList<Atom*> atoms = m_glwidget->molecule()->atoms();
-
-      OBMol mol = m_glwidget->molecule()->OBMol();
-      m_forceField->GetCoordinates( mol );
       // forces
-      if (mol.HasData(OBGenericDataType::ConformerData)) {
-        OBConformerData *cd = (OBConformerData*) mol.GetData(OBGenericDataType::ConformerData);
-        const vector<vector<vector3> > &allForces = cd->GetForces();
-        if (allForces.size()) {
-          const vector<vector3> &forces = allForces[0];
-          if (forces.size() == mol.NumAtoms()) {
-            foreach(Atom* atom, atoms) {
-              atom->setForceVector(Eigen::Vector3d(forces[atom->index()].AsArray()));
-            }
-          }
+      if (m_forces.size() == m_coordinates.size()) {
+        const double *forcePtr = m_forces.constData();
+        foreach(Atom* atom, molecule->atoms()) {
+          atom->setForceVector(Eigen::Vector3d(forcePtr));
+          forcePtr += 3;
         }
       }
-      // coordinates
-      double *coordPtr = mol.GetCoordinates();
-      foreach(Atom* atom, atoms) {
-        atom->setPos(Eigen::Vector3d(coordPtr));
-        coordPtr += 3;
-      }
+      // coordinates, in one pass with a single update below
+      molecule->setAtomPositions(m_coordinates.constData());
 
       if(m_clickedAtom && m_leftButtonPressed)
       {
@@ -454,7 +458,7 @@ namespace Avogadro {
       }
     }
 
-    m_glwidget->molecule()->update();
+    molecule->update();
     m_glwidget->update();
     m_block = false;
   }
@@ -477,10 +481,17 @@ namespace Avogadro {
     m_setupFailed = false;
   }
 
-  AutoOptThread::AutoOptThread(QObject*)
+  AutoOptThread::AutoOptThread(QObject*) : m_molecule(0), m_forceField(0),
+    m_algorithm(0), m_steps(0), m_fixedAtom(0), m_stop(false),
+    m_requested(false), m_setupNeeded(true), m_postedMol(0), m_energy(0.0),
+    m_resultsReady(false), m_topologyKey(0), m_setupForceField(0),
+    m_numConstraints(0), m_nativeReady(false), m_stepEnergy(0.0)
   {
-    m_stop = false;
-    m_velocities = false;
+  }
+
+  AutoOptThread::~AutoOptThread()
+  {
+    delete m_postedMol;
   }
 
   void AutoOptThread::setup(Molecule *molecule, OpenBabel::OBForceField* forceField,
@@ -488,111 +499,304 @@ namespace Avogadro {
   {
     //cout << "start AutoOptThread::setup()" << endl;
     m_mutex.lock();
+    if (molecule != m_molecule)
+      m_setupNeeded = true;
     m_molecule = molecule;
     m_forceField = forceField;
     m_algorithm = algorithm;
     m_steps = steps;
     m_stop = false;
-    m_velocities = false;
     m_mutex.unlock();
     emit setupDone();
     //cout << "stop AutoOptThread::setup()" << endl;
   }
 
-
   void AutoOptThread::run()
   {
-    exec();
+    for (;;) {
+      m_mutex.lock();
+      while (!m_requested && !m_stop)
+        m_condition.wait(&m_mutex);
+      if (m_stop) {
+        m_mutex.unlock();
+        return;
+      }
+      // Take the posted buffers and settings, the step runs unlocked
+      m_requested = false;
+      OpenBabel::OBMol *mol = m_postedMol;
+      m_postedMol = 0;
+      if (mol)
+        m_ignoredAtoms = m_postedIgnoredAtoms;
+      qSwap(m_coordinates, m_input);
+      OpenBabel::OBForceField *forceField = m_forceField;
+      int algorithm = m_algorithm;
+      int steps = m_steps;
+      int fixedAtom = m_fixedAtom;
+      m_mutex.unlock();
+
+      if (mol) {
+        m_mol = *mol;
+        delete mol;
+        m_setupForceField = 0;
+      }
+
+      bool calculated = update(forceField, algorithm, steps, fixedAtom);
+      if (calculated) {
+        m_mutex.lock();
+        // Swap rather than copy, takeResults() hands the old buffers back
+        qSwap(m_output, m_stepOutput);
+        qSwap(m_forces, m_stepForces);
+        m_energy = m_stepEnergy;
+        m_resultsReady = true;
+        m_mutex.unlock();
+      }
+      emit finished(calculated);
+    }
   }
 
-  void AutoOptThread::update()
+  unsigned int AutoOptThread::topologyKey() const
   {
-    // If the force field is false we have nothing and so should return
-    if (!m_forceField)
+    // Cheap fingerprint of the atoms and bonds, anything that would change
+    // the atom types or the interactions changes the key
+    unsigned int key = m_molecule->numAtoms() * 2654435761u
+      + m_molecule->numBonds();
+    foreach(const Atom *atom, m_molecule->atoms())
+      key = key * 31 + atom->atomicNumber() + 1;
+    foreach(const Bond *bond, m_molecule->bonds())
+      key = key * 31 + (bond->beginAtomId() * 7919 + bond->endAtomId()) * 4
+        + bond->order();
+    return key;
+  }
+
+  void AutoOptThread::invalidateSetup()
+  {
+    QMutexLocker locker(&m_mutex);
+    m_setupNeeded = true;
+  }
+
+  void AutoOptThread::setFixedAtom(int index)
+  {
+    QMutexLocker locker(&m_mutex);
+    m_fixedAtom = index;
+  }
+
+  void AutoOptThread::requestUpdate()
+  {
+    // Only the tool sets these, it may read them without the lock
+    if (!m_forceField || !m_molecule)
       return;
 
-     m_mutex.lock();
-
-     m_forceField->SetLogFile(NULL);
-     m_forceField->SetLogLevel(OBFF_LOGLVL_NONE);
-
-     OBMol mol = m_molecule->OBMol();
-
-     // Ignore all atoms with atomic # less than 1
-     foreach(const Atom *atom, m_molecule->atoms())
-       {
-         if (atom->atomicNumber() < 1)
-           m_forceField->GetConstraints().AddIgnore(atom->index() + 1);
-       }
-
-     if ( !m_forceField->Setup( mol ) ) {
-       m_stop = true;
-       emit setupFailed();
-       emit finished(false);
-       m_mutex.unlock();
-       return;
-     } else {
-       emit setupSucces();
-     }
-
-     m_forceField->SetConformers( mol );
-
-     switch(m_algorithm) {
-       case 0:
-         m_forceField->SteepestDescent(m_steps);
-         break;
-       case 1:
-         m_forceField->ConjugateGradients(m_steps);
-         break;
-       case 2:
-         m_forceField->MolecularDynamicsTakeNSteps(m_steps, 300, 0.001);
-         break;
-       case 3:
-         m_forceField->MolecularDynamicsTakeNSteps(m_steps, 600, 0.001);
-         break;
-       case 4:
-         m_forceField->MolecularDynamicsTakeNSteps(m_steps, 900, 0.001);
-         break;
-     }
-
-     m_mutex.unlock();
-
-     emit finished(m_stop ? false : true);
+    m_mutex.lock();
+    bool setupNeeded = m_setupNeeded;
+    m_mutex.unlock();
+
+    // Only rebuild the OBMol when the topology changed, the force field is
+    // set up again from it in the thread
+    OpenBabel::OBMol *mol = 0;
+    QList<int> ignoredAtoms;
+    unsigned int key = topologyKey();
+    if (setupNeeded || key != m_topologyKey) {
+      m_topologyKey = key;
+      mol = new OpenBabel::OBMol(m_molecule->OBMol());
+      foreach(const Atom *atom, m_molecule->atoms())
+        if (atom->atomicNumber() < 1)
+          ignoredAtoms.append(atom->index() + 1);
+    }
+
+    // Copy the current positions, including any atoms being dragged
+    QList<Atom *> atoms = m_molecule->atoms();
+    m_positions.resize(3 * atoms.size());
+    double *coordPtr = m_positions.data();
+    foreach(const Atom *atom, atoms) {
+      const Vector3d *pos = atom->pos();
+      *coordPtr++ = pos->x();
+      *coordPtr++ = pos->y();
+      *coordPtr++ = pos->z();
+    }
+
+    // and hand them over
+    OpenBabel::OBMol *unused = 0;
+    m_mutex.lock();
+    if (mol) {
+      unused = m_postedMol;
+      m_postedMol = mol;
+      m_postedIgnoredAtoms = ignoredAtoms;
+      m_setupNeeded = false;
+    }
+    qSwap(m_input, m_positions);
+    m_requested = true;
+    m_condition.wakeOne();
+    m_mutex.unlock();
+    delete unused;
+  }
+
+  bool AutoOptThread::takeResults(QVector<double> &coordinates,
+                                  QVector<double> &forces, double &energy)
+  {
+    QMutexLocker locker(&m_mutex);
+    if (!m_resultsReady)
+      return false;
+    // Swap rather than copy, the thread overwrites the old buffers next time
+    qSwap(coordinates, m_output);
+    qSwap(forces, m_forces);
+    energy = m_energy;
+    m_resultsReady = false;
+    return true;
+  }
+
+  bool AutoOptThread::update(OpenBabel::OBForceField *forceField,
+                             int algorithm, int steps, int fixedAtom)
+  {
+    // If the force field is false we have nothing and so should return
+    if (!forceField || !m_mol.NumAtoms())
+      return false;
+
+    // Set up again for a new OBMol, another force field or new constraints
+    if (forceField != m_setupForceField
+        || forceField->GetConstraints().Size() != m_numConstraints) {
+      forceField->SetLogFile(NULL);
+      forceField->SetLogLevel(OBFF_LOGLVL_NONE);
+
+      // Ignore all atoms with atomic # less than 1
+      foreach(int index, m_ignoredAtoms)
+        forceField->GetConstraints().AddIgnore(index);
+
+      if ( !forceField->Setup( m_mol ) ) {
+        m_setupForceField = 0;
+        emit setupFailed();
+        return false;
+      } else {
+        emit setupSucces();
+      }
+      m_setupForceField = forceField;
+      m_numConstraints = forceField->GetConstraints().Size();
+
+      // The native evaluator knows nothing about constraints
+      m_nativeReady = false;
+      if (!m_numConstraints && m_ignoredAtoms.isEmpty())
+        m_nativeReady = m_native.setup(m_mol, forceField);
+    }
+
+    // The atoms changed since the OBMol was posted, ask the tool for a new
+    // one with the next positions
+    if (m_coordinates.size() != static_cast<int>(3 * m_mol.NumAtoms())) {
+      QMutexLocker locker(&m_mutex);
+      m_setupNeeded = true;
+      return false;
+    }
+
+    if (m_nativeReady && algorithm < 2) {
+      m_native.setCoordinates(m_coordinates.constData());
+      m_native.clearFixedAtoms();
+      if (fixedAtom)
+        m_native.setFixedAtom(fixedAtom - 1);
+      m_native.minimize(algorithm == 0 ? ForceField::SteepestDescent
+                        : ForceField::ConjugateGradients, steps);
+
+      m_stepOutput = m_native.coordinates();
+      m_stepEnergy = m_native.energy(m_stepForces);
+      for (int i = 0; i < m_stepForces.size(); ++i)
+        m_stepForces[i] = -m_stepForces[i];
+      return true;
+    }
+
+    // Copy the positions straight into the coordinate array of the
+    // persistent OBMol and hand them to the force field
+    memcpy(m_mol.GetCoordinates(), m_coordinates.constData(),
+           m_coordinates.size() * sizeof(double));
+    forceField->SetCoordinates( m_mol );
+
+    if (fixedAtom)
+      forceField->SetFixAtom(fixedAtom);
+    else
+      forceField->UnsetFixAtom();
+
+    switch(algorithm) {
+      case 0:
+        forceField->SteepestDescent(steps);
+        break;
+      case 1:
+        forceField->ConjugateGradients(steps);
+        break;
+      case 2:
+        forceField->MolecularDynamicsTakeNSteps(steps, 300, 0.001);
+        break;
+      case 3:
+        forceField->MolecularDynamicsTakeNSteps(steps, 600, 0.001);
+        break;
+      case 4:
+        forceField->MolecularDynamicsTakeNSteps(steps, 900, 0.001);
+        break;
+    }
+
+    // Keep the results, the forces come with the conformer data
+    forceField->GetCoordinates( m_mol );
+    m_stepOutput.resize(m_coordinates.size());
+    memcpy(m_stepOutput.data(), m_mol.GetCoordinates(),
+           m_stepOutput.size() * sizeof(double));
+    m_stepForces.clear();
+    if (m_mol.HasData(OBGenericDataType::ConformerData)) {
+      OBConformerData *cd = (OBConformerData*) m_mol.GetData(OBGenericDataType::ConformerData);
+      const vector<vector<vector3> > &allForces = cd->GetForces();
+      if (allForces.size() && allForces[0].size() == m_mol.NumAtoms()) {
+        m_stepForces.resize(m_stepOutput.size());
+        double *forcePtr = m_stepForces.data();
+        for (unsigned int i = 0; i < allForces[0].size(); ++i) {
+          *forcePtr++ = allForces[0][i].x();
+          *forcePtr++ = allForces[0][i].y();
+          *forcePtr++ = allForces[0][i].z();
+        }
+      }
+    }
+    m_stepEnergy = forceField->Energy(false);
+    if (forceField->GetUnit().find("kcal") != string::npos)
+      m_stepEnergy *= KCAL_TO_KJ;
+    return true;
   }
 
   void AutoOptThread::stop()
   {
+    QMutexLocker locker(&m_mutex);
     m_stop = true;
+    m_condition.wakeOne();
   }
 
   AutoOptCommand::AutoOptCommand(Molecule *molecule, AutoOptTool *tool,
-      QUndoCommand *parent) : QUndoCommand(parent), m_molecule(0)
+      QUndoCommand *parent) : PositionUndoCommand(molecule, parent), m_tool(tool)
   {
-    // Store the original molecule before any modifications are made
+    // Store the original positions before any modifications are made
     setText(QObject::tr("AutoOpt Molecule"));
-    m_moleculeCopy = *molecule;
-    m_molecule = molecule;
-    m_tool = tool;
+    // Optimization steps need no more than a micro-Angstrom to be undone
+    setQuantum(1.0e-6);
   }
 
-  void AutoOptCommand::redo()
+  AutoOptCommand::~AutoOptCommand()
   {
-    m_moleculeCopy = *m_molecule;
+    if (m_tool && m_tool->m_command == this)
+      m_tool->m_command = 0;
   }
 
   void AutoOptCommand::undo()
   {
+    // Stop the optimizer before the positions are restored
     if(m_tool)
     {
       m_tool->disable();
     }
-    *m_molecule = m_moleculeCopy;
+    PositionUndoCommand::undo();
+  }
+
+  void AutoOptCommand::redo()
+  {
+    // Pushed when the session starts, disable() commits it when it ends
+    if (isUndone())
+      PositionUndoCommand::redo();
   }
 
   bool AutoOptCommand::mergeWith (const QUndoCommand *)
   {
-    // Just return true to repeated calls - we have stored the original molecule
-    return true;
+    // Each session is undone on its own, a new one is still running
+    return false;
   }
 
   int AutoOptCommand::id() const
@@ -25,9 +25,11 @@
 #ifndef AUTOOPTTOOL_H
 #define AUTOOPTTOOL_H
 
+#include <avogadro/forcefield.h>
 #include <avogadro/glwidget.h>
 #include <avogadro/tool.h>
 #include <avogadro/molecule.h>
+#include <avogadro/undosequence.h>
 
 #include <openbabel/mol.h>
 #include <openbabel/forcefield.h>
@@ -44,21 +46,73 @@
 #include <QSpinBox>
 #include <QUndoStack>
 #include <QMutex>
+#include <QPointer>
+#include <QWaitCondition>
+#include <QVector>
 
 namespace Avogadro {
 
+  /**
+   * @class AutoOptThread
+   * @brief Persistent force field session run by the AutoOptTool.
+   *
+   * The force field is only set up (atom typing, parameter assignment and
+   * constraints) when the session starts and when the topology of the
+   * Molecule, the force field or the constraints change. Each update then
+   * exchanges the coordinates through a pair of plain arrays: the tool
+   * copies the current positions and posts them, the thread runs the
+   * requested steps on its own copy and publishes the new positions, forces
+   * and energy, which the tool picks up with takeResults(). The mutex is
+   * only held to swap these buffers, never during a step, so posting never
+   * waits for the force field.
+   *
+   * Minimizations with UFF and no constraints run on the native ForceField,
+   * everything else on the OpenBabel force field.
+   */
   class AutoOptThread : public QThread
   {
     Q_OBJECT
 
     public:
       AutoOptThread(QObject *parent=0);
+      ~AutoOptThread();
 
       void setup(Molecule *molecule, OpenBabel::OBForceField* forceField,
           int algorithm, /* int convergence, */ int steps);
 
+      /**
+       * Run the posted updates until stop() is called.
+       */
       void run();
-      void update();
+
+      /**
+       * Post the current atom positions of the Molecule and request the
+       * next steps. Returns immediately, finished() is emitted when the
+       * results are ready. Must be called from the GUI thread.
+       */
+      void requestUpdate();
+
+      /**
+       * Force the force field to be set up again before the next update.
+       */
+      void invalidateSetup();
+
+      /**
+       * Fix the atom at @p index (1 based, OpenBabel style) during the
+       * next updates, 0 releases it.
+       */
+      void setFixedAtom(int index);
+
+      /**
+       * Swap out the results of the last update.
+       * @param coordinates set to x, y, z of each atom in index order.
+       * @param forces set to the forces in the same layout, empty if the
+       * force field did not provide them.
+       * @param energy set to the energy in kJ/mol.
+       * @return false if there are no new results.
+       */
+      bool takeResults(QVector<double> &coordinates, QVector<double> &forces,
+                       double &energy);
 
     Q_SIGNALS:
       void finished(bool calculated);
@@ -67,17 +121,51 @@ namespace Avogadro {
       void setupSucces();
 
     public Q_SLOTS:
+      /**
+       * Let run() return once the current update is done.
+       */
       void stop();
 
     private:
+      // Shared by the tool and the thread, guarded by m_mutex
+      QMutex m_mutex;
+      QWaitCondition m_condition;
       Molecule *m_molecule;
       OpenBabel::OBForceField * m_forceField;
-      bool m_velocities;
       int m_algorithm;
       //double m_convergence;
       int m_steps;
+      int m_fixedAtom;
       bool m_stop;
-      QMutex m_mutex;
+      bool m_requested;
+      bool m_setupNeeded;              // the tool must post a new OBMol
+      OpenBabel::OBMol *m_postedMol;   // new topology, taken by the thread
+      QList<int> m_postedIgnoredAtoms;
+      QVector<double> m_input;         // posted positions
+      QVector<double> m_output;        // published results
+      QVector<double> m_forces;
+      double m_energy;
+      bool m_resultsReady;
+
+      // Only touched by the tool
+      unsigned int m_topologyKey;
+      QVector<double> m_positions;
+
+      // Session state, only touched by the thread
+      OpenBabel::OBMol m_mol;
+      OpenBabel::OBForceField *m_setupForceField;
+      unsigned int m_numConstraints;
+      QList<int> m_ignoredAtoms;
+      ForceField m_native;
+      bool m_nativeReady;
+      QVector<double> m_coordinates;
+      QVector<double> m_stepOutput;
+      QVector<double> m_stepForces;
+      double m_stepEnergy;
+
+      unsigned int topologyKey() const;
+      bool update(OpenBabel::OBForceField *forceField, int algorithm,
+                  int steps, int fixedAtom);
   };
 
   /**
@@ -88,6 +176,7 @@ namespace Avogadro {
    * This tool enables the manipulation of the position of
    * the selected atoms while the optimiser is running.
    */
+  class AutoOptCommand;
   class AutoOptTool : public Tool
   {
     Q_OBJECT
@@ -152,6 +241,7 @@ namespace Avogadro {
       Eigen::Vector3d           m_selectedPrimitivesCenter;    // centroid of selected atoms
       OpenBabel::OBForceField*  m_forceField;
       AutoOptThread *           m_thread;
+      AutoOptCommand *          m_command;  // running session, see disable()
 
       std::vector<std::string>  m_forceFieldList;
 
@@ -165,6 +255,9 @@ namespace Avogadro {
 
       QPoint                    m_lastDraggingPosition;
       double                    m_lastEnergy;
+      double                    m_energy;
+      QVector<double>           m_coordinates; // results of the last update
+      QVector<double>           m_forces;
 
       void timerEvent(QTimerEvent* event);
 
@@ -172,23 +265,23 @@ namespace Avogadro {
 
     private Q_SLOTS:
       void settingsWidgetDestroyed();
+
+    friend class AutoOptCommand;
   };
 
-  class AutoOptCommand : public QUndoCommand
+  class AutoOptCommand : public PositionUndoCommand
   {
     public:
       AutoOptCommand(Molecule *molecule, AutoOptTool *tool, QUndoCommand *parent = 0);
+      ~AutoOptCommand();
 
-      void redo();
       void undo();
+      void redo();
       bool mergeWith ( const QUndoCommand * command );
       int id() const;
 
     private:
-      Molecule m_moleculeCopy;
-      Molecule *m_molecule;
-      AutoOptTool *m_tool;
-      bool undone;
+      QPointer<AutoOptTool> m_tool;
   };
 
   class AutoOptToolFactory : public QObject, public PluginFactory
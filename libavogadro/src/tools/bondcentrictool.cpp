@@ -401,6 +401,7 @@ namespace Avogadro {
       m_selectedBond = NULL;
     }
     else if (!m_movedSinceButtonPressed) {
+      delete m_undo;
       m_undo = 0;
     }
 
@@ -1651,14 +1652,10 @@ namespace Avogadro {
 
   BondCentricMoveCommand::BondCentricMoveCommand(Molecule *molecule,
       QUndoCommand *parent)
-    : QUndoCommand(parent), m_molecule(0)
+    : PositionUndoCommand(molecule, parent), m_atomIndex(0)
   {
-    // Store the molecule - this call won't actually move an atom
+    // Store the positions - this call won't actually move an atom
     setText(QObject::tr("Bond Centric Manipulation"));
-    m_moleculeCopy = *molecule;
-    m_molecule = molecule;
-    m_atomIndex = 0;
-    undone = false;
   }
 
   // ##########  Constructor  ##########
@@ -1666,44 +1663,25 @@ namespace Avogadro {
   BondCentricMoveCommand::BondCentricMoveCommand(Molecule *molecule,
       Atom *atom, Vector3d pos,
       QUndoCommand *parent)
-    : QUndoCommand(parent), m_molecule(0)
+    : PositionUndoCommand(molecule, parent)
   {
-    // Store the original molecule before any modifications are made
+    // Store the original positions before any modifications are made
     setText(QObject::tr("Bond Centric Manipulation"));
-    m_moleculeCopy = *molecule;
-    m_molecule = molecule;
     m_atomIndex = atom->index();
     m_pos = pos;
-    undone = false;
   }
 
   // ##########  redo  ##########
 
   void BondCentricMoveCommand::redo()
   {
-    // Move the specified atom to the location given
-    if (undone) {
-      Molecule newMolecule = *m_molecule;
-      *m_molecule = m_moleculeCopy;
-      m_moleculeCopy = newMolecule;
-    }
-    else if (m_atomIndex) {
-      Atom *atom = m_molecule->atom(m_atomIndex);
+    // Move the specified atom to the location given, then record the move
+    if (!isUndone() && m_atomIndex && molecule()) {
+      Atom *atom = molecule()->atom(m_atomIndex);
       atom->setPos(m_pos);
       atom->update();
     }
-    QUndoCommand::redo();
-  }
-
-  // ##########  undo  ##########
-
-  void BondCentricMoveCommand::undo()
-  {
-    // Restore our original molecule
-    Molecule newMolecule = *m_molecule;
-    *m_molecule = m_moleculeCopy;
-    m_moleculeCopy = newMolecule;
-    undone = true;
+    PositionUndoCommand::redo();
   }
 
   // ##########  mergeWith  ##########
@@ -37,6 +37,7 @@
 #include <Eigen/Core>
 
 #include <avogadro/molecule.h>
+#include <avogadro/undosequence.h>
 
 #include <QGLWidget>
 #include <QImage>
@@ -353,7 +354,7 @@ namespace Avogadro {
    *  - Adjusting bond length.
    *  - Adjusting bond angles.
    */
-  class BondCentricMoveCommand : public QUndoCommand
+  class BondCentricMoveCommand : public PositionUndoCommand
   {
     public:
       //!Constructor
@@ -382,11 +383,6 @@ namespace Avogadro {
        */
       void redo();
 
-      /**
-       * Undo move
-       */
-      void undo();
-
       /**
        * returns if undo commands are merged together to one command.
        *
@@ -404,11 +400,8 @@ namespace Avogadro {
       int id() const;
 
     private:
-      Molecule m_moleculeCopy;
-      Molecule *m_molecule;
       int m_atomIndex;
       Eigen::Vector3d m_pos;
-      bool undone;
   };
 
 
@@ -29,6 +29,7 @@
 #include <avogadro/atom.h>
 #include <avogadro/bond.h>
 #include <avogadro/molecule.h>
+#include <avogadro/undosequence.h>
 
 #include <QDebug>
 
@@ -758,6 +759,8 @@ namespace Avogadro {
     d->molecule = molecule;
     d->moleculeCopy = (*(molecule));
     d->id = molecule->bond(index)->id();
+    // Undo restores the copy, which must not skip over merged moves
+    PositionUndoCommand::mergeBarrier(molecule);
 #ifdef DEBUG_COMMANDS
     qDebug() << "DeleteBondDrawCommand(id = " << d->id << ", adj = " << adjustHydrogens << ")";
 #endif
@@ -1042,6 +1045,8 @@ namespace Avogadro {
     d->molecule = molecule;
     d->moleculeCopy = *molecule;
     d->generatedMolecule = generatedMolecule;
+    // Undo restores the copy, which must not skip over merged moves
+    PositionUndoCommand::mergeBarrier(molecule);
   }
 
   InsertFragmentCommand::~InsertFragmentCommand()
@@ -43,7 +43,7 @@ namespace Avogadro {
 
   ManipulateTool::ManipulateTool(QObject *parent) : Tool(parent),
     m_clickedAtom(0), m_leftButtonPressed(false), m_midButtonPressed(false),
-    m_rightButtonPressed(false), m_eyecandy(new Eyecandy)
+    m_rightButtonPressed(false), m_eyecandy(new Eyecandy), m_undo(0)
   {
     m_eyecandy->setColor(1.0, 0.0, 0.0, 1.0);
     QAction *action = activateAction();
@@ -58,6 +58,7 @@ namespace Avogadro {
   ManipulateTool::~ManipulateTool()
   {
     delete m_eyecandy;
+    delete m_undo;
   }
 
   int ManipulateTool::usefulness() const
@@ -209,8 +210,11 @@ namespace Avogadro {
 
     widget->update();
 
-    QUndoCommand* undo = new MoveAtomCommand(widget->molecule());
-    return undo;
+    // Keep the positions from before the drag, the command is pushed once
+    // the drag is over
+    delete m_undo;
+    m_undo = new MoveAtomCommand(widget->molecule());
+    return 0;
   }
 
   QUndoCommand* ManipulateTool::mouseReleaseEvent(GLWidget *widget, QMouseEvent *event)
@@ -225,7 +229,8 @@ namespace Avogadro {
     widget->setCursor(Qt::ArrowCursor);
 
     widget->update();
-    QUndoCommand* undo = new MoveAtomCommand(widget->molecule());
+    QUndoCommand* undo = m_undo;
+    m_undo = 0;
     return undo;
   }
 
@@ -356,50 +361,23 @@ namespace Avogadro {
     return true;
   }
 
-  MoveAtomCommand::MoveAtomCommand(Molecule *molecule, QUndoCommand *parent) : QUndoCommand(parent), m_molecule(0)
+  MoveAtomCommand::MoveAtomCommand(Molecule *molecule, QUndoCommand *parent) : PositionUndoCommand(molecule, parent), m_type(0)
   {
-    // Store the molecule - this call won't actually move an atom
+    // Store the positions - this call won't actually move an atom
     setText(QObject::tr("Manipulate Atom"));
-    m_moleculeCopy = *molecule;
-    m_molecule = molecule;
-    undone = false;
   }
 
-  MoveAtomCommand::MoveAtomCommand(Molecule *molecule, int type, QUndoCommand *parent) : QUndoCommand(parent), m_molecule(0)
+  MoveAtomCommand::MoveAtomCommand(Molecule *molecule, int type, QUndoCommand *parent) : PositionUndoCommand(molecule, parent), m_type(type)
   {
-    // Store the original molecule before any modifications are made
+    // Store the original positions before any modifications are made
     setText(QObject::tr("Manipulate Atom"));
-    m_moleculeCopy = *molecule;
-    m_molecule = molecule;
-    m_type =type;
-    undone = false;
   }
 
-  void MoveAtomCommand::redo()
+  bool MoveAtomCommand::mergeWith (const QUndoCommand *command)
   {
-    // Move the specified atom to the location given
-    if (undone)
-    {
-      Molecule newMolecule = *m_molecule;
-      *m_molecule = m_moleculeCopy;
-      m_moleculeCopy = newMolecule;
-    }
-    QUndoCommand::redo();
-  }
-
-  void MoveAtomCommand::undo()
-  {
-    // Restore our original molecule
-    Molecule newMolecule = *m_molecule;
-    *m_molecule = m_moleculeCopy;
-    m_moleculeCopy = newMolecule;
-    undone = true;
-  }
-
-  bool MoveAtomCommand::mergeWith (const QUndoCommand *)
-  {
-    // Just return true to repeated calls - we have stored the original molecule
-    return true;
+    // Successive drags are undone together
+    const MoveAtomCommand *other = static_cast<const MoveAtomCommand *>(command);
+    return absorb(other);
   }
 
   int MoveAtomCommand::id() const
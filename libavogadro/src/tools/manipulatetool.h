@@ -28,6 +28,7 @@
 #include <avogadro/tool.h>
 
 #include <avogadro/molecule.h>
+#include <avogadro/undosequence.h>
 
 #include <QGLWidget>
 #include <QObject>
@@ -84,6 +85,7 @@ namespace Avogadro {
       QPoint              m_lastDraggingPosition;
       Eyecandy            *m_eyecandy;
       double              m_yAngleEyecandy, m_xAngleEyecandy;
+      QUndoCommand *      m_undo;  // pushed when the drag ends
 
       void zoom(GLWidget *widget, const Eigen::Vector3d *goal,
                 double delta) const;
@@ -95,22 +97,17 @@ namespace Avogadro {
                 double delta) const;
   };
 
- class MoveAtomCommand : public QUndoCommand
+ class MoveAtomCommand : public PositionUndoCommand
   {
     public:
       explicit MoveAtomCommand(Molecule *molecule, QUndoCommand *parent = 0);
       MoveAtomCommand(Molecule *molecule, int type, QUndoCommand *parent = 0);
 
-      void redo();
-      void undo();
       bool mergeWith ( const QUndoCommand * command );
       int id() const;
 
     private:
-      Molecule m_moleculeCopy;
-      Molecule *m_molecule;
       int m_type;
-      bool undone;
   };
 
   class ManipulateToolFactory : public QObject, public PluginFactory
@@ -32,8 +32,6 @@
 #include <avogadro/glwidget.h>
 #include <avogadro/primitivelist.h>
 
-#include <openbabel/mol.h>
-
 #include <Eigen/Geometry>
 
 #include <QtPlugin>
@@ -45,7 +43,6 @@
 #include <QDebug>
 
 using namespace std;
-using namespace OpenBabel;
 using namespace Eigen;
 
 namespace Avogadro {
@@ -208,22 +205,16 @@ namespace Avogadro {
               QList<Primitive *> neighborList;
 
               // We really want the "connected fragment" since a Molecule can contain
-              // multiple user-visible molecule fragments
-              // we can use either BFS or DFS interators -- look for the connected fragment
-              OpenBabel::OBMol mol = molecule->OBMol();
-              OpenBabel::OBMolAtomDFSIter iter(mol, atom->index() + 1);
-              Atom *tmpNeighbor;
-              do {
-                tmpNeighbor = molecule->atom(iter->GetIdx() - 1);
+              // multiple user-visible molecule fragments, which it keeps track of
+              foreach (unsigned long id, molecule->fragmentAtoms(atom->id())) {
+                Atom *tmpNeighbor = molecule->atomById(id);
                 neighborList.append(tmpNeighbor);
 
                 // we want to find all bonds on this site
                 // (obviously all bonds will be in this fragment)
-
-                FOR_BONDS_OF_ATOM(b, *iter)
-                  neighborList.append(molecule->bond(b->GetIdx()));
-
-              } while ((iter++).next()); // this returns false when we've gone looped through the fragment
+                foreach (unsigned long bondId, tmpNeighbor->bonds())
+                  neighborList.append(molecule->bondById(bondId));
+              }
 
               widget->setSelected(neighborList, select);
             } else if (hit->type() == Primitive::BondType) {
@@ -233,22 +224,16 @@ namespace Avogadro {
               QList<Primitive *> neighborList;
 
               // We really want the "connected fragment" since a Molecule can contain
-              // multiple user-visible molecule fragments
-              // we can use either BFS or DFS interators -- look for the connected fragment
-              OpenBabel::OBMol mol = molecule->OBMol();
-              OpenBabel::OBMolAtomDFSIter iter(mol, molecule->atomById(bond->beginAtomId())->index() + 1);
-              Atom *tmpNeighbor;
-              do {
-                tmpNeighbor = molecule->atom(iter->GetIdx() - 1);
+              // multiple user-visible molecule fragments, which it keeps track of
+              foreach (unsigned long id, molecule->fragmentAtoms(bond->beginAtomId())) {
+                Atom *tmpNeighbor = molecule->atomById(id);
                 neighborList.append(tmpNeighbor);
 
                 // we want to find all bonds on this site
                 // (obviously all bonds will be in this fragment)
-
-                FOR_BONDS_OF_ATOM(b, *iter)
-                  neighborList.append(molecule->bond(b->GetIdx()));
-
-              } while ((iter++).next()); // this returns false when we've gone looped through the fragment
+                foreach (unsigned long bondId, tmpNeighbor->bonds())
+                  neighborList.append(molecule->bondById(bondId));
+              }
 
               widget->setSelected(neighborList, select);
             }
@@ -30,103 +30,50 @@
 #include <avogadro/bond.h>
 #include <avogadro/molecule.h>
 
+#include <QQueue>
+
+#include <algorithm>
+
 using namespace Eigen;
 using namespace std;
 
 namespace Avogadro {
 
-  // ################################## Node #####################################
-
-  // ##########  Constructor  ##########
-
-  Node::Node(Atom *atom)
-  {
-    m_atom = atom;
-  }
-
-  // ##########  Destructor  ##########
-
-  Node::~Node() {}
-
-  // ##########  atom  ##########
-
-  Atom* Node::atom()
-  {
-    return m_atom;
-  }
-
-  // ##########  nodes  ##########
-
-  QList<Node*> Node::nodes()
-  {
-    return m_nodes;
-  }
-
-  // ##########  isLeaf  ##########
-
-  bool Node::isLeaf()
-  {
-    return m_nodes.isEmpty();
-  }
-
-  // ##########  containsAtom  ##########
-
-  bool Node::containsAtom(Atom* atom)
-  {
-    //"atom" exist in the children and grandchildren... of this node.?
-    bool exists = false;
-    if (m_atom == atom) {
-      return true;
-    }
-
-    foreach (Node *node, m_nodes)
-    {
-      if (node->containsAtom(atom))
-      {
-        exists = true;
-        break;
+  // Mark and queue the unvisited atoms bonded to those already queued,
+  // breadth first, appending them to @p found if given
+  static void visitFragment(Molecule *molecule, QQueue<unsigned long> &queue,
+                            QBitArray &visited, QVector<unsigned long> *found)
+  {
+    while (!queue.isEmpty()) {
+      Atom *atom = molecule->atomById(queue.dequeue());
+      if (!atom)
+        continue;
+      foreach (unsigned long id, atom->neighbors()) {
+        if (id >= static_cast<unsigned long>(visited.size()) || visited.testBit(id))
+          continue;
+        visited.setBit(id);
+        queue.enqueue(id);
+        if (found)
+          found->append(id);
       }
     }
-
-    return exists;
-  }
-
-  // ##########  addNode  ##########
-
-  void Node::addNode(Node* node)
-  {
-    m_nodes.append(node);
-  }
-
-  // ##########  removeNode  ##########
-
-  void Node::removeNode(Node* node)
-  {
-    int i = m_nodes.indexOf(node);
-
-    if (i != -1) {
-      m_nodes.removeAt(i);
-    }
   }
 
-  // ############################## SkeletonTree #################################
-
   // ##########  Constructor  ##########
 
-  SkeletonTree::SkeletonTree() {}
+  SkeletonTree::SkeletonTree() : m_molecule(0), m_rootAtom(0), m_rootBond(0) {}
 
   // ##########  Destructor  ##########
 
   SkeletonTree::~SkeletonTree()
   {
-    delete m_rootNode;
   }
 
   // ##########  rootAtom  ##########
 
   Atom* SkeletonTree::rootAtom()
   {
-    return m_rootNode->atom();
+    return m_rootAtom;
   }
 
   // ##########  rootBond  ##########
@@ -140,75 +87,69 @@ namespace Avogadro {
 
   void SkeletonTree::populate(Atom *rootAtom, Bond *rootBond, Molecule* molecule)
   {
-    if (!m_rootNode) {
-      delete m_rootNode;
-    }
-
-    m_rootNode = new Node(rootAtom);
-
+    m_molecule = molecule;
+    m_rootAtom = rootAtom;
     m_rootBond = rootBond;
-
-    Atom* bAtom = m_rootBond->beginAtom();
-    Atom* eAtom = m_rootBond->endAtom();
-
-    if (bAtom != m_rootNode->atom() && eAtom != m_rootNode->atom()) {
+    m_atomIds.clear();
+    m_contains.clear();
+    if (!m_molecule || !m_rootAtom || !m_rootBond)
       return;
-    }
 
-    Atom* diffAtom = (bAtom == m_rootNode->atom()) ? eAtom : bAtom;
+    QBitArray visited(m_molecule->conformerSize());
+    m_atomIds.append(m_rootAtom->id());
+    visited.setBit(m_rootAtom->id());
 
-    //A temproray tree to find loops
-    m_endNode = new Node(diffAtom);
+    Atom* bAtom = m_rootBond->beginAtom();
+    Atom* eAtom = m_rootBond->endAtom();
 
-    //Recursively go through molecule and make a temproray tree.
-    //starting from m_endNode
-    recursivePopulate(molecule, m_endNode, m_rootBond);
+    if (bAtom == m_rootAtom || eAtom == m_rootAtom) {
+      Atom* diffAtom = (bAtom == m_rootAtom) ? eAtom : bAtom;
 
-    //Recursively go through molecule and make the tree.
-    //starting from m_rootNode
-    recursivePopulate(molecule, m_rootNode, m_rootBond);
+      // Everything reachable from the other side without passing the root
+      // atom stays put, which also keeps rings closed
+      QQueue<unsigned long> queue;
+      visited.setBit(diffAtom->id());
+      queue.enqueue(diffAtom->id());
+      visitFragment(m_molecule, queue, visited, 0);
 
-    //delete the temporary tree
-    delete m_endNode;
+      // The rest of the root atom's side moves
+      queue.enqueue(m_rootAtom->id());
+      visitFragment(m_molecule, queue, visited, &m_atomIds);
+    }
 
-    //for debugging puposes
-    //printSkeleton(m_rootNode);
+    // Walk the positions in memory order
+    std::sort(m_atomIds.begin(), m_atomIds.end());
+    m_contains.resize(visited.size());
+    foreach (unsigned long id, m_atomIds)
+      m_contains.setBit(id);
   }
 
-  // ##########  recursivePopulate  ##########
+  // ##########  transform  ##########
 
-  void SkeletonTree::recursivePopulate(Molecule* mol, Node* node, Bond* bond)
+  void SkeletonTree::transform(const Eigen::Matrix3d &linear,
+                               const Eigen::Vector3d &translation)
   {
-    Atom* atom = node->atom();
-    int found = 0;
-
-    foreach (Bond *b, mol->bonds()) {
-      Atom* bAtom = b->beginAtom();
-      Atom* eAtom = b->endAtom();
-
-      if ((b != bond) && ((bAtom == atom) || (eAtom == atom))) {
-        Atom* diffAtom = (bAtom == atom) ? eAtom : bAtom;
-
-        //Check if this atom already exists, so not to form loops
-        if ((!m_endNode->containsAtom(diffAtom)) &&
-            (!m_rootNode->containsAtom(diffAtom))) {
-          Node* newNode = new Node(diffAtom);
-          node -> addNode(newNode);
-          found++;
-          recursivePopulate(mol, newNode, b);
-        }
-      }
-    }
+    if (!m_molecule || m_atomIds.isEmpty())
+      return;
+    std::vector<Vector3d> *positions =
+      m_molecule->conformer(m_molecule->currentConformer());
+    if (!positions)
+      return;
+
+    Vector3d *pos = &(*positions)[0];
+    const unsigned long size = positions->size();
+    const unsigned long *ids = m_atomIds.constData();
+    const int n = m_atomIds.size();
+    for (int i = 0; i < n; ++i)
+      if (ids[i] < size)
+        pos[ids[i]] = linear * pos[ids[i]] + translation;
   }
 
   // ##########  skeletonTranslate  ##########
 
   void SkeletonTree::skeletonTranslate(const Eigen::Vector3d &translationVector)
   {
-    if (m_rootNode) {
-      //Translate skeleton
-      recursiveTranslate(m_rootNode, translationVector);
-    }
+    transform(Matrix3d::Identity(), translationVector);
   }
 
   // ##########  skeletonRotate  ##########
@@ -217,70 +158,22 @@ namespace Avogadro {
                                     const Eigen::Vector3d &rotationAxis,
                                     const Eigen::Vector3d &centerVector)
   {
-    if (m_rootNode) {
-      //Rotate skeleton around a particular axis and center point
-      Eigen::Transform3d rotation;
-      rotation = Eigen::AngleAxisd(angle, rotationAxis);
-      rotation.pretranslate(centerVector);
-      rotation.translate(-centerVector);
-
-      recursiveRotate(m_rootNode, rotation);
-    }
-  }
-
-  // ##########  recursiveTranslate  ##########
-
-  void SkeletonTree::recursiveTranslate(Node* n,
-                                        const Eigen::Vector3d &translationVector)
-  {
-    // Translate the root node, and then update any children
-    Atom* a = n->atom();
+    //Rotate skeleton around a particular axis and center point
+    Eigen::Transform3d rotation;
+    rotation = Eigen::AngleAxisd(angle, rotationAxis);
+    rotation.pretranslate(centerVector);
+    rotation.translate(-centerVector);
 
-    a->setPos(*(a->pos()) + translationVector);
-    a->update();
-
-    foreach (Node* node, n->nodes())
-      recursiveTranslate(node, translationVector);
-  }
-
-  // ##########  recursiveRotate  ##########
-
-  void SkeletonTree::recursiveRotate(Node* n,
-                                     const Eigen::Transform3d &rotationMatrix)
-  {
-    // Update the root node with the new position
-    Atom* a = n->atom();
-    a->setPos(rotationMatrix * (*a->pos()));
-    a->update();
-
-    // Now update the children
-    foreach (Node *node, n->nodes())
-    {
-      recursiveRotate(node, rotationMatrix);
-    }
-  }
-
-  // ##########  printSkeleton  ##########
-
-  void SkeletonTree::printSkeleton(Node* n)
-  {
-    foreach (Node* node, n->nodes())
-      printSkeleton(node);
-
-    Atom* a = n->atom();
-    cout << a->pos()->x() << "," << a->pos()->y()<< ","<<a->pos()->z() << endl;
-
-    if (!n->isLeaf()) {
-      cout << "-------------" << endl;
-    }
+    transform(rotation.linear(), rotation.translation());
   }
 
   // ##########  containsAtom  ##########
 
   bool SkeletonTree::containsAtom(Atom *atom)
   {
-    return m_rootNode ? m_rootNode->containsAtom(atom) : false;
+    if (!atom || atom->id() >= static_cast<unsigned long>(m_contains.size()))
+      return false;
+    return m_contains.testBit(atom->id());
   }
 
 }
-
@@ -31,7 +31,8 @@
 #define SKELETONTREE_H
 
 #include <QObject>
-#include <QList>
+#include <QBitArray>
+#include <QVector>
 
 #include <Eigen/Geometry>
 
@@ -41,87 +42,18 @@ namespace Avogadro {
   class Bond;
   class Molecule;
 
-  /**
-   * @class Node
-   * @brief A node of a tree used to represent a molecule in a skeletal-like structure.
-   * @author Shahzad Ali, Ross Braithwaite, James Bunt
-   *
-   * This class represents a node in a particular tree structure.  It holds
-   * an Atom and pointers to any number of child nodes.
-   */
-  class Node : public QObject
-  {
-    Q_OBJECT
-
-    protected:
-      Atom* m_atom;
-      QList<Node*> m_nodes;
-
-    public:
-      //! Constructor
-      /**
-       * Constructs a new Node.
-       *
-       * @param atom The Atom contained within this new Node.
-       */
-      Node(Atom *atom);
-
-      //! Deconstructor
-      virtual ~Node();
-
-      /**
-       * Retrieves a pointer to the Atom stored in this Node.
-       *
-       * @return A pointer to the Atom stored in this Node.
-       */
-      Atom *atom();
-
-      /**
-       * Gets all of this Node's children.
-       *
-       * @return A QList of pointers to all the children Nodes of this Node.
-       */
-      QList<Node*> nodes();
-
-      /**
-       * Determines whether or not this Node is a leaf in the SkeletonTree.
-       *
-       * @return True if this Node is a leaf in the tree, false otherwise.
-       */
-      bool isLeaf();
-
-      /**
-       * Determines whether or not this Node, or any of the Nodes in the (sub)tree
-       * that this Node is the root of, contains the given Atom.
-       *
-       * @param atom The Atom being searched for in this Node's (sub)tree.
-       *
-       * @return True if the Atom was found in the (sub)tree, false otherwise.
-       */
-      bool containsAtom(Atom* atom);
-
-      /**
-       * Adds the given Node as a child of this Node.
-       *
-       * @param node The Node being made a child of this Node.
-       */
-      void addNode(Node* node);
-
-      /**
-       * Removes the given Node from this Node's children.
-       *
-       * @param node The Node being removed from this Node's children.
-       */
-      void removeNode(Node* node);
-  };
-
   /**
    * @class SkeletonTree
    * @brief Skeletal representation and manipulation of a Molecule.
    * @author Shahzad Ali, Ross Braithwaite, James Bunt
    *
-   * This class creates and provides methods to manipulate a Molecule
-   * recursively (e.g., change a bond length or angle)
+   * This class finds the fragment of a Molecule on the root Atom's side of
+   * a Bond and provides methods to move it (e.g., change a bond length or
+   * angle). The fragment is found by breadth-first searches over the bonds
+   * of each atom, so it takes time proportional to the size of the
+   * molecule, and is kept as a list of atom ids which the transforms run
+   * over directly. The transforms do not signal any updates, call
+   * Molecule::update() once when done.
    */
   class SkeletonTree : public QObject
   {
@@ -149,6 +81,9 @@ namespace Avogadro {
 
       /**
        * Populates the tree from the Molecule, using the root node Atom.
+       * The fragment is the root Atom and all atoms bonded to it, directly
+       * or not, except through the root Bond. If the root Bond is in a
+       * ring, atoms also reachable from the other side are left out.
        *
        * @param rootAtom The root node Atom.
        * @param rootBond The Bond at which the root node Atom is.
@@ -176,15 +111,7 @@ namespace Avogadro {
                             const Eigen::Vector3d &centerVector);
 
       /**
-       * Recusively prints the children of this Node and child Nodes.
-       *
-       * @param n The root Node of the tree to print.
-       */
-      void printSkeleton(Node* n);
-
-      /**
-       * Determines whether or not this SkeletonTree contains a Node with the
-       * given Atom.
+       * Determines whether or not this SkeletonTree contains the given Atom.
        *
        * @param atom The Atom being searched for in this SkeletonTree.
        *
@@ -192,45 +119,26 @@ namespace Avogadro {
        */
       bool containsAtom(Atom *atom);
 
-    protected:
-      Node *m_rootNode; //The root node, tree
-      Bond *m_rootBond; //The bond at which root node atom is attached
-      Node *m_endNode;  //A temporary tree.
-
-    private:
       /**
-       * Recursively populates the tree, where the Node node is the root
-       * node to start from.
-       * It makes sure not to form loops.
-       *
-       * @param mol The molecule to form the tree for.
-       * @param node The root node to form the tree from.
-       * @param bond The bond at which the root node atom exists.
+       * @return The ids of the Atoms in the skeleton, in increasing order.
        */
-      void recursivePopulate(Molecule* mol, Node* node, Bond* bond);
+      const QVector<unsigned long> & atomIds() const { return m_atomIds; }
 
-      /**
-       * Recursively translates the Atoms attached to Node n in the skeleton by
-       * the given location.
-       * @param n The node atom and the atoms attached to it to translates.
-       * @param x New x location
-       * @param y New y location
-       * @param z New z location
-       */
-      void recursiveTranslate(Node* n, const Eigen::Vector3d &translationVector);
+    protected:
+      Molecule *m_molecule;
+      Atom *m_rootAtom;
+      Bond *m_rootBond; //The bond at which root node atom is attached
+      QVector<unsigned long> m_atomIds; // The atoms to move
+      QBitArray m_contains;             // Bits of m_atomIds
 
+    private:
       /**
-       * Recursivly rotates the Atoms attached to Node n in skeleton,
-       * around the Vector centerVector.
-       *
-       * @param n Current node to rotate
-       * @param rotationMatrix The rotation matrix for the transformation.
-       * @param centerVector Center location to rotate around.
+       * Moves each skeleton atom from p to @p linear * p + @p translation.
        */
-      void recursiveRotate(Node* n,
-                           const Eigen::Transform3d &rotationMatrix);
-
+      void transform(const Eigen::Matrix3d &linear,
+                     const Eigen::Vector3d &translation);
   };
+
 } // End namespace Avogadro
 
 #endif /*__SKELETONTREE_H */
@@ -43,9 +43,15 @@ namespace Avogadro {
 
   void ZMatrixModel::setZMatrix(ZMatrix *zmatrix)
   {
-    disconnect(m_zMatrix, 0, 0, 0);
+    if (m_zMatrix) {
+      disconnect(m_zMatrix, 0, 0, 0);
+      disconnect(m_zMatrix->m_molecule, 0, this, 0);
+    }
     m_zMatrix = zmatrix;
     connect(m_zMatrix, SIGNAL(rowAdded(int)), this, SLOT(addRow(int)));
+    // Atoms moved elsewhere are read back into the table in one pass
+    connect(m_zMatrix->m_molecule, SIGNAL(updated()),
+            this, SLOT(updateFromMolecule()));
     qDebug() << "Set z matrix" << m_zMatrix;
   }
 
@@ -195,7 +201,7 @@ namespace Avogadro {
         case 3: {// Connectivity element 1
           int connection = value.toInt() - 1;
           if (connection >= 0 && connection < row)
-            m_zMatrix->m_items[index.row()].indices[1] = connection;
+            m_zMatrix->setReference(index.row(), 1, connection);
           break;
         }
         case 4: // Bond angle
@@ -204,7 +210,7 @@ namespace Avogadro {
         case 5: {// Connectivity element 2
           int connection = value.toInt() - 1;
           if (connection >= 0 && connection < row)
-            m_zMatrix->m_items[index.row()].indices[2] = connection;
+            m_zMatrix->setReference(index.row(), 2, connection);
           break;
         }
         case 6: // Dihedral angle
@@ -243,5 +249,11 @@ namespace Avogadro {
     endInsertRows();
   }
 
+  void ZMatrixModel::updateFromMolecule()
+  {
+    if (m_zMatrix && m_zMatrix->updateInternalCoordinates())
+      emit dataChanged(index(0, 0), index(m_zMatrix->rows() - 1, 6));
+  }
+
 } // End namespace Avogadro
 
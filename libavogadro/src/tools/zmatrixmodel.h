@@ -62,6 +62,11 @@ namespace Avogadro {
 
   public Q_SLOTS:
     void addRow(int row);
+
+    /**
+     * Read the internal coordinates back from the atom positions.
+     */
+    void updateFromMolecule();
   };
 
 } // End namespace Avogadro
@@ -0,0 +1,497 @@
+/**********************************************************************
+  TrajectoryAnalysis - RMSD, RMSF, radius of gyration and geometry series
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "trajectoryanalysis.h"
+#include "superposition.h"
+
+#include <avogadro/molecule.h>
+#include <avogadro/atom.h>
+
+#include <openbabel/mol.h>
+#include <openbabel/obconversion.h>
+
+#include <QFile>
+#include <QObject>
+#include <QStringList>
+#include <QThread>
+#include <QtCore/QtConcurrentMap>
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+using namespace Eigen;
+
+namespace Avogadro {
+
+  ConformerFrameSource::ConformerFrameSource(const Molecule *molecule)
+    : m_molecule(molecule), m_next(0)
+  {
+    foreach (Atom *atom, molecule->atoms())
+      m_ids.append(atom->id());
+  }
+
+  int ConformerFrameSource::numAtoms() const
+  {
+    return m_ids.size();
+  }
+
+  bool ConformerFrameSource::rewind()
+  {
+    m_next = 0;
+    return true;
+  }
+
+  int ConformerFrameSource::readFrames(double *coordinates, int maxFrames)
+  {
+    const std::vector<std::vector<Vector3d> *> &conformers = m_molecule->conformers();
+    const int n = m_ids.size();
+    int count = 0;
+    while (count < maxFrames && m_next < conformers.size()) {
+      const std::vector<Vector3d> &frame = *conformers[m_next++];
+      double *out = coordinates + 3 * n * count;
+      for (int i = 0; i < n; ++i) {
+        const Vector3d &pos = frame[m_ids[i]];
+        out[3*i] = pos.x();
+        out[3*i+1] = pos.y();
+        out[3*i+2] = pos.z();
+      }
+      ++count;
+    }
+    return count;
+  }
+
+  FileFrameSource::FileFrameSource(const QString &fileName)
+    : m_file(0), m_conversion(new OpenBabel::OBConversion),
+      m_frame(new OpenBabel::OBMol), m_numAtoms(0), m_pending(false)
+  {
+    OpenBabel::OBFormat *format =
+      m_conversion->FormatFromExt(QFile::encodeName(fileName).data());
+    if (!format || !m_conversion->SetInFormat(format))
+      return;
+
+    m_file = new std::ifstream(QFile::encodeName(fileName));
+    if (!m_file->good())
+      return;
+    // The first frame tells the number of atoms
+    if (m_conversion->Read(m_frame, m_file)) {
+      m_numAtoms = m_frame->NumAtoms();
+      m_pending = true;
+    }
+  }
+
+  FileFrameSource::~FileFrameSource()
+  {
+    delete m_file;
+    delete m_frame;
+    delete m_conversion;
+  }
+
+  bool FileFrameSource::isValid() const
+  {
+    return m_numAtoms > 0;
+  }
+
+  int FileFrameSource::numAtoms() const
+  {
+    return m_numAtoms;
+  }
+
+  bool FileFrameSource::rewind()
+  {
+    if (!m_file)
+      return false;
+    m_file->clear();
+    m_file->seekg(0, std::ios::beg);
+    m_pending = false;
+    return m_file->good();
+  }
+
+  int FileFrameSource::readFrames(double *coordinates, int maxFrames)
+  {
+    if (!isValid())
+      return 0;
+    int count = 0;
+    while (count < maxFrames) {
+      if (m_pending)
+        m_pending = false;
+      else {
+        m_frame->Clear();
+        if (!m_conversion->Read(m_frame, m_file))
+          break;
+      }
+      if (static_cast<int>(m_frame->NumAtoms()) != m_numAtoms)
+        return -1;
+      memcpy(coordinates + 3 * m_numAtoms * count, m_frame->GetCoordinates(),
+             3 * m_numAtoms * sizeof(double));
+      ++count;
+    }
+    return count;
+  }
+
+  class TrajectoryAnalysisPrivate
+  {
+    public:
+      TrajectoryAnalysisPrivate() : molecule(0), massWeighted(true),
+        chunkSize(256), numAtoms(0), totalMass(0.0), numFrames(0) {}
+
+      const Molecule *molecule;
+      QList<int> fitAtoms;
+      QVector<double> reference;
+      bool massWeighted;
+      QList<QList<int> > measurements;
+      int chunkSize;
+
+      // Set up by run()
+      int numAtoms;
+      QVector<double> masses;
+      double totalMass;
+      QVector<double> referenceFit;   // reference restricted to the fit atoms
+
+      // Results
+      int numFrames;
+      QVector<double> rmsd;
+      QVector<double> radius;
+      QVector<double> rmsf;
+      QVector<QVector<double> > series;
+  };
+
+  /**
+   * A run of consecutive frames of a chunk and the per-atom sums of the
+   * frames this block has seen, kept across chunks.
+   */
+  struct FrameBlock
+  {
+    const TrajectoryAnalysisPrivate *d;
+    const double *frames;    // first frame of the block
+    int first;               // its index in the trajectory
+    int count;
+    double * const *results; // rmsd, radius, then the measurements
+    QVector<double> fit;     // scratch for the fit atoms of a frame
+    QVector<double> sum;     // sum of the deviations from the reference
+    QVector<double> sumSquares;
+  };
+
+  static double angle(const Vector3d &a, const Vector3d &b, const Vector3d &c)
+  {
+    Vector3d u = a - b, v = c - b;
+    return atan2(u.cross(v).norm(), u.dot(v)) * 180.0 / M_PI;
+  }
+
+  static double dihedral(const Vector3d &a, const Vector3d &b,
+                         const Vector3d &c, const Vector3d &d)
+  {
+    Vector3d b1 = b - a, b2 = c - b, b3 = d - c;
+    Vector3d n1 = b1.cross(b2), n2 = b2.cross(b3);
+    return atan2(b2.norm() * b1.dot(n2), n1.dot(n2)) * 180.0 / M_PI;
+  }
+
+  static void analyseBlock(FrameBlock &block)
+  {
+    const TrajectoryAnalysisPrivate *d = block.d;
+    const int n = d->numAtoms;
+    const int nFit = d->fitAtoms.isEmpty() ? n : d->fitAtoms.size();
+    const double *reference = d->reference.constData();
+    double * const *results = block.results;
+    Matrix3d rotation;
+    Vector3d translation;
+
+    for (int f = 0; f < block.count; ++f) {
+      const double *frame = block.frames + 3 * n * f;
+      const int index = block.first + f;
+
+      // RMSD after superposing the fit atoms
+      const double *fit = frame;
+      if (!d->fitAtoms.isEmpty()) {
+        double *scratch = block.fit.data();
+        for (int k = 0; k < nFit; ++k)
+          memcpy(scratch + 3 * k, frame + 3 * d->fitAtoms[k], 3 * sizeof(double));
+        fit = scratch;
+      }
+      results[0][index] = Superposition::fit(fit, d->referenceFit.constData(), nFit,
+                                             rotation, translation);
+
+      // Deviations of the superposed atoms, summed for the RMSF
+      double *sum = block.sum.data(), *sumSquares = block.sumSquares.data();
+      for (int i = 0; i < n; ++i) {
+        Vector3d deviation = rotation * Vector3d(frame + 3 * i) + translation
+          - Vector3d(reference + 3 * i);
+        sum[3*i] += deviation.x();
+        sum[3*i+1] += deviation.y();
+        sum[3*i+2] += deviation.z();
+        sumSquares[i] += deviation.squaredNorm();
+      }
+
+      // Radius of gyration about the (weighted) centroid
+      Vector3d center = Vector3d::Zero();
+      for (int i = 0; i < n; ++i)
+        center += d->masses[i] * Vector3d(frame + 3 * i);
+      center /= d->totalMass;
+      double moment = 0.0;
+      for (int i = 0; i < n; ++i)
+        moment += d->masses[i] * (Vector3d(frame + 3 * i) - center).squaredNorm();
+      results[1][index] = sqrt(moment / d->totalMass);
+
+      for (int m = 0; m < d->measurements.size(); ++m) {
+        const QList<int> &atoms = d->measurements[m];
+        Vector3d p[4];
+        for (int k = 0; k < atoms.size(); ++k)
+          p[k] = Vector3d(frame + 3 * atoms[k]);
+        double value = 0.0;
+        if (atoms.size() == 2)
+          value = (p[1] - p[0]).norm();
+        else if (atoms.size() == 3)
+          value = angle(p[0], p[1], p[2]);
+        else
+          value = dihedral(p[0], p[1], p[2], p[3]);
+        results[2 + m][index] = value;
+      }
+    }
+  }
+
+  TrajectoryAnalysis::TrajectoryAnalysis() : d(new TrajectoryAnalysisPrivate)
+  {
+  }
+
+  TrajectoryAnalysis::~TrajectoryAnalysis()
+  {
+    delete d;
+  }
+
+  void TrajectoryAnalysis::setMolecule(const Molecule *molecule)
+  {
+    d->molecule = molecule;
+  }
+
+  void TrajectoryAnalysis::setFitAtoms(const QList<int> &indices)
+  {
+    d->fitAtoms = indices;
+  }
+
+  QList<int> TrajectoryAnalysis::fitAtoms() const
+  {
+    return d->fitAtoms;
+  }
+
+  void TrajectoryAnalysis::setReference(const QVector<double> &coordinates)
+  {
+    d->reference = coordinates;
+  }
+
+  void TrajectoryAnalysis::setMassWeighted(bool weighted)
+  {
+    d->massWeighted = weighted;
+  }
+
+  bool TrajectoryAnalysis::massWeighted() const
+  {
+    return d->massWeighted;
+  }
+
+  int TrajectoryAnalysis::addMeasurement(const QList<int> &atoms)
+  {
+    if (atoms.size() < 2 || atoms.size() > 4)
+      return -1;
+    d->measurements.append(atoms);
+    return d->measurements.size() - 1;
+  }
+
+  void TrajectoryAnalysis::clearMeasurements()
+  {
+    d->measurements.clear();
+    d->series.clear();
+  }
+
+  int TrajectoryAnalysis::numMeasurements() const
+  {
+    return d->measurements.size();
+  }
+
+  QList<int> TrajectoryAnalysis::measurementAtoms(int i) const
+  {
+    return d->measurements.value(i);
+  }
+
+  QString TrajectoryAnalysis::measurementName(int i) const
+  {
+    const QList<int> atoms = d->measurements.value(i);
+    QStringList numbers;
+    foreach (int index, atoms)
+      numbers << QString::number(index + 1);
+    QString kind;
+    if (atoms.size() == 2)
+      kind = QObject::tr("Distance");
+    else if (atoms.size() == 3)
+      kind = QObject::tr("Angle");
+    else
+      kind = QObject::tr("Dihedral");
+    return kind + ' ' + numbers.join("-");
+  }
+
+  void TrajectoryAnalysis::setChunkSize(int frames)
+  {
+    d->chunkSize = qMax(1, frames);
+  }
+
+  int TrajectoryAnalysis::chunkSize() const
+  {
+    return d->chunkSize;
+  }
+
+  bool TrajectoryAnalysis::run(TrajectoryFrameSource *source)
+  {
+    d->numFrames = 0;
+    d->rmsd.clear();
+    d->radius.clear();
+    d->rmsf.clear();
+    d->series.clear();
+
+    if (!d->molecule || !source)
+      return false;
+    const int n = d->molecule->numAtoms();
+    if (!n || source->numAtoms() != n || !source->rewind())
+      return false;
+    foreach (int index, d->fitAtoms)
+      if (index < 0 || index >= n)
+        return false;
+    foreach (const QList<int> &atoms, d->measurements)
+      foreach (int index, atoms)
+        if (index < 0 || index >= n)
+          return false;
+
+    d->numAtoms = n;
+    d->masses.fill(1.0, n);
+    if (d->massWeighted) {
+      foreach (Atom *atom, d->molecule->atoms())
+        d->masses[atom->index()] = OpenBabel::etab.GetMass(atom->atomicNumber());
+    }
+    d->totalMass = 0.0;
+    for (int i = 0; i < n; ++i)
+      d->totalMass += d->masses[i];
+
+    const int nFit = d->fitAtoms.isEmpty() ? n : d->fitAtoms.size();
+    const int numResults = 2 + d->measurements.size();
+    QVector<QVector<double> > results(numResults);
+    QVector<double *> outputs(numResults);
+
+    // One block per thread, all buffers reused from chunk to chunk
+    const int numBlocks = qMax(1, QThread::idealThreadCount());
+    QVector<double> buffer(3 * n * d->chunkSize);
+    QVector<FrameBlock> blocks(numBlocks);
+    for (int b = 0; b < numBlocks; ++b) {
+      blocks[b].d = d;
+      blocks[b].results = outputs.constData();
+      blocks[b].fit.resize(3 * nFit);
+      blocks[b].sum.fill(0.0, 3 * n);
+      blocks[b].sumSquares.fill(0.0, n);
+    }
+
+    int numFrames = 0;
+    bool referenceFromFrames = d->reference.size() != 3 * n;
+    int read;
+    while ((read = source->readFrames(buffer.data(), d->chunkSize)) > 0) {
+      if (numFrames == 0) {
+        if (referenceFromFrames) {
+          d->reference.resize(3 * n);
+          memcpy(d->reference.data(), buffer.constData(), 3 * n * sizeof(double));
+        }
+        d->referenceFit.resize(3 * nFit);
+        for (int k = 0; k < nFit; ++k) {
+          const int i = d->fitAtoms.isEmpty() ? k : d->fitAtoms[k];
+          memcpy(d->referenceFit.data() + 3 * k, d->reference.constData() + 3 * i,
+                 3 * sizeof(double));
+        }
+      }
+
+      // Resizing may move the data, so the blocks get fresh pointers
+      for (int r = 0; r < numResults; ++r) {
+        results[r].resize(numFrames + read);
+        outputs[r] = results[r].data();
+      }
+
+      const int perBlock = (read + numBlocks - 1) / numBlocks;
+      for (int b = 0; b < numBlocks; ++b) {
+        const int start = qMin(read, b * perBlock);
+        blocks[b].frames = buffer.constData() + 3 * n * start;
+        blocks[b].first = numFrames + start;
+        blocks[b].count = qMin(read, start + perBlock) - start;
+      }
+      QtConcurrent::blockingMap(blocks, analyseBlock);
+      numFrames += read;
+    }
+    if (referenceFromFrames)
+      d->reference.clear();
+    if (read < 0)
+      return false;
+
+    // RMSF about the average of the superposed positions
+    d->rmsf.fill(0.0, n);
+    if (numFrames) {
+      for (int i = 0; i < n; ++i) {
+        Vector3d mean = Vector3d::Zero();
+        double meanSquare = 0.0;
+        foreach (const FrameBlock &block, blocks) {
+          mean += Vector3d(block.sum.constData() + 3 * i);
+          meanSquare += block.sumSquares[i];
+        }
+        mean /= numFrames;
+        meanSquare /= numFrames;
+        const double variance = meanSquare - mean.squaredNorm();
+        d->rmsf[i] = variance > 0.0 ? sqrt(variance) : 0.0;
+      }
+    }
+
+    d->numFrames = numFrames;
+    d->rmsd = results[0];
+    d->radius = results[1];
+    d->series = results.mid(2);
+    return true;
+  }
+
+  int TrajectoryAnalysis::numFrames() const
+  {
+    return d->numFrames;
+  }
+
+  QVector<double> TrajectoryAnalysis::rmsd() const
+  {
+    return d->rmsd;
+  }
+
+  QVector<double> TrajectoryAnalysis::radiusOfGyration() const
+  {
+    return d->radius;
+  }
+
+  QVector<double> TrajectoryAnalysis::rmsf() const
+  {
+    return d->rmsf;
+  }
+
+  QVector<double> TrajectoryAnalysis::measurement(int i) const
+  {
+    return d->series.value(i);
+  }
+
+} // End namespace Avogadro
@@ -0,0 +1,245 @@
+/**********************************************************************
+  TrajectoryAnalysis - RMSD, RMSF, radius of gyration and geometry series
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef TRAJECTORYANALYSIS_H
+#define TRAJECTORYANALYSIS_H
+
+#include <avogadro/global.h>
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include <iosfwd>
+
+namespace OpenBabel {
+  class OBConversion;
+  class OBMol;
+}
+
+namespace Avogadro {
+
+  class Molecule;
+
+  /**
+   * @class TrajectoryFrameSource trajectoryanalysis.h <avogadro/trajectoryanalysis.h>
+   * @brief Sequential access to the frames of a trajectory.
+   *
+   * Frames are read in chunks into a buffer owned by the caller, as packed
+   * x, y, z coordinates in the order of the atom indices, so a trajectory
+   * never has to be held in memory as a whole.
+   */
+  class A_EXPORT TrajectoryFrameSource
+  {
+    public:
+      virtual ~TrajectoryFrameSource() {}
+
+      /**
+       * @return The number of atoms in every frame.
+       */
+      virtual int numAtoms() const = 0;
+
+      /**
+       * Go back to the first frame.
+       * @return false if the source cannot be read again.
+       */
+      virtual bool rewind() = 0;
+
+      /**
+       * Read up to @p maxFrames frames into @p coordinates, which has room
+       * for 3 * numAtoms() * @p maxFrames values.
+       * @return The number of frames read, 0 at the end and -1 if a frame
+       * does not match numAtoms().
+       */
+      virtual int readFrames(double *coordinates, int maxFrames) = 0;
+  };
+
+  /**
+   * @class ConformerFrameSource trajectoryanalysis.h <avogadro/trajectoryanalysis.h>
+   * @brief The conformers of a Molecule as trajectory frames.
+   */
+  class A_EXPORT ConformerFrameSource : public TrajectoryFrameSource
+  {
+    public:
+      /**
+       * The molecule has to stay unchanged while the frames are read.
+       */
+      explicit ConformerFrameSource(const Molecule *molecule);
+
+      int numAtoms() const;
+      bool rewind();
+      int readFrames(double *coordinates, int maxFrames);
+
+    private:
+      const Molecule *m_molecule;
+      QVector<unsigned long> m_ids;   // atom id of each index
+      unsigned int m_next;
+  };
+
+  /**
+   * @class FileFrameSource trajectoryanalysis.h <avogadro/trajectoryanalysis.h>
+   * @brief Frames streamed from a multi-structure file.
+   *
+   * Any format Open Babel reads more than one structure from works, such
+   * as multi-frame XYZ or multi-model PDB. Only the frames of the current
+   * chunk are decoded, into a single reused OBMol.
+   */
+  class A_EXPORT FileFrameSource : public TrajectoryFrameSource
+  {
+    public:
+      explicit FileFrameSource(const QString &fileName);
+      ~FileFrameSource();
+
+      /**
+       * @return True if the file was opened and its first frame read.
+       */
+      bool isValid() const;
+
+      int numAtoms() const;
+      bool rewind();
+      int readFrames(double *coordinates, int maxFrames);
+
+    private:
+      std::ifstream *m_file;
+      OpenBabel::OBConversion *m_conversion;
+      OpenBabel::OBMol *m_frame;
+      int m_numAtoms;
+      bool m_pending;   // the first frame was read to find numAtoms()
+  };
+
+  /**
+   * @class TrajectoryAnalysis trajectoryanalysis.h <avogadro/trajectoryanalysis.h>
+   * @brief Per-frame and per-atom properties of a trajectory.
+   *
+   * run() reads the frames chunk by chunk and spreads each chunk over all
+   * cores. For every frame it computes the RMSD to the reference after the
+   * best superposition of the fit atoms, the radius of gyration and the
+   * requested distances, angles and dihedrals. The superposed positions are
+   * accumulated per atom for the RMSF, the fluctuation about the average
+   * structure, so one pass over the frames is enough. Buffers are allocated
+   * once per run, not per frame.
+   *
+   * @code
+   * TrajectoryAnalysis analysis;
+   * analysis.setMolecule(molecule);
+   * analysis.addMeasurement(QList<int>() << 0 << 5);
+   * ConformerFrameSource frames(molecule);
+   * if (analysis.run(&frames))
+   *   plot(analysis.rmsd(), analysis.measurement(0));
+   * @endcode
+   */
+  class TrajectoryAnalysisPrivate;
+  class A_EXPORT TrajectoryAnalysis
+  {
+    public:
+      TrajectoryAnalysis();
+      ~TrajectoryAnalysis();
+
+      /**
+       * Take the atoms and their masses from @p molecule, which has to stay
+       * unchanged until run() returns.
+       */
+      void setMolecule(const Molecule *molecule);
+
+      /**
+       * Superpose only the atoms with these indices for the RMSD and RMSF,
+       * for example the backbone. All atoms are used if it is empty.
+       */
+      void setFitAtoms(const QList<int> &indices);
+      QList<int> fitAtoms() const;
+
+      /**
+       * Compare against @p coordinates, packed like the frames. With an empty
+       * reference, the default, the first frame is used.
+       */
+      void setReference(const QVector<double> &coordinates);
+
+      /**
+       * Weight the radius of gyration by the atomic masses, the default.
+       */
+      void setMassWeighted(bool weighted);
+      bool massWeighted() const;
+
+      /**
+       * Follow the distance between two atoms, the angle between three or the
+       * dihedral between four, given by their indices.
+       * @return The index of the measurement, -1 if it has the wrong size.
+       */
+      int addMeasurement(const QList<int> &atoms);
+      void clearMeasurements();
+      int numMeasurements() const;
+      QList<int> measurementAtoms(int i) const;
+
+      /**
+       * @return A label for measurement @p i, such as "Distance 1-2".
+       */
+      QString measurementName(int i) const;
+
+      /**
+       * The number of frames read and analysed at a time, 256 by default.
+       */
+      void setChunkSize(int frames);
+      int chunkSize() const;
+
+      /**
+       * Analyse all frames of @p source.
+       * @return false if the source does not match the molecule.
+       */
+      bool run(TrajectoryFrameSource *source);
+
+      /**
+       * @return The number of frames analysed by the last run().
+       */
+      int numFrames() const;
+
+      /**
+       * @return The RMSD of the fit atoms to the reference for each frame, in
+       * Angstrom.
+       */
+      QVector<double> rmsd() const;
+
+      /**
+       * @return The radius of gyration for each frame, in Angstrom.
+       */
+      QVector<double> radiusOfGyration() const;
+
+      /**
+       * @return The RMSF of each atom by index, in Angstrom.
+       */
+      QVector<double> rmsf() const;
+
+      /**
+       * @return The values of measurement @p i for each frame, in Angstrom
+       * or degrees.
+       */
+      QVector<double> measurement(int i) const;
+
+    private:
+      TrajectoryAnalysisPrivate * const d;
+      Q_DISABLE_COPY(TrajectoryAnalysis)
+  };
+
+} // End namespace Avogadro
+
+#endif
@@ -0,0 +1,372 @@
+/**********************************************************************
+  TransparencyPass - Weighted blended order independent transparency
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include "config.h"
+
+#ifdef ENABLE_GLSL
+  #include <GL/glew.h>
+#endif
+
+#include "transparencypass_p.h"
+
+#include <QGLWidget> // for OpenGL bits
+#include <QDebug>
+
+namespace Avogadro {
+
+#ifdef ENABLE_GLSL
+  // Fixed function style lighting of the (at most two) scene lights, the
+  // eye space depth is passed on for the weight function. With the color
+  // material the diffuse color and alpha come from gl_Color per vertex.
+  static const char *accumulateVertex =
+    "uniform int lights;\n"
+    "uniform int colorMaterial;\n"
+    "varying vec4 color;\n"
+    "varying float depth;\n"
+    "void main()\n"
+    "{\n"
+    "  vec4 eye = gl_ModelViewMatrix * gl_Vertex;\n"
+    "  vec3 n = normalize(gl_NormalMatrix * gl_Normal);\n"
+    "  vec3 v = normalize(-eye.xyz);\n"
+    "  vec4 c = gl_FrontLightModelProduct.sceneColor;\n"
+    "  for (int i = 0; i < lights; ++i) {\n"
+    "    vec3 l = normalize(gl_LightSource[i].position.xyz\n"
+    "                       - eye.xyz * gl_LightSource[i].position.w);\n"
+    "    float diffuse = max(dot(n, l), 0.0);\n"
+    "    vec4 diffuseProduct = colorMaterial != 0 ?\n"
+    "      gl_Color * gl_LightSource[i].diffuse : gl_FrontLightProduct[i].diffuse;\n"
+    "    c += gl_FrontLightProduct[i].ambient + diffuse * diffuseProduct;\n"
+    "    if (diffuse > 0.0)\n"
+    "      c += pow(max(dot(n, normalize(l + v)), 0.0),\n"
+    "               gl_FrontMaterial.shininess) * gl_FrontLightProduct[i].specular;\n"
+    "  }\n"
+    "  color = vec4(c.rgb, colorMaterial != 0 ? gl_Color.a\n"
+    "                                         : gl_FrontMaterial.diffuse.a);\n"
+    "  depth = -eye.z;\n"
+    "  gl_Position = ftransform();\n"
+    "}\n";
+
+  // Target 0: rgb = sum of premultiplied weighted colors, a = product of
+  // (1 - alpha). Target 1: r = sum of the weights. Both are blended with
+  // (ONE, ONE) on color and (ZERO, ONE_MINUS_SRC_ALPHA) on alpha.
+  static const char *accumulateFragment =
+    "varying vec4 color;\n"
+    "varying float depth;\n"
+    "void main()\n"
+    "{\n"
+    "  float a = color.a;\n"
+    "  float w = clamp(10.0 / (1e-5 + pow(depth / 5.0, 2.0)\n"
+    "                         + pow(depth / 200.0, 6.0)), 1e-2, 3e3) * a;\n"
+    "  gl_FragData[0] = vec4(color.rgb * w, a);\n"
+    "  gl_FragData[1] = vec4(w, 0.0, 0.0, a);\n"
+    "}\n";
+
+  static const char *compositeFragment =
+    "uniform sampler2D accumulation;\n"
+    "uniform sampler2D weights;\n"
+    "void main()\n"
+    "{\n"
+    "  vec4 accum = texture2D(accumulation, gl_TexCoord[0].st);\n"
+    "  float revealage = accum.a;\n"
+    "  if (revealage > 0.9999)\n"
+    "    discard;\n"
+    "  float weight = texture2D(weights, gl_TexCoord[0].st).r;\n"
+    "  gl_FragColor = vec4(accum.rgb / max(weight, 1e-5), 1.0 - revealage);\n"
+    "}\n";
+#endif
+
+  class TransparencyPassPrivate
+  {
+  public:
+    TransparencyPassPrivate() : checked(false), supported(false), active(false),
+      width(0), height(0), framebuffer(0), depthBuffer(0),
+#ifdef ENABLE_GLSL
+      accumulateProgram(0), compositeProgram(0),
+#endif
+      previousFramebuffer(0)
+    {
+      textures[0] = textures[1] = 0;
+      viewport[0] = viewport[1] = viewport[2] = viewport[3] = 0;
+    }
+
+    bool checked;
+    bool supported;
+    bool active;
+
+    int width;
+    int height;
+    GLuint framebuffer;
+    GLuint textures[2];
+    GLuint depthBuffer;
+#ifdef ENABLE_GLSL
+    GLhandleARB accumulateProgram;
+    GLhandleARB compositeProgram;
+#endif
+
+    GLint previousFramebuffer;
+    GLint viewport[4];
+
+#ifdef ENABLE_GLSL
+    GLhandleARB compile(const char *vertex, const char *fragment);
+    bool resize(int w, int h);
+#endif
+  };
+
+#ifdef ENABLE_GLSL
+  GLhandleARB TransparencyPassPrivate::compile(const char *vertex,
+                                               const char *fragment)
+  {
+    GLhandleARB program = glCreateProgramObjectARB();
+    GLhandleARB shaders[2] = { 0, 0 };
+    if (vertex) {
+      shaders[0] = glCreateShaderObjectARB(GL_VERTEX_SHADER_ARB);
+      glShaderSourceARB(shaders[0], 1, &vertex, 0);
+      glCompileShaderARB(shaders[0]);
+      glAttachObjectARB(program, shaders[0]);
+    }
+    shaders[1] = glCreateShaderObjectARB(GL_FRAGMENT_SHADER_ARB);
+    glShaderSourceARB(shaders[1], 1, &fragment, 0);
+    glCompileShaderARB(shaders[1]);
+    glAttachObjectARB(program, shaders[1]);
+    glLinkProgramARB(program);
+
+    for (int i = 0; i < 2; ++i) {
+      if (shaders[i]) {
+        glDetachObjectARB(program, shaders[i]);
+        glDeleteObjectARB(shaders[i]);
+      }
+    }
+
+    GLint linked = 0;
+    glGetObjectParameterivARB(program, GL_OBJECT_LINK_STATUS_ARB, &linked);
+    if (!linked) {
+      char log[1024];
+      glGetInfoLogARB(program, sizeof(log), 0, log);
+      qDebug() << "TransparencyPass: shader failed to link:" << log;
+      glDeleteObjectARB(program);
+      return 0;
+    }
+    return program;
+  }
+
+  bool TransparencyPassPrivate::resize(int w, int h)
+  {
+    if (framebuffer && w == width && h == height)
+      return true;
+
+    if (!framebuffer) {
+      glGenFramebuffersEXT(1, &framebuffer);
+      glGenTextures(2, textures);
+      glGenRenderbuffersEXT(1, &depthBuffer);
+    }
+    width = w;
+    height = h;
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+    for (int i = 0; i < 2; ++i) {
+      glBindTexture(GL_TEXTURE_2D, textures[i]);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F_ARB, w, h, 0, GL_RGBA,
+                   GL_FLOAT, 0);
+      glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
+                                GL_COLOR_ATTACHMENT0_EXT + i,
+                                GL_TEXTURE_2D, textures[i], 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depthBuffer);
+    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, w, h);
+    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
+                                 GL_RENDERBUFFER_EXT, depthBuffer);
+    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+
+    GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, previousFramebuffer);
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+      qDebug() << "TransparencyPass: incomplete frame buffer" << status;
+      supported = false;
+      return false;
+    }
+    return true;
+  }
+#endif
+
+  TransparencyPass::TransparencyPass() : d(new TransparencyPassPrivate)
+  {
+  }
+
+  TransparencyPass::~TransparencyPass()
+  {
+    delete d;
+  }
+
+  bool TransparencyPass::isSupported()
+  {
+#ifdef ENABLE_GLSL
+    if (!d->checked) {
+      d->checked = true;
+      d->supported = GLEW_ARB_shader_objects && GLEW_ARB_fragment_shader
+        && GLEW_EXT_framebuffer_object && GLEW_EXT_framebuffer_blit
+        && (GLEW_ARB_texture_float || GLEW_VERSION_3_0)
+        && (GLEW_ARB_draw_buffers || GLEW_VERSION_2_0);
+      if (d->supported) {
+        d->accumulateProgram = d->compile(accumulateVertex, accumulateFragment);
+        d->compositeProgram = d->compile(0, compositeFragment);
+        d->supported = d->accumulateProgram && d->compositeProgram;
+      }
+      if (!d->supported)
+        qDebug() << "Order independent transparency not supported.";
+    }
+    return d->supported;
+#else
+    return false;
+#endif
+  }
+
+  bool TransparencyPass::begin()
+  {
+#ifdef ENABLE_GLSL
+    if (d->active || !isSupported())
+      return false;
+
+    // Render into targets the size of the current viewport, copying the
+    // depth of the opaque layer from whatever frame buffer is bound
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &d->previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, d->viewport);
+    if (!d->resize(d->viewport[2], d->viewport[3]))
+      return false;
+
+    glBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, d->previousFramebuffer);
+    glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, d->framebuffer);
+    glBlitFramebufferEXT(d->viewport[0], d->viewport[1],
+                         d->viewport[0] + d->width, d->viewport[1] + d->height,
+                         0, 0, d->width, d->height,
+                         GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, d->framebuffer);
+
+    glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_ENABLE_BIT
+                 | GL_VIEWPORT_BIT);
+    glViewport(0, 0, d->width, d->height);
+    GLenum buffers[2] = { GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT };
+    glDrawBuffersARB(2, buffers);
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Test against the opaque depth but never write it, order does not
+    // matter as long as everything reaches the blender
+    glDepthMask(GL_FALSE);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+
+    glUseProgramObjectARB(d->accumulateProgram);
+    glUniform1iARB(glGetUniformLocationARB(d->accumulateProgram, "lights"),
+                   glIsEnabled(GL_LIGHT1) ? 2 : 1);
+    glUniform1iARB(glGetUniformLocationARB(d->accumulateProgram, "colorMaterial"),
+                   0);
+    d->active = true;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void TransparencyPass::end()
+  {
+#ifdef ENABLE_GLSL
+    if (!d->active)
+      return;
+    d->active = false;
+
+    glUseProgramObjectARB(0);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, d->previousFramebuffer);
+    glPopAttrib();
+
+    // One screen sized quad, whatever was drawn in the pass
+    glPushAttrib(GL_COLOR_BUFFER_BIT | GL_ENABLE_BIT | GL_TEXTURE_BIT);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_FOG);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glUseProgramObjectARB(d->compositeProgram);
+    glUniform1iARB(glGetUniformLocationARB(d->compositeProgram, "accumulation"), 0);
+    glUniform1iARB(glGetUniformLocationARB(d->compositeProgram, "weights"), 1);
+    glActiveTextureARB(GL_TEXTURE1_ARB);
+    glBindTexture(GL_TEXTURE_2D, d->textures[1]);
+    glActiveTextureARB(GL_TEXTURE0_ARB);
+    glBindTexture(GL_TEXTURE_2D, d->textures[0]);
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0, 0.0); glVertex2f(-1.0, -1.0);
+    glTexCoord2f(1.0, 0.0); glVertex2f(1.0, -1.0);
+    glTexCoord2f(1.0, 1.0); glVertex2f(1.0, 1.0);
+    glTexCoord2f(0.0, 1.0); glVertex2f(-1.0, 1.0);
+    glEnd();
+
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+
+    glActiveTextureARB(GL_TEXTURE1_ARB);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTextureARB(GL_TEXTURE0_ARB);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgramObjectARB(0);
+    glPopAttrib();
+#endif
+  }
+
+  void TransparencyPass::release()
+  {
+#ifdef ENABLE_GLSL
+    if (d->framebuffer) {
+      glDeleteFramebuffersEXT(1, &d->framebuffer);
+      glDeleteTextures(2, d->textures);
+      glDeleteRenderbuffersEXT(1, &d->depthBuffer);
+      d->framebuffer = 0;
+    }
+    if (d->accumulateProgram)
+      glDeleteObjectARB(d->accumulateProgram);
+    if (d->compositeProgram)
+      glDeleteObjectARB(d->compositeProgram);
+    d->accumulateProgram = d->compositeProgram = 0;
+    d->checked = d->supported = false;
+#endif
+  }
+
+} // End namespace Avogadro
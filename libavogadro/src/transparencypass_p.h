@@ -0,0 +1,89 @@
+/**********************************************************************
+  TransparencyPass - Weighted blended order independent transparency
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#ifndef TRANSPARENCYPASS_P_H
+#define TRANSPARENCYPASS_P_H
+
+namespace Avogadro {
+
+  class TransparencyPassPrivate;
+
+  /**
+   * @class TransparencyPass
+   * @internal
+   * @brief Renders the transparent layer without sorting.
+   *
+   * Implements weighted blended order independent transparency (McGuire and
+   * Bavoil, JCGT 2013). Between begin() and end() every fragment is lit by a
+   * shader that mimics the fixed function lighting and accumulated into two
+   * floating point targets: the premultiplied color weighted by depth and
+   * alpha, and the product of (1 - alpha) of all fragments. The order in
+   * which primitives arrive therefore does not matter, and end() blends the
+   * result over the opaque scene with a single full screen quad whatever the
+   * number of translucent primitives.
+   *
+   * The opaque depth buffer is copied so that translucent fragments hidden
+   * behind opaque geometry are still rejected. Requires GLSL, frame buffer
+   * objects with multiple render targets and floating point textures, see
+   * isSupported().
+   */
+  class TransparencyPass
+  {
+  public:
+    TransparencyPass();
+    ~TransparencyPass();
+
+    /**
+     * @return true if the OpenGL implementation of the current context can
+     * run the pass.
+     */
+    bool isSupported();
+
+    /**
+     * Redirect rendering to the accumulation targets. Must be called with
+     * the opaque layer complete in the currently bound frame buffer.
+     * @return false if the pass could not be set up, in which case nothing
+     * was changed and the caller should blend as usual.
+     */
+    bool begin();
+
+    /**
+     * Composite the accumulated transparent layer over the frame buffer
+     * that was bound when begin() was called.
+     */
+    void end();
+
+    /**
+     * Free the GL resources, the current context must be the one the pass
+     * was used with.
+     */
+    void release();
+
+  private:
+    TransparencyPassPrivate * const d;
+  };
+
+} // End namespace Avogadro
+
+#endif
@@ -24,6 +24,17 @@
 
 #include "undosequence.h"
 
+#include <avogadro/molecule.h>
+
+#include <QPointer>
+#include <QReadWriteLock>
+
+#include <cmath>
+#include <cstring>
+#include <map>
+
+using Eigen::Vector3d;
+
 namespace Avogadro {
 
   class UndoSequencePrivate {
@@ -67,4 +78,489 @@ namespace Avogadro {
     d->commands.append(command);
   }
 
+  // Displacements that do not fit in 52 bits of quanta are stored exactly
+  static const double MAX_QUANTA = 4.0e15;
+
+  static inline void writeVarint(QByteArray &out, quint64 value)
+  {
+    while (value >= 0x80) {
+      out.append(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+  }
+
+  static inline quint64 readVarint(const char *&p)
+  {
+    quint64 value = 0;
+    int shift = 0;
+    unsigned char c;
+    do {
+      c = static_cast<unsigned char>(*p++);
+      value |= static_cast<quint64>(c & 0x7f) << shift;
+      shift += 7;
+    } while (c & 0x80);
+    return value;
+  }
+
+  static inline quint64 zigzag(quint64 n)
+  {
+    return (n << 1) ^ (0 - (n >> 63));
+  }
+
+  static inline qint64 unzigzag(quint64 v)
+  {
+    return static_cast<qint64>(v >> 1) ^ -static_cast<qint64>(v & 1);
+  }
+
+  // Doubles mapped to integers in the same order, adjacent doubles being
+  // adjacent integers, so that differences count units in the last place
+  static inline quint64 toOrdinal(double x)
+  {
+    quint64 bits;
+    memcpy(&bits, &x, sizeof(bits));
+    if (bits >> 63)
+      return ~(bits & Q_UINT64_C(0x7fffffffffffffff));
+    return bits;
+  }
+
+  static inline double fromOrdinal(quint64 ordinal)
+  {
+    quint64 bits = ordinal;
+    if (ordinal >> 63)
+      bits = (~ordinal) | Q_UINT64_C(0x8000000000000000);
+    double x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+  }
+
+  // FNV-1a over the coordinates, to tell whether anything moved the atoms
+  // between two commands
+  static quint64 hashPositions(const std::vector<Vector3d> &positions)
+  {
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    for (unsigned int i = 0; i < positions.size(); ++i)
+      for (int k = 0; k < 3; ++k) {
+        hash ^= toOrdinal(positions[i][k]);
+        hash *= Q_UINT64_C(1099511628211);
+      }
+    return hash;
+  }
+
+  class PositionDeltaPrivate
+  {
+    public:
+      PositionDeltaPrivate() : count(0), quantum(0.0) {}
+
+      QByteArray ids;      // gaps between the ids of the moved atoms
+      QByteArray values;   // three varints per moved atom
+      int count;
+      double quantum;
+
+      // Decoded form, for append(): zigzag differences by atom id
+      struct Triple
+      {
+        Triple() { v[0] = v[1] = v[2] = 0; }
+        quint64 & operator[](int k) { return v[k]; }
+        quint64 operator[](int k) const { return v[k]; }
+        quint64 v[3];
+      };
+      typedef std::map<quint64, Triple> Decoded;
+      void decode(Decoded &decoded) const;
+      void encode(const Decoded &decoded);
+      void patch(std::vector<Vector3d> &positions, int sign) const;
+  };
+
+  void PositionDeltaPrivate::decode(Decoded &decoded) const
+  {
+    const char *ip = ids.constData(), *vp = values.constData();
+    qint64 id = -1;
+    for (int n = 0; n < count; ++n) {
+      id += readVarint(ip) + 1;
+      PositionDeltaPrivate::Triple &v = decoded[id];
+      for (int k = 0; k < 3; ++k)
+        v[k] = readVarint(vp);
+    }
+  }
+
+  void PositionDeltaPrivate::encode(const Decoded &decoded)
+  {
+    ids.clear();
+    values.clear();
+    count = 0;
+    qint64 last = -1;
+    for (Decoded::const_iterator it = decoded.begin(); it != decoded.end(); ++it) {
+      if (!it->second[0] && !it->second[1] && !it->second[2])
+        continue;
+      writeVarint(ids, it->first - last - 1);
+      last = it->first;
+      for (int k = 0; k < 3; ++k)
+        writeVarint(values, it->second[k]);
+      ++count;
+    }
+    ids.squeeze();
+    values.squeeze();
+  }
+
+  void PositionDeltaPrivate::patch(std::vector<Vector3d> &positions, int sign) const
+  {
+    const char *ip = ids.constData(), *vp = values.constData();
+    qint64 id = -1;
+    for (int n = 0; n < count; ++n) {
+      id += readVarint(ip) + 1;
+      quint64 v[3];
+      for (int k = 0; k < 3; ++k)
+        v[k] = readVarint(vp);
+      if (id >= static_cast<qint64>(positions.size()))
+        continue;
+      Vector3d &pos = positions[id];
+      for (int k = 0; k < 3; ++k) {
+        quint64 step = static_cast<quint64>(unzigzag(v[k]));
+        if (sign < 0)
+          step = 0 - step;
+        if (quantum > 0.0)
+          pos[k] += static_cast<qint64>(step) * quantum;
+        else
+          pos[k] = fromOrdinal(toOrdinal(pos[k]) + step);
+      }
+    }
+  }
+
+  PositionDelta::PositionDelta() : d(new PositionDeltaPrivate)
+  {
+  }
+
+  PositionDelta::~PositionDelta()
+  {
+    delete d;
+  }
+
+  void PositionDelta::record(const std::vector<Vector3d> &before,
+                             const std::vector<Vector3d> &after,
+                             double quantum)
+  {
+    clear();
+    const unsigned int size = qMin(before.size(), after.size());
+
+    if (quantum > 0.0)
+      for (unsigned int id = 0; id < size; ++id)
+        if ((after[id] - before[id]).cwise().abs().maxCoeff() > MAX_QUANTA * quantum) {
+          quantum = 0.0;
+          break;
+        }
+    d->quantum = quantum > 0.0 ? quantum : 0.0;
+
+    qint64 last = -1;
+    for (unsigned int id = 0; id < size; ++id) {
+      quint64 v[3];
+      for (int k = 0; k < 3; ++k)
+        v[k] = d->quantum > 0.0
+          ? zigzag(qRound64((after[id][k] - before[id][k]) / d->quantum))
+          : zigzag(toOrdinal(after[id][k]) - toOrdinal(before[id][k]));
+      if (!v[0] && !v[1] && !v[2])
+        continue;
+
+      writeVarint(d->ids, id - last - 1);
+      last = id;
+      for (int k = 0; k < 3; ++k)
+        writeVarint(d->values, v[k]);
+      ++d->count;
+    }
+    d->ids.squeeze();
+    d->values.squeeze();
+  }
+
+  void PositionDelta::revert(std::vector<Vector3d> &positions) const
+  {
+    d->patch(positions, -1);
+  }
+
+  void PositionDelta::apply(std::vector<Vector3d> &positions) const
+  {
+    d->patch(positions, 1);
+  }
+
+  bool PositionDelta::append(const PositionDelta &later)
+  {
+    if (later.isEmpty())
+      return true;
+    if (isEmpty()) {
+      d->quantum = later.d->quantum;
+    } else if (d->quantum != later.d->quantum)
+      return false;
+
+    // Both kinds of difference compose by addition
+    PositionDeltaPrivate::Decoded decoded, next;
+    d->decode(decoded);
+    later.d->decode(next);
+    for (PositionDeltaPrivate::Decoded::const_iterator it = next.begin();
+         it != next.end(); ++it) {
+      PositionDeltaPrivate::Triple &v = decoded[it->first];
+      for (int k = 0; k < 3; ++k)
+        v[k] = zigzag(static_cast<quint64>(unzigzag(v[k]))
+                      + static_cast<quint64>(unzigzag(it->second[k])));
+    }
+    d->encode(decoded);
+    return true;
+  }
+
+  void PositionDelta::swap(PositionDelta &other)
+  {
+    qSwap(d->ids, other.d->ids);
+    qSwap(d->values, other.d->values);
+    qSwap(d->count, other.d->count);
+    qSwap(d->quantum, other.d->quantum);
+  }
+
+  void PositionDelta::clear()
+  {
+    d->ids.clear();
+    d->values.clear();
+    d->count = 0;
+    d->quantum = 0.0;
+  }
+
+  bool PositionDelta::isEmpty() const
+  {
+    return d->count == 0;
+  }
+
+  int PositionDelta::numAtoms() const
+  {
+    return d->count;
+  }
+
+  double PositionDelta::quantum() const
+  {
+    return d->quantum;
+  }
+
+  int PositionDelta::memoryUsage() const
+  {
+    return sizeof(PositionDeltaPrivate) + d->ids.capacity() + d->values.capacity();
+  }
+
+  class PositionUndoCommandPrivate
+  {
+    public:
+      PositionUndoCommandPrivate() : conformer(0), quantum(0.0),
+        committed(false), undone(false), beforeVersion(0), afterVersion(0),
+        beforeHash(0), afterHash(0), barrier(false) {}
+
+      QPointer<Molecule> molecule;
+      unsigned int conformer;
+      std::vector<Vector3d> snapshot;  // positions until the commit
+      PositionDelta delta;
+      double quantum;
+      bool committed;
+      bool undone;
+
+      // The molecule on construction and on commit. Commands are only
+      // coalesced if nothing changed it from the end of one to the start
+      // of the next, see enforceBudget()
+      unsigned long beforeVersion, afterVersion;
+      quint64 beforeHash, afterHash;
+      bool barrier;  // a command restoring a whole molecule followed
+
+      std::vector<Vector3d> * positions() const;
+      bool follows(const PositionUndoCommandPrivate *older) const;
+
+      // All live position commands in order of creation, GUI thread only
+      static QList<PositionUndoCommand *> commands;
+      static qint64 budget;
+      static void enforceBudget();
+  };
+
+  QList<PositionUndoCommand *> PositionUndoCommandPrivate::commands;
+  qint64 PositionUndoCommandPrivate::budget = 64 * 1024 * 1024;
+
+  std::vector<Vector3d> * PositionUndoCommandPrivate::positions() const
+  {
+    if (!molecule)
+      return 0;
+    // conformer(0) is the current conformer, so go through the list
+    const std::vector<std::vector<Vector3d> *> &all = molecule->conformers();
+    return conformer < all.size() ? all[conformer] : 0;
+  }
+
+  bool PositionUndoCommandPrivate::follows(const PositionUndoCommandPrivate *older) const
+  {
+    // Undoing the merged change must give the state before the older
+    // command. Commands in between that moved atoms, changed the topology
+    // (and with it the ids) or restore copies of the molecule on undo
+    // would be undone on top of the wrong positions.
+    return older->committed && committed && !older->undone && !undone
+      && !older->barrier && older->molecule == molecule
+      && older->conformer == conformer
+      && older->afterVersion == beforeVersion
+      && older->afterHash == beforeHash;
+  }
+
+  void PositionUndoCommandPrivate::enforceBudget()
+  {
+    while (PositionUndoCommand::totalMemoryUsage() > budget) {
+      // Fold the oldest change into the next command if nothing else
+      // changed the molecule between them
+      bool merged = false;
+      for (int i = 0; i + 1 < commands.size() && !merged; ++i) {
+        PositionUndoCommand *older = commands[i];
+        PositionUndoCommandPrivate *a = older->d, *b = commands[i + 1]->d;
+        if (!b->follows(a))
+          continue;
+        if (!a->delta.append(b->delta))
+          continue;
+        b->delta.swap(a->delta);
+        a->delta.clear();
+        // The newer command now starts where the older one did
+        b->beforeVersion = a->beforeVersion;
+        b->beforeHash = a->beforeHash;
+        older->setText(QObject::tr("%1 (merged with the next step)").arg(older->text()));
+        commands.removeAt(i);
+        merged = true;
+      }
+      if (!merged)
+        break;
+    }
+  }
+
+  PositionUndoCommand::PositionUndoCommand(Molecule *molecule, QUndoCommand *parent)
+    : QUndoCommand(parent), d(new PositionUndoCommandPrivate)
+  {
+    d->molecule = molecule;
+    if (molecule) {
+      d->conformer = molecule->currentConformer();
+      d->beforeVersion = molecule->topologyVersion();
+      std::vector<Vector3d> *positions = d->positions();
+      if (positions) {
+        d->snapshot = *positions;
+        d->beforeHash = hashPositions(*positions);
+      }
+    }
+
+    PositionUndoCommandPrivate::commands.append(this);
+    PositionUndoCommandPrivate::enforceBudget();
+  }
+
+  PositionUndoCommand::~PositionUndoCommand()
+  {
+    PositionUndoCommandPrivate::commands.removeAll(this);
+    delete d;
+  }
+
+  void PositionUndoCommand::setQuantum(double quantum)
+  {
+    d->quantum = quantum;
+  }
+
+  double PositionUndoCommand::quantum() const
+  {
+    return d->quantum;
+  }
+
+  void PositionUndoCommand::commit()
+  {
+    if (d->committed)
+      return;
+    std::vector<Vector3d> *positions = d->positions();
+    if (positions) {
+      d->delta.record(d->snapshot, *positions, d->quantum);
+      d->afterHash = hashPositions(*positions);
+    }
+    if (d->molecule)
+      d->afterVersion = d->molecule->topologyVersion();
+    std::vector<Vector3d>().swap(d->snapshot);
+    d->committed = true;
+    PositionUndoCommandPrivate::enforceBudget();
+  }
+
+  bool PositionUndoCommand::isUndone() const
+  {
+    return d->undone;
+  }
+
+  void PositionUndoCommand::undo()
+  {
+    commit();
+    std::vector<Vector3d> *positions = d->positions();
+    if (positions && !d->delta.isEmpty()) {
+      d->molecule->lock()->lockForWrite();
+      d->delta.revert(*positions);
+      d->molecule->lock()->unlock();
+      d->molecule->update();
+    }
+    d->undone = true;
+  }
+
+  void PositionUndoCommand::redo()
+  {
+    // The first redo() happens on push, after the tool made the change
+    if (!d->undone) {
+      commit();
+      return;
+    }
+    std::vector<Vector3d> *positions = d->positions();
+    if (positions && !d->delta.isEmpty()) {
+      d->molecule->lock()->lockForWrite();
+      d->delta.apply(*positions);
+      d->molecule->lock()->unlock();
+      d->molecule->update();
+    }
+    d->undone = false;
+  }
+
+  int PositionUndoCommand::memoryUsage() const
+  {
+    return sizeof(PositionUndoCommandPrivate) + d->delta.memoryUsage()
+      + d->snapshot.capacity() * sizeof(Vector3d);
+  }
+
+  void PositionUndoCommand::setMemoryBudget(qint64 bytes)
+  {
+    PositionUndoCommandPrivate::budget = bytes;
+    PositionUndoCommandPrivate::enforceBudget();
+  }
+
+  qint64 PositionUndoCommand::memoryBudget()
+  {
+    return PositionUndoCommandPrivate::budget;
+  }
+
+  qint64 PositionUndoCommand::totalMemoryUsage()
+  {
+    qint64 total = 0;
+    foreach (const PositionUndoCommand *command, PositionUndoCommandPrivate::commands)
+      total += command->memoryUsage();
+    return total;
+  }
+
+  bool PositionUndoCommand::absorb(const PositionUndoCommand *later)
+  {
+    if (!later || later->d->molecule != d->molecule
+        || later->d->conformer != d->conformer)
+      return false;
+    // later was pushed right after us, so both changes are complete
+    commit();
+    if (!d->delta.append(later->d->delta))
+      return false;
+    d->afterVersion = later->d->afterVersion;
+    d->afterHash = later->d->afterHash;
+    return true;
+  }
+
+  void PositionUndoCommand::mergeBarrier(Molecule *molecule)
+  {
+    // Only the latest command of the molecule can be merged with later ones
+    QList<PositionUndoCommand *> &commands = PositionUndoCommandPrivate::commands;
+    for (int i = commands.size() - 1; i >= 0; --i)
+      if (commands.at(i)->d->molecule == molecule) {
+        commands.at(i)->d->barrier = true;
+        break;
+      }
+  }
+
+  Molecule * PositionUndoCommand::molecule() const
+  {
+    return d->molecule;
+  }
+
 } // end namespace Avogadro
@@ -29,8 +29,14 @@
 
 #include <avogadro/global.h>
 
+#include <Eigen/Core>
+
+#include <vector>
+
 namespace Avogadro {
 
+  class Molecule;
+
   /**
    * @class UndoSequence undosequence.h <avogadro/undosequence.h>
    * @brief Provides a sequence of Undo/Redo commands in a single command
@@ -60,6 +66,169 @@ namespace Avogadro {
       UndoSequencePrivate * const d;
   };
 
+  /**
+   * @class PositionDelta undosequence.h <avogadro/undosequence.h>
+   * @brief Compact record of the atom positions changed between two states.
+   *
+   * Only atoms that moved are stored, as gaps between their ids followed by
+   * their coordinates, all as variable length integers. Exact deltas keep
+   * the difference of the coordinates in units in the last place, so both
+   * states are recovered bit for bit, in a few bytes for nearby values.
+   * Quantized deltas store the displacement in multiples of a quantum
+   * instead, typically one or two bytes per coordinate, and restore each
+   * coordinate to within half a quantum.
+   *
+   * Positions are vectors indexed by atom id like Molecule::conformer(), so
+   * topology changes between recording and restoring are harmless: atoms
+   * added later are not touched.
+   */
+  class PositionDeltaPrivate;
+  class A_EXPORT PositionDelta
+  {
+    public:
+      PositionDelta();
+      ~PositionDelta();
+
+      /**
+       * Record the change from @p before to @p after. With @p quantum > 0
+       * the displacements are rounded to multiples of @p quantum Angstrom.
+       */
+      void record(const std::vector<Eigen::Vector3d> &before,
+                  const std::vector<Eigen::Vector3d> &after,
+                  double quantum = 0.0);
+
+      /**
+       * Take @p positions from the after state back to the before state.
+       */
+      void revert(std::vector<Eigen::Vector3d> &positions) const;
+
+      /**
+       * Take @p positions from the before state to the after state.
+       */
+      void apply(std::vector<Eigen::Vector3d> &positions) const;
+
+      /**
+       * Extend this delta with @p later, which starts where this one ends.
+       * @return false if the two were recorded with different quanta.
+       */
+      bool append(const PositionDelta &later);
+
+      /**
+       * Exchange the contents with @p other.
+       */
+      void swap(PositionDelta &other);
+
+      void clear();
+      bool isEmpty() const;
+
+      /**
+       * @return The number of atoms that moved.
+       */
+      int numAtoms() const;
+
+      /**
+       * @return The quantum used by record(), 0 for exact deltas.
+       */
+      double quantum() const;
+
+      /**
+       * @return The number of bytes held.
+       */
+      int memoryUsage() const;
+
+    private:
+      PositionDeltaPrivate * const d;
+      Q_DISABLE_COPY(PositionDelta)
+  };
+
+  /**
+   * @class PositionUndoCommand undosequence.h <avogadro/undosequence.h>
+   * @brief Base class for commands that only move atoms.
+   *
+   * The positions of the current conformer are copied on construction. The
+   * change is encoded as a PositionDelta when the command is pushed, by its
+   * first redo(), or when commit() is called. Tools therefore create the
+   * command when an interaction starts and push it when it ends. undo() and
+   * redo() then patch the positions in place instead of copying whole
+   * molecules.
+   *
+   * All position commands share a memory budget. Once it is exceeded, the
+   * oldest pairs of neighboring commands are coalesced: the newer command
+   * takes over both changes and the older one becomes empty, so old history
+   * loses steps rather than memory growing without bound. Only commands
+   * with nothing in between that moved atoms or changed the topology are
+   * coalesced. Commands that restore a copy of the molecule on undo must
+   * call mergeBarrier() when they are created.
+   *
+   * Subclasses that merge repeated steps return absorb() from mergeWith().
+   */
+  class PositionUndoCommandPrivate;
+  class A_EXPORT PositionUndoCommand : public QUndoCommand
+  {
+    public:
+      explicit PositionUndoCommand(Molecule *molecule, QUndoCommand *parent = 0);
+      ~PositionUndoCommand();
+
+      /**
+       * Store displacements in multiples of @p quantum Angstrom, 0 (the
+       * default) keeps them exact. Has to be set before the commit.
+       */
+      void setQuantum(double quantum);
+      double quantum() const;
+
+      /**
+       * Encode the change since construction and release the copy of the
+       * positions. Nothing happens if it was already committed.
+       */
+      void commit();
+
+      /**
+       * @return True if the command is currently undone.
+       */
+      bool isUndone() const;
+
+      virtual void undo();
+      virtual void redo();
+
+      /**
+       * @return The number of bytes held by this command.
+       */
+      int memoryUsage() const;
+
+      /**
+       * Set the memory shared by all position commands, 64 MB by default.
+       */
+      static void setMemoryBudget(qint64 bytes);
+      static qint64 memoryBudget();
+
+      /**
+       * @return The number of bytes held by all position commands.
+       */
+      static qint64 totalMemoryUsage();
+
+      /**
+       * Keep the position commands of @p molecule created so far from being
+       * coalesced with later ones. Called by commands that restore a copy
+       * of the molecule on undo, which would otherwise restore it on top of
+       * changes already undone.
+       */
+      static void mergeBarrier(Molecule *molecule);
+
+    protected:
+      /**
+       * Add the change of @p later, pushed right after this command, for
+       * use in mergeWith().
+       * @return false if the changes can not be combined.
+       */
+      bool absorb(const PositionUndoCommand *later);
+
+      Molecule * molecule() const;
+
+    private:
+      PositionUndoCommandPrivate * const d;
+      friend class PositionUndoCommandPrivate;
+  };
+
 } // end namespace Avogadro
 
 #endif
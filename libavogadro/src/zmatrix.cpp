@@ -34,23 +34,186 @@
 #include <Eigen/Geometry>
 
 #include <QDebug>
+#include <QVector>
+#include <QtCore/QtConcurrentMap>
 
 namespace Avogadro{
 
   using Eigen::Vector3d;
 
-  ZMatrix::ZMatrix(QObject *parent) : QObject(parent)
+  // Rows per block of work, fewer than two blocks are not worth the threads
+  static const int rowsPerBlock = 1024;
+
+  // A run of rows that can be calculated independently of each other
+  struct ZMatrixBlock
+  {
+    const int *rows;         // the rows of the block, or 0 for a run of rows
+    int first, count;        // from first
+    const int *references;   // three per row, -1 where there is none
+    double *values;          // three per row, lengths and angles
+    Vector3d *positions;     // by row
+  };
+
+  class ZMatrixPrivate
+  {
+    public:
+      ZMatrixPrivate() : compiled(false), writing(false) {}
+
+      QVector<int> references;     // three per row, -1 where there is none
+      QVector<int> order;          // the rows sorted by depth
+      QVector<int> levels;         // start of each depth in order, then the end
+      QVector<double> values;
+      QVector<Vector3d> positions; // scratch buffer, by row
+      bool compiled;
+      bool writing;
+
+      void compile(const QList<ZMatrix::zItem> &items);
+  };
+
+  // Rows 0 to 2 are placed on their own, all others from the three rows they
+  // refer to. Their depth is one more than the deepest of those, so all
+  // rows of one depth only need rows of lower depths to have been placed.
+  // The references of rows 1 and 2 are still kept for measuring them.
+  void ZMatrixPrivate::compile(const QList<ZMatrix::zItem> &items)
+  {
+    const int n = items.size();
+    references.fill(-1, 3 * n);
+    QVector<int> depth(n, 0);
+    int maxDepth = 0;
+    for (int i = 1; i < n; ++i) {
+      for (int j = 0; j < qMin(i, 3); ++j) {
+        const int reference = items.at(i).indices[j];
+        if (reference < 0 || reference >= i)
+          continue;
+        references[3 * i + j] = reference;
+        if (i >= 3)
+          depth[i] = qMax(depth.at(i), depth.at(reference) + 1);
+      }
+      maxDepth = qMax(maxDepth, depth.at(i));
+    }
+
+    levels.fill(0, maxDepth + 2);
+    for (int i = 0; i < n; ++i)
+      ++levels[depth.at(i) + 1];
+    for (int l = 1; l < levels.size(); ++l)
+      levels[l] += levels.at(l - 1);
+    order.resize(n);
+    QVector<int> next = levels;
+    for (int i = 0; i < n; ++i)
+      order[next[depth.at(i)]++] = i;
+    compiled = true;
+  }
+
+  static void placeRow(int row, const int *references, const double *values,
+                       Vector3d *positions)
+  {
+    const double length = values[3 * row];
+    const double angle = values[3 * row + 1];
+    if (row == 0) { // First atom - origin
+      positions[row] = Vector3d::Zero();
+      return;
+    }
+    else if (row == 1) { // Second atom - just length
+      positions[row] = Vector3d(length, 0.0, 0.0);
+      return;
+    }
+    else if (row == 2) { // Third atom - length and angle
+      positions[row] = Vector3d(length * cos(angle), length * sin(angle), 0.0);
+      return;
+    }
+
+    // The general case where all three values are set
+    const double dihedral = values[3 * row + 2];
+    const int *r = references + 3 * row;
+    const Vector3d a1 = r[0] < 0 ? Vector3d::Zero() : positions[r[0]];
+    const Vector3d a2 = r[1] < 0 ? Vector3d::Zero() : positions[r[1]];
+    const Vector3d a3 = r[2] < 0 ? Vector3d::Zero() : positions[r[2]];
+
+    // Dihedral angle - perform rotation
+    Vector3d v1(a1 - a2);
+    Vector3d v2(a1 - a3);
+    if (v1.norm() < 0.01 || v2.norm() < 0.01) { // Undefined
+      positions[row] = a1;
+      return;
+    }
+    // Find the two orthogonal axes for the dihedral angle rotation
+    Vector3d axis1 = v1.cross(v2).normalized();
+    Vector3d axis2 = v1.cross(axis1).normalized();
+    axis1 *= -sin(dihedral);
+    axis2 *= cos(dihedral);
+    // Now rotate about the bond angle
+    Vector3d v3 = (axis1 + axis2).normalized();
+    v3 *= length * sin(angle);
+    v1.normalize();
+    v1 *= length * cos(angle);
+    // Now we have the position of the new atom
+    positions[row] = a1 + v3 - v1;
+  }
+
+  static void placeBlock(ZMatrixBlock &block)
+  {
+    for (int i = 0; i < block.count; ++i)
+      placeRow(block.rows[block.first + i], block.references, block.values,
+               block.positions);
+  }
+
+  // The inverse of placeRow, writing the values of one row in degrees. Rows
+  // that cannot be measured keep the values they had.
+  static void measureRow(int row, const int *references, const Vector3d *positions,
+                         double *values)
+  {
+    if (row == 0)
+      return;
+    const int *r = references + 3 * row;
+    const Vector3d &p = positions[row];
+    if (r[0] < 0)
+      return;
+    const Vector3d &a1 = positions[r[0]];
+    const Vector3d u(p - a1);
+    const double length = u.norm();
+    if (length < 0.01)
+      return;
+    values[3 * row] = length;
+    if (row == 1 || r[1] < 0)
+      return;
+    const Vector3d v1(a1 - positions[r[1]]);
+    if (v1.norm() < 0.01)
+      return;
+    // The bond angle is between the new bond and a2 - a1, that is -v1
+    const double cosAngle = qBound(-1.0, -u.dot(v1) / (length * v1.norm()), 1.0);
+    values[3 * row + 1] = acos(cosAngle) / cDegToRad;
+    if (row == 2 || r[2] < 0)
+      return;
+    const Vector3d v2(a1 - positions[r[2]]);
+    const Vector3d normal = v1.cross(v2);
+    if (v2.norm() < 0.01 || normal.norm() < 1e-8)
+      return;
+    const Vector3d axis1 = normal.normalized();
+    const Vector3d axis2 = v1.cross(axis1).normalized();
+    values[3 * row + 2] = atan2(-u.dot(axis1), u.dot(axis2)) / cDegToRad;
+  }
+
+  // For the inverse all rows are independent, so blocks are just runs of rows
+  static void measureBlock(ZMatrixBlock &block)
+  {
+    for (int row = block.first; row < block.first + block.count; ++row)
+      measureRow(row, block.references, block.positions, block.values);
+  }
+
+  ZMatrix::ZMatrix(QObject *parent) : QObject(parent), d(new ZMatrixPrivate)
   {
     m_molecule = qobject_cast<Molecule *>(parent);
   }
 
   ZMatrix::~ZMatrix()
   {
+    delete d;
   }
 
   void ZMatrix::addRow(int row)
   {
     qDebug() << "Adding new row" << row << m_items.size();
+    d->compiled = false;
     if (row == -1) {
       m_items.push_back(zItem());
       m_items.last().atomIndex = m_molecule->addAtom()->id();
@@ -96,57 +259,122 @@ namespace Avogadro{
                                m_items[m_items[atom1].indices[0]].atomIndex);
     b->setAtoms(m_items[atom1].atomIndex, m_items[atom2].atomIndex);
     m_items[atom1].indices[0] = atom2;
+    d->compiled = false;
+  }
+
+  void ZMatrix::setReference(int row, int column, int reference)
+  {
+    if (row < 0 || row >= m_items.size() || column < 0 || column > 2)
+      return;
+    if (column == 0) {
+      setBond(row, reference);
+      return;
+    }
+    m_items[row].indices[column] = reference;
+    d->compiled = false;
   }
 
   void ZMatrix::update()
   {
-    // Start at the origin and calculate the coords relative to that
-    for(int i = 0; i < m_items.size(); ++i) {
-      Atom *a = m_molecule->atomById(m_items[i].atomIndex);
-      a->setAtomicNumber(m_items[i].atomicNumber);
-      if (i == 0) // First atom - origin
-        a->setPos(Vector3d::Zero());
-      else if (i == 1) // Second atom - just length
-        a->setPos(Vector3d(m_items[i].lengths[0], 0.0, 0.0));
-      else if (i == 2) { // Third atom - length and angle
-        double length = m_items[i].lengths[0];
-        double angle = m_items[i].lengths[1] * cDegToRad;
-        double x = length * cos(angle);
-        double y = length * sin(angle);
-        a->setPos(Vector3d(x, y, 0.0));
+    const int n = m_items.size();
+    if (!n)
+      return;
+    if (!d->compiled || d->order.size() != n)
+      d->compile(m_items);
+
+    d->values.resize(3 * n);
+    for (int i = 0; i < n; ++i) {
+      const zItem &item = m_items.at(i);
+      d->values[3 * i] = item.lengths[0];
+      d->values[3 * i + 1] = item.lengths[1] * cDegToRad;
+      d->values[3 * i + 2] = item.lengths[2] * cDegToRad;
+    }
+    d->positions.resize(n);
+
+    // Start at the origin and place the rows one depth at a time
+    const int *references = d->references.constData();
+    double *values = d->values.data();
+    Vector3d *positions = d->positions.data();
+    for (int l = 0; l + 1 < d->levels.size(); ++l) {
+      const int first = d->levels.at(l), end = d->levels.at(l + 1);
+      if (end - first < 2 * rowsPerBlock) {
+        for (int i = first; i < end; ++i)
+          placeRow(d->order.at(i), references, values, positions);
+        continue;
       }
-      else { // The general case where all three values are set
-        double length = m_items[i].lengths[0];
-        double angle = m_items[i].lengths[1] * cDegToRad;
-        double dihedral = m_items[i].lengths[2] * cDegToRad;
-        Atom *a1 = m_molecule->atomById(m_items[m_items[i].indices[0]].atomIndex);
-        Atom *a2 = m_molecule->atomById(m_items[m_items[i].indices[1]].atomIndex);
-        Atom *a3 = m_molecule->atomById(m_items[m_items[i].indices[2]].atomIndex);
-
-        // Dihedral angle - perform rotation
-        Vector3d v1(*a1->pos() - *a2->pos());
-        Vector3d v2(*a1->pos() - *a3->pos());
-        if (v1.norm() < 0.01 || v2.norm() < 0.01) {// Undefined
-          a->setPos(a1->pos());
-          continue;
-        }
-        // Find the two orthogonal axes for the dihedral angle rotation
-        Vector3d axis1 = v1.cross(v2).normalized();
-        Vector3d axis2 = v1.cross(axis1).normalized();
-        axis1 *= -sin(dihedral);
-        axis2 *= cos(dihedral);
-        // Now rotate about the bond angle
-        Vector3d v3 = (axis1 + axis2).normalized();
-        v3 *= length * sin(angle);
-        v1.normalize();
-        v1 *= length * cos(angle);
-        v2 = *a1->pos() + v3 - v1;
-        // Now we have the position of the new atom
-        a->setPos(v2);
+      QVector<ZMatrixBlock> blocks;
+      for (int i = first; i < end; i += rowsPerBlock) {
+        ZMatrixBlock block = { d->order.constData(), i,
+                               qMin(rowsPerBlock, end - i),
+                               references, values, positions };
+        blocks.append(block);
       }
+      QtConcurrent::blockingMap(blocks, placeBlock);
+    }
+
+    // Only changed elements are set as each one updates the molecule
+    d->writing = true;
+    for (int i = 0; i < n; ++i) {
+      Atom *a = m_molecule->atomById(m_items.at(i).atomIndex);
+      if (!a)
+        continue;
+      if (a->atomicNumber() != m_items.at(i).atomicNumber)
+        a->setAtomicNumber(m_items.at(i).atomicNumber);
+      m_molecule->setAtomPos(a->id(), positions[i]);
     }
+    m_molecule->update();
+    d->writing = false;
   }
 
+  bool ZMatrix::updateInternalCoordinates()
+  {
+    const int n = m_items.size();
+    if (!n || d->writing)
+      return false;
+    if (!d->compiled || d->order.size() != n)
+      d->compile(m_items);
+
+    d->positions.resize(n);
+    d->values.resize(3 * n);
+    QVector<bool> present(n, false);
+    for (int i = 0; i < n; ++i) {
+      const zItem &item = m_items.at(i);
+      for (int j = 0; j < 3; ++j)
+        d->values[3 * i + j] = item.lengths[j];
+      const Vector3d *pos = m_molecule->atomPos(item.atomIndex);
+      if (m_molecule->atomById(item.atomIndex) && pos) {
+        d->positions[i] = *pos;
+        present[i] = true;
+      }
+      else
+        d->positions[i] = Vector3d::Zero();
+    }
+    // Rows measured against a missing atom keep their values
+    QVector<int> references = d->references;
+    for (int i = 0; i < n; ++i)
+      for (int j = 0; j < 3; ++j) {
+        const int reference = references.at(3 * i + j);
+        if (!present.at(i) || (reference >= 0 && !present.at(reference)))
+          references[3 * i + j] = -1;
+      }
+
+    QVector<ZMatrixBlock> blocks;
+    for (int i = 0; i < n; i += rowsPerBlock) {
+      ZMatrixBlock block = { 0, i, qMin(rowsPerBlock, n - i),
+                             references.constData(), d->values.data(),
+                             d->positions.data() };
+      blocks.append(block);
+    }
+    if (blocks.size() > 1)
+      QtConcurrent::blockingMap(blocks, measureBlock);
+    else
+      measureBlock(blocks.first());
+
+    for (int i = 0; i < n; ++i)
+      for (int j = 0; j < 3; ++j)
+        m_items[i].lengths[j] = d->values.at(3 * i + j);
+    return true;
+  }
 
 } // End namespace Avogadro
 
@@ -33,6 +33,7 @@
 namespace Avogadro {
 
   class Molecule;
+  class ZMatrixPrivate;
 
   /**
    * @class ZMatrix zmatrix.h <avogadro/zmatrix.h>
@@ -42,6 +43,12 @@ namespace Avogadro {
    * The ZMatrix class is a Primitive subclass that provides a ZMatrix object.
    * All z matrices must be owned by a Molecule. It should also be removed by
    * the Molecule that owns it.
+   *
+   * The references between the rows are compiled into flat arrays, with the
+   * rows grouped by their depth in the reference graph, and only compiled
+   * again after addRow(), setBond() or setReference(). Rows of the same depth
+   * do not depend on each other and are placed in parallel when there are
+   * many of them.
    */
 
   class A_EXPORT ZMatrix : public QObject
@@ -78,10 +85,28 @@ namespace Avogadro {
     void setBond(int atom1, int atom2);
 
     /**
-     * Update the atoms of the z matrix according to the z matrix
+     * Set the row that @p row refers to for its bond (@p column 0), angle
+     * (1) or dihedral (2). Always use this rather than changing the indices
+     * of m_items directly, so the references are compiled again.
+     */
+    void setReference(int row, int column, int reference);
+
+    /**
+     * Update the atoms of the z matrix according to the z matrix. All the
+     * positions are calculated before any is written, and the molecule is
+     * updated once at the end.
      */
     void update();
 
+    /**
+     * Set the lengths, angles and dihedrals of all rows from the current
+     * positions of their atoms, the reverse of update(). Rows whose atoms
+     * are missing or on top of each other are left as they were.
+     * @return False if nothing was read, including while update() is
+     * writing the positions.
+     */
+    bool updateInternalCoordinates();
+
 //  private:
     /**
      * Struct storing a z-matrix
@@ -97,6 +122,9 @@ namespace Avogadro {
     QList<zItem> m_items;
     Molecule *m_molecule;
 
+  private:
+    ZMatrixPrivate * const d;
+
   Q_SIGNALS:
     void rowAdded(int row);
 
@@ -0,0 +1,141 @@
+/**********************************************************************
+  BondPerceptionTest - unit testing for the BondPerception class
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include <QtTest>
+#include <avogadro/bondperception.h>
+#include <avogadro/molecule.h>
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+
+#include <openbabel/data.h>
+#include <openbabel/generic.h>
+
+#include <Eigen/Core>
+
+using Avogadro::BondPerception;
+using Avogadro::Molecule;
+using Avogadro::Atom;
+using Avogadro::Bond;
+
+using Eigen::Vector3d;
+
+typedef QPair<int, int> AtomPair;
+
+class BondPerceptionTest : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    void bruteForce();
+    void periodic();
+    void updateBonds();
+};
+
+void BondPerceptionTest::bruteForce()
+{
+  // Random carbons, nitrogens and hydrogens at about liquid density
+  Molecule molecule;
+  qsrand(42);
+  const int elements[3] = { 1, 6, 7 };
+  for (int i = 0; i < 500; ++i) {
+    Atom *atom = molecule.addAtom();
+    atom->setAtomicNumber(elements[qrand() % 3]);
+    atom->setPos(Vector3d(qrand() % 1500 / 100.0, qrand() % 1500 / 100.0,
+                          qrand() % 1500 / 100.0));
+  }
+
+  BondPerception perception;
+  perception.setMolecule(&molecule);
+  QVector<AtomPair> bonds = perception.perceive();
+
+  QVector<AtomPair> expected;
+  QList<Atom *> atoms = molecule.atoms();
+  for (int i = 0; i < atoms.size(); ++i)
+    for (int j = i + 1; j < atoms.size(); ++j) {
+      const double cutoff = OpenBabel::etab.GetCovalentRad(atoms[i]->atomicNumber())
+        + OpenBabel::etab.GetCovalentRad(atoms[j]->atomicNumber()) + 0.45;
+      const double d2 = (*atoms[i]->pos() - *atoms[j]->pos()).squaredNorm();
+      if (d2 < cutoff * cutoff && d2 >= 0.40)
+        expected.append(qMakePair(i, j));
+    }
+  QVERIFY(!expected.isEmpty());
+  QCOMPARE(bonds, expected);
+}
+
+void BondPerceptionTest::periodic()
+{
+  // Two carbons 1.5 Angstrom apart through the faces of a 10 Angstrom cell
+  Molecule molecule;
+  Atom *a = molecule.addAtom();
+  a->setAtomicNumber(6);
+  a->setPos(Vector3d(0.5, 5.0, 5.0));
+  Atom *b = molecule.addAtom();
+  b->setAtomicNumber(6);
+  b->setPos(Vector3d(9.0, 5.0, 5.0));
+
+  OpenBabel::OBUnitCell *cell = new OpenBabel::OBUnitCell;
+  cell->SetData(10.0, 10.0, 10.0, 90.0, 90.0, 90.0);
+  molecule.setOBUnitCell(cell);
+
+  BondPerception perception;
+  perception.setMolecule(&molecule);
+  QCOMPARE(perception.perceive().size(), 1);
+  perception.setPeriodic(false);
+  QVERIFY(perception.perceive().isEmpty());
+
+  molecule.setOBUnitCell(0);
+  delete cell;
+}
+
+void BondPerceptionTest::updateBonds()
+{
+  // A chain of carbons 1.5 Angstrom apart
+  Molecule molecule;
+  for (int i = 0; i < 10; ++i) {
+    Atom *atom = molecule.addAtom();
+    atom->setAtomicNumber(6);
+    atom->setPos(Vector3d(1.5 * i, 0.0, 0.0));
+  }
+  BondPerception perception;
+  perception.setMolecule(&molecule);
+  QCOMPARE(perception.updateBonds(), 9);
+  QCOMPARE(molecule.numBonds(), 9u);
+
+  // Nothing changes for the same positions, and kept bonds keep their order
+  molecule.bond(molecule.atom(0), molecule.atom(1))->setOrder(2);
+  QCOMPARE(perception.updateBonds(), 0);
+  QCOMPARE(static_cast<int>(molecule.bond(molecule.atom(0), molecule.atom(1))->order()), 2);
+
+  // Pulling the last atom away breaks one bond, a stray bond is removed
+  Bond *stray = molecule.addBond();
+  stray->setAtoms(molecule.atom(0)->id(), molecule.atom(5)->id(), 1);
+  molecule.atom(9)->setPos(Vector3d(20.0, 0.0, 0.0));
+  QCOMPARE(perception.updateBonds(), 2);
+  QCOMPARE(molecule.numBonds(), 8u);
+  QVERIFY(!molecule.bond(molecule.atom(0), molecule.atom(5)));
+}
+
+QTEST_MAIN(BondPerceptionTest)
+
+#include "moc_bondperceptiontest.cxx"
@@ -0,0 +1,210 @@
+/**********************************************************************
+  ConformerClusteringTest - Superposition and clustering of conformers
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include <QtTest>
+#include <avogadro/conformerclustering.h>
+#include <avogadro/superposition.h>
+#include <avogadro/molecule.h>
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+
+#include <Eigen/Geometry>
+
+#include <cmath>
+
+using Avogadro::ConformerClustering;
+using Avogadro::Superposition;
+using Avogadro::Molecule;
+using Avogadro::Atom;
+using Avogadro::Bond;
+
+using Eigen::Vector3d;
+using Eigen::Matrix3d;
+using Eigen::AngleAxisd;
+
+class ConformerClusteringTest : public QObject
+{
+  Q_OBJECT
+
+  private:
+    Molecule *m_molecule;
+    std::vector<std::vector<Vector3d> *> m_conformers;
+
+    /**
+     * Append a copy of the molecule coordinates, turned about the C-C bond
+     * by @p torsion degrees, moved rigidly and shaken by @p noise.
+     */
+    void addConformer(double torsion, double noise, int seed);
+
+  private slots:
+    /**
+     * Build ethane and a set of staggered and eclipsed conformers.
+     */
+    void initTestCase();
+    void cleanupTestCase();
+
+    /**
+     * The QCP RMSD must equal the RMSD after the Kabsch fit.
+     */
+    void superposition();
+
+    /**
+     * Exchanging the hydrogens of a methyl group is not a change.
+     */
+    void symmetry();
+
+    /**
+     * Both clusterings must separate the three torsions.
+     */
+    void clustering();
+};
+
+void ConformerClusteringTest::addConformer(double torsion, double noise, int seed)
+{
+  std::vector<Vector3d> *conformer = new std::vector<Vector3d>(m_molecule->conformerSize());
+  Matrix3d twist = AngleAxisd(torsion * M_PI / 180.0, Vector3d::UnitX()).toRotationMatrix();
+  Matrix3d turn = AngleAxisd(0.1 * seed, Vector3d(1.0, 2.0, 3.0).normalized()).toRotationMatrix();
+  foreach (Atom *atom, m_molecule->atoms()) {
+    Vector3d pos = *atom->pos();
+    // The second carbon and its hydrogens sit at x > 0.5
+    if (pos.x() > 0.5)
+      pos = twist * pos;
+    pos += noise * Vector3d(sin(seed + 3.0 * atom->id()), cos(2.0 * seed + atom->id()),
+                            sin(5.0 * seed * atom->id()));
+    (*conformer)[atom->id()] = turn * pos + Vector3d(seed, 0.0, -seed);
+  }
+  m_conformers.push_back(conformer);
+}
+
+void ConformerClusteringTest::initTestCase()
+{
+  m_molecule = new Molecule;
+  Atom *c1 = m_molecule->addAtom();
+  c1->setAtomicNumber(6);
+  c1->setPos(Vector3d(0.0, 0.0, 0.0));
+  Atom *c2 = m_molecule->addAtom();
+  c2->setAtomicNumber(6);
+  c2->setPos(Vector3d(1.54, 0.0, 0.0));
+  for (int k = 0; k < 6; ++k) {
+    Atom *h = m_molecule->addAtom();
+    h->setAtomicNumber(1);
+    double angle = (k < 3 ? 120.0 * k : 120.0 * k + 60.0) * M_PI / 180.0;
+    h->setPos(Vector3d(k < 3 ? -0.36 : 1.90, cos(angle), sin(angle)));
+    Bond *bond = m_molecule->addBond();
+    bond->setAtoms(h->id(), k < 3 ? c1->id() : c2->id(), 1);
+  }
+  Bond *bond = m_molecule->addBond();
+  bond->setAtoms(c1->id(), c2->id(), 1);
+
+  // Three groups of five: staggered, eclipsed and half way
+  for (int seed = 0; seed < 15; ++seed)
+    addConformer(30.0 * (seed % 3), 0.02, seed);
+}
+
+void ConformerClusteringTest::cleanupTestCase()
+{
+  for (unsigned int i = 0; i < m_conformers.size(); ++i)
+    delete m_conformers[i];
+  delete m_molecule;
+}
+
+void ConformerClusteringTest::superposition()
+{
+  const int n = m_molecule->numAtoms();
+  QVector<double> a(3 * n), b(3 * n);
+  foreach (Atom *atom, m_molecule->atoms())
+    for (int k = 0; k < 3; ++k) {
+      a[3 * atom->index() + k] = (*m_conformers[0])[atom->id()][k];
+      b[3 * atom->index() + k] = (*m_conformers[3])[atom->id()][k];
+    }
+
+  Matrix3d rotation;
+  Vector3d translation;
+  double fitted = Superposition::fit(a.constData(), b.constData(), n,
+                                     rotation, translation);
+  double sum = 0.0;
+  for (int i = 0; i < n; ++i)
+    sum += (rotation * Vector3d(a.constData() + 3 * i) + translation
+            - Vector3d(b.constData() + 3 * i)).squaredNorm();
+
+  QVERIFY(fabs(fitted - sqrt(sum / n)) < 1.0e-8);
+  QVERIFY(fabs(Superposition::rmsd(a.constData(), b.constData(), n) - fitted) < 1.0e-8);
+  QVERIFY(fitted < 0.1);
+}
+
+void ConformerClusteringTest::symmetry()
+{
+  // Swap two hydrogens of the first methyl group
+  std::vector<std::vector<Vector3d> *> pair;
+  pair.push_back(new std::vector<Vector3d>(*m_conformers[0]));
+  pair.push_back(new std::vector<Vector3d>(*m_conformers[0]));
+  qSwap((*pair[1])[m_molecule->atom(2)->id()], (*pair[1])[m_molecule->atom(3)->id()]);
+
+  ConformerClustering plain;
+  plain.setHeavyAtomsOnly(false);
+  plain.setConformers(m_molecule, pair);
+  QCOMPARE(plain.numAtoms(), 8);
+  QVERIFY(plain.rmsd(0, 1) > 0.1);
+
+  ConformerClustering symmetric;
+  symmetric.setHeavyAtomsOnly(false);
+  symmetric.setSymmetryAware(true);
+  symmetric.setConformers(m_molecule, pair);
+  QVERIFY(symmetric.rmsd(0, 1) < 1.0e-6);
+
+  delete pair[0];
+  delete pair[1];
+}
+
+void ConformerClusteringTest::clustering()
+{
+  ConformerClustering clustering;
+  clustering.setHeavyAtomsOnly(false);
+  clustering.setConformers(m_molecule, m_conformers);
+  QCOMPARE(clustering.numConformers(), 15);
+
+  QVector<float> matrix = clustering.rmsdMatrix();
+  QCOMPARE(matrix.size(), 15 * 14 / 2);
+  QVERIFY(fabs(matrix[ConformerClustering::matrixIndex(2, 7, 15)]
+               - clustering.rmsd(2, 7)) < 1.0e-5);
+
+  QList<QList<int> > leaders = clustering.leaderClusters(0.1);
+  QCOMPARE(leaders.size(), 3);
+  QCOMPARE(ConformerClustering::representatives(leaders), QList<int>() << 0 << 1 << 2);
+  foreach (const QList<int> &cluster, leaders)
+    foreach (int member, cluster)
+      QCOMPARE(member % 3, cluster.first() % 3);
+
+  QList<QList<int> > hierarchy = clustering.hierarchicalClusters(0.1);
+  QCOMPARE(hierarchy.size(), 3);
+  foreach (const QList<int> &cluster, hierarchy) {
+    QCOMPARE(cluster.size(), 5);
+    foreach (int member, cluster)
+      QCOMPARE(member % 3, cluster.first() % 3);
+  }
+}
+
+QTEST_MAIN(ConformerClusteringTest)
+
+#include "moc_conformerclusteringtest.cxx"
@@ -0,0 +1,218 @@
+/**********************************************************************
+  ForceFieldTest - Validation of the native force field against OpenBabel
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include <QtTest>
+#include <avogadro/forcefield.h>
+#include <avogadro/moleculefile.h>
+#include <avogadro/molecule.h>
+
+#include <openbabel/mol.h>
+#include <openbabel/forcefield.h>
+
+#include <cmath>
+
+using OpenBabel::OBMol;
+using OpenBabel::OBForceField;
+
+using Avogadro::ForceField;
+using Avogadro::MoleculeFile;
+using Avogadro::Molecule;
+
+class ForceFieldTest : public QObject
+{
+  Q_OBJECT
+
+  private:
+    /**
+     * Read @p fileName from the test data and set @p ff up from it.
+     */
+    bool setup(const QString &fileName, ForceField &ff, OBMol &mol);
+
+  private slots:
+    void energies_data();
+    /**
+     * Compare each energy term with OBForceField UFF on the same molecule.
+     */
+    void energies();
+
+    void gradient_data();
+    /**
+     * Check the analytical gradient against central finite differences.
+     */
+    void gradient();
+
+    void minimize_data();
+    /**
+     * Every minimizer must lower the energy and the gradient.
+     */
+    void minimize();
+
+    /**
+     * The cell list must find the same pairs as the all pairs loop.
+     */
+    void cutoff();
+};
+
+bool ForceFieldTest::setup(const QString &fileName, ForceField &ff, OBMol &mol)
+{
+  Molecule *molecule = MoleculeFile::readMolecule(TESTDATADIR + fileName);
+  if (!molecule)
+    return false;
+  mol = molecule->OBMol();
+  delete molecule;
+  // OpenBabel uses all pairs
+  ff.setCutoff(0.0);
+  return ff.setup(mol);
+}
+
+void ForceFieldTest::energies_data()
+{
+  QTest::addColumn<QString>("fileName");
+  QTest::newRow("butane") << "butane.cml";
+  QTest::newRow("propan-2-ol") << "propan-2-ol.cml";
+  QTest::newRow("thiophene") << "thiophene.cml";
+  QTest::newRow("porphyrin") << "porphyrin.cml";
+}
+
+void ForceFieldTest::energies()
+{
+  QFETCH(QString, fileName);
+
+  ForceField ff;
+  OBMol mol;
+  QVERIFY(setup(fileName, ff, mol));
+
+  OBForceField *reference = OBForceField::FindForceField("UFF");
+  QVERIFY(reference);
+  QVERIFY(reference->Setup(mol));
+  double scale = reference->GetUnit().find("kcal") != std::string::npos
+    ? 4.1868 : 1.0;
+
+  const int terms[5] = { ForceField::BondStretch, ForceField::AngleBend,
+                         ForceField::Torsion, ForceField::Inversion,
+                         ForceField::VanDerWaals };
+  const double expected[5] = { reference->E_Bond(false) * scale,
+                               reference->E_Angle(false) * scale,
+                               reference->E_Torsion(false) * scale,
+                               reference->E_OOP(false) * scale,
+                               reference->E_VDW(false) * scale };
+
+  for (int t = 0; t < 5; ++t) {
+    double energy = ff.energy(terms[t]);
+    QVERIFY(fabs(energy - expected[t]) < 0.01 * fabs(expected[t]) + 0.1);
+  }
+}
+
+void ForceFieldTest::gradient_data()
+{
+  energies_data();
+}
+
+void ForceFieldTest::gradient()
+{
+  QFETCH(QString, fileName);
+
+  ForceField ff;
+  OBMol mol;
+  QVERIFY(setup(fileName, ff, mol));
+
+  QVector<double> gradient;
+  ff.energy(gradient);
+  QVector<double> coordinates = ff.coordinates();
+  const double h = 1.0e-5;
+  for (int k = 0; k < coordinates.size(); ++k) {
+    double x = coordinates[k];
+    coordinates[k] = x + h;
+    ff.setCoordinates(coordinates.constData());
+    double plus = ff.energy();
+    coordinates[k] = x - h;
+    ff.setCoordinates(coordinates.constData());
+    double minus = ff.energy();
+    coordinates[k] = x;
+    double numerical = (plus - minus) / (2.0 * h);
+    QVERIFY(fabs(numerical - gradient[k]) < 1.0e-3 * fabs(gradient[k]) + 1.0e-3);
+  }
+}
+
+void ForceFieldTest::minimize_data()
+{
+  QTest::addColumn<int>("algorithm");
+  QTest::newRow("steepest descent") << static_cast<int>(ForceField::SteepestDescent);
+  QTest::newRow("conjugate gradients") << static_cast<int>(ForceField::ConjugateGradients);
+  QTest::newRow("L-BFGS") << static_cast<int>(ForceField::LBFGS);
+}
+
+void ForceFieldTest::minimize()
+{
+  QFETCH(int, algorithm);
+
+  ForceField ff;
+  OBMol mol;
+  QVERIFY(setup("porphyrin.cml", ff, mol));
+
+  // Start well away from the minimum
+  QVector<double> coordinates = ff.coordinates();
+  for (int k = 0; k < coordinates.size(); ++k)
+    coordinates[k] += 0.1 * sin(7.0 * k);
+  ff.setCoordinates(coordinates.constData());
+
+  QVector<double> gradient;
+  double start = ff.energy(gradient);
+  double startRms = 0.0;
+  foreach (double g, gradient)
+    startRms += g * g;
+  startRms = sqrt(startRms / gradient.size());
+
+  int steps = ff.minimize(static_cast<ForceField::Algorithm>(algorithm), 500);
+  QVERIFY(steps > 0);
+  QVERIFY(ff.energy() < start);
+  QVERIFY(ff.rmsGradient() < startRms);
+}
+
+void ForceFieldTest::cutoff()
+{
+  ForceField ff;
+  OBMol mol;
+  QVERIFY(setup("porphyrin.cml", ff, mol));
+
+  const QVector<double> &x = ff.coordinates();
+  const double cutoff = 6.0;
+
+  // Brute force count, the excluded 1-2 and 1-3 pairs are all within 6 A
+  int allPairs = ff.numNonbondedPairs();
+  int outside = 0;
+  for (int i = 0; i < ff.numAtoms(); ++i)
+    for (int j = i + 1; j < ff.numAtoms(); ++j) {
+      double dx = x[3*i] - x[3*j], dy = x[3*i+1] - x[3*j+1], dz = x[3*i+2] - x[3*j+2];
+      if (dx*dx + dy*dy + dz*dz > cutoff * cutoff)
+        ++outside;
+    }
+
+  ff.setCutoff(cutoff);
+  QCOMPARE(ff.numNonbondedPairs(), allPairs - outside);
+}
+
+QTEST_MAIN(ForceFieldTest)
+
+#include "moc_forcefieldtest.cxx"
@@ -31,6 +31,8 @@
 
 #include <QCoreApplication>
 
+#include <cmath>
+
 using Avogadro::Molecule;
 using Avogadro::Atom;
 using Avogadro::Bond;
@@ -49,6 +51,12 @@ private:
    */
   void prepareMolecule();
 
+  /**
+   * Add @p n water molecules on a grid to m_molecule.
+   * @return The unique ids of the water atoms.
+   */
+  QList<unsigned long> addWaters(int n);
+
 private slots:
     /**
    * Called before the first test function is executed.
@@ -127,8 +135,51 @@ private slots:
    */
   void deleteLater();
 
+  /**
+   * Timing to remove 5,000 water molecules one atom at a time
+   */
+  void removeWaters();
+
+  /**
+   * Timing to remove the same 5,000 water molecules in one go
+   */
+  void removeWatersBulk();
+
+  /**
+   * Timing to strip the solvent from a box of 200,000 atoms, selected by
+   * fragment as SelectExtension does, keeping a 2,000 atom solute
+   */
+  void removeSolvent();
+
+  /**
+   * Timing to compact the ids left after stripping the solvent
+   */
+  void compactIds();
+
 };
 
+QList<unsigned long> MoleculeBench::addWaters(int n)
+{
+  QList<unsigned long> ids;
+  const int side = static_cast<int>(ceil(pow(n, 1.0 / 3.0)));
+  for (int i = 0; i < n; ++i) {
+    const Vector3d center(3.0 * (i % side), 3.0 * ((i / side) % side),
+                          3.0 * (i / (side * side)));
+    Atom *o = m_molecule->addAtom();
+    o->setAtomicNumber(8);
+    o->setPos(center);
+    ids.append(o->id());
+    for (int j = 0; j < 2; ++j) {
+      Atom *h = m_molecule->addAtom();
+      h->setAtomicNumber(1);
+      h->setPos(center + Vector3d(0.76 * (2 * j - 1), 0.59, 0.0));
+      m_molecule->addBond()->setAtoms(o->id(), h->id(), 1);
+      ids.append(h->id());
+    }
+  }
+  return ids;
+}
+
 void MoleculeBench::initTestCase()
 {
   m_molecule = 0;
@@ -302,6 +353,70 @@ void MoleculeBench::deleteLater()
   }
 }
 
+void MoleculeBench::removeWaters()
+{
+  m_molecule = new Molecule;
+  QList<unsigned long> ids = addWaters(5000);
+  QBENCHMARK{
+    foreach (unsigned long id, ids)
+      m_molecule->removeAtom(id);
+  }
+  QCOMPARE(m_molecule->numAtoms(), static_cast<unsigned int>(0));
+  delete m_molecule;
+  m_molecule = 0;
+}
+
+void MoleculeBench::removeWatersBulk()
+{
+  m_molecule = new Molecule;
+  QList<unsigned long> ids = addWaters(5000);
+  QBENCHMARK{
+    m_molecule->removeAtoms(ids);
+  }
+  QCOMPARE(m_molecule->numAtoms(), static_cast<unsigned int>(0));
+  QCOMPARE(m_molecule->numBonds(), static_cast<unsigned int>(0));
+  delete m_molecule;
+  m_molecule = 0;
+}
+
+void MoleculeBench::removeSolvent()
+{
+  m_molecule = new Molecule;
+  // A carbon chain as the solute, in the middle of the waters
+  Atom *last = 0;
+  for (int i = 0; i < 2000; ++i) {
+    Atom *a = m_molecule->addAtom();
+    a->setAtomicNumber(6);
+    a->setPos(Vector3d(0.1 * i, 0.5, 0.5));
+    if (last)
+      m_molecule->addBond()->setAtoms(last->id(), a->id(), 1);
+    last = a;
+  }
+  addWaters(66000);
+
+  QBENCHMARK{
+    QList<unsigned long> solvent;
+    foreach (const QList<unsigned long> &fragment,
+             m_molecule->fragmentAtomLists())
+      if (fragment.size() == 3)
+        solvent += fragment;
+    m_molecule->removeAtoms(solvent);
+  }
+  QCOMPARE(m_molecule->numAtoms(), static_cast<unsigned int>(2000));
+  QCOMPARE(m_molecule->numFragments(), static_cast<unsigned int>(1));
+}
+
+void MoleculeBench::compactIds()
+{
+  QBENCHMARK{
+    m_molecule->compactIds();
+  }
+  QCOMPARE(m_molecule->atom(1999)->id(), static_cast<unsigned long>(1999));
+  QCOMPARE(m_molecule->conformerSize(), static_cast<unsigned long>(2000));
+  delete m_molecule;
+  m_molecule = 0;
+}
+
 QTEST_MAIN(MoleculeBench)
 
 #include "moc_moleculebench.cxx"
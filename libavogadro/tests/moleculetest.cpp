@@ -142,6 +142,31 @@ private slots:
    * Tests conformer support.
    */ 
   void conformers();
+
+  /**
+   * Tests ring perception and aromaticity, and that they follow edits.
+   */
+  void rings();
+
+  /**
+   * Tests the partial charges, and that only topology changes redo them.
+   */
+  void partialCharges();
+
+  /**
+   * Tests the connected fragments as bonds are added and removed.
+   */
+  void fragments();
+
+  /**
+   * Tests that snapshots keep their state and share unchanged topology.
+   */
+  void snapshot();
+
+  /**
+   * Tests removing several atoms and bonds at once, and compacting the ids.
+   */
+  void removeAtoms();
 };
 
 void MoleculeTest::prepareMolecule()
@@ -374,6 +399,193 @@ void MoleculeTest::conformers()
 
 }
 
+void MoleculeTest::rings()
+{
+  // Naphthalene as a Kekule structure, with the fused bond between 4 and 5
+  Molecule molecule;
+  for (int i = 0; i < 10; ++i)
+    molecule.addAtom()->setAtomicNumber(6);
+  const int bonds[11][3] = { {0, 1, 2}, {1, 2, 1}, {2, 3, 2}, {3, 4, 1},
+    {4, 5, 2}, {5, 0, 1}, {4, 6, 1}, {6, 7, 2}, {7, 8, 1}, {8, 9, 2},
+    {9, 5, 1} };
+  for (int i = 0; i < 11; ++i)
+    molecule.addBond()->setAtoms(molecule.atom(bonds[i][0])->id(),
+                                 molecule.atom(bonds[i][1])->id(), bonds[i][2]);
+
+  QCOMPARE(molecule.rings().size(), 2);
+  QCOMPARE(molecule.rings().at(0)->atoms().size(), 6);
+  QCOMPARE(molecule.rings().at(1)->atoms().size(), 6);
+  foreach (Bond *bond, molecule.bonds())
+    QVERIFY(bond->isAromatic());
+
+  // Saturating a bond breaks the conjugation of the first ring only
+  unsigned long version = molecule.topologyVersion();
+  molecule.bond(molecule.atom(0), molecule.atom(1))->setOrder(1);
+  QVERIFY(molecule.topologyVersion() != version);
+  QVERIFY(!molecule.bond(molecule.atom(2), molecule.atom(3))->isAromatic());
+  QVERIFY(molecule.bond(molecule.atom(7), molecule.atom(8))->isAromatic());
+
+  // Cutting the fused bond leaves one ten membered ring
+  molecule.removeBond(molecule.bond(molecule.atom(4), molecule.atom(5)));
+  QCOMPARE(molecule.rings().size(), 1);
+  QCOMPARE(molecule.rings().at(0)->atoms().size(), 10);
+}
+
+void MoleculeTest::partialCharges()
+{
+  // Methane, with the Gasteiger charges of OpenBabel
+  Molecule molecule;
+  Atom *carbon = molecule.addAtom();
+  carbon->setAtomicNumber(6);
+  for (int i = 0; i < 4; ++i) {
+    Atom *hydrogen = molecule.addAtom();
+    hydrogen->setAtomicNumber(1);
+    hydrogen->setPos(Vector3d(i, 1.0, 0.0));
+    molecule.addBond()->setAtoms(carbon->id(), hydrogen->id(), 1);
+  }
+  QVERIFY(!molecule.hasPartialCharges());
+  QVERIFY(qAbs(carbon->partialCharge() + 0.0776) < 1.0e-4);
+  QVERIFY(qAbs(molecule.atom(1)->partialCharge() - 0.0194) < 1.0e-4);
+  QVERIFY(molecule.hasPartialCharges());
+
+  // Moving an atom keeps them, changing an element does not
+  molecule.atom(1)->setPos(Vector3d(0.0, 0.0, 5.0));
+  QVERIFY(molecule.hasPartialCharges());
+  molecule.atom(1)->setAtomicNumber(9);
+  QVERIFY(!molecule.hasPartialCharges());
+  QVERIFY(carbon->partialCharge() > 0.0);
+}
+
+void MoleculeTest::fragments()
+{
+  // Two ethane-like chains of three atoms, and a lone atom
+  Molecule molecule;
+  for (int i = 0; i < 7; ++i)
+    molecule.addAtom();
+  QCOMPARE(molecule.numFragments(), static_cast<unsigned int>(7));
+  molecule.addBond()->setAtoms(0, 1, 1);
+  Bond *bond = molecule.addBond();
+  bond->setAtoms(1, 2, 1);
+  molecule.addBond()->setAtoms(3, 4, 1);
+  molecule.addBond()->setAtoms(4, 5, 1);
+  QCOMPARE(molecule.numFragments(), static_cast<unsigned int>(3));
+  QCOMPARE(molecule.fragmentAtoms(2).size(), 3);
+  QVERIFY(molecule.fragmentAtoms(0).contains(2));
+  QVERIFY(!molecule.fragmentAtoms(0).contains(3));
+  QCOMPARE(molecule.fragmentAtoms(6).size(), 1);
+
+  // Joining the chains, then closing a ring that keeps them joined
+  molecule.addBond()->setAtoms(2, 3, 1);
+  QCOMPARE(molecule.numFragments(), static_cast<unsigned int>(2));
+  molecule.addBond()->setAtoms(5, 0, 1);
+  molecule.removeBond(bond);
+  QCOMPARE(molecule.numFragments(), static_cast<unsigned int>(2));
+  QCOMPARE(molecule.fragmentAtoms(1).size(), 6);
+
+  // Moving a bond end splits off the atom left behind
+  molecule.bond(0)->setEnd(molecule.atomById(6));
+  QCOMPARE(molecule.numFragments(), static_cast<unsigned int>(2));
+  QCOMPARE(molecule.fragmentAtoms(1).size(), 1);
+  QCOMPARE(molecule.fragmentAtoms(6).size(), 6);
+
+  // Removing an atom splits the fragment around it
+  molecule.removeAtom(molecule.atomById(3));
+  QCOMPARE(molecule.numFragments(), static_cast<unsigned int>(3));
+  QCOMPARE(molecule.fragmentAtoms(2).size(), 1);
+  QCOMPARE(molecule.fragmentAtoms(4).size(), 4);
+  QVERIFY(molecule.fragmentAtoms(3).isEmpty());
+  QCOMPARE(molecule.fragmentAtomLists().size(), 3);
+}
+
+void MoleculeTest::snapshot()
+{
+  Molecule molecule;
+  Atom *carbon = molecule.addAtom();
+  carbon->setAtomicNumber(6);
+  Atom *oxygen = molecule.addAtom();
+  oxygen->setAtomicNumber(8);
+  oxygen->setPos(Vector3d(1.2, 0.0, 0.0));
+  molecule.addBond()->setAtoms(carbon->id(), oxygen->id(), 2);
+
+  MoleculeSnapshot first = molecule.snapshot();
+  QVERIFY(first.isValid());
+  QCOMPARE(first.numAtoms(), 2);
+  QCOMPARE(first.numBonds(), 1);
+  QCOMPARE(first.atomicNumbers().at(1), 8);
+  QCOMPARE(first.bondOrders().at(0), static_cast<short>(2));
+  QCOMPARE(first.center().x(), 0.6);
+  // Nothing changed, so the same snapshot comes back
+  QCOMPARE(molecule.snapshot().revision(), first.revision());
+
+  // Moving an atom leaves the old snapshot as it was
+  oxygen->setPos(Vector3d(2.0, 0.0, 0.0));
+  MoleculeSnapshot second = molecule.snapshot();
+  QVERIFY(second.revision() != first.revision());
+  QCOMPARE(first.atomPositions().at(1).x(), 1.2);
+  QCOMPARE(second.atomPositions().at(1).x(), 2.0);
+  QCOMPARE(second.center().x(), 1.0);
+  QVERIFY(second.atomIds().constData() == first.atomIds().constData());
+
+  // A topology change copies the topology
+  molecule.addAtom()->setAtomicNumber(1);
+  MoleculeSnapshot third = molecule.snapshot();
+  QCOMPARE(third.numAtoms(), 3);
+  QCOMPARE(second.numAtoms(), 2);
+  QVERIFY(third.topologyVersion() != second.topologyVersion());
+  QCOMPARE(third.bondIds().size(), 1);
+
+  // A writer only publishes once a reader was handed an old snapshot
+  molecule.lock()->lockForWrite();
+  oxygen->setPos(Vector3d(3.0, 0.0, 0.0));
+  molecule.publishSnapshot();
+  QCOMPARE(molecule.snapshot().revision(), third.revision());
+  molecule.publishSnapshot();
+  QCOMPARE(molecule.snapshot().atomPositions().at(1).x(), 3.0);
+  molecule.lock()->unlock();
+}
+
+void MoleculeTest::removeAtoms()
+{
+  // Two waters either side of a lone atom
+  Molecule molecule;
+  for (int i = 0; i < 7; ++i)
+    molecule.addAtom()->setPos(Vector3d(i, 0.0, 0.0));
+  molecule.addBond()->setAtoms(0, 1, 1);
+  molecule.addBond()->setAtoms(0, 2, 1);
+  molecule.addBond()->setAtoms(4, 5, 1);
+  molecule.addBond()->setAtoms(4, 6, 1);
+
+  QList<unsigned long> ids;
+  ids << 0 << 1 << 2 << 1 << 42;
+  molecule.removeAtoms(ids);
+  QCOMPARE(molecule.numAtoms(), static_cast<unsigned int>(4));
+  QCOMPARE(molecule.numBonds(), static_cast<unsigned int>(2));
+  QCOMPARE(molecule.atom(0)->id(), static_cast<unsigned long>(3));
+  QCOMPARE(molecule.atom(3)->index(), static_cast<unsigned long>(3));
+  QCOMPARE(molecule.bond(1)->index(), static_cast<unsigned long>(1));
+  QCOMPARE(molecule.numFragments(), static_cast<unsigned int>(2));
+
+  // Repeated and missing ids are skipped
+  ids.clear();
+  ids << molecule.bond(0)->id() << molecule.bond(0)->id() << 7;
+  molecule.removeBonds(ids);
+  QCOMPARE(molecule.numBonds(), static_cast<unsigned int>(1));
+  QCOMPARE(molecule.numFragments(), static_cast<unsigned int>(3));
+
+  // The ids follow the indices afterwards, with the positions kept, and
+  // views are told to rebuild what they keep by id
+  QSignalSpy changed(&molecule, SIGNAL(moleculeChanged()));
+  molecule.compactIds();
+  QCOMPARE(changed.count(), 1);
+  QCOMPARE(molecule.atomById(0)->pos()->x(), 3.0);
+  QCOMPARE(molecule.atomById(3)->pos()->x(), 6.0);
+  QVERIFY(!molecule.atomById(4));
+  QCOMPARE(molecule.bondById(0)->beginAtomId(), static_cast<unsigned long>(1));
+  QCOMPARE(molecule.bondById(0)->endAtomId(), static_cast<unsigned long>(3));
+  QCOMPARE(molecule.fragmentAtoms(3).size(), 2);
+  QCOMPARE(molecule.addAtom()->id(), static_cast<unsigned long>(4));
+}
+
 QTEST_MAIN(MoleculeTest)
 
 #include "moc_moleculetest.cxx"
@@ -0,0 +1,216 @@
+/**********************************************************************
+  SelectionTest - unit testing for the Selection class
+
+  Copyright (C) 2009 The Avogadro developers
+
+  This file is part of the Avogadro molecular editor project.
+  For more information, see <http://avogadro.openmolecules.net/>
+
+  Avogadro is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  Avogadro is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+ **********************************************************************/
+
+#include <QtTest>
+#include <avogadro/selection.h>
+#include <avogadro/primitivelist.h>
+#include <avogadro/molecule.h>
+#include <avogadro/atom.h>
+#include <avogadro/bond.h>
+
+using Avogadro::Selection;
+using Avogadro::PrimitiveList;
+using Avogadro::Primitive;
+using Avogadro::Molecule;
+using Avogadro::Atom;
+using Avogadro::Bond;
+
+class SelectionTest : public QObject
+{
+  Q_OBJECT
+
+  private:
+    Molecule *m_molecule; /// Molecule object for use by the test class.
+
+    // The atoms with index from <= i < to
+    PrimitiveList atoms(int from, int to) const;
+
+  private slots:
+    /**
+     * Called before the first test function is executed.
+     */
+    void initTestCase();
+
+    /**
+     * Called after the last test function is executed.
+     */
+    void cleanupTestCase();
+
+    void addRemove();
+    void toggle();
+    void setAlgebra();
+    void types();
+    void removedAtoms();
+    void removeOneByOne();
+};
+
+PrimitiveList SelectionTest::atoms(int from, int to) const
+{
+  PrimitiveList list;
+  for (int i = from; i < to; ++i)
+    list.append(m_molecule->atom(i));
+  return list;
+}
+
+void SelectionTest::initTestCase()
+{
+  m_molecule = new Molecule;
+  for (int i = 0; i < 100; ++i)
+    m_molecule->addAtom();
+  for (int i = 1; i < 100; ++i) {
+    Bond *bond = m_molecule->addBond();
+    bond->setAtoms(i - 1, i, 1);
+  }
+}
+
+void SelectionTest::cleanupTestCase()
+{
+  delete m_molecule;
+  m_molecule = 0;
+}
+
+void SelectionTest::addRemove()
+{
+  Selection selection;
+  QVERIFY(selection.isEmpty());
+  QCOMPARE(selection.add(atoms(10, 20)), 10);
+  // Already selected atoms are not counted or added twice
+  QCOMPARE(selection.add(atoms(15, 25)), 5);
+  QCOMPARE(selection.count(), 15);
+  QCOMPARE(selection.primitives().size(), 15);
+
+  QCOMPARE(selection.remove(atoms(0, 12)), 2);
+  QCOMPARE(selection.count(), 13);
+  QVERIFY(!selection.contains(m_molecule->atom(11)));
+  QVERIFY(selection.contains(m_molecule->atom(12)));
+  QVERIFY(selection.contains(Primitive::AtomType, m_molecule->atom(24)->id()));
+  QVERIFY(!selection.contains(m_molecule->atom(25)));
+  // The order in which they were added is kept
+  QCOMPARE(selection.subList(Primitive::AtomType).first(),
+           static_cast<Primitive *>(m_molecule->atom(12)));
+
+  QVERIFY(selection.remove(m_molecule->atom(12)));
+  QVERIFY(!selection.remove(m_molecule->atom(12)));
+  selection.clear();
+  QVERIFY(selection.isEmpty());
+  QVERIFY(!selection.contains(m_molecule->atom(20)));
+}
+
+void SelectionTest::toggle()
+{
+  Selection selection(atoms(0, 50));
+  // Inverting the whole molecule
+  QCOMPARE(selection.toggle(atoms(0, 100)), 100);
+  QCOMPARE(selection.count(), 50);
+  QVERIFY(!selection.contains(m_molecule->atom(49)));
+  QVERIFY(selection.contains(m_molecule->atom(50)));
+
+  // A primitive listed twice is toggled twice
+  PrimitiveList twice = atoms(0, 1);
+  twice.append(m_molecule->atom(0));
+  selection.toggle(twice);
+  QVERIFY(!selection.contains(m_molecule->atom(0)));
+  QCOMPARE(selection.count(), 50);
+}
+
+void SelectionTest::setAlgebra()
+{
+  Selection a(atoms(0, 60)), b(atoms(40, 100));
+
+  Selection both = a & b;
+  QCOMPARE(both.count(), 20);
+  QVERIFY(both.contains(m_molecule->atom(40)));
+  QVERIFY(!both.contains(m_molecule->atom(39)));
+  QVERIFY(!both.contains(m_molecule->atom(60)));
+
+  Selection either = a | b;
+  QCOMPARE(either.count(), 100);
+
+  Selection difference = a - b;
+  QCOMPARE(difference.count(), 40);
+  QVERIFY(difference.contains(m_molecule->atom(39)));
+  QVERIFY(!difference.contains(m_molecule->atom(40)));
+
+  // The operands are left as they were
+  QCOMPARE(a.count(), 60);
+  QCOMPARE(b.count(), 60);
+
+  QCOMPARE(a.intersect(Selection()), 60);
+  QVERIFY(a.isEmpty());
+}
+
+void SelectionTest::types()
+{
+  PrimitiveList list = atoms(0, 10);
+  foreach (Bond *bond, m_molecule->bonds())
+    list.append(bond);
+
+  // Atoms and bonds with the same ids are told apart
+  Selection selection(list);
+  QCOMPARE(selection.count(), 109);
+  QCOMPARE(selection.count(Primitive::AtomType), 10);
+  QCOMPARE(selection.count(Primitive::BondType), 99);
+  QVERIFY(selection.contains(m_molecule->bond(50)));
+  QVERIFY(!selection.contains(m_molecule->atom(50)));
+
+  QBitArray bonds = selection.bits(Primitive::BondType);
+  QCOMPARE(bonds.count(true), 99);
+}
+
+void SelectionTest::removedAtoms()
+{
+  Molecule molecule;
+  for (int i = 0; i < 10; ++i)
+    molecule.addAtom();
+  Atom *last = molecule.atom(9);
+  Selection selection;
+  selection.add(last);
+
+  // Removing other atoms changes the indices but not the ids
+  selection.remove(molecule.atom(0));
+  molecule.removeAtom(molecule.atom(0));
+  QVERIFY(selection.contains(last));
+  QCOMPARE(selection.count(), 1);
+}
+
+void SelectionTest::removeOneByOne()
+{
+  Selection selection(atoms(0, 100));
+  for (int i = 0; i < 90; ++i)
+    QVERIFY(selection.remove(m_molecule->atom(i)));
+  QCOMPARE(selection.count(), 10);
+
+  // An atom selected again goes to the end of the list
+  selection.add(m_molecule->atom(0));
+  selection.remove(m_molecule->atom(95));
+  QList<Primitive *> list = selection.subList(Primitive::AtomType);
+  QCOMPARE(list.size(), 10);
+  QCOMPARE(list.first(), static_cast<Primitive *>(m_molecule->atom(90)));
+  QCOMPARE(list.last(), static_cast<Primitive *>(m_molecule->atom(0)));
+  QCOMPARE(selection.count(Primitive::AtomType), 10);
+}
+
+QTEST_MAIN(SelectionTest)
+
+#include "moc_selectiontest.cxx"